@@ -175,6 +175,35 @@ public class Collectd
   native public static int registerWrite (String name,
       CollectdWriteInterface object);
 
+  /**
+   * Registers a write callback that receives value lists in batches.
+   *
+   * Value lists are packed into a direct {@link java.nio.ByteBuffer} and
+   * handed to the callback in a single call once {@code size} value lists
+   * have been buffered, the oldest of them is {@code timeout} seconds old or
+   * the callback is flushed. A negative timeout selects the interval of the
+   * java plugin, zero disables the limit.
+   *
+   * @return Zero when successful, non-zero otherwise.
+   * @see CollectdWriteBatchInterface
+   * @see ValueListBatch
+   */
+  native public static int registerWriteBatch (String name,
+      CollectdWriteBatchInterface object, int size, double timeout);
+
+  /**
+   * Registers a write callback that receives up to 1024 value lists per
+   * batch, which are delivered at least once per interval.
+   *
+   * @return Zero when successful, non-zero otherwise.
+   * @see #registerWriteBatch(String, CollectdWriteBatchInterface, int, double)
+   */
+  public static int registerWriteBatch (String name,
+      CollectdWriteBatchInterface object)
+  {
+    return (registerWriteBatch (name, object, 1024, -1.0));
+  } /* int registerWriteBatch */
+
   /**
    * Java representation of collectd/src/plugin.h:plugin_register_flush
    *
@@ -0,0 +1,39 @@
+/**
+ * collectd - bindings/java/org/collectd/api/CollectdWriteBatchInterface.java
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+package org.collectd.api;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Interface for objects implementing a batched write method.
+ *
+ * The buffer holds {@code count} packed value lists. It is only valid for the
+ * duration of the call and must not be kept. Use {@link ValueListBatch} to
+ * decode it.
+ *
+ * @see Collectd#registerWriteBatch
+ */
+public interface CollectdWriteBatchInterface
+{
+	public int writeBatch (ByteBuffer buffer, int count);
+}
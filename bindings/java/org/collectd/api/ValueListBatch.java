@@ -0,0 +1,215 @@
+/**
+ * collectd - bindings/java/org/collectd/api/ValueListBatch.java
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+package org.collectd.api;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.Charset;
+
+/**
+ * Decoder for the buffers passed to {@link CollectdWriteBatchInterface}.
+ *
+ * Each value list is stored in native byte order as the number of values
+ * (int), the time and interval in milliseconds (long), the host, plugin,
+ * plugin instance, type and type instance and finally the values. Strings are
+ * stored as their length in bytes (short) followed by the UTF-8 encoded
+ * string; a length of -1 repeats the string of the previous value list. Each
+ * value is stored as its data source type (byte) followed by a long or, for
+ * gauges, a double.
+ *
+ * <pre>
+ * ValueListBatch batch = new ValueListBatch (buffer, count);
+ * while (batch.next ())
+ *   handle (batch.getType (), batch.getDouble (0));
+ * </pre>
+ */
+public class ValueListBatch {
+
+    private static final Charset UTF8 = Charset.forName ("UTF-8");
+
+    private static final int HOST            = 0;
+    private static final int PLUGIN          = 1;
+    private static final int PLUGIN_INSTANCE = 2;
+    private static final int TYPE            = 3;
+    private static final int TYPE_INSTANCE   = 4;
+
+    private final ByteBuffer _buffer;
+    private final int _count;
+
+    private int _index = -1;
+    private int _position = 0;
+
+    private long _time;
+    private long _interval;
+    private final String[] _names = new String[5];
+    private int _valuesPosition;
+    private int _valuesCount;
+
+    private byte[] _scratch = new byte[128];
+
+    public ValueListBatch (ByteBuffer buffer, int count) {
+        _buffer = buffer.duplicate ().order (ByteOrder.nativeOrder ());
+        _count = count;
+    }
+
+    /**
+     * Returns the number of value lists in the batch.
+     */
+    public int size () {
+        return _count;
+    }
+
+    /**
+     * Advances to the next value list.
+     *
+     * @return False if there are no more value lists, true otherwise.
+     */
+    public boolean next () {
+        if ((_index + 1) >= _count)
+            return false;
+        _index++;
+
+        _valuesCount = _buffer.getInt (_position);
+        _time = _buffer.getLong (_position + 4);
+        _interval = _buffer.getLong (_position + 12);
+        _position += 20;
+
+        for (int i = 0; i < _names.length; i++) {
+            int len = _buffer.getShort (_position);
+            _position += 2;
+            if (len < 0)
+                continue;
+
+            if (_scratch.length < len)
+                _scratch = new byte[len];
+            for (int j = 0; j < len; j++)
+                _scratch[j] = _buffer.get (_position + j);
+            _names[i] = new String (_scratch, 0, len, UTF8);
+            _position += len;
+        }
+
+        _valuesPosition = _position;
+        _position += 9 * _valuesCount;
+        return true;
+    }
+
+    public String getHost () {
+        return _names[HOST];
+    }
+
+    public String getPlugin () {
+        return _names[PLUGIN];
+    }
+
+    public String getPluginInstance () {
+        return _names[PLUGIN_INSTANCE];
+    }
+
+    public String getType () {
+        return _names[TYPE];
+    }
+
+    public String getTypeInstance () {
+        return _names[TYPE_INSTANCE];
+    }
+
+    /**
+     * Returns the time of the value list in milliseconds since the epoch.
+     */
+    public long getTime () {
+        return _time;
+    }
+
+    /**
+     * Returns the interval of the value list in milliseconds.
+     */
+    public long getInterval () {
+        return _interval;
+    }
+
+    public int getValuesCount () {
+        return _valuesCount;
+    }
+
+    /**
+     * Returns the type of the value at index {@code i}, one of the
+     * {@code DataSource.TYPE_*} constants.
+     */
+    public int getDataSourceType (int i) {
+        checkIndex (i);
+        return _buffer.get (_valuesPosition + 9 * i);
+    }
+
+    /**
+     * Returns the value at index {@code i} as a double.
+     */
+    public double getDouble (int i) {
+        if (getDataSourceType (i) == DataSource.TYPE_GAUGE)
+            return _buffer.getDouble (_valuesPosition + 9 * i + 1);
+        return (double) _buffer.getLong (_valuesPosition + 9 * i + 1);
+    }
+
+    /**
+     * Returns the value at index {@code i} as a long. Gauges are truncated.
+     */
+    public long getLong (int i) {
+        if (getDataSourceType (i) == DataSource.TYPE_GAUGE)
+            return (long) _buffer.getDouble (_valuesPosition + 9 * i + 1);
+        return _buffer.getLong (_valuesPosition + 9 * i + 1);
+    }
+
+    /**
+     * Returns the value at index {@code i} as a {@link Double} for gauges and
+     * as a {@link Long} otherwise, like {@link ValueList#getValues} does.
+     */
+    public Number getValue (int i) {
+        if (getDataSourceType (i) == DataSource.TYPE_GAUGE)
+            return new Double (_buffer.getDouble (_valuesPosition + 9 * i + 1));
+        return new Long (_buffer.getLong (_valuesPosition + 9 * i + 1));
+    }
+
+    /**
+     * Copies the current value list into a new {@link ValueList}. The data
+     * set is not set; use {@link Collectd#getDS} if you need it.
+     */
+    public ValueList getValueList () {
+        ValueList vl = new ValueList ();
+
+        vl.setHost (getHost ());
+        vl.setPlugin (getPlugin ());
+        vl.setPluginInstance (getPluginInstance ());
+        vl.setType (getType ());
+        vl.setTypeInstance (getTypeInstance ());
+        vl.setTime (getTime ());
+        vl.setInterval (getInterval ());
+        for (int i = 0; i < _valuesCount; i++)
+            vl.addValue (getValue (i));
+
+        return vl;
+    }
+
+    private void checkIndex (int i) {
+        if ((_index < 0) || (i < 0) || (i >= _valuesCount))
+            throw new IndexOutOfBoundsException ("No value with index " + i);
+    }
+}
@@ -40,6 +40,7 @@ our @ISA = qw( Exporter );
 our %EXPORT_TAGS = (
 	'plugin' => [ qw(
 			plugin_register
+			plugin_register_write_batch
 			plugin_unregister
 			plugin_dispatch_values
 			plugin_get_interval
@@ -311,6 +312,29 @@ sub plugin_register {
 	return 1;
 }
 
+sub plugin_register_write_batch {
+	my $name    = shift;
+	my $data    = shift;
+	my $size    = shift;
+	my $timeout = shift;
+
+	DEBUG ("Collectd::plugin_register_write_batch: "
+		. "name = \"$name\", data = \"$data\"");
+
+	if (! ((defined $name) && (defined $data) && (! ref $data))) {
+		ERROR ("Usage: Collectd::plugin_register_write_batch "
+			. "(name, data[, size[, timeout]])");
+		return;
+	}
+
+	my $pkg = scalar caller;
+	if ($data !~ m/^$pkg\:\:/) {
+		$data = $pkg . "::" . $data;
+	}
+
+	return _plugin_register_write_batch ($name, $data, $size, $timeout);
+}
+
 sub plugin_unregister {
 	my $type = shift;
 	my $name = shift;
@@ -0,0 +1,208 @@
+#!/bin/sh
+#
+# Runs the snmp plugin against a local snmpd, once in synchronous and once in
+# asynchronous mode, and checks that both collect the same values from the
+# same hosts. A table served by table.sh is changed halfway through each run
+# to check walking it with GETBULK and caching its instance names. Needs
+# Net-SNMP's snmpd and an installed collectd:
+#
+#   COLLECTD=/opt/collectd/sbin/collectd \
+#   PLUGINDIR=/opt/collectd/lib/collectd \
+#   TYPESDB=/opt/collectd/share/collectd/types.db \
+#   contrib/snmp/run.sh
+#
+# To poll the agent by hand: snmpwalk -v2c -c public 127.0.0.1:16161 system
+
+set -e
+
+COLLECTD="${COLLECTD:-collectd}"
+SNMPD="${SNMPD:-snmpd}"
+PLUGINDIR="${PLUGINDIR:-/usr/lib/collectd}"
+TYPESDB="${TYPESDB:-/usr/share/collectd/types.db}"
+DURATION="${DURATION:-11}"
+
+SRCDIR="$(cd "$(dirname "$0")" && pwd)"
+WORKDIR="$(mktemp -d "${TMPDIR:-/tmp}/collectd-snmp.XXXXXX")"
+SNMPD_PID=""
+
+cleanup() {
+	if test -n "$SNMPD_PID"; then
+		kill "$SNMPD_PID" 2>/dev/null || true
+		wait "$SNMPD_PID" 2>/dev/null || true
+	fi
+	if test -z "$KEEP"; then
+		rm -rf "$WORKDIR"
+	else
+		echo "Results kept in $WORKDIR"
+	fi
+}
+trap cleanup EXIT INT TERM
+
+# Twelve rows, named "row<index>" with the value 10 * index.
+table_reset() {
+	i=1
+	while test $i -le 12; do
+		echo "$i row$i $((10 * i))"
+		i=$((i + 1))
+	done >"$WORKDIR/table"
+}
+
+# Renames row 2, removes row 7 and adds row 13.
+table_change() {
+	awk '$1 == 2 { $2 = "renamed2" } $1 != 7 { print }' "$WORKDIR/table" \
+	    >"$WORKDIR/table.new"
+	echo "13 row13 130" >>"$WORKDIR/table.new"
+	mv "$WORKDIR/table.new" "$WORKDIR/table"
+}
+
+# Number of lines written to the CSV file(s) of a value.
+csv_lines() {
+	cat "$1"-* 2>/dev/null | wc -l
+}
+
+{
+	cat "$SRCDIR/snmpd.conf"
+	echo "pass .1.3.6.1.4.1.8072.9999.1 /bin/sh $SRCDIR/table.sh $WORKDIR/table"
+} >"$WORKDIR/snmpd.conf"
+table_reset
+
+# -f: stay in the foreground, -Lo: log to stdout, -C: ignore the default
+# configuration files.
+"$SNMPD" -f -Lo -C -c "$WORKDIR/snmpd.conf" >"$WORKDIR/snmpd.log" 2>&1 &
+SNMPD_PID=$!
+sleep 1
+if ! kill -0 "$SNMPD_PID" 2>/dev/null; then
+	cat "$WORKDIR/snmpd.log"
+	echo "snmpd failed to start." >&2
+	exit 1
+fi
+
+for mode in false true; do
+	dir="$WORKDIR/async-$mode"
+	mkdir -p "$dir"
+	sed -e "s|@WORKDIR@|$dir|g" \
+	    -e "s|@PLUGINDIR@|$PLUGINDIR|g" \
+	    -e "s|@TYPESDB@|$TYPESDB|g" \
+	    -e "s|@ASYNCHRONOUS@|$mode|g" \
+	    "$SRCDIR/collectd.conf.in" >"$dir/collectd.conf"
+
+	table_reset
+	"$COLLECTD" -f -C "$dir/collectd.conf" &
+	pid=$!
+	sleep $((DURATION / 2))
+	table_change
+	sleep $((DURATION - DURATION / 2))
+	kill -INT "$pid"
+	wait "$pid" || true
+done
+
+status=0
+for mode in false true; do
+	dir="$WORKDIR/async-$mode"
+
+	for host in agent-v1 agent-v2 agent-v2-nobulk; do
+		for file in uptime gauge-services if_octets-lo; do
+			if ! ls "$dir/csv/$host/snmp/$file"-* >/dev/null 2>&1; then
+				echo "Asynchronous $mode: $host/snmp/$file is missing." >&2
+				status=1
+				continue
+			fi
+			# Header plus at least three intervals.
+			lines=$(cat "$dir/csv/$host/snmp/$file"-* | wc -l)
+			if test "$lines" -lt 4; then
+				echo "Asynchronous $mode: $host/snmp/$file has only $lines lines." >&2
+				status=1
+			fi
+		done
+	done
+
+	if ! grep -q "host agent-dead" "$dir/collectd.log"; then
+		echo "Asynchronous $mode: timeouts of agent-dead weren't reported." >&2
+		status=1
+	fi
+
+	for host in table-getnext table-bulk table-cached table-expiring; do
+		table="$dir/csv/$host/snmp/gauge"
+
+		lines=$(csv_lines "$table-row1")
+		if test "$lines" -lt 4; then
+			echo "Asynchronous $mode: $host/snmp/gauge-row1 has only $lines lines." >&2
+			status=1
+			continue
+		fi
+
+		value=$(tail -n 1 "$table-row5"-* | cut -d, -f2)
+		if test "${value%.*}" != "50"; then
+			echo "Asynchronous $mode: $host/snmp/gauge-row5 is \"$value\", want 50." >&2
+			status=1
+		fi
+
+		# The removed row must not be dispatched anymore, with or without
+		# cached instance names.
+		if test "$(csv_lines "$table-row7")" -ge "$lines"; then
+			echo "Asynchronous $mode: $host: the removed row was still collected." >&2
+			status=1
+		fi
+
+		# Renamed and added rows are only seen without a valid cache. With a
+		# valid cache, the old name of the renamed row is used throughout.
+		for row in renamed2 row13; do
+			if test "$host" = "table-cached"; then
+				if ls "$table-$row"-* >/dev/null 2>&1; then
+					echo "Asynchronous $mode: $host: $row was collected despite the cache." >&2
+					status=1
+				fi
+			elif ! ls "$table-$row"-* >/dev/null 2>&1; then
+				echo "Asynchronous $mode: $host: $row is missing." >&2
+				status=1
+			fi
+		done
+		if test "$host" = "table-cached" &&
+		   test "$(csv_lines "$table-row2")" -ne "$lines"; then
+			echo "Asynchronous $mode: $host: the cached name of row 2 wasn't used." >&2
+			status=1
+		fi
+	done
+
+	# Walking the table with GETBULK must yield the same rows as GETNEXT.
+	getnext_rows=$(cd "$dir/csv/table-getnext/snmp" && ls | sort)
+	bulk_rows=$(cd "$dir/csv/table-bulk/snmp" && ls | sort)
+	if test "$getnext_rows" != "$bulk_rows"; then
+		echo "Asynchronous $mode: GETNEXT and GETBULK collected different rows." >&2
+		status=1
+	fi
+
+	if test -d "$dir/csv/agent-dead"; then
+		echo "Asynchronous $mode: got values from a host that doesn't exist." >&2
+		status=1
+	fi
+
+	if grep -q "\[error\]" "$dir/collectd.log" &&
+	   grep "\[error\]" "$dir/collectd.log" | grep -v -q "agent-dead"; then
+		echo "Asynchronous $mode: unexpected errors:" >&2
+		grep "\[error\]" "$dir/collectd.log" | grep -v "agent-dead" >&2
+		status=1
+	fi
+done
+
+# Both modes must see the same interfaces, and the same value for the
+# constant sysServices.
+for host in agent-v1 agent-v2 agent-v2-nobulk; do
+	sync_ifs=$(cd "$WORKDIR/async-false/csv/$host/snmp" && ls | sort)
+	async_ifs=$(cd "$WORKDIR/async-true/csv/$host/snmp" && ls | sort)
+	if test "$sync_ifs" != "$async_ifs"; then
+		echo "$host: synchronous and asynchronous mode collected different values." >&2
+		status=1
+	fi
+
+	services=$(tail -n 1 "$WORKDIR/async-true/csv/$host/snmp/gauge-services"-* | cut -d, -f2)
+	if test "${services%.*}" != "72"; then
+		echo "$host: sysServices is \"$services\", want 72." >&2
+		status=1
+	fi
+done
+
+if test $status -eq 0; then
+	echo "OK"
+fi
+exit $status
@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# "pass" script for snmpd, see run.sh. Serves a table with a name and a value
+# column below .1.3.6.1.4.1.8072.9999.1.2.1 (netSnmpPlaypen), whose rows are
+# read from a file with one "index name value" line per row, so that the
+# table can be changed while the agent is running.
+#
+# Usage: table.sh FILE -g|-n OID
+
+FILE="$1"
+MODE="$2"
+REQUEST="$3"
+
+sort -n "$FILE" | awk -v base=".1.3.6.1.4.1.8072.9999.1.2.1" \
+    -v mode="$MODE" -v request="$REQUEST" '
+# Compares two numeric OIDs with a leading dot, subidentifier by subidentifier.
+function oid_compare(a, b,    a_num, b_num, a_sub, b_sub, i) {
+	a_num = split(a, a_sub, ".")
+	b_num = split(b, b_sub, ".")
+	for (i = 2; (i <= a_num) && (i <= b_num); i++) {
+		if ((a_sub[i] + 0) < (b_sub[i] + 0))
+			return -1
+		if ((a_sub[i] + 0) > (b_sub[i] + 0))
+			return 1
+	}
+	return (a_num < b_num) ? -1 : (a_num > b_num)
+}
+
+NF == 3 {
+	rows++
+	index_of[rows] = $1
+	name_of[rows] = $2
+	value_of[rows] = $3
+}
+
+# Columns are walked one after the other, rows in ascending order.
+END {
+	for (column = 2; column <= 3; column++) {
+		for (row = 1; row <= rows; row++) {
+			oid = base "." column "." index_of[row]
+			status = oid_compare(oid, request)
+			if (((mode == "-g") && (status == 0)) ||
+			    ((mode == "-n") && (status > 0))) {
+				print oid
+				if (column == 2) {
+					print "string"
+					print name_of[row]
+				} else {
+					print "gauge"
+					print value_of[row]
+				}
+				exit
+			}
+		}
+	}
+}'
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+#
+# Minimal HTTP endpoint for testing the write_http plugin. It accepts POST
+# requests, decompresses gzip encoded bodies, counts the value lists in them
+# and appends one line per request to the log file:
+#
+#   <path> <content encoding> <number of value lists>
+#
+# Use --delay to simulate a slow server.
+
+import argparse
+import gzip
+import json
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length', 0))
+        body = self.rfile.read(length)
+        encoding = self.headers.get('Content-Encoding', 'identity')
+
+        try:
+            if encoding == 'gzip':
+                body = gzip.decompress(body)
+            elif encoding != 'identity':
+                raise ValueError('unsupported encoding ' + encoding)
+
+            if self.headers.get('Content-Type', '').startswith(
+                    'application/json'):
+                count = len(json.loads(body))
+            else:
+                count = sum(1 for line in body.decode().splitlines()
+                            if line.startswith('PUTVAL '))
+        except Exception as e:
+            self.server.record('%s error %s' % (self.path, e))
+            self.send_response(400)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return
+
+        time.sleep(self.server.delay)
+        self.server.record('%s %s %d' % (self.path, encoding, count))
+        self.send_response(200)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def log_message(self, format, *args):
+        pass
+
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, address, log, delay):
+        super().__init__(address, Handler)
+        self.log = log
+        self.delay = delay
+        self.lock = threading.Lock()
+
+    def record(self, line):
+        with self.lock:
+            self.log.write(line + '\n')
+            self.log.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--port', type=int, default=18080)
+    parser.add_argument('--delay', type=float, default=0.0,
+                        help='seconds to wait before answering')
+    parser.add_argument('log')
+    args = parser.parse_args()
+
+    with open(args.log, 'a') as log:
+        Server(('127.0.0.1', args.port), log, args.delay).serve_forever()
+
+
+if __name__ == '__main__':
+    main()
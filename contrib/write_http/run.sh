@@ -0,0 +1,98 @@
+#!/bin/sh
+#
+# Runs the write_http plugin against a local HTTP stub, with and without
+# compression and in synchronous and asynchronous mode, and checks that every
+# node posted its values with the expected encoding. Needs python3 and an
+# installed collectd built with libcurl and zlib:
+#
+#   COLLECTD=/opt/collectd/sbin/collectd \
+#   PLUGINDIR=/opt/collectd/lib/collectd \
+#   TYPESDB=/opt/collectd/share/collectd/types.db \
+#   contrib/write_http/run.sh
+#
+# Set DELAY to make the stub answer slowly, e.g. DELAY=0.5.
+
+set -e
+
+COLLECTD="${COLLECTD:-collectd}"
+PYTHON="${PYTHON:-python3}"
+PLUGINDIR="${PLUGINDIR:-/usr/lib/collectd}"
+TYPESDB="${TYPESDB:-/usr/share/collectd/types.db}"
+DURATION="${DURATION:-10}"
+DELAY="${DELAY:-0}"
+PORT="${PORT:-18080}"
+
+SRCDIR="$(cd "$(dirname "$0")" && pwd)"
+WORKDIR="$(mktemp -d "${TMPDIR:-/tmp}/collectd-write_http.XXXXXX")"
+STUB_PID=""
+
+cleanup() {
+	if test -n "$STUB_PID"; then
+		kill "$STUB_PID" 2>/dev/null || true
+		wait "$STUB_PID" 2>/dev/null || true
+	fi
+	if test -z "$KEEP"; then
+		rm -rf "$WORKDIR"
+	else
+		echo "Results kept in $WORKDIR"
+	fi
+}
+trap cleanup EXIT INT TERM
+
+"$PYTHON" "$SRCDIR/http-stub.py" --port "$PORT" --delay "$DELAY" \
+	"$WORKDIR/requests.log" >"$WORKDIR/stub.log" 2>&1 &
+STUB_PID=$!
+sleep 1
+if ! kill -0 "$STUB_PID" 2>/dev/null; then
+	cat "$WORKDIR/stub.log"
+	echo "The HTTP stub failed to start." >&2
+	exit 1
+fi
+
+sed -e "s|@WORKDIR@|$WORKDIR|g" \
+    -e "s|@PLUGINDIR@|$PLUGINDIR|g" \
+    -e "s|@TYPESDB@|$TYPESDB|g" \
+    -e "s|@PORT@|$PORT|g" \
+    "$SRCDIR/collectd.conf.in" >"$WORKDIR/collectd.conf"
+
+"$COLLECTD" -f -C "$WORKDIR/collectd.conf" &
+pid=$!
+sleep "$DURATION"
+kill -INT "$pid"
+wait "$pid" || true
+
+status=0
+for node in sync sync-gzip async async-gzip; do
+	case "$node" in
+		*-gzip) encoding=gzip ;;
+		*)      encoding=identity ;;
+	esac
+
+	requests=$(grep -c "^/$node " "$WORKDIR/requests.log" || true)
+	if test "$requests" -eq 0; then
+		echo "$node: no requests received." >&2
+		status=1
+		continue
+	fi
+
+	if grep "^/$node " "$WORKDIR/requests.log" | grep -v -q "^/$node $encoding "; then
+		echo "$node: requests without \"Content-Encoding: $encoding\":" >&2
+		grep "^/$node " "$WORKDIR/requests.log" | grep -v "^/$node $encoding " >&2
+		status=1
+	fi
+
+	values=$(grep "^/$node $encoding " "$WORKDIR/requests.log" |
+		awk '{ sum += $3 } END { print sum + 0 }')
+	echo "$node: $requests requests, $values value lists"
+done
+
+if grep -q "\[error\]" "$WORKDIR/collectd.log"; then
+	echo "Unexpected errors:" >&2
+	grep "\[error\]" "$WORKDIR/collectd.log" >&2
+	status=1
+fi
+
+if test $status -eq 0; then
+	echo "OK"
+fi
+exit $status
@@ -0,0 +1,291 @@
+/**
+ * collectd - src/collectd-segdump.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#if !__GNUC__
+#define __attribute__(x) /**/
+#endif
+
+#include <fnmatch.h>
+
+#include "utils_format_number.h"
+#include "utils_segment.h"
+
+/* The data source types as stored by the segment plugin. */
+#define SEGDUMP_DS_TYPE_COUNTER 0
+#define SEGDUMP_DS_TYPE_GAUGE 1
+#define SEGDUMP_DS_TYPE_DERIVE 2
+#define SEGDUMP_DS_TYPE_ABSOLUTE 3
+
+typedef struct segdump_series_s {
+  _Bool defined;
+  _Bool selected;
+  segment_record_t rec;
+
+  /* for listing */
+  uint64_t points;
+  uint64_t t_min;
+  uint64_t t_max;
+} segdump_series_t;
+
+static char const *conf_pattern = NULL;
+static uint64_t conf_start = 0;
+static uint64_t conf_end = UINT64_MAX;
+static _Bool conf_list = 0;
+
+__attribute__((noreturn)) static void exit_usage(int exit_status) /* {{{ */
+{
+  fprintf((exit_status == EXIT_FAILURE) ? stderr : stdout,
+          "collectd-segdump -- dump segment files written by collectd\n"
+          "\n"
+          "  Usage: collectd-segdump [OPTION] <file> [<file> ...]\n"
+          "\n"
+          "  Valid options:\n"
+          "    -i <pattern>   Only dump identifiers matching the shell\n"
+          "                   wildcard pattern.\n"
+          "    -s <time>      Only dump points at or after this epoch.\n"
+          "    -e <time>      Only dump points before this epoch.\n"
+          "    -l             List series instead of dumping points.\n"
+          "    -h             Print usage information (this output).\n");
+  exit(exit_status);
+} /* }}} void exit_usage */
+
+static uint64_t parse_time(char const *str) /* {{{ */
+{
+  char *endptr = NULL;
+  double t;
+
+  errno = 0;
+  t = strtod(str, &endptr);
+  if ((errno != 0) || (endptr == str) || (*endptr != 0) || (t < 0.0)) {
+    fprintf(stderr, "Invalid time: \"%s\"\n", str);
+    exit_usage(EXIT_FAILURE);
+  }
+
+  return (uint64_t)(t * 1000.0);
+} /* }}} uint64_t parse_time */
+
+static void print_value(segdump_series_t const *s, size_t i, /* {{{ */
+                        segment_decoder_t *d) {
+  char buffer[FORMAT_NUMBER_BUFSIZE];
+  int64_t v = 0;
+  double g = NAN;
+
+  if (d->encoding == SEGMENT_ENCODING_DOUBLE) {
+    if (segment_decoder_next_double(d, &g) != 0)
+      g = NAN;
+    if (isnan(g))
+      fputs(":U", stdout);
+    else {
+      format_double(buffer, g);
+      printf(":%s", buffer);
+    }
+    return;
+  }
+
+  if (segment_decoder_next_int64(d, &v) != 0) {
+    fputs(":U", stdout);
+    return;
+  }
+  if (s->rec.ds_types[i] == SEGDUMP_DS_TYPE_DERIVE)
+    format_int64(buffer, v);
+  else
+    format_uint64(buffer, (uint64_t)v);
+  printf(":%s", buffer);
+} /* }}} void print_value */
+
+static int dump_block(segdump_series_t *s, /* {{{ */
+                      segment_record_t const *rec) {
+  segment_decoder_t decoders[SEGMENT_DS_MAX + 1];
+
+  if (rec->columns_num != s->rec.ds_num + 1)
+    return -1;
+
+  if (conf_list) {
+    if ((s->points == 0) || (rec->t_first < s->t_min))
+      s->t_min = rec->t_first;
+    if ((s->points == 0) || (rec->t_last > s->t_max))
+      s->t_max = rec->t_last;
+    s->points += rec->count;
+    return 0;
+  }
+
+  if ((rec->t_last < conf_start) || (rec->t_first >= conf_end))
+    return 0;
+
+  segment_decoder_init(decoders, SEGMENT_ENCODING_INT64, rec->columns[0],
+                       rec->columns_size[0]);
+  for (size_t i = 0; i < s->rec.ds_num; i++)
+    segment_decoder_init(
+        decoders + i + 1,
+        (s->rec.ds_types[i] == SEGDUMP_DS_TYPE_GAUGE) ? SEGMENT_ENCODING_DOUBLE
+                                                      : SEGMENT_ENCODING_INT64,
+        rec->columns[i + 1], rec->columns_size[i + 1]);
+
+  for (size_t n = 0; n < rec->count; n++) {
+    int64_t t;
+    _Bool skip;
+
+    if (segment_decoder_next_int64(decoders, &t) != 0)
+      return -1;
+    skip = ((uint64_t)t < conf_start) || ((uint64_t)t >= conf_end);
+
+    /* Decode all columns, even if the point is skipped. */
+    if (skip) {
+      for (size_t i = 0; i < s->rec.ds_num; i++) {
+        int64_t v;
+        double g;
+        if (decoders[i + 1].encoding == SEGMENT_ENCODING_DOUBLE)
+          segment_decoder_next_double(decoders + i + 1, &g);
+        else
+          segment_decoder_next_int64(decoders + i + 1, &v);
+      }
+      continue;
+    }
+
+    printf("PUTVAL \"%s\" %" PRIu64 ".%03" PRIu64, s->rec.identifier,
+           (uint64_t)t / 1000, (uint64_t)t % 1000);
+    for (size_t i = 0; i < s->rec.ds_num; i++)
+      print_value(s, i, decoders + i + 1);
+    printf("\n");
+  }
+
+  return 0;
+} /* }}} int dump_block */
+
+static void list_series(segdump_series_t const *series, /* {{{ */
+                        size_t series_num) {
+  for (size_t i = 0; i < series_num; i++) {
+    segdump_series_t const *s = series + i;
+
+    if (!s->defined || !s->selected || (s->points == 0))
+      continue;
+
+    printf("%s", s->rec.identifier);
+    for (size_t j = 0; j < s->rec.ds_num; j++)
+      printf("%c%s", (j == 0) ? ' ' : ',', s->rec.ds_names[j]);
+    printf(" points=%" PRIu64 " first=%" PRIu64 ".%03" PRIu64
+           " last=%" PRIu64 ".%03" PRIu64 "\n",
+           s->points, s->t_min / 1000, s->t_min % 1000, s->t_max / 1000,
+           s->t_max % 1000);
+  }
+} /* }}} void list_series */
+
+static int dump_file(char const *path) /* {{{ */
+{
+  segment_reader_t *r;
+  segment_record_t rec;
+  segdump_series_t *series = NULL;
+  size_t series_num = 0;
+  int status;
+
+  r = segment_reader_open(path);
+  if (r == NULL) {
+    fprintf(stderr, "Opening \"%s\" failed: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  while ((status = segment_reader_next(r, &rec)) == 0) {
+    if (rec.type == SEGMENT_RECORD_SERIES) {
+      if (rec.id >= series_num) {
+        size_t num = (2 * series_num > rec.id) ? 2 * series_num : rec.id + 1;
+        segdump_series_t *tmp = realloc(series, num * sizeof(*series));
+        if (tmp == NULL) {
+          fprintf(stderr, "realloc failed.\n");
+          status = -1;
+          break;
+        }
+        memset(tmp + series_num, 0, (num - series_num) * sizeof(*series));
+        series = tmp;
+        series_num = num;
+      }
+
+      series[rec.id] = (segdump_series_t){
+          .defined = 1,
+          .selected = (conf_pattern == NULL) ||
+                      (fnmatch(conf_pattern, rec.identifier, 0) == 0),
+          .rec = rec,
+      };
+    } else if (rec.type == SEGMENT_RECORD_BLOCK) {
+      if ((rec.id >= series_num) || !series[rec.id].defined) {
+        fprintf(stderr, "%s: Block of undefined series %" PRIu32 ".\n", path,
+                rec.id);
+        continue;
+      }
+      if (!series[rec.id].selected)
+        continue;
+      if (dump_block(series + rec.id, &rec) != 0)
+        fprintf(stderr, "%s: Block of \"%s\" is corrupt.\n", path,
+                series[rec.id].rec.identifier);
+    }
+  }
+  if (status < 0)
+    fprintf(stderr, "%s: File is corrupt, stopped reading.\n", path);
+
+  if (conf_list)
+    list_series(series, series_num);
+
+  free(series);
+  segment_reader_close(r);
+  return (status < 0) ? -1 : 0;
+} /* }}} int dump_file */
+
+int main(int argc, char **argv) /* {{{ */
+{
+  int status = 0;
+
+  while (42) {
+    int opt = getopt(argc, argv, "i:s:e:lh");
+    if (opt == -1)
+      break;
+
+    switch (opt) {
+    case 'i':
+      conf_pattern = optarg;
+      break;
+    case 's':
+      conf_start = parse_time(optarg);
+      break;
+    case 'e':
+      conf_end = parse_time(optarg);
+      break;
+    case 'l':
+      conf_list = 1;
+      break;
+    case 'h':
+      exit_usage(EXIT_SUCCESS);
+    default:
+      exit_usage(EXIT_FAILURE);
+    }
+  }
+
+  if (optind >= argc)
+    exit_usage(EXIT_FAILURE);
+
+  for (int i = optind; i < argc; i++) {
+    if (dump_file(argv[i]) != 0)
+      status = 1;
+  }
+
+  return status;
+} /* }}} int main */
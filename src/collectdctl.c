@@ -93,7 +93,8 @@ __attribute__((noreturn)) static void exit_usage(const char *name, int status) {
 
       "\nAvailable commands:\n\n"
 
-      " * getval <identifier>\n"
+      " * getval <identifier> [<identifier> ...]\n"
+      " * gethistory <identifier> [start=<time>] [end=<time>]\n"
       " * flush [timeout=<seconds>] [plugin=<name>] [identifier=<id>]\n"
       " * listval\n"
       " * putval <identifier> [interval=<seconds>] <value-list(s)>\n"
@@ -182,6 +183,68 @@ static int parse_identifier(lcc_connection_t *c, const char *value,
   return 0;
 } /* parse_identifier */
 
+/* Queries many identifiers at once. */
+static int getvals(lcc_connection_t *c, int argc, char **argv) {
+  size_t idents_num = (size_t)(argc - 1);
+  lcc_identifier_t *idents;
+  size_t *ret_values_num;
+  gauge_t **ret_values;
+  char ***ret_values_names;
+
+  int status = 0;
+
+  idents = calloc(idents_num, sizeof(*idents));
+  ret_values_num = calloc(idents_num, sizeof(*ret_values_num));
+  ret_values = calloc(idents_num, sizeof(*ret_values));
+  ret_values_names = calloc(idents_num, sizeof(*ret_values_names));
+  if ((idents == NULL) || (ret_values_num == NULL) || (ret_values == NULL) ||
+      (ret_values_names == NULL)) {
+    fprintf(stderr, "ERROR: Failed to allocate memory.\n");
+    free(idents);
+    free(ret_values_num);
+    free(ret_values);
+    free(ret_values_names);
+    return -1;
+  }
+
+  for (size_t i = 0; (status == 0) && (i < idents_num); ++i)
+    status = parse_identifier(c, argv[i + 1], idents + i);
+
+  if (status == 0) {
+    status = lcc_getvals(c, idents, idents_num, ret_values_num, ret_values,
+                         ret_values_names);
+    if (status != 0)
+      fprintf(stderr, "ERROR: %s\n", lcc_strerror(c));
+  }
+
+  for (size_t i = 0; (status == 0) && (i < idents_num); ++i) {
+    char id[1024];
+
+    lcc_identifier_to_string(c, id, sizeof(id), idents + i);
+    if (ret_values_num[i] == 0) {
+      fprintf(stderr, "ERROR: %s: No such value.\n", id);
+      continue;
+    }
+
+    printf("%s", id);
+    for (size_t j = 0; j < ret_values_num[i]; ++j)
+      printf(" %s=%e", ret_values_names[i][j], ret_values[i][j]);
+    printf("\n");
+  }
+
+  for (size_t i = 0; i < idents_num; ++i) {
+    for (size_t j = 0; j < ret_values_num[i]; ++j)
+      free(ret_values_names[i][j]);
+    free(ret_values_names[i]);
+    free(ret_values[i]);
+  }
+  free(ret_values_names);
+  free(ret_values);
+  free(ret_values_num);
+  free(idents);
+  return status;
+} /* getvals */
+
 static int getval(lcc_connection_t *c, int argc, char **argv) {
   lcc_identifier_t ident;
 
@@ -193,11 +256,14 @@ static int getval(lcc_connection_t *c, int argc, char **argv) {
 
   assert(strcasecmp(argv[0], "getval") == 0);
 
-  if (argc != 2) {
+  if (argc < 2) {
     fprintf(stderr, "ERROR: getval: Missing identifier.\n");
     return -1;
   }
 
+  if (argc > 2)
+    return getvals(c, argc, argv);
+
   status = parse_identifier(c, argv[1], &ident);
   if (status != 0)
     return status;
@@ -228,6 +294,87 @@ static int getval(lcc_connection_t *c, int argc, char **argv) {
 #undef BAIL_OUT
 } /* getval */
 
+static int gethistory(lcc_connection_t *c, int argc, char **argv) {
+  lcc_identifier_t ident;
+  double start = 0.0;
+  double end = 0.0;
+
+  size_t ret_points_num = 0;
+  double *ret_times = NULL;
+  size_t ret_values_num = 0;
+  gauge_t *ret_values = NULL;
+  char **ret_values_names = NULL;
+
+  int status;
+
+  assert(strcasecmp(argv[0], "gethistory") == 0);
+
+  if (argc < 2) {
+    fprintf(stderr, "ERROR: gethistory: Missing identifier.\n");
+    return -1;
+  }
+
+  for (int i = 2; i < argc; ++i) {
+    char *key, *value, *endptr;
+    double *dest;
+
+    key = argv[i];
+    value = strchr(argv[i], (int)'=');
+
+    if (!value) {
+      fprintf(stderr, "ERROR: gethistory: Invalid option ``%s''.\n", argv[i]);
+      return -1;
+    }
+
+    *value = '\0';
+    ++value;
+
+    if (strcasecmp(key, "start") == 0)
+      dest = &start;
+    else if (strcasecmp(key, "end") == 0)
+      dest = &end;
+    else {
+      fprintf(stderr, "ERROR: gethistory: Unknown option `%s'.\n", key);
+      return -1;
+    }
+
+    endptr = NULL;
+    *dest = strtod(value, &endptr);
+    if ((endptr == value) || (*endptr != '\0')) {
+      fprintf(stderr, "ERROR: Failed to parse %s as time: %s.\n", key, value);
+      return -1;
+    }
+  }
+
+  status = parse_identifier(c, argv[1], &ident);
+  if (status != 0)
+    return status;
+
+  status = lcc_gethistory(c, &ident, start, end, &ret_points_num, &ret_times,
+                          &ret_values_num, &ret_values, &ret_values_names);
+  if (status != 0) {
+    fprintf(stderr, "ERROR: %s\n", lcc_strerror(c));
+    return -1;
+  }
+
+  for (size_t i = 0; i < ret_points_num; ++i) {
+    printf("%.3f", ret_times[i]);
+    for (size_t j = 0; j < ret_values_num; ++j)
+      printf(" %s=%e", ret_values_names[j],
+             ret_values[i * ret_values_num + j]);
+    printf("\n");
+  }
+
+  free(ret_times);
+  free(ret_values);
+  if (ret_values_names != NULL) {
+    for (size_t j = 0; j < ret_values_num; ++j)
+      free(ret_values_names[j]);
+    free(ret_values_names);
+  }
+  return 0;
+} /* gethistory */
+
 static int flush(lcc_connection_t *c, int argc, char **argv) {
   int timeout = -1;
 
@@ -568,6 +715,8 @@ int main(int argc, char **argv) {
 
   if (strcasecmp(argv[optind], "getval") == 0)
     status = getval(c, argc - optind, argv + optind);
+  else if (strcasecmp(argv[optind], "gethistory") == 0)
+    status = gethistory(c, argc - optind, argv + optind);
   else if (strcasecmp(argv[optind], "flush") == 0)
     status = flush(c, argc - optind, argv + optind);
   else if (strcasecmp(argv[optind], "listval") == 0)
@@ -25,18 +25,63 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_format_number.h"
 
 /*
  * Private variables
  */
-static const char *config_keys[] = {"DataDir", "StoreRates"};
+static const char *config_keys[] = {"DataDir", "StoreRates", "MaxOpenFiles",
+                                    "FlushInterval"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static char *datadir = NULL;
 static int store_rates = 0;
 static int use_stdio = 0;
 
+/* If "MaxOpenFiles" is set, files are kept open between writes and lines are
+ * collected in a per-file buffer. Buffered lines are written every
+ * "FlushInterval" by a read callback. When the limit is reached, the least
+ * recently used file is closed. The files are kept in a tree, keyed by name,
+ * and in a list, most recently used first. All of it is protected by
+ * files_lock.
+ *
+ * Closing any descriptor of a file releases all locks the daemon holds on it,
+ * so opening and closing cached files is serialized by open_lock, which is
+ * taken before files_lock. Writing out buffers is serialized by open_lock,
+ * too, so that lines stay in order when they are written without holding
+ * files_lock. A file is marked stale if writing to it fails or
+ * if it has been moved or removed, for example by logrotate, and is reopened
+ * by the next write.
+ *
+ * Plain file descriptors are used rather than stdio: glibc keeps all open
+ * streams in a singly linked list, so fclose(3) on the least recently opened
+ * of thousands of streams has to walk all of them. */
+#define CSV_BUFFER_SIZE 4096
+
+typedef struct csv_file_s {
+  char *filename;
+  int fd;
+  dev_t dev;
+  ino_t ino;
+  _Bool stale;
+  size_t fill;
+  char buffer[CSV_BUFFER_SIZE];
+  struct csv_file_s *prev;
+  struct csv_file_s *next;
+} csv_file_t;
+
+static size_t max_open_files = 0;
+static cdtime_t flush_interval = TIME_T_TO_CDTIME_T_STATIC(10);
+
+static c_avl_tree_t *files = NULL;
+static csv_file_t *files_head = NULL;
+static csv_file_t *files_tail = NULL;
+static size_t files_num = 0;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int value_list_to_string(char *buffer, int buffer_len,
                                 const data_set_t *ds, const value_list_t *vl) {
   int offset;
@@ -61,9 +106,11 @@ static int value_list_to_string(char *buffer, int buffer_len,
       return -1;
     }
 
+    char tmp[FORMAT_NUMBER_BUFSIZE];
+    size_t len = 0;
+
     if (ds->ds[i].type == DS_TYPE_GAUGE) {
-      status = snprintf(buffer + offset, buffer_len - offset, ",%lf",
-                        vl->values[i].gauge);
+      len = format_double(tmp, vl->values[i].gauge);
     } else if (store_rates != 0) {
       if (rates == NULL)
         rates = uc_get_rate(ds, vl);
@@ -72,23 +119,23 @@ static int value_list_to_string(char *buffer, int buffer_len,
                 "uc_get_rate failed.");
         return -1;
       }
-      status = snprintf(buffer + offset, buffer_len - offset, ",%lf", rates[i]);
+      len = format_double(tmp, rates[i]);
     } else if (ds->ds[i].type == DS_TYPE_COUNTER) {
-      status = snprintf(buffer + offset, buffer_len - offset, ",%llu",
-                        vl->values[i].counter);
+      len = format_uint64(tmp, (uint64_t)vl->values[i].counter);
     } else if (ds->ds[i].type == DS_TYPE_DERIVE) {
-      status = snprintf(buffer + offset, buffer_len - offset, ",%" PRIi64,
-                        vl->values[i].derive);
+      len = format_int64(tmp, vl->values[i].derive);
     } else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
-      status = snprintf(buffer + offset, buffer_len - offset, ",%" PRIu64,
-                        vl->values[i].absolute);
+      len = format_uint64(tmp, vl->values[i].absolute);
     }
 
-    if ((status < 1) || (status >= (buffer_len - offset))) {
+    status = (int)len + 1;
+    if (status >= (buffer_len - offset)) {
       sfree(rates);
       return -1;
     }
 
+    buffer[offset] = ',';
+    memcpy(buffer + offset + 1, tmp, len + 1);
     offset += status;
   } /* for ds->ds_num */
 
@@ -207,20 +254,397 @@ static int csv_config(const char *key, const char *value) {
       store_rates = 1;
     else
       store_rates = 0;
+  } else if (strcasecmp("MaxOpenFiles", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 0) {
+      ERROR("csv plugin: MaxOpenFiles must not be negative.");
+      return -1;
+    }
+    max_open_files = (size_t)tmp;
+  } else if (strcasecmp("FlushInterval", key) == 0) {
+    double tmp = atof(value);
+    if (tmp <= 0.0) {
+      ERROR("csv plugin: FlushInterval must be positive.");
+      return -1;
+    }
+    flush_interval = DOUBLE_TO_CDTIME_T(tmp);
   } else {
     return -1;
   }
   return 0;
 } /* int csv_config */
 
+/* Opens `filename' for appending and locks it, creating it if necessary.
+ * Returns the file descriptor or -1 on failure. */
+static int csv_open_file(char const *filename, /* {{{ */
+                         const data_set_t *ds) {
+  struct stat statbuf;
+  int fd;
+  struct flock fl = {0};
+  int status;
+
+  if (stat(filename, &statbuf) == -1) {
+    if (errno == ENOENT) {
+      if (csv_create_file(filename, ds))
+        return -1;
+    } else {
+      char errbuf[1024];
+      ERROR("stat(%s) failed: %s", filename,
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      return -1;
+    }
+  } else if (!S_ISREG(statbuf.st_mode)) {
+    ERROR("stat(%s): Not a regular file!", filename);
+    return -1;
+  }
+
+  fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (fd < 0) {
+    char errbuf[1024];
+    ERROR("csv plugin: open (%s) failed: %s", filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  fl.l_pid = getpid();
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+
+  status = fcntl(fd, F_SETLK, &fl);
+  if (status != 0) {
+    char errbuf[1024];
+    ERROR("csv plugin: flock (%s) failed: %s", filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+} /* }}} int csv_open_file */
+
+static int csv_file_write(csv_file_t *f, char const *data, /* {{{ */
+                          size_t data_len) {
+  if (swrite(f->fd, data, data_len) != 0) {
+    char errbuf[1024];
+    ERROR("csv plugin: Writing to %s failed: %s", f->filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  return 0;
+} /* }}} int csv_file_write */
+
+/* Writes out the buffered lines of a cached file. On failure, the lines are
+ * dropped and the file is marked stale. Must hold open_lock. */
+static int csv_file_flush(csv_file_t *f) /* {{{ */
+{
+  int status = 0;
+
+  if (f->fill == 0)
+    return 0;
+
+  if (csv_file_write(f, f->buffer, f->fill) != 0) {
+    f->stale = 1;
+    status = -1;
+  }
+  f->fill = 0;
+
+  return status;
+} /* }}} int csv_file_flush */
+
+/* Closes a file that has been removed from the cache, writing out buffered
+ * lines. Must hold open_lock but not files_lock. */
+static void csv_file_destroy(csv_file_t *f) /* {{{ */
+{
+  csv_file_flush(f);
+  /* The lock is released implicitly. */
+  close(f->fd);
+
+  sfree(f->filename);
+  sfree(f);
+} /* }}} void csv_file_destroy */
+
+static void csv_file_unlink(csv_file_t *f) /* {{{ */
+{
+  if (f->prev != NULL)
+    f->prev->next = f->next;
+  else
+    files_head = f->next;
+  if (f->next != NULL)
+    f->next->prev = f->prev;
+  else
+    files_tail = f->prev;
+  f->prev = f->next = NULL;
+} /* }}} void csv_file_unlink */
+
+static void csv_file_link_head(csv_file_t *f) /* {{{ */
+{
+  f->prev = NULL;
+  f->next = files_head;
+  if (files_head != NULL)
+    files_head->prev = f;
+  files_head = f;
+  if (files_tail == NULL)
+    files_tail = f;
+} /* }}} void csv_file_link_head */
+
+/* Removes a file from the cache. The caller has to close it with
+ * csv_file_destroy() after releasing files_lock. Must hold files_lock. */
+static void csv_file_remove(csv_file_t *f) /* {{{ */
+{
+  csv_file_unlink(f);
+  c_avl_remove(files, f->filename, NULL, NULL);
+  files_num--;
+} /* }}} void csv_file_remove */
+
+/* Returns the cached file `filename' and makes it the most recently used one,
+ * or NULL if it is not open. Must hold files_lock. */
+static csv_file_t *csv_file_lookup(char const *filename) /* {{{ */
+{
+  csv_file_t *f = NULL;
+
+  if ((files == NULL) || (c_avl_get(files, filename, (void *)&f) != 0))
+    return NULL;
+
+  if (f != files_head) {
+    csv_file_unlink(f);
+    csv_file_link_head(f);
+  }
+  return f;
+} /* }}} csv_file_t *csv_file_lookup */
+
+/* Adds an opened file to the cache. The least recently used files are
+ * removed to stay below "MaxOpenFiles" and prepended to `evicted'. Must hold
+ * files_lock. */
+static int csv_file_insert(csv_file_t *f, csv_file_t **evicted) /* {{{ */
+{
+  if (files == NULL) {
+    files = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (files == NULL) {
+      ERROR("csv plugin: c_avl_create failed.");
+      return -1;
+    }
+  }
+
+  if (c_avl_insert(files, f->filename, f) != 0) {
+    ERROR("csv plugin: c_avl_insert failed.");
+    return -1;
+  }
+  files_num++;
+  csv_file_link_head(f);
+
+  while (files_num > max_open_files) {
+    csv_file_t *old = files_tail;
+    csv_file_remove(old);
+    old->next = *evicted;
+    *evicted = old;
+  }
+
+  return 0;
+} /* }}} int csv_file_insert */
+
+/* Writes out the buffered lines of all cached files and marks those stale
+ * that no longer are at their path. The lines are taken from the buffers
+ * under files_lock and written without holding it, like csv_write_open()
+ * opens and closes files, so that appending to the buffers isn't blocked by
+ * slow file systems. Holding open_lock keeps the files from being closed. */
+static void csv_files_flush(void) /* {{{ */
+{
+  struct {
+    csv_file_t *file;
+    char *data;
+    size_t data_len;
+    _Bool stale;
+  } *chunks;
+  size_t chunks_num = 0;
+
+  pthread_mutex_lock(&open_lock);
+  pthread_mutex_lock(&files_lock);
+  if (files_num == 0) {
+    pthread_mutex_unlock(&files_lock);
+    pthread_mutex_unlock(&open_lock);
+    return;
+  }
+
+  chunks = calloc(files_num, sizeof(*chunks));
+  if (chunks == NULL) {
+    ERROR("csv plugin: calloc failed.");
+    pthread_mutex_unlock(&files_lock);
+    pthread_mutex_unlock(&open_lock);
+    return;
+  }
+
+  for (csv_file_t *f = files_head; f != NULL; f = f->next) {
+    chunks[chunks_num].file = f;
+    if (f->fill > 0) {
+      chunks[chunks_num].data = malloc(f->fill);
+      if (chunks[chunks_num].data != NULL) {
+        memcpy(chunks[chunks_num].data, f->buffer, f->fill);
+        chunks[chunks_num].data_len = f->fill;
+        f->fill = 0;
+      } else {
+        /* Write the lines out while holding the lock rather than losing
+         * them. */
+        csv_file_flush(f);
+      }
+    }
+    chunks_num++;
+  }
+  pthread_mutex_unlock(&files_lock);
+
+  for (size_t i = 0; i < chunks_num; i++) {
+    csv_file_t *f = chunks[i].file;
+    struct stat statbuf;
+
+    if ((chunks[i].data_len > 0) &&
+        (csv_file_write(f, chunks[i].data, chunks[i].data_len) != 0))
+      chunks[i].stale = 1;
+    sfree(chunks[i].data);
+
+    if ((stat(f->filename, &statbuf) != 0) || (statbuf.st_dev != f->dev) ||
+        (statbuf.st_ino != f->ino))
+      chunks[i].stale = 1;
+  }
+
+  pthread_mutex_lock(&files_lock);
+  for (size_t i = 0; i < chunks_num; i++)
+    if (chunks[i].stale)
+      chunks[i].file->stale = 1;
+  pthread_mutex_unlock(&files_lock);
+  pthread_mutex_unlock(&open_lock);
+
+  sfree(chunks);
+} /* }}} void csv_files_flush */
+
+/* Opens `filename' for caching. Must hold open_lock. */
+static csv_file_t *csv_file_create(char const *filename, /* {{{ */
+                                   const data_set_t *ds) {
+  struct stat statbuf;
+  csv_file_t *f;
+
+  f = calloc(1, sizeof(*f));
+  if (f == NULL) {
+    ERROR("csv plugin: calloc failed.");
+    return NULL;
+  }
+  f->filename = strdup(filename);
+  if (f->filename == NULL) {
+    ERROR("csv plugin: strdup failed.");
+    sfree(f);
+    return NULL;
+  }
+  f->fd = csv_open_file(filename, ds);
+  if (f->fd < 0) {
+    sfree(f->filename);
+    sfree(f);
+    return NULL;
+  }
+
+  if (fstat(f->fd, &statbuf) != 0) {
+    char errbuf[1024];
+    ERROR("csv plugin: fstat (%s) failed: %s", filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    csv_file_destroy(f);
+    return NULL;
+  }
+  f->dev = statbuf.st_dev;
+  f->ino = statbuf.st_ino;
+
+  return f;
+} /* }}} csv_file_t *csv_file_create */
+
+/* Appends a line to the buffer of a cached file. Must hold files_lock, and
+ * open_lock if the buffer may have to be written out. */
+static int csv_file_append(csv_file_t *f, char const *line, /* {{{ */
+                           size_t line_len) {
+  if ((f->fill + line_len > sizeof(f->buffer)) && (csv_file_flush(f) != 0))
+    return -1;
+
+  memcpy(f->buffer + f->fill, line, line_len);
+  f->fill += line_len;
+  return 0;
+} /* }}} int csv_file_append */
+
+/* Opens a file that is not cached or stale, adds it to the cache and appends
+ * a line to it. Also used to append to a full buffer, which has to be
+ * written out first. Files are opened and closed without holding
+ * files_lock, so that slow file system operations don't block writes to
+ * other files. */
+static int csv_write_open(char const *filename, /* {{{ */
+                          const data_set_t *ds, char const *line,
+                          size_t line_len) {
+  csv_file_t *evicted = NULL;
+  csv_file_t *f;
+  int status;
+
+  pthread_mutex_lock(&open_lock);
+  pthread_mutex_lock(&files_lock);
+  /* Another thread may have opened or flushed the file in the meantime. */
+  f = csv_file_lookup(filename);
+  if ((f != NULL) && !f->stale) {
+    status = csv_file_append(f, line, line_len);
+    pthread_mutex_unlock(&files_lock);
+    pthread_mutex_unlock(&open_lock);
+    return status;
+  }
+  if (f != NULL)
+    csv_file_remove(f);
+  pthread_mutex_unlock(&files_lock);
+
+  /* The old descriptor is closed before the file is locked again. */
+  if (f != NULL)
+    csv_file_destroy(f);
+
+  f = csv_file_create(filename, ds);
+  if (f == NULL) {
+    pthread_mutex_unlock(&open_lock);
+    return -1;
+  }
+
+  pthread_mutex_lock(&files_lock);
+  status = csv_file_insert(f, &evicted);
+  if (status == 0)
+    status = csv_file_append(f, line, line_len);
+  else
+    evicted = f;
+  pthread_mutex_unlock(&files_lock);
+
+  while (evicted != NULL) {
+    csv_file_t *next = evicted->next;
+    csv_file_destroy(evicted);
+    evicted = next;
+  }
+  pthread_mutex_unlock(&open_lock);
+
+  return status;
+} /* }}} int csv_write_open */
+
+/* Appends a line to a file that is kept open. */
+static int csv_write_cached(char const *filename, /* {{{ */
+                            const data_set_t *ds, char const *line,
+                            size_t line_len) {
+  csv_file_t *f;
+  int status;
+
+  pthread_mutex_lock(&files_lock);
+  f = csv_file_lookup(filename);
+  if ((f == NULL) || f->stale || (f->fill + line_len > sizeof(f->buffer))) {
+    pthread_mutex_unlock(&files_lock);
+    return csv_write_open(filename, ds, line, line_len);
+  }
+
+  status = csv_file_append(f, line, line_len);
+  pthread_mutex_unlock(&files_lock);
+
+  return status;
+} /* }}} int csv_write_cached */
+
 static int csv_write(const data_set_t *ds, const value_list_t *vl,
                      user_data_t __attribute__((unused)) * user_data) {
-  struct stat statbuf;
   char filename[512];
   char values[4096];
   FILE *csv;
-  int csv_fd;
-  struct flock fl = {0};
+  int fd;
   int status;
 
   if (0 != strcmp(ds->type, vl->type)) {
@@ -253,40 +677,24 @@ static int csv_write(const data_set_t *ds, const value_list_t *vl,
     return 0;
   }
 
-  if (stat(filename, &statbuf) == -1) {
-    if (errno == ENOENT) {
-      if (csv_create_file(filename, ds))
-        return -1;
-    } else {
-      char errbuf[1024];
-      ERROR("stat(%s) failed: %s", filename,
-            sstrerror(errno, errbuf, sizeof(errbuf)));
-      return -1;
-    }
-  } else if (!S_ISREG(statbuf.st_mode)) {
-    ERROR("stat(%s): Not a regular file!", filename);
-    return -1;
-  }
+  if (max_open_files > 0) {
+    size_t len = strlen(values);
 
-  csv = fopen(filename, "a");
-  if (csv == NULL) {
-    char errbuf[1024];
-    ERROR("csv plugin: fopen (%s) failed: %s", filename,
-          sstrerror(errno, errbuf, sizeof(errbuf)));
-    return -1;
+    /* value_list_to_string() leaves room for at least one more byte. */
+    values[len] = '\n';
+    return csv_write_cached(filename, ds, values, len + 1);
   }
-  csv_fd = fileno(csv);
 
-  fl.l_pid = getpid();
-  fl.l_type = F_WRLCK;
-  fl.l_whence = SEEK_SET;
+  fd = csv_open_file(filename, ds);
+  if (fd < 0)
+    return -1;
 
-  status = fcntl(csv_fd, F_SETLK, &fl);
-  if (status != 0) {
+  csv = fdopen(fd, "a");
+  if (csv == NULL) {
     char errbuf[1024];
-    ERROR("csv plugin: flock (%s) failed: %s", filename,
+    ERROR("csv plugin: fdopen (%s) failed: %s", filename,
           sstrerror(errno, errbuf, sizeof(errbuf)));
-    fclose(csv);
+    close(fd);
     return -1;
   }
 
@@ -299,7 +707,50 @@ static int csv_write(const data_set_t *ds, const value_list_t *vl,
   return 0;
 } /* int csv_write */
 
+static int csv_flush(cdtime_t __attribute__((unused)) timeout, /* {{{ */
+                     const char __attribute__((unused)) * identifier,
+                     user_data_t __attribute__((unused)) * user_data) {
+  csv_files_flush();
+  return 0;
+} /* }}} int csv_flush */
+
+/* Called every "FlushInterval", so that buffered lines are written even if
+ * no more values arrive. */
+static int csv_read(user_data_t *user_data) /* {{{ */
+{
+  return csv_flush(0, NULL, user_data);
+} /* }}} int csv_read */
+
+static int csv_init(void) /* {{{ */
+{
+  if (max_open_files == 0)
+    return 0;
+
+  return plugin_register_complex_read(/* group = */ NULL, "csv", csv_read,
+                                      flush_interval, /* user_data = */ NULL);
+} /* }}} int csv_init */
+
+static int csv_shutdown(void) /* {{{ */
+{
+  pthread_mutex_lock(&open_lock);
+  pthread_mutex_lock(&files_lock);
+  while (files_tail != NULL) {
+    csv_file_t *f = files_tail;
+    csv_file_remove(f);
+    csv_file_destroy(f);
+  }
+  c_avl_destroy(files);
+  files = NULL;
+  pthread_mutex_unlock(&files_lock);
+  pthread_mutex_unlock(&open_lock);
+
+  return 0;
+} /* }}} int csv_shutdown */
+
 void module_register(void) {
   plugin_register_config("csv", csv_config, config_keys, config_keys_num);
+  plugin_register_init("csv", csv_init);
   plugin_register_write("csv", csv_write, /* user_data = */ NULL);
+  plugin_register_flush("csv", csv_flush, /* user_data = */ NULL);
+  plugin_register_shutdown("csv", csv_shutdown);
 } /* void module_register */
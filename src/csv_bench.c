@@ -0,0 +1,108 @@
+/**
+ * collectd - src/csv_bench.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "csv.c" /* sic */
+
+#include <time.h>
+
+/* Stays below the usual limit of 1024 open files. */
+#define BENCH_FILES_NUM 500
+#define BENCH_ROUNDS 20
+
+static double elapsed_ns(struct timespec const *begin) {
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return 1e9 * (double)(end.tv_sec - begin->tv_sec) +
+         (double)(end.tv_nsec - begin->tv_nsec);
+}
+
+static void bench_vl(value_list_t *vl, size_t i) {
+  *vl = (value_list_t){
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T(1480063672),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "bench",
+      .plugin = "test",
+      .type = "MAGIC",
+  };
+  snprintf(vl->type_instance, sizeof(vl->type_instance), "%zu", i);
+}
+
+/* Writes one line to each of BENCH_FILES_NUM files per round, as if as many
+ * metrics were reported every interval, and flushes after each round. Shows
+ * how many files per second are written with every write opening the file,
+ * with the least recently used files being closed, and with all files being
+ * kept open. */
+int main(void) {
+  char dir[] = "/tmp/bench_csv.XXXXXX";
+  size_t const limits[] = {0, BENCH_FILES_NUM / 5, BENCH_FILES_NUM};
+  data_set_t const *ds = plugin_get_ds("MAGIC");
+  char filename[512];
+
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  csv_config("DataDir", dir);
+
+  for (size_t l = 0; l < STATIC_ARRAY_SIZE(limits); l++) {
+    struct timespec begin;
+    double ns;
+
+    max_open_files = limits[l];
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+      for (size_t i = 0; i < BENCH_FILES_NUM; i++) {
+        value_list_t vl;
+
+        bench_vl(&vl, i);
+        vl.values = &(value_t){.derive = r};
+        if (csv_write(ds, &vl, NULL) != 0)
+          return 1;
+      }
+      csv_flush(0, NULL, NULL);
+    }
+    csv_shutdown();
+    ns = elapsed_ns(&begin);
+
+    printf("MaxOpenFiles %zu: %.0f files/s, %.1f us/file\n", limits[l],
+           1e9 * (double)(BENCH_ROUNDS * BENCH_FILES_NUM) / ns,
+           ns / (1e3 * (double)(BENCH_ROUNDS * BENCH_FILES_NUM)));
+  }
+
+  for (size_t i = 0; i < BENCH_FILES_NUM; i++) {
+    value_list_t vl;
+
+    bench_vl(&vl, i);
+    value_list_to_filename(filename, sizeof(filename), &vl);
+    unlink(filename);
+  }
+  snprintf(filename, sizeof(filename), "%s/bench/test", dir);
+  rmdir(filename);
+  snprintf(filename, sizeof(filename), "%s/bench", dir);
+  rmdir(filename);
+  rmdir(dir);
+  sfree(datadir);
+  return 0;
+}
@@ -0,0 +1,232 @@
+/**
+ * collectd - src/csv_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "testing.h"
+#include "csv.c" /* sic */
+
+#define TEST_HEADER "epoch,value\n"
+
+static char test_dir[] = "/tmp/test_plugin_csv.XXXXXX";
+
+static value_list_t test_vl(char const *host, derive_t value) {
+  value_list_t vl = {
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T(1480063672),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .plugin = "test",
+      .type = "MAGIC",
+  };
+  sstrncpy(vl.host, host, sizeof(vl.host));
+  vl.values = calloc(1, sizeof(*vl.values));
+  vl.values[0].derive = value;
+  return vl;
+}
+
+static int test_write(char const *host, derive_t value) {
+  value_list_t vl = test_vl(host, value);
+  int status;
+
+  status = csv_write(plugin_get_ds("MAGIC"), &vl, NULL);
+  sfree(vl.values);
+  return status;
+}
+
+static void test_filename(char const *host, char *buffer, size_t buffer_size) {
+  value_list_t vl = test_vl(host, 0);
+
+  value_list_to_filename(buffer, buffer_size, &vl);
+  sfree(vl.values);
+}
+
+/* Returns the content of a file, or an empty string if it doesn't exist. */
+static char const *test_read(char const *filename) {
+  static char buffer[65536];
+  ssize_t len;
+
+  len = read_file_contents(filename, buffer, sizeof(buffer) - 1);
+  buffer[(len > 0) ? len : 0] = 0;
+  return buffer;
+}
+
+static char const *test_read_host(char const *host) {
+  char filename[512];
+
+  test_filename(host, filename, sizeof(filename));
+  return test_read(filename);
+}
+
+/* Removes the files written for `host', including a rotated one. */
+static void test_remove(char const *host) {
+  char filename[512];
+  char rotated[520];
+
+  test_filename(host, filename, sizeof(filename));
+  snprintf(rotated, sizeof(rotated), "%s.1", filename);
+  unlink(filename);
+  unlink(rotated);
+
+  snprintf(filename, sizeof(filename), "%s/%s/test", test_dir, host);
+  rmdir(filename);
+  snprintf(filename, sizeof(filename), "%s/%s", test_dir, host);
+  rmdir(filename);
+}
+
+DEF_TEST(flush) {
+  char expected[65536] = TEST_HEADER;
+
+  CHECK_ZERO(csv_config("MaxOpenFiles", "10"));
+
+  CHECK_ZERO(test_write("flush", 1));
+  CHECK_ZERO(test_write("flush", 2));
+  /* The lines are buffered until the file is flushed. */
+  EXPECT_EQ_STR(TEST_HEADER, test_read_host("flush"));
+  EXPECT_EQ_INT(1, files_num);
+  EXPECT_EQ_INT(strlen("1480063672.000,1\n") * 2, files_head->fill);
+
+  CHECK_ZERO(csv_flush(0, NULL, NULL));
+  EXPECT_EQ_STR(TEST_HEADER "1480063672.000,1\n"
+                            "1480063672.000,2\n",
+                test_read_host("flush"));
+  EXPECT_EQ_INT(0, files_head->fill);
+
+  /* A full buffer is written out before the next line is appended, and all
+   * lines stay in order. */
+  csv_shutdown();
+  test_remove("flush");
+  for (int i = 0; i < 500; i++) {
+    char line[64];
+
+    CHECK_ZERO(test_write("flush", i));
+    snprintf(line, sizeof(line), "1480063672.000,%d\n", i);
+    sstrncpy(expected + strlen(expected), line,
+             sizeof(expected) - strlen(expected));
+  }
+  OK(strlen(test_read_host("flush")) > strlen(TEST_HEADER));
+  OK(strlen(test_read_host("flush")) < strlen(expected));
+
+  CHECK_ZERO(csv_flush(0, NULL, NULL));
+  EXPECT_EQ_STR(expected, test_read_host("flush"));
+
+  csv_shutdown();
+  test_remove("flush");
+  return 0;
+}
+
+DEF_TEST(evict) {
+  char filename[512];
+
+  CHECK_ZERO(csv_config("MaxOpenFiles", "2"));
+
+  CHECK_ZERO(test_write("evict_a", 1));
+  CHECK_ZERO(test_write("evict_b", 2));
+  /* Makes "evict_b" the least recently used file. */
+  CHECK_ZERO(test_write("evict_a", 3));
+  CHECK_ZERO(test_write("evict_c", 4));
+
+  EXPECT_EQ_INT(2, files_num);
+  test_filename("evict_a", filename, sizeof(filename));
+  EXPECT_EQ_STR(filename, files_tail->filename);
+  test_filename("evict_c", filename, sizeof(filename));
+  EXPECT_EQ_STR(filename, files_head->filename);
+
+  /* The buffer of an evicted file is written out when it is closed. */
+  EXPECT_EQ_STR(TEST_HEADER "1480063672.000,2\n", test_read_host("evict_b"));
+  EXPECT_EQ_STR(TEST_HEADER, test_read_host("evict_a"));
+  EXPECT_EQ_STR(TEST_HEADER, test_read_host("evict_c"));
+
+  /* Writing to an evicted file opens it again. */
+  CHECK_ZERO(test_write("evict_b", 5));
+  EXPECT_EQ_INT(2, files_num);
+  EXPECT_EQ_STR(TEST_HEADER "1480063672.000,1\n"
+                            "1480063672.000,3\n",
+                test_read_host("evict_a"));
+
+  csv_shutdown();
+  EXPECT_EQ_INT(0, files_num);
+  EXPECT_EQ_STR(TEST_HEADER "1480063672.000,2\n"
+                            "1480063672.000,5\n",
+                test_read_host("evict_b"));
+  EXPECT_EQ_STR(TEST_HEADER "1480063672.000,4\n", test_read_host("evict_c"));
+
+  test_remove("evict_a");
+  test_remove("evict_b");
+  test_remove("evict_c");
+  return 0;
+}
+
+DEF_TEST(rotate) {
+  char filename[512];
+  char rotated[520];
+
+  CHECK_ZERO(csv_config("MaxOpenFiles", "10"));
+  test_filename("rotate", filename, sizeof(filename));
+  snprintf(rotated, sizeof(rotated), "%s.1", filename);
+
+  CHECK_ZERO(test_write("rotate", 1));
+  CHECK_ZERO(csv_flush(0, NULL, NULL));
+  OK(!files_head->stale);
+
+  /* Lines written before the next flush still go to the moved file, which
+   * is then marked stale. */
+  CHECK_ZERO(rename(filename, rotated));
+  CHECK_ZERO(test_write("rotate", 2));
+  CHECK_ZERO(csv_flush(0, NULL, NULL));
+  OK(files_head->stale);
+  EXPECT_EQ_STR(TEST_HEADER "1480063672.000,1\n"
+                            "1480063672.000,2\n",
+                test_read(rotated));
+
+  /* The next write creates a new file at the old path. */
+  CHECK_ZERO(test_write("rotate", 3));
+  EXPECT_EQ_INT(1, files_num);
+  OK(!files_head->stale);
+  CHECK_ZERO(csv_flush(0, NULL, NULL));
+  EXPECT_EQ_STR(TEST_HEADER "1480063672.000,3\n", test_read(filename));
+
+  /* The same happens if the file has been removed. */
+  CHECK_ZERO(unlink(filename));
+  CHECK_ZERO(csv_flush(0, NULL, NULL));
+  OK(files_head->stale);
+  CHECK_ZERO(test_write("rotate", 4));
+  CHECK_ZERO(csv_flush(0, NULL, NULL));
+  EXPECT_EQ_STR(TEST_HEADER "1480063672.000,4\n", test_read(filename));
+
+  csv_shutdown();
+  test_remove("rotate");
+  return 0;
+}
+
+int main(void) {
+  if (mkdtemp(test_dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  csv_config("DataDir", test_dir);
+
+  RUN_TEST(flush);
+  RUN_TEST(evict);
+  RUN_TEST(rotate);
+
+  rmdir(test_dir);
+  sfree(datadir);
+  END_TEST;
+}
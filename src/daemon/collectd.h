@@ -263,6 +263,9 @@
 #endif
 #endif
 
+/* Values written by format_values(), the graphite, JSON and KairosDB
+ * formatters and the csv, write_tsdb, write_sensu and write_prometheus plugins
+ * use format_double() (utils_format_number.h) and ignore GAUGE_FORMAT. */
 #ifndef GAUGE_FORMAT
 #define GAUGE_FORMAT "%.15g"
 #endif
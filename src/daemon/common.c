@@ -36,6 +36,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_cache.h"
+#include "utils_format_number.h"
 
 /* for getaddrinfo */
 #include <netdb.h>
@@ -883,9 +884,22 @@ int format_values(char *ret, size_t ret_len, /* {{{ */
 
   BUFFER_ADD("%.3f", CDTIME_T_TO_DOUBLE(vl->time));
 
+#define BUFFER_ADD_NUMBER(func, value)                                         \
+  do {                                                                         \
+    char tmp[FORMAT_NUMBER_BUFSIZE];                                           \
+    size_t len = func(tmp, value);                                             \
+    if ((offset + 1 + len) >= ret_len) {                                       \
+      sfree(rates);                                                            \
+      return -1;                                                               \
+    }                                                                          \
+    ret[offset++] = ':';                                                       \
+    memcpy(ret + offset, tmp, len + 1);                                        \
+    offset += len;                                                             \
+  } while (0)
+
   for (size_t i = 0; i < ds->ds_num; i++) {
     if (ds->ds[i].type == DS_TYPE_GAUGE)
-      BUFFER_ADD(":" GAUGE_FORMAT, vl->values[i].gauge);
+      BUFFER_ADD_NUMBER(format_double, vl->values[i].gauge);
     else if (store_rates) {
       if (rates == NULL)
         rates = uc_get_rate(ds, vl);
@@ -893,13 +907,13 @@ int format_values(char *ret, size_t ret_len, /* {{{ */
         WARNING("format_values: uc_get_rate failed.");
         return -1;
       }
-      BUFFER_ADD(":" GAUGE_FORMAT, rates[i]);
+      BUFFER_ADD_NUMBER(format_double, rates[i]);
     } else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD(":%llu", vl->values[i].counter);
+      BUFFER_ADD_NUMBER(format_uint64, (uint64_t)vl->values[i].counter);
     else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD(":%" PRIi64, vl->values[i].derive);
+      BUFFER_ADD_NUMBER(format_int64, vl->values[i].derive);
     else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD(":%" PRIu64, vl->values[i].absolute);
+      BUFFER_ADD_NUMBER(format_uint64, vl->values[i].absolute);
     else {
       ERROR("format_values: Unknown data source type: %i", ds->ds[i].type);
       sfree(rates);
@@ -907,6 +921,7 @@ int format_values(char *ret, size_t ret_len, /* {{{ */
     }
   } /* for ds->ds_num */
 
+#undef BUFFER_ADD_NUMBER
 #undef BUFFER_ADD
 
   sfree(rates);
@@ -111,6 +111,7 @@ static cf_global_option_t cf_global_options[] = {
     {"WriteQueueLimitHigh", NULL, 0, NULL},
     {"WriteQueueLimitLow", NULL, 0, NULL},
     {"Timeout", NULL, 0, "2"},
+    {"CacheHistory", NULL, 0, "0"},
     {"AutoLoadPlugin", NULL, 0, "false"},
     {"CollectInternalStats", NULL, 0, "false"},
     {"PreCacheChain", NULL, 0, "PreCache"},
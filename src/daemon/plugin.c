@@ -742,19 +742,19 @@ plugin_value_list_clone(value_list_t const *vl_orig) /* {{{ */
   return vl;
 } /* }}} value_list_t *plugin_value_list_clone */
 
-static int plugin_write_enqueue(value_list_t const *vl) /* {{{ */
+static write_queue_t *plugin_write_queue_entry(value_list_t const *vl) /* {{{ */
 {
   write_queue_t *q;
 
   q = malloc(sizeof(*q));
   if (q == NULL)
-    return ENOMEM;
+    return NULL;
   q->next = NULL;
 
   q->vl = plugin_value_list_clone(vl);
   if (q->vl == NULL) {
     sfree(q);
-    return ENOMEM;
+    return NULL;
   }
 
   /* Store context of caller (read plugin); otherwise, it would not be
@@ -762,21 +762,41 @@ static int plugin_write_enqueue(value_list_t const *vl) /* {{{ */
    * value-list later on. */
   q->ctx = plugin_get_ctx();
 
+  return q;
+} /* }}} write_queue_t *plugin_write_queue_entry */
+
+/* Appends the chain of `num' entries from `head' to `tail' to the write queue
+ * while holding the lock only once. */
+static void plugin_write_enqueue_chain(write_queue_t *head, /* {{{ */
+                                       write_queue_t *tail, long num) {
   pthread_mutex_lock(&write_lock);
 
   if (write_queue_tail == NULL) {
-    write_queue_head = q;
-    write_queue_tail = q;
-    write_queue_length = 1;
+    write_queue_head = head;
+    write_queue_tail = tail;
+    write_queue_length = num;
   } else {
-    write_queue_tail->next = q;
-    write_queue_tail = q;
-    write_queue_length += 1;
+    write_queue_tail->next = head;
+    write_queue_tail = tail;
+    write_queue_length += num;
   }
 
-  pthread_cond_signal(&write_cond);
+  if (num > 1)
+    pthread_cond_broadcast(&write_cond);
+  else
+    pthread_cond_signal(&write_cond);
   pthread_mutex_unlock(&write_lock);
+} /* }}} void plugin_write_enqueue_chain */
+
+static int plugin_write_enqueue(value_list_t const *vl) /* {{{ */
+{
+  write_queue_t *q;
 
+  q = plugin_write_queue_entry(vl);
+  if (q == NULL)
+    return ENOMEM;
+
+  plugin_write_enqueue_chain(q, q, 1);
   return 0;
 } /* }}} int plugin_write_enqueue */
 
@@ -2086,16 +2106,23 @@ static _Bool check_drop_value(void) /* {{{ */
     return 0;
 } /* }}} _Bool check_drop_value */
 
+static void plugin_count_dropped(void) /* {{{ */
+{
+  static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+  if (!record_statistics)
+    return;
+
+  pthread_mutex_lock(&statistics_lock);
+  stats_values_dropped++;
+  pthread_mutex_unlock(&statistics_lock);
+} /* }}} void plugin_count_dropped */
+
 int plugin_dispatch_values(value_list_t const *vl) {
   int status;
-  static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
 
   if (check_drop_value()) {
-    if (record_statistics) {
-      pthread_mutex_lock(&statistics_lock);
-      stats_values_dropped++;
-      pthread_mutex_unlock(&statistics_lock);
-    }
+    plugin_count_dropped();
     return 0;
   }
 
@@ -2111,6 +2138,46 @@ int plugin_dispatch_values(value_list_t const *vl) {
   return 0;
 }
 
+int plugin_dispatch_values_batch(value_list_t const *vl, /* {{{ */
+                                 size_t vl_num) {
+  write_queue_t *head = NULL;
+  write_queue_t *tail = NULL;
+  long num = 0;
+  int failed = 0;
+
+  for (size_t i = 0; i < vl_num; i++) {
+    write_queue_t *q;
+
+    if (check_drop_value()) {
+      plugin_count_dropped();
+      continue;
+    }
+
+    q = plugin_write_queue_entry(vl + i);
+    if (q == NULL) {
+      failed++;
+      continue;
+    }
+
+    if (tail == NULL)
+      head = q;
+    else
+      tail->next = q;
+    tail = q;
+    num++;
+  }
+
+  if (num > 0)
+    plugin_write_enqueue_chain(head, tail, num);
+
+  if (failed > 0)
+    ERROR("plugin_dispatch_values_batch: Failed to queue %i of %zu "
+          "value lists.",
+          failed, vl_num);
+
+  return failed;
+} /* }}} int plugin_dispatch_values_batch */
+
 __attribute__((sentinel)) int
 plugin_dispatch_multivalue(value_list_t const *template, /* {{{ */
                            _Bool store_percentage, int store_type, ...) {
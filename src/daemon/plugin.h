@@ -345,6 +345,21 @@ void plugin_log_available_writers(void);
  */
 int plugin_dispatch_values(value_list_t const *vl);
 
+/*
+ * NAME
+ *  plugin_dispatch_values_batch
+ *
+ * DESCRIPTION
+ *  Dispatches the `vl_num' value lists at `vl', like calling
+ *  `plugin_dispatch_values' for each of them. The value lists are handed to
+ *  the write threads in one go, which is considerably cheaper for callers
+ *  that receive many values at once.
+ *
+ * RETURNS
+ *  The number of value lists it failed to dispatch (zero on success).
+ */
+int plugin_dispatch_values_batch(value_list_t const *vl, size_t vl_num);
+
 /*
  * NAME
  *  plugin_dispatch_multivalue
@@ -31,6 +31,7 @@ kstat_ctl_t *kc = NULL;
 #endif /* HAVE_LIBKSTAT */
 
 char hostname_g[] = "example.com";
+cdtime_t interval_g = TIME_T_TO_CDTIME_T_STATIC(10);
 
 void plugin_set_dir(const char *dir) { /* nop */
 }
@@ -67,14 +68,76 @@ int plugin_register_shutdown(const char *name, int (*callback)(void)) {
   return ENOTSUP;
 }
 
+int plugin_register_write(const char *name, plugin_write_cb callback,
+                          user_data_t const *user_data) {
+  return ENOTSUP;
+}
+
+int plugin_register_flush(const char *name, plugin_flush_cb callback,
+                          user_data_t const *user_data) {
+  return ENOTSUP;
+}
+
 int plugin_register_data_set(const data_set_t *ds) { return ENOTSUP; }
 
+int plugin_register_log(const char *name, plugin_log_cb callback,
+                        user_data_t const *user_data) {
+  return ENOTSUP;
+}
+
+int plugin_register_notification(const char *name,
+                                 plugin_notification_cb callback,
+                                 user_data_t const *user_data) {
+  return ENOTSUP;
+}
+
+int plugin_unregister_complex_config(const char *name) { return ENOTSUP; }
+
+int plugin_unregister_init(const char *name) { return ENOTSUP; }
+
+int plugin_unregister_read(const char *name) { return ENOTSUP; }
+
+int plugin_unregister_read_group(const char *group) { return ENOTSUP; }
+
+int plugin_unregister_write(const char *name) { return ENOTSUP; }
+
+int plugin_unregister_flush(const char *name) { return ENOTSUP; }
+
+int plugin_unregister_shutdown(const char *name) { return ENOTSUP; }
+
+int plugin_unregister_data_set(const char *name) { return ENOTSUP; }
+
+int plugin_unregister_log(const char *name) { return ENOTSUP; }
+
+int plugin_unregister_notification(const char *name) { return ENOTSUP; }
+
+int plugin_write(const char *plugin, const data_set_t *ds,
+                 const value_list_t *vl) {
+  return ENOTSUP;
+}
+
+int plugin_dispatch_notification(const notification_t *notif) {
+  return ENOTSUP;
+}
+
+int plugin_notification_meta_free(notification_meta_t *n) { return ENOTSUP; }
+
 int plugin_dispatch_values(value_list_t const *vl) { return ENOTSUP; }
 
+int plugin_dispatch_values_batch(value_list_t const *vl, size_t vl_num) {
+  return (int)vl_num;
+}
+
 int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier) {
   return ENOTSUP;
 }
 
+int plugin_thread_create(pthread_t *thread, const pthread_attr_t *attr,
+                         void *(*start_routine)(void *), void *arg,
+                         char const *name) {
+  return pthread_create(thread, attr, start_routine, arg);
+}
+
 static data_source_t magic_ds[] = {{"value", DS_TYPE_DERIVE, 0.0, NAN}};
 static data_set_t magic = {"MAGIC", 1, magic_ds};
 const data_set_t *plugin_get_ds(const char *name) {
@@ -589,6 +589,32 @@ c_avl_iterator_t *c_avl_get_iterator(c_avl_tree_t *t) {
   return iter;
 } /* c_avl_iterator_t *c_avl_get_iterator */
 
+c_avl_iterator_t *c_avl_get_iterator_after(c_avl_tree_t *t, const void *key) {
+  c_avl_iterator_t *iter;
+
+  iter = c_avl_get_iterator(t);
+  if ((iter == NULL) || (key == NULL))
+    return iter;
+
+  /* Position the iterator on the largest key less than or equal to `key', so
+   * that c_avl_iterator_next() continues with its successor. If there is no
+   * such key, `node' stays NULL and the iteration starts at the smallest key.
+   */
+  for (c_avl_node_t *n = t->root; n != NULL;) {
+    int cmp = t->compare(key, n->key);
+    if (cmp < 0) {
+      n = n->left;
+    } else {
+      iter->node = n;
+      if (cmp == 0)
+        break;
+      n = n->right;
+    }
+  }
+
+  return iter;
+} /* c_avl_iterator_t *c_avl_get_iterator_after */
+
 int c_avl_iterator_next(c_avl_iterator_t *iter, void **key, void **value) {
   c_avl_node_t *n;
 
@@ -29,6 +29,7 @@
 #include "collectd.h"
 
 #include "common.h"
+#include "configfile.h"
 #include "meta_data.h"
 #include "plugin.h"
 #include "utils_avltree.h"
@@ -66,6 +67,17 @@ typedef struct cache_entry_s {
   size_t history_index; /* points to the next position to write to. */
   size_t history_length;
 
+  /*
+   * Ring buffer of the last `ring_size' rates and their times, enabled with
+   * the "CacheHistory" option. Both arrays share one allocation:
+   * `ring_values' holds `values_num' rates per point, like `history' above.
+   * `ring_index' points to the next position to write to.
+   */
+  cdtime_t *ring_times;
+  gauge_t *ring_values;
+  size_t ring_index;
+  size_t ring_num;
+
   meta_data_t *meta;
 } cache_entry_t;
 
@@ -79,6 +91,9 @@ struct uc_iter_s {
 static c_avl_tree_t *cache_tree = NULL;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Number of points kept in each entry's ring buffer; zero disables it. */
+static size_t ring_size = 0;
+
 static int cache_compare(const cache_entry_t *a, const cache_entry_t *b) {
 #if COLLECT_DEBUG
   assert((a != NULL) && (b != NULL));
@@ -110,6 +125,19 @@ static cache_entry_t *cache_alloc(size_t values_num) {
   ce->history_length = 0;
   ce->meta = NULL;
 
+  if (ring_size > 0) {
+    ce->ring_times = malloc(ring_size * (sizeof(*ce->ring_times) +
+                                         values_num * sizeof(*ce->ring_values)));
+    if (ce->ring_times == NULL) {
+      sfree(ce->values_gauge);
+      sfree(ce->values_raw);
+      sfree(ce);
+      ERROR("utils_cache: cache_alloc: malloc failed.");
+      return NULL;
+    }
+    ce->ring_values = (gauge_t *)(ce->ring_times + ring_size);
+  }
+
   return ce;
 } /* cache_entry_t *cache_alloc */
 
@@ -120,6 +148,7 @@ static void cache_free(cache_entry_t *ce) {
   sfree(ce->values_gauge);
   sfree(ce->values_raw);
   sfree(ce->history);
+  sfree(ce->ring_times);
   if (ce->meta != NULL) {
     meta_data_destroy(ce->meta);
     ce->meta = NULL;
@@ -138,6 +167,47 @@ static void uc_check_range(const data_set_t *ds, cache_entry_t *ce) {
   }
 } /* void uc_check_range */
 
+/* Appends the current rates to the ring buffer, overwriting the oldest point
+ * once it is full. `cache_lock' must be held. */
+static void uc_ring_add(cache_entry_t *ce, cdtime_t t) {
+  if (ce->ring_times == NULL)
+    return;
+
+  ce->ring_times[ce->ring_index] = t;
+  memcpy(ce->ring_values + ce->ring_index * ce->values_num, ce->values_gauge,
+         ce->values_num * sizeof(*ce->ring_values));
+
+  ce->ring_index = (ce->ring_index + 1) % ring_size;
+  if (ce->ring_num < ring_size)
+    ce->ring_num++;
+} /* void uc_ring_add */
+
+/* Returns the position of the n-th oldest point in the ring buffer. */
+static size_t uc_ring_pos(cache_entry_t const *ce, size_t n) {
+  return (ce->ring_index + ring_size - ce->ring_num + n) % ring_size;
+} /* size_t uc_ring_pos */
+
+/* Returns the number of points in the ring buffer older than `t' (or, if
+ * `inclusive' is true, not newer than `t'). Times are strictly increasing
+ * because uc_update() rejects values that are not newer than the last one. */
+static size_t uc_ring_search(cache_entry_t const *ce, cdtime_t t,
+                             _Bool inclusive) {
+  size_t lo = 0;
+  size_t hi = ce->ring_num;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    cdtime_t mid_time = ce->ring_times[uc_ring_pos(ce, mid)];
+
+    if ((mid_time < t) || (inclusive && (mid_time == t)))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+} /* size_t uc_ring_search */
+
 static int uc_insert(const data_set_t *ds, const value_list_t *vl,
                      const char *key) {
   char *key_copy;
@@ -197,6 +267,7 @@ static int uc_insert(const data_set_t *ds, const value_list_t *vl,
 
   /* Prune invalid gauge data */
   uc_check_range(ds, ce);
+  uc_ring_add(ce, vl->time);
 
   ce->last_time = vl->time;
   ce->last_update = cdtime();
@@ -218,6 +289,17 @@ int uc_init(void) {
     cache_tree =
         c_avl_create((int (*)(const void *, const void *))cache_compare);
 
+  /* The ring buffers are allocated with the entries, so the size can only be
+   * set while the cache is still empty. */
+  if (c_avl_size(cache_tree) == 0) {
+    long size = global_option_get_long("CacheHistory", 0);
+    if (size < 0) {
+      WARNING("uc_init: Ignoring invalid CacheHistory %li.", size);
+      size = 0;
+    }
+    ring_size = (size_t)size;
+  }
+
   return 0;
 } /* int uc_init */
 
@@ -398,6 +480,7 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
 
   /* Prune invalid gauge data */
   uc_check_range(ds, ce);
+  uc_ring_add(ce, vl->time);
 
   ce->last_time = vl->time;
   ce->last_update = cdtime();
@@ -638,6 +721,56 @@ int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
   return 0;
 } /* int uc_get_names */
 
+int uc_get_names_after(const char *after, char **ret_names,
+                       cdtime_t *ret_times, size_t max, size_t *ret_number) {
+  c_avl_iterator_t *iter;
+  char *key;
+  cache_entry_t *value;
+
+  size_t number = 0;
+  int status = 0;
+
+  if ((ret_names == NULL) || (ret_number == NULL))
+    return -1;
+
+  pthread_mutex_lock(&cache_lock);
+
+  iter = c_avl_get_iterator_after(cache_tree, after);
+  if (iter == NULL) {
+    pthread_mutex_unlock(&cache_lock);
+    return ENOMEM;
+  }
+
+  while ((number < max) &&
+         (c_avl_iterator_next(iter, (void *)&key, (void *)&value) == 0)) {
+    /* remove missing values when list values */
+    if (value->state == STATE_MISSING)
+      continue;
+
+    ret_names[number] = strdup(key);
+    if (ret_names[number] == NULL) {
+      status = -1;
+      break;
+    }
+    if (ret_times != NULL)
+      ret_times[number] = value->last_time;
+
+    number++;
+  } /* while (c_avl_iterator_next) */
+
+  c_avl_iterator_destroy(iter);
+  pthread_mutex_unlock(&cache_lock);
+
+  if (status != 0) {
+    for (size_t i = 0; i < number; i++)
+      sfree(ret_names[i]);
+    return -1;
+  }
+
+  *ret_number = number;
+  return 0;
+} /* int uc_get_names_after */
+
 int uc_get_state(const data_set_t *ds, const value_list_t *vl) {
   char name[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
@@ -755,6 +888,63 @@ int uc_get_history(const data_set_t *ds, const value_list_t *vl,
   return uc_get_history_by_name(name, ret_history, num_steps, num_ds);
 } /* int uc_get_history */
 
+int uc_get_history_range_by_name(const char *name, cdtime_t start,
+                                 cdtime_t end, cdtime_t **ret_times,
+                                 gauge_t **ret_values, size_t *ret_points_num,
+                                 size_t *ret_values_num) {
+  cache_entry_t *ce = NULL;
+  cdtime_t *times = NULL;
+  gauge_t *values = NULL;
+  size_t first, last;
+
+  if ((ret_times == NULL) || (ret_values == NULL) ||
+      (ret_points_num == NULL) || (ret_values_num == NULL))
+    return -EINVAL;
+
+  if (ring_size == 0)
+    return -ENOTSUP;
+
+  pthread_mutex_lock(&cache_lock);
+
+  if (c_avl_get(cache_tree, name, (void *)&ce) != 0) {
+    pthread_mutex_unlock(&cache_lock);
+    return -ENOENT;
+  }
+
+  first = uc_ring_search(ce, start, /* inclusive = */ 0);
+  last = uc_ring_search(ce, end, /* inclusive = */ 1);
+
+  if (first < last) {
+    times = malloc((last - first) * sizeof(*times));
+    values = malloc((last - first) * ce->values_num * sizeof(*values));
+    if ((times == NULL) || (values == NULL)) {
+      pthread_mutex_unlock(&cache_lock);
+      sfree(times);
+      sfree(values);
+      return -ENOMEM;
+    }
+
+    for (size_t i = first; i < last; i++) {
+      size_t pos = uc_ring_pos(ce, i);
+
+      times[i - first] = ce->ring_times[pos];
+      memcpy(values + (i - first) * ce->values_num,
+             ce->ring_values + pos * ce->values_num,
+             ce->values_num * sizeof(*values));
+    }
+  } else {
+    last = first;
+  }
+
+  *ret_values_num = ce->values_num;
+  pthread_mutex_unlock(&cache_lock);
+
+  *ret_times = times;
+  *ret_values = values;
+  *ret_points_num = last - first;
+  return 0;
+} /* int uc_get_history_range_by_name */
+
 int uc_get_hits(const data_set_t *ds, const value_list_t *vl) {
   char name[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
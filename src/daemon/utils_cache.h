@@ -48,6 +48,25 @@ value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl);
 size_t uc_get_size(void);
 int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
+/*
+ * NAME
+ *   uc_get_names_after
+ *
+ * DESCRIPTION
+ *   Like uc_get_names(), but stores at most `max' names (and times, unless
+ *   `ret_times' is NULL) in the caller's arrays, starting with the first name
+ *   sorting after `after' (or the first name, if `after' is NULL). Passing the
+ *   last name returned as `after' to the next call lists the whole cache in
+ *   chunks, without holding the cache lock while copying all of it. The names
+ *   must be freed by the caller.
+ *
+ * RETURN VALUE
+ *   Zero on success, non-zero otherwise. Fewer than `max' names are returned
+ *   only at the end of the cache.
+ */
+int uc_get_names_after(const char *after, char **ret_names,
+                       cdtime_t *ret_times, size_t max, size_t *ret_number);
+
 int uc_get_state(const data_set_t *ds, const value_list_t *vl);
 int uc_set_state(const data_set_t *ds, const value_list_t *vl, int state);
 int uc_get_hits(const data_set_t *ds, const value_list_t *vl);
@@ -59,6 +78,27 @@ int uc_get_history(const data_set_t *ds, const value_list_t *vl,
 int uc_get_history_by_name(const char *name, gauge_t *ret_history,
                            size_t num_steps, size_t num_ds);
 
+/*
+ * NAME
+ *   uc_get_history_range_by_name
+ *
+ * DESCRIPTION
+ *   Returns the rates stored in the ring buffer of the value list `name' with
+ *   a time between `start' and `end', both inclusive, oldest first. The size
+ *   of the ring buffer is set with the global "CacheHistory" option.
+ *   `ret_times' receives one time per point, `ret_values' receives
+ *   `ret_values_num' rates per point. Both must be freed by the caller and
+ *   are NULL if no points are in the range.
+ *
+ * RETURN VALUE
+ *   Zero on success, -ENOENT if there is no such value list, -ENOTSUP if the
+ *   ring buffers are disabled and another negative errno value on failure.
+ */
+int uc_get_history_range_by_name(const char *name, cdtime_t start,
+                                 cdtime_t end, cdtime_t **ret_times,
+                                 gauge_t **ret_values, size_t *ret_points_num,
+                                 size_t *ret_values_num);
+
 /*
  * Iterator interface
  */
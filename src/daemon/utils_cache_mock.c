@@ -41,3 +41,15 @@ int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
 int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
   return ENOTSUP;
 }
+
+int uc_get_names_after(const char *after, char **ret_names,
+                       cdtime_t *ret_times, size_t max, size_t *ret_number) {
+  return ENOTSUP;
+}
+
+int uc_get_history_range_by_name(const char *name, cdtime_t start,
+                                 cdtime_t end, cdtime_t **ret_times,
+                                 gauge_t **ret_values, size_t *ret_points_num,
+                                 size_t *ret_values_num) {
+  return -ENOTSUP;
+}
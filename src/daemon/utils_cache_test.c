@@ -0,0 +1,152 @@
+/**
+ * collectd - src/daemon/utils_cache_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "testing.h"
+#include "utils_cache.c" /* sic */
+
+#define TEST_RING_SIZE 5
+
+static data_set_t ds_test = {
+    .type = "test",
+    .ds_num = 1,
+    .ds = &(data_source_t){"value", DS_TYPE_GAUGE, NAN, NAN},
+};
+
+int timeout_g = 2;
+
+int plugin_dispatch_missing(const value_list_t *vl) { return ENOTSUP; }
+
+/* uc_init() reads the ring size from the configuration. */
+long global_option_get_long(const char *option, long default_value) {
+  if (strcasecmp("CacheHistory", option) == 0)
+    return TEST_RING_SIZE;
+  return default_value;
+}
+
+/* Adds the value `t' at time `t'. */
+static int test_update(int t) {
+  value_list_t vl = {
+      .values = &(value_t){.gauge = (gauge_t)t},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T(t),
+      .interval = TIME_T_TO_CDTIME_T(1),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "test",
+  };
+
+  return uc_update(&ds_test, &vl);
+}
+
+/* Returns the times of the points between `start' and `end' as a string like
+ * "3,4,5", or "-" if there are none. */
+static char const *test_range(int start, int end) {
+  static char buffer[256];
+  cdtime_t *times = NULL;
+  gauge_t *values = NULL;
+  size_t points_num = 0;
+  size_t values_num = 0;
+  int status;
+
+  status = uc_get_history_range_by_name(
+      "example.com/test/test", TIME_T_TO_CDTIME_T(start),
+      TIME_T_TO_CDTIME_T(end), &times, &values, &points_num, &values_num);
+  if (status != 0)
+    return "error";
+
+  sstrncpy(buffer, "-", sizeof(buffer));
+  for (size_t i = 0; i < points_num; i++) {
+    size_t len = (i == 0) ? 0 : strlen(buffer);
+    int t = (int)CDTIME_T_TO_TIME_T(times[i]);
+
+    snprintf(buffer + len, sizeof(buffer) - len, "%s%d", (i == 0) ? "" : ",",
+             t);
+    /* The value equals the time. */
+    if ((values_num != 1) || (values[i] != (gauge_t)t))
+      sstrncpy(buffer, "bad value", sizeof(buffer));
+  }
+
+  sfree(times);
+  sfree(values);
+  return buffer;
+}
+
+DEF_TEST(history_range) {
+  CHECK_ZERO(uc_init());
+  EXPECT_EQ_INT(TEST_RING_SIZE, ring_size);
+
+  EXPECT_EQ_INT(-ENOENT, uc_get_history_range_by_name(
+                             "example.com/test/test", 0, 0,
+                             &(cdtime_t *){NULL}, &(gauge_t *){NULL},
+                             &(size_t){0}, &(size_t){0}));
+
+  /* Partially filled: 10, 20, 30 */
+  for (int t = 10; t <= 30; t += 10)
+    CHECK_ZERO(test_update(t));
+  EXPECT_EQ_STR("10,20,30", test_range(0, 100));
+  EXPECT_EQ_STR("20", test_range(20, 20));
+  EXPECT_EQ_STR("-", test_range(31, 100));
+
+  /* Filled past the ring size: 40 ... 130 overwrite the older points, so
+   * 90 ... 130 remain. */
+  for (int t = 40; t <= 130; t += 10)
+    CHECK_ZERO(test_update(t));
+  EXPECT_EQ_STR("90,100,110,120,130", test_range(0, 1000));
+
+  /* Both ends are inclusive. */
+  EXPECT_EQ_STR("100,110,120", test_range(100, 120));
+  EXPECT_EQ_STR("100,110", test_range(95, 115));
+  EXPECT_EQ_STR("90", test_range(90, 90));
+  EXPECT_EQ_STR("130", test_range(130, 130));
+
+  /* Empty ranges: between two points, reversed, before and after the data,
+   * and before the oldest point that is still kept. */
+  EXPECT_EQ_STR("-", test_range(101, 109));
+  EXPECT_EQ_STR("-", test_range(120, 100));
+  EXPECT_EQ_STR("-", test_range(0, 89));
+  EXPECT_EQ_STR("-", test_range(131, 1000));
+  EXPECT_EQ_STR("-", test_range(10, 80));
+
+  /* Ranges reaching over either end. */
+  EXPECT_EQ_STR("90,100", test_range(0, 100));
+  EXPECT_EQ_STR("120,130", test_range(120, 1000));
+
+  /* Values that are not newer than the last one are rejected and don't end
+   * up in the ring buffer. */
+  OK(test_update(130) != 0);
+  OK(test_update(125) != 0);
+  EXPECT_EQ_STR("90,100,110,120,130", test_range(0, 1000));
+
+  /* Wrapping around more than once. */
+  for (int t = 140; t <= 250; t += 10)
+    CHECK_ZERO(test_update(t));
+  EXPECT_EQ_STR("210,220,230,240,250", test_range(0, 1000));
+  EXPECT_EQ_STR("230,240", test_range(221, 249));
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(history_range);
+
+  END_TEST;
+}
@@ -0,0 +1,68 @@
+/**
+ * collectd - src/daemon/utils_format_number.h
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *   Converts numbers to text without going through printf(3). Doubles are
+ *   printed with the fewest significant digits that parse back to the exact
+ *   same value, using the algorithm from Ulf Adams, "Ryū: fast float-to-string
+ *   conversion" (PLDI 2018).
+ **/
+
+#ifndef UTILS_FORMAT_NUMBER_H
+#define UTILS_FORMAT_NUMBER_H 1
+
+#include "collectd.h"
+
+/* Size of a buffer that can hold any number formatted by the functions below,
+ * including the terminating null byte. */
+#define FORMAT_NUMBER_BUFSIZE 32
+
+/*
+ * NAME
+ *   format_double
+ *
+ * DESCRIPTION
+ *   Writes the shortest representation of `value' that strtod(3) converts
+ *   back to `value' to `buffer', which must be at least FORMAT_NUMBER_BUFSIZE
+ *   bytes large. Like "%g", exponential notation is used for very small and
+ *   very large numbers, e.g. "0.1", "42", "1e+15" and "-1.5e-07". Non-finite
+ *   values are written as "nan", "inf" and "-inf".
+ *
+ * RETURN VALUE
+ *   The length of the string written to `buffer'.
+ */
+size_t format_double(char *buffer, double value);
+
+/*
+ * NAME
+ *   format_uint64, format_int64
+ *
+ * DESCRIPTION
+ *   Writes `value' in decimal to `buffer', which must be at least
+ *   FORMAT_NUMBER_BUFSIZE bytes large.
+ *
+ * RETURN VALUE
+ *   The length of the string written to `buffer'.
+ */
+size_t format_uint64(char *buffer, uint64_t value);
+size_t format_int64(char *buffer, int64_t value);
+
+#endif /* UTILS_FORMAT_NUMBER_H */
@@ -0,0 +1,69 @@
+/**
+ * collectd - src/daemon/utils_format_number_bench.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_format_number.h"
+
+#include <time.h>
+
+static double elapsed_ns(struct timespec const *begin) {
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return 1e9 * (double)(end.tv_sec - begin->tv_sec) +
+         (double)(end.tv_nsec - begin->tv_nsec);
+}
+
+/* Compares format_double() with snprintf(). */
+int main(void) {
+  size_t const values_num = 1000;
+  int const rounds = 100;
+  double values[values_num];
+  char buffer[FORMAT_NUMBER_BUFSIZE];
+  struct timespec begin;
+  size_t total = 0;
+  double ns_format;
+  double ns_snprintf;
+
+  for (size_t i = 0; i < values_num; i++)
+    values[i] = (i % 2) ? ((double)i) / 7.0 : ((double)(i * 1000));
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int r = 0; r < rounds; r++)
+    for (size_t i = 0; i < values_num; i++)
+      total += format_double(buffer, values[i]);
+  ns_format = elapsed_ns(&begin) / (double)(rounds * values_num);
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int r = 0; r < rounds; r++)
+    for (size_t i = 0; i < values_num; i++)
+      total += (size_t)snprintf(buffer, sizeof(buffer), GAUGE_FORMAT, values[i]);
+  ns_snprintf = elapsed_ns(&begin) / (double)(rounds * values_num);
+
+  /* Printing the total keeps the loops from being optimized away. */
+  printf("format_double: %.1f ns/value, snprintf(\"%s\"): %.1f ns/value "
+         "(%zu bytes)\n",
+         ns_format, GAUGE_FORMAT, ns_snprintf, total);
+
+  return 0;
+}
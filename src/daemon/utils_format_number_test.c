@@ -0,0 +1,204 @@
+/**
+ * collectd - src/daemon/utils_format_number_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils_format_number.h"
+
+static double bits_to_double(uint64_t bits) {
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+/* Returns the number of significant digits in the output of format_double().
+ */
+static int significant_digits(char const *str) {
+  int digits = 0;
+  int zeros = 0;
+  _Bool leading = 1;
+
+  for (char const *ptr = str; (*ptr != 0) && (*ptr != 'e'); ptr++) {
+    if ((*ptr < '0') || (*ptr > '9'))
+      continue;
+    if (leading && (*ptr == '0'))
+      continue;
+    leading = 0;
+    if (*ptr == '0') {
+      zeros++;
+    } else {
+      digits += zeros + 1;
+      zeros = 0;
+    }
+  }
+
+  return digits;
+}
+
+/* Checks that "value" is printed with as few digits as possible and that the
+ * result is parsed as the exact same value. */
+static int check_round_trip(double value) {
+  char buffer[FORMAT_NUMBER_BUFSIZE];
+  char want[64];
+  size_t len;
+  double got;
+  int digits;
+
+  len = format_double(buffer, value);
+  if (len != strlen(buffer)) {
+    printf("# format_double(%a) returned %zu for \"%s\"\n", value, len, buffer);
+    return -1;
+  }
+
+  got = strtod(buffer, NULL);
+  if (memcmp(&got, &value, sizeof(got)) != 0) {
+    printf("# format_double(%a) = \"%s\" does not round-trip\n", value, buffer);
+    return -1;
+  }
+
+  if ((value == 0) || !isfinite(value))
+    return 0;
+
+  /* The correctly rounded value with "digits" significant digits is at least
+   * as long as the shortest one. */
+  digits = significant_digits(buffer);
+  for (int precision = 1; precision < digits; precision++) {
+    snprintf(want, sizeof(want), "%.*e", precision - 1, value);
+    if (strtod(want, NULL) == value) {
+      printf("# format_double(%a) = \"%s\", but \"%s\" is shorter\n", value,
+             buffer, want);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+DEF_TEST(format_double) {
+  struct {
+    double value;
+    char const *want;
+  } cases[] = {
+      {0.0, "0"},
+      {-0.0, "-0"},
+      {1.0, "1"},
+      {42.0, "42"},
+      {-7.25, "-7.25"},
+      {0.1, "0.1"},
+      {0.1 + 0.2, "0.30000000000000004"},
+      {1.0 / 3.0, "0.3333333333333333"},
+      {100.0, "100"},
+      {123456789012345.0, "123456789012345"},
+      {1e15, "1e+15"},
+      {1e23, "1e+23"},
+      {1.5e300, "1.5e+300"},
+      {0.0001, "0.0001"},
+      {0.00012345, "0.00012345"},
+      {1e-5, "1e-05"},
+      {-1.5e-7, "-1.5e-07"},
+      {9007199254740993.0, "9.007199254740992e+15"},
+      {5e-324, "5e-324"},
+      {2.2250738585072014e-308, "2.2250738585072014e-308"},
+      {1.7976931348623157e308, "1.7976931348623157e+308"},
+      {NAN, "nan"},
+      {INFINITY, "inf"},
+      {-INFINITY, "-inf"},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    char buffer[FORMAT_NUMBER_BUFSIZE];
+
+    EXPECT_EQ_INT((int)strlen(cases[i].want),
+                  (int)format_double(buffer, cases[i].value));
+    EXPECT_EQ_STR(cases[i].want, buffer);
+  }
+
+  return 0;
+}
+
+DEF_TEST(format_integer) {
+  char buffer[FORMAT_NUMBER_BUFSIZE];
+
+  EXPECT_EQ_INT(1, format_uint64(buffer, 0));
+  EXPECT_EQ_STR("0", buffer);
+  EXPECT_EQ_INT(2, format_uint64(buffer, 42));
+  EXPECT_EQ_STR("42", buffer);
+  EXPECT_EQ_INT(20, format_uint64(buffer, UINT64_MAX));
+  EXPECT_EQ_STR("18446744073709551615", buffer);
+
+  EXPECT_EQ_INT(1, format_int64(buffer, 0));
+  EXPECT_EQ_STR("0", buffer);
+  EXPECT_EQ_INT(3, format_int64(buffer, -10));
+  EXPECT_EQ_STR("-10", buffer);
+  EXPECT_EQ_INT(19, format_int64(buffer, INT64_MAX));
+  EXPECT_EQ_STR("9223372036854775807", buffer);
+  EXPECT_EQ_INT(20, format_int64(buffer, INT64_MIN));
+  EXPECT_EQ_STR("-9223372036854775808", buffer);
+
+  return 0;
+}
+
+/* Every binary exponent with the boundary mantissas and a number of
+ * pseudo-random ones, plus all short decimal fractions. */
+DEF_TEST(round_trip) {
+  uint64_t const mantissa_mask = (UINT64_C(1) << 52) - 1;
+  uint64_t const mantissas[] = {
+      0, 1, 2, 3, mantissa_mask, mantissa_mask - 1, UINT64_C(1) << 51,
+  };
+  uint64_t state = 88172645463325252ULL;
+  int failures = 0;
+
+  for (uint64_t exponent = 0; exponent < 2047; exponent++) {
+    for (size_t i = 0; i < STATIC_ARRAY_SIZE(mantissas); i++) {
+      uint64_t bits = (exponent << 52) | mantissas[i];
+      failures += (check_round_trip(bits_to_double(bits)) != 0);
+      failures += (check_round_trip(-bits_to_double(bits)) != 0);
+    }
+
+    for (int i = 0; i < 16; i++) {
+      /* xorshift64 */
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      failures += (check_round_trip(bits_to_double(
+                       (exponent << 52) | (state & mantissa_mask))) != 0);
+    }
+  }
+
+  for (int i = 1; i < 10000; i++) {
+    failures += (check_round_trip(((double)i) / 1000.0) != 0);
+    failures += (check_round_trip(((double)i) * 1e-9) != 0);
+  }
+
+  EXPECT_EQ_INT(0, failures);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(format_double);
+  RUN_TEST(format_integer);
+  RUN_TEST(round_trip);
+
+  END_TEST;
+}
@@ -496,13 +496,18 @@ failed:
   return -1;
 } /* int fork_child }}} */
 
-static int parse_line(char *buffer) /* {{{ */
+/* PUTVAL lines are collected in `putval' and dispatched in batches, see
+ * exec_read_one(). */
+static int parse_line(cmd_putval_stream_t *putval, char *buffer) /* {{{ */
 {
-  if (strncasecmp("PUTVAL", buffer, strlen("PUTVAL")) == 0)
-    return cmd_handle_putval(stdout, buffer);
-  else if (strncasecmp("PUTNOTIF", buffer, strlen("PUTNOTIF")) == 0)
+  if (strncasecmp("PUTVAL", buffer, strlen("PUTVAL")) == 0) {
+    cmd_error_handler_t err = {cmd_error_fh, stdout};
+    return cmd_putval_stream_parse(putval, buffer, NULL, &err, NULL);
+  } else if (strncasecmp("PUTNOTIF", buffer, strlen("PUTNOTIF")) == 0) {
+    /* Keep the order of values and notifications. */
+    cmd_putval_stream_flush(putval);
     return handle_putnotif(stdout, buffer);
-  else {
+  } else {
     ERROR("exec plugin: Unable to parse command, ignoring line: \"%s\"",
           buffer);
     return -1;
@@ -515,10 +520,13 @@ static void *exec_read_one(void *arg) /* {{{ */
   int fd, fd_err, highest_fd;
   fd_set fdset, copy;
   int status;
-  char buffer[1200]; /* if not completely read */
+  char buffer[16384]; /* if not completely read */
   char buffer_err[1024];
   char *pbuffer = buffer;
   char *pbuffer_err = buffer_err;
+  cmd_putval_stream_t putval;
+
+  cmd_putval_stream_init(&putval);
 
   status = fork_child(pl, NULL, &fd, &fd_err);
   if (status < 0) {
@@ -574,10 +582,13 @@ static void *exec_read_one(void *arg) /* {{{ */
         if (*(pnl - 1) == '\r')
           *(pnl - 1) = '\0';
 
-        parse_line(pbuffer);
+        parse_line(&putval, pbuffer);
 
         pbuffer = ++pnl;
       }
+      /* Dispatch the values of all complete lines read so far. */
+      cmd_putval_stream_flush(&putval);
+
       /* not completely read ? */
       if (pbuffer - buffer < len) {
         len -= pbuffer - buffer;
@@ -636,6 +647,8 @@ static void *exec_read_one(void *arg) /* {{{ */
     copy = fdset;
   }
 
+  cmd_putval_stream_destroy(&putval);
+
   DEBUG("exec plugin: exec_read_one: Waiting for `%s' to exit.", pl->exec);
   if (waitpid(pl->pid, &status, 0) > 0)
     pl->status = status;
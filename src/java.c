@@ -63,6 +63,7 @@ typedef struct java_plugin_class_s java_plugin_class_t;
 #define CB_TYPE_NOTIFICATION 8
 #define CB_TYPE_MATCH 9
 #define CB_TYPE_TARGET 10
+#define CB_TYPE_WRITE_BATCH 11
 struct cjni_callback_info_s /* {{{ */
 {
   char *name;
@@ -74,6 +75,57 @@ struct cjni_callback_info_s /* {{{ */
 typedef struct cjni_callback_info_s cjni_callback_info_t;
 /* }}} */
 
+/* Batched write callbacks pack value lists into a byte buffer, which is
+ * passed to Java as a direct ByteBuffer in a single call. The layout is
+ * described in bindings/java/org/collectd/api/ValueListBatch.java. */
+struct cjni_batch_buffer_s /* {{{ */
+{
+  char *data;
+  size_t data_len;
+  size_t data_size;
+  size_t entries_num;
+
+  /* Identifier of the previous value list. Repeated strings are not copied. */
+  char last[5][DATA_MAX_NAME_LEN];
+
+  /* Direct ByteBuffer wrapping `data'. Recreated when `data' has moved. */
+  jobject o_buffer;
+  char *o_buffer_data;
+  size_t o_buffer_size;
+};
+typedef struct cjni_batch_buffer_s cjni_batch_buffer_t;
+/* }}} */
+
+struct cjni_batch_s /* {{{ */
+{
+  cjni_callback_info_t *cbi;
+  size_t size;
+  cdtime_t timeout;
+
+  /* `lock' protects `active', `first_time', `refcount' and the statistics.
+   * `flush_lock' serializes calls into Java and protects `spare'. The
+   * buffers are swapped when flushing so that writers don't wait for Java. */
+  pthread_mutex_t lock;
+  pthread_mutex_t flush_lock;
+  cjni_batch_buffer_t active;
+  cjni_batch_buffer_t spare;
+  cdtime_t first_time;
+
+  /* The batch is registered as both, a write and a flush callback. */
+  int refcount;
+
+  /* Number of calls into Java, value lists passed and time spent in Java. */
+  derive_t calls;
+  derive_t values;
+  cdtime_t latency;
+  derive_t calls_reported;
+  cdtime_t latency_reported;
+
+  struct cjni_batch_s *next;
+};
+typedef struct cjni_batch_s cjni_batch_t;
+/* }}} */
+
 /*
  * Global variables
  */
@@ -95,6 +147,11 @@ static pthread_mutex_t java_callbacks_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static oconfig_item_t *config_block = NULL;
 
+/* List of batched write callbacks. */
+static cjni_batch_t *cjni_batches = NULL;
+static pthread_mutex_t cjni_batches_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Bool report_stats = 0;
+
 /*
  * Prototypes
  *
@@ -113,6 +170,11 @@ static int cjni_write(const data_set_t *ds, const value_list_t *vl,
                       user_data_t *ud);
 static int cjni_flush(cdtime_t timeout, const char *identifier,
                       user_data_t *ud);
+static int cjni_write_batch(const data_set_t *ds, const value_list_t *vl,
+                            user_data_t *ud);
+static int cjni_flush_batch(cdtime_t timeout, const char *identifier,
+                            user_data_t *ud);
+static void cjni_batch_destroy(void *arg);
 static void cjni_log(int severity, const char *message, user_data_t *ud);
 static int cjni_notification(const notification_t *n, user_data_t *ud);
 
@@ -1359,6 +1421,59 @@ static jint JNICALL cjni_api_register_flush(JNIEnv *jvm_env, /* {{{ */
   return 0;
 } /* }}} jint cjni_api_register_flush */
 
+static jint JNICALL cjni_api_register_write_batch( /* {{{ */
+    JNIEnv *jvm_env, jobject this, jobject o_name, jobject o_write,
+    jint size, jdouble timeout) {
+  cjni_callback_info_t *cbi;
+  cjni_batch_t *b;
+
+  if (size < 1) {
+    ERROR("java plugin: cjni_api_register_write_batch: "
+          "The batch size must be positive.");
+    return -1;
+  }
+
+  cbi = cjni_callback_info_create(jvm_env, o_name, o_write,
+                                  CB_TYPE_WRITE_BATCH);
+  if (cbi == NULL)
+    return -1;
+
+  b = calloc(1, sizeof(*b));
+  if (b == NULL) {
+    ERROR("java plugin: cjni_api_register_write_batch: calloc failed.");
+    cjni_callback_info_destroy(cbi);
+    return -1;
+  }
+
+  b->cbi = cbi;
+  b->size = (size_t)size;
+  b->timeout =
+      (timeout < 0) ? plugin_get_interval() : DOUBLE_TO_CDTIME_T(timeout);
+  pthread_mutex_init(&b->lock, /* attr = */ NULL);
+  pthread_mutex_init(&b->flush_lock, /* attr = */ NULL);
+  b->refcount = 2;
+
+  pthread_mutex_lock(&cjni_batches_lock);
+  b->next = cjni_batches;
+  cjni_batches = b;
+  pthread_mutex_unlock(&cjni_batches_lock);
+
+  DEBUG("java plugin: Registering new batched write callback: %s", cbi->name);
+
+  plugin_register_write(cbi->name, cjni_write_batch,
+                        &(user_data_t){
+                            .data = b, .free_func = cjni_batch_destroy,
+                        });
+  plugin_register_flush(cbi->name, cjni_flush_batch,
+                        &(user_data_t){
+                            .data = b, .free_func = cjni_batch_destroy,
+                        });
+
+  (*jvm_env)->DeleteLocalRef(jvm_env, o_write);
+
+  return 0;
+} /* }}} jint cjni_api_register_write_batch */
+
 static jint JNICALL cjni_api_register_shutdown(JNIEnv *jvm_env, /* {{{ */
                                                jobject this, jobject o_name,
                                                jobject o_shutdown) {
@@ -1532,6 +1647,10 @@ static JNINativeMethod jni_api_functions[] = /* {{{ */
          "(Ljava/lang/String;Lorg/collectd/api/CollectdWriteInterface;)I",
          cjni_api_register_write},
 
+        {"registerWriteBatch", "(Ljava/lang/String;Lorg/collectd/api/"
+                               "CollectdWriteBatchInterface;ID)I",
+         cjni_api_register_write_batch},
+
         {"registerFlush",
          "(Ljava/lang/String;Lorg/collectd/api/CollectdFlushInterface;)I",
          cjni_api_register_flush},
@@ -1599,6 +1718,11 @@ cjni_callback_info_create(JNIEnv *jvm_env, /* {{{ */
     method_signature = "(Lorg/collectd/api/ValueList;)I";
     break;
 
+  case CB_TYPE_WRITE_BATCH:
+    method_name = "writeBatch";
+    method_signature = "(Ljava/nio/ByteBuffer;I)I";
+    break;
+
   case CB_TYPE_FLUSH:
     method_name = "flush";
     method_signature = "(Ljava/lang/Number;Ljava/lang/String;)I";
@@ -2177,6 +2301,12 @@ static int cjni_config_perform(oconfig_item_t *ci) /* {{{ */
         success++;
       else
         errors++;
+    } else if (strcasecmp("ReportStats", child->key) == 0) {
+      status = cf_util_get_boolean(child, &report_stats);
+      if (status == 0)
+        success++;
+      else
+        errors++;
     } else {
       WARNING("java plugin: Option `%s' not allowed here.", child->key);
       errors++;
@@ -2402,6 +2532,352 @@ static int cjni_flush(cdtime_t timeout, const char *identifier, /* {{{ */
   return ret_status;
 } /* }}} int cjni_flush */
 
+/* Makes sure `len' more bytes fit into the buffer. */
+static int cjni_batch_buffer_reserve(cjni_batch_buffer_t *buf, /* {{{ */
+                                     size_t len) {
+  size_t size;
+  char *tmp;
+
+  if ((buf->data_len + len) <= buf->data_size)
+    return 0;
+
+  size = (buf->data_size == 0) ? 4096 : buf->data_size;
+  while (size < (buf->data_len + len))
+    size *= 2;
+
+  tmp = realloc(buf->data, size);
+  if (tmp == NULL)
+    return ENOMEM;
+  buf->data = tmp;
+  buf->data_size = size;
+
+  return 0;
+} /* }}} int cjni_batch_buffer_reserve */
+
+/* Packs a value list into the buffer. See ValueListBatch.java. */
+static int cjni_batch_buffer_append(cjni_batch_buffer_t *buf, /* {{{ */
+                                    const data_set_t *ds,
+                                    const value_list_t *vl) {
+  char const *names[5] = {vl->host, vl->plugin, vl->plugin_instance,
+                          vl->type, vl->type_instance};
+  int32_t values_num = (int32_t)vl->values_len;
+  int64_t time_ms = (int64_t)CDTIME_T_TO_MS(vl->time);
+  int64_t interval_ms = (int64_t)CDTIME_T_TO_MS(vl->interval);
+  char *ptr;
+  int status;
+
+  status = cjni_batch_buffer_reserve(
+      buf, sizeof(values_num) + sizeof(time_ms) + sizeof(interval_ms) +
+               STATIC_ARRAY_SIZE(names) * (sizeof(int16_t) + DATA_MAX_NAME_LEN) +
+               vl->values_len * (sizeof(int8_t) + sizeof(int64_t)));
+  if (status != 0)
+    return status;
+
+  ptr = buf->data + buf->data_len;
+  memcpy(ptr, &values_num, sizeof(values_num));
+  ptr += sizeof(values_num);
+  memcpy(ptr, &time_ms, sizeof(time_ms));
+  ptr += sizeof(time_ms);
+  memcpy(ptr, &interval_ms, sizeof(interval_ms));
+  ptr += sizeof(interval_ms);
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(names); i++) {
+    int16_t len = -1;
+
+    if ((buf->entries_num == 0) || (strcmp(names[i], buf->last[i]) != 0)) {
+      len = (int16_t)strlen(names[i]);
+      sstrncpy(buf->last[i], names[i], sizeof(buf->last[i]));
+    }
+
+    memcpy(ptr, &len, sizeof(len));
+    ptr += sizeof(len);
+    if (len > 0) {
+      memcpy(ptr, names[i], (size_t)len);
+      ptr += len;
+    }
+  }
+
+  for (size_t i = 0; i < vl->values_len; i++) {
+    int8_t type = (int8_t)ds->ds[i].type;
+    int64_t value;
+
+    memcpy(ptr, &type, sizeof(type));
+    ptr += sizeof(type);
+
+    if (type == DS_TYPE_GAUGE) {
+      double gauge = (double)vl->values[i].gauge;
+      memcpy(ptr, &gauge, sizeof(gauge));
+    } else {
+      if (type == DS_TYPE_COUNTER)
+        value = (int64_t)vl->values[i].counter;
+      else if (type == DS_TYPE_DERIVE)
+        value = (int64_t)vl->values[i].derive;
+      else
+        value = (int64_t)vl->values[i].absolute;
+      memcpy(ptr, &value, sizeof(value));
+    }
+    ptr += sizeof(value);
+  }
+
+  buf->data_len = (size_t)(ptr - buf->data);
+  buf->entries_num++;
+  return 0;
+} /* }}} int cjni_batch_buffer_append */
+
+/* Releases the ByteBuffer wrapping the buffer's data. */
+static void cjni_batch_buffer_unref(JNIEnv *jvm_env, /* {{{ */
+                                    cjni_batch_buffer_t *buf) {
+  if (buf->o_buffer != NULL)
+    (*jvm_env)->DeleteGlobalRef(jvm_env, buf->o_buffer);
+  buf->o_buffer = NULL;
+  buf->o_buffer_data = NULL;
+  buf->o_buffer_size = 0;
+} /* }}} void cjni_batch_buffer_unref */
+
+/* Passes all buffered value lists to Java with a single call. */
+static int cjni_batch_flush(cjni_batch_t *b) /* {{{ */
+{
+  cjni_batch_buffer_t tmp;
+  cjni_batch_buffer_t *buf = &b->spare;
+  JNIEnv *jvm_env;
+  cdtime_t start;
+  cdtime_t latency;
+  int status;
+
+  pthread_mutex_lock(&b->flush_lock);
+
+  pthread_mutex_lock(&b->lock);
+  tmp = b->active;
+  b->active = b->spare;
+  b->spare = tmp;
+  pthread_mutex_unlock(&b->lock);
+
+  if (buf->entries_num == 0) {
+    pthread_mutex_unlock(&b->flush_lock);
+    return 0;
+  }
+
+  status = -1;
+  if (jvm == NULL) {
+    WARNING("java plugin: %s: The JVM is gone, dropping %zu value lists.",
+            b->cbi->name, buf->entries_num);
+    goto out;
+  }
+
+  jvm_env = cjni_thread_attach();
+  if (jvm_env == NULL)
+    goto out;
+
+  /* The ByteBuffer is reused until the data is reallocated. */
+  if ((buf->o_buffer_data != buf->data) ||
+      (buf->o_buffer_size != buf->data_size)) {
+    jobject o_buffer;
+
+    cjni_batch_buffer_unref(jvm_env, buf);
+
+    o_buffer = (*jvm_env)->NewDirectByteBuffer(jvm_env, buf->data,
+                                               (jlong)buf->data_size);
+    if (o_buffer == NULL) {
+      ERROR("java plugin: %s: NewDirectByteBuffer failed.", b->cbi->name);
+      cjni_thread_detach();
+      goto out;
+    }
+
+    buf->o_buffer = (*jvm_env)->NewGlobalRef(jvm_env, o_buffer);
+    (*jvm_env)->DeleteLocalRef(jvm_env, o_buffer);
+    if (buf->o_buffer == NULL) {
+      ERROR("java plugin: %s: NewGlobalRef failed.", b->cbi->name);
+      cjni_thread_detach();
+      goto out;
+    }
+    buf->o_buffer_data = buf->data;
+    buf->o_buffer_size = buf->data_size;
+  }
+
+  start = cdtime();
+  status = (*jvm_env)->CallIntMethod(jvm_env, b->cbi->object, b->cbi->method,
+                                     buf->o_buffer, (jint)buf->entries_num);
+  latency = cdtime() - start;
+
+  if ((*jvm_env)->ExceptionCheck(jvm_env)) {
+    ERROR("java plugin: %s: The writeBatch method threw an exception.",
+          b->cbi->name);
+    (*jvm_env)->ExceptionDescribe(jvm_env);
+    (*jvm_env)->ExceptionClear(jvm_env);
+    status = -1;
+  }
+
+  cjni_thread_detach();
+
+  pthread_mutex_lock(&b->lock);
+  b->calls++;
+  b->values += (derive_t)buf->entries_num;
+  b->latency += latency;
+  pthread_mutex_unlock(&b->lock);
+
+out:
+  buf->entries_num = 0;
+  buf->data_len = 0;
+  pthread_mutex_unlock(&b->flush_lock);
+  return status;
+} /* }}} int cjni_batch_flush */
+
+/* Buffers the value list of a CB_TYPE_WRITE_BATCH callback. */
+static int cjni_write_batch(const data_set_t *ds, /* {{{ */
+                            const value_list_t *vl, user_data_t *ud) {
+  cjni_batch_t *b;
+  cdtime_t now = cdtime();
+  _Bool flush;
+  int status;
+
+  if ((ud == NULL) || (ud->data == NULL)) {
+    ERROR("java plugin: cjni_write_batch: Invalid user data.");
+    return -1;
+  }
+  b = ud->data;
+
+  pthread_mutex_lock(&b->lock);
+  if (b->active.entries_num == 0)
+    b->first_time = now;
+  status = cjni_batch_buffer_append(&b->active, ds, vl);
+  flush = (b->active.entries_num >= b->size) ||
+          ((b->timeout != 0) && ((now - b->first_time) >= b->timeout));
+  pthread_mutex_unlock(&b->lock);
+
+  if (status != 0) {
+    ERROR("java plugin: %s: Buffering the values failed.", b->cbi->name);
+    return status;
+  }
+
+  if (flush)
+    cjni_batch_flush(b);
+  return 0;
+} /* }}} int cjni_write_batch */
+
+/* Passes the buffer of a CB_TYPE_WRITE_BATCH callback to Java if its oldest
+ * value list is older than `timeout'. */
+static int cjni_flush_batch(cdtime_t timeout, /* {{{ */
+                            const char *identifier, user_data_t *ud) {
+  cjni_batch_t *b;
+  _Bool flush;
+
+  if ((ud == NULL) || (ud->data == NULL)) {
+    ERROR("java plugin: cjni_flush_batch: Invalid user data.");
+    return -1;
+  }
+  b = ud->data;
+
+  pthread_mutex_lock(&b->lock);
+  flush = (b->active.entries_num > 0) &&
+          ((timeout == 0) || ((cdtime() - b->first_time) >= timeout));
+  pthread_mutex_unlock(&b->lock);
+
+  if (!flush)
+    return 0;
+  return cjni_batch_flush(b);
+} /* }}} int cjni_flush_batch */
+
+/* Called for both, the write and the flush callback. The second call flushes
+ * the remaining value lists and frees the batch. */
+static void cjni_batch_destroy(void *arg) /* {{{ */
+{
+  cjni_batch_t *b = arg;
+  int refcount;
+
+  if (b == NULL)
+    return;
+
+  pthread_mutex_lock(&b->lock);
+  refcount = --b->refcount;
+  pthread_mutex_unlock(&b->lock);
+  if (refcount > 0)
+    return;
+
+  cjni_batch_flush(b);
+
+  pthread_mutex_lock(&cjni_batches_lock);
+  for (cjni_batch_t **ptr = &cjni_batches; *ptr != NULL;
+       ptr = &(*ptr)->next) {
+    if (*ptr == b) {
+      *ptr = b->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&cjni_batches_lock);
+
+  /* The global references are gone with the JVM. */
+  if (jvm != NULL) {
+    JNIEnv *jvm_env = cjni_thread_attach();
+    if (jvm_env != NULL) {
+      cjni_batch_buffer_unref(jvm_env, &b->active);
+      cjni_batch_buffer_unref(jvm_env, &b->spare);
+      cjni_thread_detach();
+    }
+  }
+
+  sfree(b->active.data);
+  sfree(b->spare.data);
+  cjni_callback_info_destroy(b->cbi);
+  pthread_mutex_destroy(&b->lock);
+  pthread_mutex_destroy(&b->flush_lock);
+  sfree(b);
+} /* }}} void cjni_batch_destroy */
+
+/* Passes everything buffered by batched write callbacks to Java. Called before
+ * the JVM is destroyed. */
+static void cjni_batch_flush_all(void) /* {{{ */
+{
+  pthread_mutex_lock(&cjni_batches_lock);
+  for (cjni_batch_t *b = cjni_batches; b != NULL; b = b->next)
+    cjni_batch_flush(b);
+  pthread_mutex_unlock(&cjni_batches_lock);
+} /* }}} void cjni_batch_flush_all */
+
+static void cjni_submit_stat(const char *plugin_instance, /* {{{ */
+                             const char *type, value_t value) {
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "java", sizeof(vl.plugin));
+  sstrncpy(vl.plugin_instance, plugin_instance, sizeof(vl.plugin_instance));
+  sstrncpy(vl.type, type, sizeof(vl.type));
+
+  plugin_dispatch_values(&vl);
+} /* }}} void cjni_submit_stat */
+
+/* Reports the number of calls into Java, the number of value lists passed and
+ * the average time per call of all batched write callbacks. */
+static int cjni_read_stats(void) /* {{{ */
+{
+  pthread_mutex_lock(&cjni_batches_lock);
+  for (cjni_batch_t *b = cjni_batches; b != NULL; b = b->next) {
+    derive_t calls;
+    derive_t values;
+    gauge_t latency = NAN;
+
+    pthread_mutex_lock(&b->lock);
+    calls = b->calls;
+    values = b->values;
+    if (calls > b->calls_reported)
+      latency = CDTIME_T_TO_DOUBLE(b->latency - b->latency_reported) /
+                (gauge_t)(calls - b->calls_reported);
+    b->calls_reported = calls;
+    b->latency_reported = b->latency;
+    pthread_mutex_unlock(&b->lock);
+
+    cjni_submit_stat(b->cbi->name, "total_requests",
+                     (value_t){.derive = calls});
+    cjni_submit_stat(b->cbi->name, "total_values",
+                     (value_t){.derive = values});
+    cjni_submit_stat(b->cbi->name, "response_time",
+                     (value_t){.gauge = latency});
+  }
+  pthread_mutex_unlock(&cjni_batches_lock);
+
+  return 0;
+} /* }}} int cjni_read_stats */
+
 /* Call the CB_TYPE_LOG callback pointed to by the `user_data_t' pointer. */
 static void cjni_log(int severity, const char *message, /* {{{ */
                      user_data_t *ud) {
@@ -2749,6 +3225,9 @@ static int cjni_shutdown(void) /* {{{ */
   if (jvm == NULL)
     return 0;
 
+  /* Pass on what batched write callbacks still hold while the JVM exists. */
+  cjni_batch_flush_all();
+
   jvm_env = NULL;
   args.version = JNI_VERSION_1_2;
 
@@ -2831,6 +3310,10 @@ static int cjni_init(void) /* {{{ */
   cjni_init_plugins(jvm_env);
 
   cjni_thread_detach();
+
+  if (report_stats)
+    plugin_register_read("java", cjni_read_stats);
+
   return 0;
 } /* }}} int cjni_init */
 
@@ -34,6 +34,7 @@
 
 #include "collectd/lcc_features.h"
 
+#include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
 #include <math.h>
@@ -94,12 +95,16 @@
     snprintf((c)->errbuf, sizeof((c)->errbuf), __VA_ARGS__);                   \
   } while (0)
 
+/* Maximum length of a batched GETVAL request sent by lcc_getvals. */
+#define LCC_GETVALS_MAX_LINE 65536
+
 /*
  * Types
  */
 struct lcc_connection_s {
   FILE *fh;
   char errbuf[2048];
+  int framing;
 };
 
 struct lcc_response_s {
@@ -256,16 +261,142 @@ static int lcc_send(lcc_connection_t *c, const char *command) /* {{{ */
 
   lcc_tracef("send:    --> %s\n", command);
 
-  status = fprintf(c->fh, "%s\r\n", command);
-  if (status < 0) {
-    lcc_set_errno(c, errno);
-    return -1;
+  if (c->framing == LCC_FRAMING_BINARY) {
+    size_t command_len = strlen(command);
+    uint32_t len = htonl((uint32_t)command_len);
+
+    if ((fwrite(&len, sizeof(len), 1, c->fh) != 1) ||
+        (fwrite(command, 1, command_len, c->fh) != command_len)) {
+      lcc_set_errno(c, errno);
+      return -1;
+    }
+  } else {
+    status = fprintf(c->fh, "%s\r\n", command);
+    if (status < 0) {
+      lcc_set_errno(c, errno);
+      return -1;
+    }
   }
   fflush(c->fh);
 
   return 0;
 } /* }}} int lcc_send */
 
+/* Reads the frames of a response up to the empty frame that ends it and
+ * splits it into the status line and the following lines. */
+static int lcc_receive_frames(lcc_connection_t *c, /* {{{ */
+                              lcc_response_t *ret_res) {
+  lcc_response_t res = {0};
+  char *data = NULL;
+  size_t data_len = 0;
+  size_t lines_size = 0;
+  char *line;
+  char *next;
+  char *ptr;
+
+  errno = 0;
+  while (42) {
+    uint32_t len;
+    char *tmp;
+
+    if (fread(&len, sizeof(len), 1, c->fh) != 1) {
+      lcc_set_errno(c, (errno != 0) ? errno : EILSEQ);
+      free(data);
+      return -1;
+    }
+    len = ntohl(len);
+    if (len == 0)
+      break;
+
+    tmp = realloc(data, data_len + len + 1);
+    if (tmp == NULL) {
+      lcc_set_errno(c, ENOMEM);
+      free(data);
+      return -1;
+    }
+    data = tmp;
+
+    if (fread(data + data_len, 1, len, c->fh) != len) {
+      lcc_set_errno(c, (errno != 0) ? errno : EILSEQ);
+      free(data);
+      return -1;
+    }
+    data_len += len;
+  }
+
+  if (data == NULL) {
+    lcc_set_errno(c, EILSEQ);
+    return -1;
+  }
+  data[data_len] = 0;
+
+  /* The first line contains the status and a message. */
+  line = data;
+  next = strchr(line, '\n');
+  if (next != NULL)
+    *(next++) = 0;
+  lcc_chomp(line);
+  lcc_tracef("receive: <-- %s\n", line);
+
+  ptr = NULL;
+  errno = 0;
+  res.status = (int)strtol(line, &ptr, 0);
+  if ((errno != 0) || (ptr == line)) {
+    lcc_set_errno(c, errno);
+    free(data);
+    return -1;
+  }
+
+  while ((*ptr == ' ') || (*ptr == '\t'))
+    ptr++;
+  strncpy(res.message, ptr, sizeof(res.message));
+  res.message[sizeof(res.message) - 1] = 0;
+
+  /* Errors have no lines. Otherwise, the lines end with the response rather
+   * than after the number given by the status. */
+  if (res.status < 0) {
+    free(data);
+    memcpy(ret_res, &res, sizeof(res));
+    return 0;
+  }
+  res.status = 0;
+
+  while ((next != NULL) && (*next != 0)) {
+    line = next;
+    next = strchr(line, '\n');
+    if (next != NULL)
+      *(next++) = 0;
+    lcc_chomp(line);
+    lcc_tracef("receive: <-- %s\n", line);
+
+    if (res.lines_num >= lines_size) {
+      size_t new_size = (lines_size == 0) ? 16 : 2 * lines_size;
+      char **tmp = realloc(res.lines, new_size * sizeof(*res.lines));
+      if (tmp == NULL) {
+        lcc_set_errno(c, ENOMEM);
+        lcc_response_free(&res);
+        free(data);
+        return -1;
+      }
+      res.lines = tmp;
+      lines_size = new_size;
+    }
+
+    res.lines[res.lines_num] = strdup(line);
+    if (res.lines[res.lines_num] == NULL) {
+      lcc_set_errno(c, ENOMEM);
+      lcc_response_free(&res);
+      free(data);
+      return -1;
+    }
+    res.lines_num++;
+  }
+
+  free(data);
+  memcpy(ret_res, &res, sizeof(res));
+  return 0;
+} /* }}} int lcc_receive_frames */
+
 static int lcc_receive(lcc_connection_t *c, /* {{{ */
                        lcc_response_t *ret_res) {
   lcc_response_t res = {0};
@@ -273,6 +404,9 @@ static int lcc_receive(lcc_connection_t *c, /* {{{ */
   char buffer[4096];
   size_t i;
 
+  if (c->framing == LCC_FRAMING_BINARY)
+    return lcc_receive_frames(c, ret_res);
+
   /* Read the first line, containing the status and a message */
   ptr = fgets(buffer, sizeof(buffer), c->fh);
   if (ptr == NULL) {
@@ -579,6 +713,40 @@ int lcc_disconnect(lcc_connection_t *c) /* {{{ */
   return 0;
 } /* }}} int lcc_disconnect */
 
+int lcc_set_framing(lcc_connection_t *c, int framing) /* {{{ */
+{
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL)
+    return -1;
+
+  if ((framing != LCC_FRAMING_TEXT) && (framing != LCC_FRAMING_BINARY)) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  status = lcc_sendreceive(c, (framing == LCC_FRAMING_BINARY)
+                                  ? "FRAMING binary"
+                                  : "FRAMING text",
+                           &res);
+  if (status != 0)
+    return status;
+
+  if (res.status != 0) {
+    LCC_SET_ERRSTR(c, "Server error: %s", res.message);
+    lcc_response_free(&res);
+    return -1;
+  }
+
+  /* The response was sent in the old mode, the next request uses the new
+   * one. */
+  c->framing = framing;
+
+  lcc_response_free(&res);
+  return 0;
+} /* }}} int lcc_set_framing */
+
 int lcc_getval(lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
                size_t *ret_values_num, gauge_t **ret_values,
                char ***ret_values_names) {
@@ -698,8 +866,355 @@ int lcc_getval(lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   lcc_response_free(&res);
 
   return 0;
+#undef BAIL_OUT
 } /* }}} int lcc_getval */
 
+/* lcc_getvals_parse: Parses one line of a batched GETVAL response, i.e. an
+ * identifier followed by zero or more "<name>=<value>" pairs. */
+static int lcc_getvals_parse(lcc_connection_t *c, char *line, /* {{{ */
+                             size_t *ret_values_num, gauge_t **ret_values,
+                             char ***ret_values_names) {
+  char *ptr = line;
+  size_t values_num = 0;
+  gauge_t *values = NULL;
+  char **values_names = NULL;
+  int status = 0;
+
+  /* Skip the identifier, which may be quoted. */
+  if (*ptr == '"') {
+    for (ptr++; (*ptr != 0) && (*ptr != '"'); ptr++)
+      if ((ptr[0] == '\\') && (ptr[1] != 0))
+        ptr++;
+    if (*ptr != '"') {
+      lcc_set_errno(c, EILSEQ);
+      return -1;
+    }
+    ptr++;
+  } else {
+    while ((*ptr != ' ') && (*ptr != 0))
+      ptr++;
+  }
+
+  for (char *tmp = ptr; *tmp != 0; tmp++)
+    if (*tmp == '=')
+      values_num++;
+
+  if (values_num > 0) {
+    values = malloc(values_num * sizeof(*values));
+    if (values == NULL) {
+      lcc_set_errno(c, ENOMEM);
+      return -1;
+    }
+    if (ret_values_names != NULL) {
+      values_names = calloc(values_num, sizeof(*values_names));
+      if (values_names == NULL) {
+        free(values);
+        lcc_set_errno(c, ENOMEM);
+        return -1;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < values_num; i++) {
+    char *key;
+    char *value;
+    char *endptr = NULL;
+
+    while (*ptr == ' ')
+      ptr++;
+    key = ptr;
+    value = strchr(key, '=');
+    *value = 0;
+    value++;
+
+    errno = 0;
+    values[i] = strtod(value, &endptr);
+    if ((endptr == value) || (errno != 0) ||
+        ((*endptr != ' ') && (*endptr != 0))) {
+      status = EILSEQ;
+      break;
+    }
+    ptr = endptr;
+
+    if (values_names != NULL) {
+      values_names[i] = strdup(key);
+      if (values_names[i] == NULL) {
+        status = ENOMEM;
+        break;
+      }
+    }
+  }
+
+  if (status != 0) {
+    free(values);
+    if (values_names != NULL) {
+      for (size_t i = 0; i < values_num; i++)
+        free(values_names[i]);
+      free(values_names);
+    }
+    lcc_set_errno(c, status);
+    return -1;
+  }
+
+  *ret_values_num = values_num;
+  *ret_values = values;
+  if (ret_values_names != NULL)
+    *ret_values_names = values_names;
+  return 0;
+} /* }}} int lcc_getvals_parse */
+
+int lcc_getvals(lcc_connection_t *c, /* {{{ */
+                const lcc_identifier_t *idents, size_t idents_num,
+                size_t *ret_values_num, gauge_t **ret_values,
+                char ***ret_values_names) {
+  char *command;
+  size_t done = 0;
+  int status = 0;
+
+  if (c == NULL)
+    return -1;
+
+  if ((idents == NULL) || (ret_values_num == NULL) || (ret_values == NULL)) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  for (size_t i = 0; i < idents_num; i++) {
+    ret_values_num[i] = 0;
+    ret_values[i] = NULL;
+    if (ret_values_names != NULL)
+      ret_values_names[i] = NULL;
+  }
+
+  command = malloc(LCC_GETVALS_MAX_LINE);
+  if (command == NULL) {
+    lcc_set_errno(c, ENOMEM);
+    return -1;
+  }
+
+  while ((status == 0) && (done < idents_num)) {
+    size_t batch_num = 0;
+    size_t command_len;
+    lcc_response_t res;
+
+    /* Add as many identifiers as fit into one request. */
+    strcpy(command, "GETVAL -m");
+    command_len = strlen(command);
+    while (done + batch_num < idents_num) {
+      char ident_str[6 * LCC_NAME_LEN];
+      char ident_esc[12 * LCC_NAME_LEN];
+      size_t ident_len;
+
+      status = lcc_identifier_to_string(c, ident_str, sizeof(ident_str),
+                                        idents + done + batch_num);
+      if (status != 0)
+        break;
+      lcc_strescape(ident_esc, ident_str, sizeof(ident_esc));
+      ident_len = strlen(ident_esc);
+
+      if ((batch_num > 0) &&
+          (command_len + 1 + ident_len >= LCC_GETVALS_MAX_LINE))
+        break;
+
+      command[command_len] = ' ';
+      memcpy(command + command_len + 1, ident_esc, ident_len + 1);
+      command_len += 1 + ident_len;
+      batch_num++;
+    }
+    if (status != 0)
+      break;
+
+    status = lcc_sendreceive(c, command, &res);
+    if (status != 0)
+      break;
+
+    if (res.status != 0) {
+      LCC_SET_ERRSTR(c, "Server error: %s", res.message);
+      lcc_response_free(&res);
+      status = -1;
+      break;
+    }
+
+    if (res.lines_num < batch_num) {
+      lcc_set_errno(c, EILSEQ);
+      lcc_response_free(&res);
+      status = -1;
+      break;
+    }
+
+    for (size_t i = 0; i < batch_num; i++) {
+      status = lcc_getvals_parse(
+          c, res.lines[i], ret_values_num + done + i, ret_values + done + i,
+          (ret_values_names != NULL) ? ret_values_names + done + i : NULL);
+      if (status != 0)
+        break;
+    }
+
+    lcc_response_free(&res);
+    done += batch_num;
+  }
+
+  free(command);
+
+  if (status != 0) {
+    for (size_t i = 0; i < idents_num; i++) {
+      if ((ret_values_names != NULL) && (ret_values_names[i] != NULL)) {
+        for (size_t j = 0; j < ret_values_num[i]; j++)
+          free(ret_values_names[i][j]);
+        free(ret_values_names[i]);
+        ret_values_names[i] = NULL;
+      }
+      free(ret_values[i]);
+      ret_values[i] = NULL;
+      ret_values_num[i] = 0;
+    }
+    return -1;
+  }
+
+  return 0;
+} /* }}} int lcc_getvals */
+
+int lcc_gethistory(lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
+                   double start, double end, size_t *ret_points_num,
+                   double **ret_times, size_t *ret_values_num,
+                   gauge_t **ret_values, char ***ret_values_names) {
+  char ident_str[6 * LCC_NAME_LEN];
+  char ident_esc[12 * LCC_NAME_LEN];
+  char command[1024] = "";
+
+  lcc_response_t res;
+  size_t points_num;
+  size_t values_num = 0;
+  double *times = NULL;
+  gauge_t *values = NULL;
+  char **values_names = NULL;
+
+  int status;
+
+  if (c == NULL)
+    return -1;
+
+  if ((ident == NULL) || (ret_points_num == NULL) || (ret_times == NULL) ||
+      (ret_values_num == NULL) || (ret_values == NULL)) {
+    lcc_set_errno(c, EINVAL);
+    return -1;
+  }
+
+  status = lcc_identifier_to_string(c, ident_str, sizeof(ident_str), ident);
+  if (status != 0)
+    return status;
+
+  SSTRCATF(command, "GETHISTORY %s",
+           lcc_strescape(ident_esc, ident_str, sizeof(ident_esc)));
+  if (start != 0.0)
+    SSTRCATF(command, " start=%.3f", start);
+  if (end != 0.0)
+    SSTRCATF(command, " end=%.3f", end);
+
+  status = lcc_sendreceive(c, command, &res);
+  if (status != 0)
+    return status;
+
+  if (res.status != 0) {
+    LCC_SET_ERRSTR(c, "Server error: %s", res.message);
+    lcc_response_free(&res);
+    return -1;
+  }
+
+  points_num = res.lines_num;
+
+#define BAIL_OUT(e)                                                            \
+  do {                                                                         \
+    lcc_set_errno(c, (e));                                                     \
+    free(times);                                                               \
+    free(values);                                                              \
+    if (values_names != NULL) {                                                \
+      for (size_t j = 0; j < values_num; j++) {                                \
+        free(values_names[j]);                                                 \
+      }                                                                        \
+    }                                                                          \
+    free(values_names);                                                        \
+    lcc_response_free(&res);                                                   \
+    return -1;                                                                 \
+  } while (0)
+
+  /* Each line looks like "<time> <name>=<value> [<name>=<value> ...]". The
+   * number of values and their names are taken from the first line. */
+  if (points_num > 0) {
+    for (char *ptr = res.lines[0]; *ptr != 0; ptr++)
+      if (*ptr == '=')
+        values_num++;
+    if (values_num == 0)
+      BAIL_OUT(EILSEQ);
+
+    times = malloc(points_num * sizeof(*times));
+    values = malloc(points_num * values_num * sizeof(*values));
+    if ((times == NULL) || (values == NULL))
+      BAIL_OUT(ENOMEM);
+
+    if (ret_values_names != NULL) {
+      values_names = calloc(values_num, sizeof(*values_names));
+      if (values_names == NULL)
+        BAIL_OUT(ENOMEM);
+    }
+  }
+
+  for (size_t i = 0; i < points_num; i++) {
+    char *ptr = res.lines[i];
+    char *endptr = NULL;
+
+    errno = 0;
+    times[i] = strtod(ptr, &endptr);
+    if ((endptr == ptr) || (errno != 0))
+      BAIL_OUT(EILSEQ);
+    ptr = endptr;
+
+    for (size_t j = 0; j < values_num; j++) {
+      char *key;
+      char *value;
+
+      while (*ptr == ' ')
+        ptr++;
+      key = ptr;
+      value = strchr(key, '=');
+      if (value == NULL)
+        BAIL_OUT(EILSEQ);
+      *value = 0;
+      value++;
+
+      endptr = NULL;
+      errno = 0;
+      values[i * values_num + j] = strtod(value, &endptr);
+      if ((endptr == value) || (errno != 0) ||
+          ((*endptr != ' ') && (*endptr != 0)))
+        BAIL_OUT(EILSEQ);
+      ptr = endptr;
+
+      if ((i == 0) && (values_names != NULL)) {
+        values_names[j] = strdup(key);
+        if (values_names[j] == NULL)
+          BAIL_OUT(ENOMEM);
+      }
+    }
+
+    if (*ptr != 0)
+      BAIL_OUT(EILSEQ);
+  } /* for (i = 0; i < points_num; i++) */
+
+#undef BAIL_OUT
+
+  *ret_points_num = points_num;
+  *ret_times = times;
+  *ret_values_num = values_num;
+  *ret_values = values;
+  if (ret_values_names != NULL)
+    *ret_values_names = values_names;
+
+  lcc_response_free(&res);
+
+  return 0;
+} /* }}} int lcc_gethistory */
+
 int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
 {
   char ident_str[6 * LCC_NAME_LEN];
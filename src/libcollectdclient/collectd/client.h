@@ -57,6 +57,9 @@
 #define LCC_TYPE_DERIVE 2
 #define LCC_TYPE_ABSOLUTE 3
 
+#define LCC_FRAMING_TEXT 0
+#define LCC_FRAMING_BINARY 1
+
 LCC_BEGIN_DECLS
 
 typedef uint64_t counter_t;
@@ -109,10 +112,37 @@ int lcc_disconnect(lcc_connection_t *c);
     (c) = NULL;                                                                \
   } while (0)
 
+/* lcc_set_framing: Switches the connection to LCC_FRAMING_BINARY, in which
+ * each request and each part of a response is prefixed with its length, or
+ * back to LCC_FRAMING_TEXT, in which they are terminated by newlines. Binary
+ * framing lets the daemon stream long responses, e.g. of LISTVAL. */
+int lcc_set_framing(lcc_connection_t *c, int framing);
+
 int lcc_getval(lcc_connection_t *c, lcc_identifier_t *ident,
                size_t *ret_values_num, gauge_t **ret_values,
                char ***ret_values_names);
 
+/* lcc_getvals: Queries the values of the `idents_num' identifiers `idents',
+ * sending many identifiers per request. For each identifier,
+ * `ret_values_num[i]' receives the number of values stored in the newly
+ * allocated array `ret_values[i]' -- zero and NULL if the identifier was not
+ * found. If `ret_values_names' is not NULL, `ret_values_names[i]' receives
+ * the names of the values. All arrays must hold `idents_num' elements. */
+int lcc_getvals(lcc_connection_t *c, const lcc_identifier_t *idents,
+                size_t idents_num, size_t *ret_values_num,
+                gauge_t **ret_values, char ***ret_values_names);
+
+/* lcc_gethistory: Returns the points stored in the daemon's value cache for
+ * `ident' with a time between `start' and `end'. Zero omits the respective
+ * limit, negative values are relative to the daemon's current time. For each
+ * of the `ret_points_num' points, `ret_times' receives one time and
+ * `ret_values' receives `ret_values_num' values. All arrays must be freed by
+ * the caller. `ret_values_names' may be NULL. */
+int lcc_gethistory(lcc_connection_t *c, lcc_identifier_t *ident, double start,
+                   double end, size_t *ret_points_num, double **ret_times,
+                   size_t *ret_values_num, gauge_t **ret_values,
+                   char ***ret_values_names);
+
 int lcc_putval(lcc_connection_t *c, const lcc_value_list_t *vl);
 
 int lcc_flush(lcc_connection_t *c, const char *plugin, lcc_identifier_t *ident,
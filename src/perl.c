@@ -117,6 +117,7 @@ static XS(Collectd_plugin_unregister_ds);
 static XS(Collectd_plugin_dispatch_values);
 static XS(Collectd_plugin_get_interval);
 static XS(Collectd__plugin_write);
+static XS(Collectd__plugin_register_write_batch);
 static XS(Collectd__plugin_flush);
 static XS(Collectd_plugin_dispatch_notification);
 static XS(Collectd_plugin_log);
@@ -130,6 +131,11 @@ static void perl_log(int level, const char *msg, user_data_t *user_data);
 static int perl_notify(const notification_t *notif, user_data_t *user_data);
 static int perl_flush(cdtime_t timeout, const char *identifier,
                       user_data_t *user_data);
+static int perl_write_batch(const data_set_t *ds, const value_list_t *vl,
+                            user_data_t *user_data);
+static int perl_flush_batch(cdtime_t timeout, const char *identifier,
+                            user_data_t *user_data);
+static void perl_batch_destroy(void *arg);
 
 /*
  * private data types
@@ -160,6 +166,54 @@ typedef struct {
   pthread_mutexattr_t mutexattr;
 } c_ithread_list_t;
 
+/* value lists buffered for a batched write callback; "vl.values" is set
+ * when the batch is delivered, since the value buffer may be reallocated */
+typedef struct {
+  value_list_t vl;
+  size_t values_offset;
+} perl_batch_entry_t;
+
+typedef struct {
+  perl_batch_entry_t *entries;
+  size_t entries_num;
+  size_t entries_size;
+
+  value_t *values;
+  size_t values_num;
+  size_t values_size;
+} perl_batch_buffer_t;
+
+typedef struct perl_batch_s {
+  char *subname;
+  size_t size;
+  cdtime_t timeout;
+
+  /* "lock" protects "active", "first_time" and "refcount". "flush_lock"
+   * serializes deliveries and protects "spare". The buffers are swapped
+   * when delivering, so writers never wait for a Perl interpreter. */
+  pthread_mutex_t lock;
+  pthread_mutex_t flush_lock;
+  perl_batch_buffer_t active;
+  perl_batch_buffer_t spare;
+  cdtime_t first_time;
+
+  /* interpreter the batches are delivered in, independent of the number
+   * of threads writing values; protected by "flush_lock" */
+  c_ithread_t *ithread;
+
+  /* Perl structures of the last delivery, overwritten by the next one
+   * unless the sub kept a reference to them; they belong to "ithread" and
+   * are released along with it; protected by "flush_lock" */
+  AV *pool_batch;
+  AV **pool;
+  size_t pool_size;
+
+  /* registered as both, a write and a flush callback */
+  int refcount;
+
+  struct perl_batch_s *next;
+} perl_batch_t;
+
 /* name / user_data for Perl matches / targets */
 typedef struct {
   char *name;
@@ -197,6 +251,10 @@ static char **perl_argv = NULL;
 
 static char base_name[DATA_MAX_NAME_LEN] = "";
 
+/* all batched write callbacks, delivered one last time on shutdown */
+static perl_batch_t *perl_batches = NULL;
+static pthread_mutex_t perl_batches_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static struct {
   char name[64];
   XS((*f));
@@ -218,6 +276,8 @@ static struct {
     {"Collectd::plugin_dispatch_values", Collectd_plugin_dispatch_values},
     {"Collectd::plugin_get_interval", Collectd_plugin_get_interval},
     {"Collectd::_plugin_write", Collectd__plugin_write},
+    {"Collectd::_plugin_register_write_batch",
+     Collectd__plugin_register_write_batch},
     {"Collectd::_plugin_flush", Collectd__plugin_flush},
     {"Collectd::plugin_dispatch_notification",
      Collectd_plugin_dispatch_notification},
@@ -1183,6 +1243,230 @@ static int pplugin_call(pTHX_ int type, ...) {
   return ret;
 } /* static int pplugin_call (int, ...) */
 
+/*
+ * Pooled entries of batched write callbacks.
+ *
+ * An entry is [ $type, $data_set, $value_list ], as created by
+ * perl_batch_entry_new. Filling it in place avoids allocating a hash, an
+ * array and a dozen scalars for every value list.
+ */
+
+static AV *perl_batch_entry_new(pTHX) {
+  AV *entry = newAV();
+  HV *pvl = newHV();
+
+  av_extend(entry, 2);
+  av_store(entry, 0, newSV(0));
+  av_store(entry, 1, newSV(0));
+  av_store(entry, 2, newRV_noinc((SV *)pvl));
+  (void)hv_store(pvl, "values", 6, newRV_noinc((SV *)newAV()), 0);
+  return entry;
+} /* static AV *perl_batch_entry_new (void) */
+
+/* An entry may only be overwritten if the sub did not keep a reference to
+ * it or to one of its containers and did not replace any of them. */
+static int perl_batch_entry_reusable(pTHX_ AV *entry) {
+  SV **svp;
+  SV *pvl;
+  SV *values;
+
+  if ((1 != SvREFCNT((SV *)entry)) || (2 != av_len(entry)))
+    return 0;
+
+  svp = av_fetch(entry, 2, 0);
+  if ((NULL == svp) || !SvROK(*svp))
+    return 0;
+  pvl = SvRV(*svp);
+  if ((SVt_PVHV != SvTYPE(pvl)) || (1 != SvREFCNT(pvl)))
+    return 0;
+
+  svp = hv_fetch((HV *)pvl, "values", 6, 0);
+  if ((NULL == svp) || !SvROK(*svp))
+    return 0;
+  values = SvRV(*svp);
+  return (SVt_PVAV == SvTYPE(values)) && (1 == SvREFCNT(values));
+} /* static int perl_batch_entry_reusable (AV *) */
+
+static void perl_batch_hv_setpv(pTHX_ HV *hash, const char *key,
+                                const char *value) {
+  I32 len = (I32)strlen(key);
+  SV **svp;
+
+  /* empty fields are left out, just like value_list2hv does */
+  if ('\0' == value[0]) {
+    (void)hv_delete(hash, key, len, G_DISCARD);
+    return;
+  }
+
+  svp = hv_fetch(hash, key, len, 1);
+  if (NULL != svp)
+    sv_setpv(*svp, value);
+} /* static void perl_batch_hv_setpv (HV *, const char *, const char *) */
+
+static void perl_batch_entry_set(pTHX_ AV *entry, const data_set_t *ds,
+                                 SV *pds_ref, const value_list_t *vl) {
+  HV *pvl = (HV *)SvRV(*av_fetch(entry, 2, 0));
+  AV *values = (AV *)SvRV(*hv_fetch(pvl, "values", 6, 0));
+
+  sv_setpv(*av_fetch(entry, 0, 0), ds->type);
+  sv_setsv(*av_fetch(entry, 1, 0), pds_ref);
+
+  av_fill(values, (I32)vl->values_len - 1);
+  for (size_t i = 0; i < vl->values_len; ++i) {
+    SV **val = av_fetch(values, (I32)i, 1);
+
+    if (NULL == val)
+      continue;
+
+    if (DS_TYPE_COUNTER == ds->ds[i].type)
+      sv_setiv(*val, vl->values[i].counter);
+    else if (DS_TYPE_GAUGE == ds->ds[i].type)
+      sv_setnv(*val, vl->values[i].gauge);
+    else if (DS_TYPE_DERIVE == ds->ds[i].type)
+      sv_setiv(*val, vl->values[i].derive);
+    else if (DS_TYPE_ABSOLUTE == ds->ds[i].type)
+      sv_setiv(*val, vl->values[i].absolute);
+  }
+
+  if (0 != vl->time)
+    sv_setnv(*hv_fetch(pvl, "time", 4, 1), CDTIME_T_TO_DOUBLE(vl->time));
+  else
+    (void)hv_delete(pvl, "time", 4, G_DISCARD);
+
+  sv_setnv(*hv_fetch(pvl, "interval", 8, 1), CDTIME_T_TO_DOUBLE(vl->interval));
+
+  perl_batch_hv_setpv(aTHX_ pvl, "host", vl->host);
+  perl_batch_hv_setpv(aTHX_ pvl, "plugin", vl->plugin);
+  perl_batch_hv_setpv(aTHX_ pvl, "plugin_instance", vl->plugin_instance);
+  perl_batch_hv_setpv(aTHX_ pvl, "type", vl->type);
+  perl_batch_hv_setpv(aTHX_ pvl, "type_instance", vl->type_instance);
+} /* static void perl_batch_entry_set (AV *, ...) */
+
+/*
+ * Call the sub of a batched write callback with all buffered value lists.
+ */
+static int pplugin_write_batch(pTHX_ perl_batch_t *b,
+                               perl_batch_buffer_t *buf) {
+  const data_set_t *ds = NULL;
+  SV *pds_ref = NULL;
+  AV *batch;
+  size_t n = 0;
+  int retvals = 0;
+  int ret = 0;
+
+  dSP;
+
+  /*
+   * $_[0] =
+   * [
+   *   [ $type, $data_set, $value_list ],
+   *   ...
+   * ];
+   *
+   * Each element holds the arguments a write callback would have been
+   * called with. Consecutive value lists of the same type share the data
+   * set array.
+   */
+  if (buf->entries_num > b->pool_size) {
+    AV **tmp = realloc(b->pool, buf->entries_num * sizeof(*tmp));
+    if (NULL == tmp) {
+      log_err("pplugin_write_batch: realloc failed.");
+      return -1;
+    }
+    memset(tmp + b->pool_size, 0,
+           (buf->entries_num - b->pool_size) * sizeof(*tmp));
+    b->pool = tmp;
+    b->pool_size = buf->entries_num;
+  }
+
+  if (NULL == b->pool_batch)
+    b->pool_batch = newAV();
+  batch = b->pool_batch;
+  av_extend(batch, buf->entries_num - 1);
+
+  for (size_t i = 0; i < buf->entries_num; ++i) {
+    perl_batch_entry_t *e = buf->entries + i;
+
+    if ((NULL == ds) || (0 != strcmp(ds->type, e->vl.type))) {
+      AV *pds;
+
+      if (NULL != pds_ref)
+        SvREFCNT_dec(pds_ref);
+      pds_ref = NULL;
+
+      ds = plugin_get_ds(e->vl.type);
+      if (NULL == ds) {
+        log_warn("pplugin_write_batch: Unknown type \"%s\".", e->vl.type);
+        continue;
+      }
+
+      pds = newAV();
+      if (-1 == data_set2av(aTHX_(data_set_t *) ds, pds)) {
+        SvREFCNT_dec((SV *)pds);
+        ds = NULL;
+        ret = -1;
+        continue;
+      }
+      pds_ref = newRV_noinc((SV *)pds);
+    }
+
+    if (ds->ds_num != e->vl.values_len) {
+      log_warn("pplugin_write_batch: Data set \"%s\" has changed.", ds->type);
+      continue;
+    }
+
+    if ((NULL != b->pool[n]) &&
+        !perl_batch_entry_reusable(aTHX_ b->pool[n])) {
+      SvREFCNT_dec((SV *)b->pool[n]);
+      b->pool[n] = NULL;
+    }
+    if (NULL == b->pool[n])
+      b->pool[n] = perl_batch_entry_new(aTHX);
+
+    e->vl.values = buf->values + e->values_offset;
+    perl_batch_entry_set(aTHX_ b->pool[n], ds, pds_ref, &e->vl);
+    av_push(batch, newRV_inc((SV *)b->pool[n]));
+    ++n;
+  }
+
+  if (NULL != pds_ref)
+    SvREFCNT_dec(pds_ref);
+
+  ENTER;
+  SAVETMPS;
+
+  PUSHMARK(SP);
+  XPUSHs(sv_2mortal(newRV_inc((SV *)batch)));
+  PUTBACK;
+
+  retvals = call_pv_locked(aTHX_ b->subname);
+
+  SPAGAIN;
+  if (SvTRUE(ERRSV)) {
+    ERROR("perl: %s error: %s", b->subname, SvPV_nolen(ERRSV));
+    ret = -1;
+  } else if (0 < retvals) {
+    SV *tmp = POPs;
+    if (!SvTRUE(tmp))
+      ret = -1;
+  }
+
+  PUTBACK;
+  FREETMPS;
+  LEAVE;
+
+  /* the sub kept the list; its entries are left alone as well, since
+   * they are referenced from it */
+  if (1 != SvREFCNT((SV *)batch)) {
+    SvREFCNT_dec((SV *)batch);
+    b->pool_batch = NULL;
+  } else {
+    av_clear(batch);
+  }
+
+  return ret;
+} /* static int pplugin_write_batch (perl_batch_t *, perl_batch_buffer_t *) */
+
 /*
  * collectd's Perl interpreter based thread implementation.
  *
@@ -1671,6 +1955,98 @@ static XS(Collectd_plugin_register_flush) {
   return _plugin_register_generic_userdata(aTHX, PLUGIN_FLUSH, "flush");
 }
 
+/*
+ * Collectd::_plugin_register_write_batch (pluginname, subname[, size[,
+ *                                         timeout]]).
+ *
+ * pluginname:
+ *   name of the perl plugin
+ *
+ * subname:
+ *   name of the plugin's subroutine that receives the batches
+ *
+ * size:
+ *   maximum number of value lists per batch, may be 'undef'
+ *
+ * timeout:
+ *   maximum number of seconds a value list is buffered, may be 'undef'
+ */
+static XS(Collectd__plugin_register_write_batch) {
+  perl_batch_t *b;
+  char *pluginname;
+  IV size = 1024;
+  cdtime_t timeout = plugin_get_interval();
+  int ret;
+
+  dXSARGS;
+
+  if ((2 > items) || (4 < items)) {
+    log_err("Usage: Collectd::plugin_register_write_batch(pluginname, "
+            "subname[, size[, timeout]])");
+    XSRETURN_EMPTY;
+  }
+
+  if (!SvOK(ST(0)) || !SvOK(ST(1))) {
+    log_err("Collectd::plugin_register_write_batch: "
+            "Invalid pluginname or subname");
+    XSRETURN_EMPTY;
+  }
+
+  if ((2 < items) && SvOK(ST(2)))
+    size = SvIV(ST(2));
+  if ((3 < items) && SvOK(ST(3))) {
+    if (0 > SvNV(ST(3))) {
+      log_err("Collectd::plugin_register_write_batch: Invalid timeout");
+      XSRETURN_EMPTY;
+    }
+    timeout = DOUBLE_TO_CDTIME_T(SvNV(ST(3)));
+  }
+  if (1 > size) {
+    log_err("Collectd::plugin_register_write_batch: Invalid size");
+    XSRETURN_EMPTY;
+  }
+
+  pluginname = SvPV_nolen(ST(0));
+
+  log_debug("Collectd::plugin_register_write_batch: "
+            "plugin = \"%s\", sub = \"%s\", size = %i",
+            pluginname, SvPV_nolen(ST(1)), (int)size);
+
+  b = calloc(1, sizeof(*b));
+  if (NULL == b) {
+    log_err("Collectd::plugin_register_write_batch: calloc failed.");
+    XSRETURN_EMPTY;
+  }
+
+  b->subname = strdup(SvPV_nolen(ST(1)));
+  b->size = (size_t)size;
+  b->timeout = timeout;
+  pthread_mutex_init(&b->lock, /* attr = */ NULL);
+  pthread_mutex_init(&b->flush_lock, /* attr = */ NULL);
+  b->refcount = 2;
+
+  pthread_mutex_lock(&perl_batches_lock);
+  b->next = perl_batches;
+  perl_batches = b;
+  pthread_mutex_unlock(&perl_batches_lock);
+
+  ret = plugin_register_write(pluginname, perl_write_batch,
+                              &(user_data_t){
+                                  .data = b, .free_func = perl_batch_destroy,
+                              });
+  if (0 != plugin_register_flush(pluginname, perl_flush_batch,
+                                 &(user_data_t){
+                                     .data = b,
+                                     .free_func = perl_batch_destroy,
+                                 }))
+    ret = -1;
+
+  if (0 == ret)
+    XSRETURN_YES;
+  else
+    XSRETURN_EMPTY;
+} /* static XS (Collectd__plugin_register_write_batch) */
+
 typedef int perl_unregister_function_t(const char *name);
 
 static void _plugin_unregister_generic(pTHX, perl_unregister_function_t *unreg,
@@ -2247,6 +2623,175 @@ static int perl_flush(cdtime_t timeout, const char *identifier,
   return pplugin_call(aTHX_ PLUGIN_FLUSH, user_data->data, timeout, identifier);
 } /* static int perl_flush (const int) */
 
+static int perl_batch_buffer_append(perl_batch_buffer_t *buf,
+                                    const value_list_t *vl) {
+  perl_batch_entry_t *e;
+
+  if (buf->entries_num >= buf->entries_size) {
+    size_t size = (0 == buf->entries_size) ? 64 : 2 * buf->entries_size;
+    perl_batch_entry_t *tmp = realloc(buf->entries, size * sizeof(*tmp));
+    if (NULL == tmp)
+      return ENOMEM;
+    buf->entries = tmp;
+    buf->entries_size = size;
+  }
+
+  if (buf->values_num + vl->values_len > buf->values_size) {
+    size_t size = (0 == buf->values_size) ? 64 : buf->values_size;
+    value_t *tmp;
+
+    while (size < buf->values_num + vl->values_len)
+      size *= 2;
+
+    tmp = realloc(buf->values, size * sizeof(*tmp));
+    if (NULL == tmp)
+      return ENOMEM;
+    buf->values = tmp;
+    buf->values_size = size;
+  }
+
+  e = buf->entries + buf->entries_num;
+  e->vl = *vl;
+  e->vl.values = NULL;
+  e->vl.meta = NULL;
+  e->values_offset = buf->values_num;
+
+  memcpy(buf->values + buf->values_num, vl->values,
+         vl->values_len * sizeof(*buf->values));
+  buf->values_num += vl->values_len;
+  buf->entries_num++;
+  return 0;
+} /* static int perl_batch_buffer_append (perl_batch_buffer_t *, ...) */
+
+/* Hands all buffered value lists to the batch's own interpreter. Creating
+ * and using that interpreter temporarily replaces the calling thread's one. */
+static int perl_batch_flush(perl_batch_t *b) {
+  perl_batch_buffer_t tmp;
+  perl_batch_buffer_t *buf = &b->spare;
+  c_ithread_t *old;
+  int ret = 0;
+
+  if (NULL == perl_threads)
+    return 0;
+
+  pthread_mutex_lock(&b->flush_lock);
+
+  pthread_mutex_lock(&b->lock);
+  tmp = b->active;
+  b->active = b->spare;
+  b->spare = tmp;
+  pthread_mutex_unlock(&b->lock);
+
+  if (0 == buf->entries_num) {
+    pthread_mutex_unlock(&b->flush_lock);
+    return 0;
+  }
+
+  old = (c_ithread_t *)pthread_getspecific(perl_thr_key);
+
+  if (NULL == b->ithread) {
+    pthread_mutex_lock(&perl_threads->mutex);
+    b->ithread = c_ithread_create(perl_threads->head->interp);
+    pthread_mutex_unlock(&perl_threads->mutex);
+  }
+
+  b->ithread->pthread = pthread_self();
+  pthread_setspecific(perl_thr_key, (const void *)b->ithread);
+  PERL_SET_CONTEXT(b->ithread->interp);
+
+  log_debug("perl_batch_flush: c_ithread: interp = %p (active threads: %i)",
+            b->ithread->interp, perl_threads->number_of_threads);
+  ret = pplugin_write_batch(b->ithread->interp, b, buf);
+
+  pthread_setspecific(perl_thr_key, (const void *)old);
+  PERL_SET_CONTEXT((NULL == old) ? NULL : old->interp);
+
+  buf->entries_num = 0;
+  buf->values_num = 0;
+
+  pthread_mutex_unlock(&b->flush_lock);
+  return ret;
+} /* static int perl_batch_flush (perl_batch_t *) */
+
+/* Value lists are only copied here. The Perl structures are built once per
+ * batch, so writer threads don't need an interpreter of their own. */
+static int perl_write_batch(const data_set_t *ds, const value_list_t *vl,
+                            user_data_t *user_data) {
+  perl_batch_t *b = user_data->data;
+  cdtime_t now = cdtime();
+  _Bool flush;
+  int status;
+
+  if (NULL == perl_threads)
+    return 0;
+
+  pthread_mutex_lock(&b->lock);
+  if (0 == b->active.entries_num)
+    b->first_time = now;
+  status = perl_batch_buffer_append(&b->active, vl);
+  flush = (b->active.entries_num >= b->size) ||
+          ((0 != b->timeout) && ((now - b->first_time) >= b->timeout));
+  pthread_mutex_unlock(&b->lock);
+
+  if (0 != status) {
+    log_err("perl_write_batch: Buffering the values for %s failed.",
+            b->subname);
+    return status;
+  }
+
+  if (flush)
+    return perl_batch_flush(b);
+  return 0;
+} /* static int perl_write_batch (const data_set_t *, const value_list_t *) */
+
+static int perl_flush_batch(cdtime_t timeout, const char *identifier,
+                            user_data_t *user_data) {
+  perl_batch_t *b = user_data->data;
+  _Bool flush;
+
+  pthread_mutex_lock(&b->lock);
+  flush = (0 < b->active.entries_num) &&
+          ((0 == timeout) || ((cdtime() - b->first_time) >= timeout));
+  pthread_mutex_unlock(&b->lock);
+
+  if (flush)
+    return perl_batch_flush(b);
+  return 0;
+} /* static int perl_flush_batch (cdtime_t, const char *, user_data_t *) */
+
+static void perl_batch_destroy(void *arg) {
+  perl_batch_t *b = arg;
+  int refcount;
+
+  pthread_mutex_lock(&b->lock);
+  refcount = --b->refcount;
+  pthread_mutex_unlock(&b->lock);
+  if (0 < refcount)
+    return;
+
+  pthread_mutex_lock(&perl_batches_lock);
+  for (perl_batch_t **p = &perl_batches; NULL != *p; p = &(*p)->next) {
+    if (*p == b) {
+      *p = b->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&perl_batches_lock);
+
+  /* a no-op after perl_shutdown() */
+  perl_batch_flush(b);
+
+  sfree(b->active.entries);
+  sfree(b->active.values);
+  sfree(b->spare.entries);
+  sfree(b->spare.values);
+  sfree(b->pool);
+  pthread_mutex_destroy(&b->lock);
+  pthread_mutex_destroy(&b->flush_lock);
+  sfree(b->subname);
+  sfree(b);
+} /* static void perl_batch_destroy (void *) */
+
 static int perl_shutdown(void) {
   c_ithread_t *t;
   int ret;
@@ -2273,6 +2818,13 @@ static int perl_shutdown(void) {
   plugin_unregister_init("perl");
   plugin_unregister_flush("perl"); /* For collectd-5.6 only, #1731 */
 
+  /* the interpreters are gone by the time the write callbacks are
+   * destroyed */
+  pthread_mutex_lock(&perl_batches_lock);
+  for (perl_batch_t *b = perl_batches; NULL != b; b = b->next)
+    perl_batch_flush(b);
+  pthread_mutex_unlock(&perl_batches_lock);
+
   ret = pplugin_call(aTHX_ PLUGIN_SHUTDOWN);
 
   pthread_mutex_lock(&perl_threads->mutex);
@@ -0,0 +1,140 @@
+/**
+ * collectd - src/perl_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "perl.c" /* sic */
+#include "testing.h"
+
+/* The perl plugin registers matches and targets when it is loaded. */
+int fc_register_match(const char *name, match_proc_t proc) { return ENOTSUP; }
+int fc_register_target(const char *name, target_proc_t proc) {
+  return ENOTSUP;
+}
+
+/* Records every entry as "type,data source,host,type instance,value" in
+ * @seen and the address of the entry in @addrs. */
+static char perl_test_code[] =
+    "our (@seen, @addrs, $keep, $kept);"
+    "sub write_batch {"
+    "  my $batch = shift;"
+    "  for my $e (@$batch) {"
+    "    push @addrs, \"$e\";"
+    "    push @seen, join(',', $e->[0], $e->[1][0]{name}, $e->[2]{host},"
+    "      exists $e->[2]{type_instance} ? $e->[2]{type_instance} : '-',"
+    "      $e->[2]{values}[0]);"
+    "  }"
+    "  $kept = $batch if $keep;"
+    "  return 1;"
+    "}"
+    "Collectd::plugin_register_write_batch('batch_test', 'write_batch', 2, 0);";
+
+static int write_value(perl_batch_t *b, const char *type_instance,
+                       derive_t value) {
+  value_list_t vl = {
+      .values = &(value_t){.derive = value},
+      .values_len = 1,
+      .host = "example.com",
+      .plugin = "test",
+      .type = "MAGIC",
+  };
+  sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+
+  return perl_write_batch(plugin_get_ds("MAGIC"), &vl,
+                          &(user_data_t){.data = b});
+}
+
+/* Returns element "i" of the array "name" in the batch's interpreter. */
+static const char *perl_test_get(perl_batch_t *b, const char *name, int i) {
+  dTHXa(b->ithread->interp);
+  SV **svp;
+
+  PERL_SET_CONTEXT(aTHX);
+  svp = av_fetch(get_av(name, 0), i, 0);
+  return (NULL == svp) ? NULL : SvPV_nolen(*svp);
+}
+
+/* Evaluates "code" in the batch's interpreter. */
+static const char *perl_test_eval(perl_batch_t *b, const char *code) {
+  dTHXa(b->ithread->interp);
+
+  PERL_SET_CONTEXT(aTHX);
+  return SvPV_nolen(eval_pv(code, /* croak_on_error = */ 1));
+}
+
+DEF_TEST(write_batch) {
+  char *argv[] = {"", "-I" PERL_TEST_LIBDIR, "-MCollectd", "-e",
+                  perl_test_code, NULL};
+  perl_batch_t *b;
+
+  CHECK_ZERO(init_pi(STATIC_ARRAY_SIZE(argv) - 1, argv));
+  b = perl_batches;
+  CHECK_NOT_NULL(b);
+
+  /* The first batch is delivered when it is full. */
+  EXPECT_EQ_INT(0, write_value(b, "one", 1));
+  EXPECT_EQ_INT(0, b->pool_size);
+  EXPECT_EQ_INT(0, write_value(b, "two", 2));
+  EXPECT_EQ_STR("MAGIC,value,example.com,one,1",
+                perl_test_get(b, "main::seen", 0));
+  EXPECT_EQ_STR("MAGIC,value,example.com,two,2",
+                perl_test_get(b, "main::seen", 1));
+
+  /* The second batch overwrites the entries of the first. Fields that are
+   * empty now are removed. */
+  EXPECT_EQ_INT(0, write_value(b, "", 3));
+  EXPECT_EQ_INT(0, write_value(b, "four", 4));
+  EXPECT_EQ_STR("MAGIC,value,example.com,-,3",
+                perl_test_get(b, "main::seen", 2));
+  EXPECT_EQ_STR("MAGIC,value,example.com,four,4",
+                perl_test_get(b, "main::seen", 3));
+  EXPECT_EQ_STR(perl_test_get(b, "main::addrs", 0),
+                perl_test_get(b, "main::addrs", 2));
+  EXPECT_EQ_STR(perl_test_get(b, "main::addrs", 1),
+                perl_test_get(b, "main::addrs", 3));
+
+  /* Entries the sub keeps a reference to are left alone. */
+  perl_test_eval(b, "$keep = 1;");
+  EXPECT_EQ_INT(0, write_value(b, "five", 5));
+  EXPECT_EQ_INT(0, write_value(b, "six", 6));
+  perl_test_eval(b, "$keep = 0;");
+  EXPECT_EQ_INT(0, write_value(b, "seven", 7));
+  EXPECT_EQ_INT(0, write_value(b, "eight", 8));
+  EXPECT_EQ_STR("MAGIC,value,example.com,eight,8",
+                perl_test_get(b, "main::seen", 7));
+  OK(0 != strcmp(perl_test_get(b, "main::addrs", 4),
+                 perl_test_get(b, "main::addrs", 6)));
+  EXPECT_EQ_STR("five=5,six=6",
+                perl_test_eval(b, "join(',', map { \"$_->[2]{type_instance}"
+                                  "=$_->[2]{values}[0]\" } @$kept)"));
+
+  /* Shutting down delivers the values that are still buffered. */
+  EXPECT_EQ_INT(0, write_value(b, "nine", 9));
+  PERL_SET_CONTEXT(NULL);
+  CHECK_ZERO(perl_shutdown());
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(write_batch);
+
+  END_TEST;
+}
@@ -39,6 +39,9 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_complain.h"
+#include "utils_prefilter.h"
 
 /* Include header files for the mach system, if they exist.. */
 #if HAVE_THREAD_INFO
@@ -93,6 +96,18 @@
 #ifndef CONFIG_HZ
 #define CONFIG_HZ 100
 #endif
+#if HAVE_LINUX_CN_PROC_H || HAVE_LINUX_TASKSTATS_H
+#include <linux/netlink.h>
+#endif
+#if HAVE_LINUX_CN_PROC_H
+#include <poll.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#endif
+#if HAVE_LINUX_TASKSTATS_H
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -224,6 +239,7 @@ typedef struct procstat {
   char name[PROCSTAT_NAME_LEN];
 #if HAVE_REGEX_H
   regex_t *re;
+  char *regex;
 #endif
 
   unsigned long num_proc;
@@ -275,7 +291,82 @@ static mach_msg_type_number_t pset_list_len;
 
 #elif KERNEL_LINUX
 static long pagesize_g;
-static void ps_fill_details(const procstat_t *ps, process_entry_t *entry);
+
+/* Per-process cache of everything that doesn't change during the lifetime of
+ * a process, most importantly the list of "procstat_t"s it matches. Keyed by
+ * PID; the start time (and name, which changes on exec) detect PID reuse. */
+typedef struct ps_cache_entry_s {
+  long pid;
+  unsigned long long starttime;
+  char *name;
+  procstat_t **matches;
+  size_t matches_num;
+  unsigned long generation;
+} ps_cache_entry_t;
+
+/* One slot per PID found in /proc. Filled by the scanner threads, consumed by
+ * ps_read() after all threads have been joined. */
+typedef struct ps_scan_slot_s {
+  long pid;
+  char state; /* zero if the process couldn't be read */
+  ps_cache_entry_t *ce;
+  _Bool ce_new;
+  process_entry_t *entry; /* only set for matched processes */
+} ps_scan_slot_t;
+
+/* A generic netlink socket used to query per-process accounting
+ * ("taskstats"). Each scanner thread uses its own socket. */
+typedef struct ps_taskstats_sock_s {
+  int fd;
+  uint32_t seq;
+} ps_taskstats_sock_t;
+
+typedef struct ps_scan_s {
+  ps_scan_slot_t *slots;
+  size_t slots_num;
+  size_t offset;
+  size_t stride;
+  ps_taskstats_sock_t *taskstats; /* NULL if taskstats aren't used */
+  _Bool *candidate;               /* scratch space for ps_index_match() */
+} ps_scan_t;
+
+static size_t read_threads_num = 1;
+static c_avl_tree_t *ps_cache = NULL;
+static unsigned long ps_cache_generation = 0;
+
+#if HAVE_LINUX_CN_PROC_H
+/* With the proc connector, the listener thread maintains a table of all
+ * processes ("proc_events_table") from fork events, so ps_read() only reads
+ * the processes in the table instead of listing /proc. Exited processes are
+ * removed by ps_read() once /proc/<pid> is gone: they remain visible as
+ * zombies until they are reaped. PIDs of processes calling exec(2) are
+ * collected in "proc_events_pids" and removed from "ps_cache" by the next
+ * ps_read(). If events were lost, the table is rebuilt by listing /proc. */
+static _Bool use_proc_connector = 0;
+static int proc_events_fd = -1;
+static pthread_t proc_events_thread;
+static _Bool proc_events_thread_running = 0;
+static _Bool proc_events_thread_shutdown = 0;
+static _Bool proc_events_thread_failed = 0;
+static c_complain_t proc_events_complaint = C_COMPLAIN_INIT_STATIC;
+static pthread_mutex_t proc_events_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_avl_tree_t *proc_events_table = NULL;
+static long *proc_events_pids = NULL;
+static size_t proc_events_pids_num = 0;
+static size_t proc_events_pids_size = 0;
+static _Bool proc_events_lost = 1;
+static int ps_proc_events_open(void);
+#endif
+
+#if HAVE_LINUX_TASKSTATS_H
+/* One taskstats socket per scanner thread, so that requests of different
+ * threads don't have to wait for each other. */
+static _Bool use_taskstats = 0;
+static ps_taskstats_sock_t *taskstats_socks = NULL;
+static size_t taskstats_socks_num = 0;
+static uint16_t taskstats_family = 0;
+static int ps_taskstats_open(void);
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -343,6 +434,15 @@ static procstat_t *ps_list_register(const char *name, const char *regexp) {
       sfree(new);
       return NULL;
     }
+
+    new->regex = strdup(regexp);
+    if (new->regex == NULL) {
+      ERROR("processes plugin: ps_list_register: strdup failed.");
+      regfree(new->re);
+      sfree(new->re);
+      sfree(new);
+      return NULL;
+    }
   }
 #else
   if (regexp != NULL) {
@@ -364,7 +464,10 @@ static procstat_t *ps_list_register(const char *name, const char *regexp) {
               "All but the first setting will be "
               "ignored.");
 #if HAVE_REGEX_H
+      if (new->re != NULL)
+        regfree(new->re);
       sfree(new->re);
+      sfree(new->regex);
 #endif
       sfree(new);
       return NULL;
@@ -410,6 +513,111 @@ static int ps_list_match(const char *name, const char *cmdline,
   return 0;
 } /* int ps_list_match */
 
+/*
+ * Index over all "Process" and "ProcessMatch" blocks, so that a process can be
+ * matched without trying every block in turn: "Process" names are looked up
+ * in a tree, and the "ProcessMatch" regular expressions are narrowed down to
+ * the candidates that may match using a prefilter.
+ */
+typedef struct ps_index_s {
+  c_avl_tree_t *names; /* name -> procstat_t */
+  size_t procstat_num;
+
+  procstat_t **regex;
+  size_t regex_num;
+  cu_prefilter_t *prefilter;
+
+  /* Scratch space for the read callback, i.e. ps_list_add() and single
+   * threaded scans, which never run concurrently. */
+  procstat_t **matches;
+  _Bool *candidate;
+} ps_index_t;
+
+static ps_index_t ps_index;
+
+static void ps_index_destroy(void) {
+  /* Keys and values are owned by list_head_g. */
+  c_avl_destroy(ps_index.names);
+  sfree(ps_index.regex);
+  prefilter_destroy(ps_index.prefilter);
+  sfree(ps_index.matches);
+  sfree(ps_index.candidate);
+  memset(&ps_index, 0, sizeof(ps_index));
+} /* void ps_index_destroy */
+
+static int ps_index_create(void) {
+  size_t num = 0;
+
+  ps_index_destroy();
+
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next)
+    num++;
+  ps_index.procstat_num = num;
+
+  ps_index.names = c_avl_create((int (*)(const void *, const void *))strcmp);
+  ps_index.regex = calloc(num + 1, sizeof(*ps_index.regex));
+  ps_index.prefilter = prefilter_create();
+  ps_index.matches = calloc(num + 1, sizeof(*ps_index.matches));
+  ps_index.candidate = calloc(num + 1, sizeof(*ps_index.candidate));
+  if ((ps_index.names == NULL) || (ps_index.regex == NULL) ||
+      (ps_index.prefilter == NULL) || (ps_index.matches == NULL) ||
+      (ps_index.candidate == NULL)) {
+    ps_index_destroy();
+    return -1;
+  }
+
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
+#if HAVE_REGEX_H
+    if (ps->re != NULL) {
+      /* Ids are assigned in order, so they index ps_index.regex. */
+      if (prefilter_add(ps_index.prefilter, ps->regex) < 0) {
+        ps_index_destroy();
+        return -1;
+      }
+      ps_index.regex[ps_index.regex_num++] = ps;
+      continue;
+    }
+#endif
+    /* ps_list_register() makes sure that names are unique. */
+    c_avl_insert(ps_index.names, ps->name, ps);
+  }
+
+  if (prefilter_compile(ps_index.prefilter) != 0) {
+    ps_index_destroy();
+    return -1;
+  }
+
+  return 0;
+} /* int ps_index_create */
+
+/* Stores all "procstat_t"s a process matches in "ret", which must have room
+ * for "ps_index.procstat_num" entries. "candidate" is scratch space with room
+ * for "ps_index.regex_num" entries. Returns the number of matches. May be
+ * called from multiple threads concurrently, as long as each thread passes
+ * its own buffers. */
+static size_t ps_index_match(const char *name, const char *cmdline,
+                             procstat_t **ret, _Bool *candidate) {
+  procstat_t *ps = NULL;
+  size_t num = 0;
+
+  if (c_avl_get(ps_index.names, name, (void *)&ps) == 0)
+    ret[num++] = ps;
+
+  if (ps_index.regex_num == 0)
+    return num;
+
+  prefilter_candidates(ps_index.prefilter,
+                       ((cmdline == NULL) || (cmdline[0] == 0)) ? name
+                                                                : cmdline,
+                       candidate);
+
+  for (size_t i = 0; i < ps_index.regex_num; i++)
+    if (candidate[i] && ps_list_match(name, cmdline, ps_index.regex[i]))
+      ret[num++] = ps_index.regex[i];
+
+  return num;
+} /* size_t ps_index_match */
+
 static void ps_update_counter(derive_t *group_counter, derive_t *curr_counter,
                               derive_t new_counter) {
   unsigned long curr_value;
@@ -431,86 +639,89 @@ static void ps_update_counter(derive_t *group_counter, derive_t *curr_counter,
   *group_counter += curr_value;
 }
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add(const char *name, const char *cmdline,
-                        process_entry_t *entry) {
+/* add process entry to the 'instances' of 'ps' (or refresh it) */
+static void ps_list_update(procstat_t *ps, process_entry_t *entry) {
   procstat_entry_t *pse;
 
-  if (entry->id == 0)
-    return;
+  for (pse = ps->instances; pse != NULL; pse = pse->next)
+    if ((pse->id == entry->id) || (pse->next == NULL))
+      break;
 
-  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
-    if ((ps_list_match(name, cmdline, ps)) == 0)
-      continue;
+  if ((pse == NULL) || (pse->id != entry->id)) {
+    procstat_entry_t *new;
 
-#if KERNEL_LINUX
-    ps_fill_details(ps, entry);
-#endif
+    new = calloc(1, sizeof(*new));
+    if (new == NULL)
+      return;
+    new->id = entry->id;
 
-    for (pse = ps->instances; pse != NULL; pse = pse->next)
-      if ((pse->id == entry->id) || (pse->next == NULL))
-        break;
+    if (pse == NULL)
+      ps->instances = new;
+    else
+      pse->next = new;
 
-    if ((pse == NULL) || (pse->id != entry->id)) {
-      procstat_entry_t *new;
+    pse = new;
+  }
 
-      new = calloc(1, sizeof(*new));
-      if (new == NULL)
-        return;
-      new->id = entry->id;
+  pse->age = 0;
 
-      if (pse == NULL)
-        ps->instances = new;
-      else
-        pse->next = new;
+  ps->num_proc += entry->num_proc;
+  ps->num_lwp += entry->num_lwp;
+  ps->num_fd += entry->num_fd;
+  ps->vmem_size += entry->vmem_size;
+  ps->vmem_rss += entry->vmem_rss;
+  ps->vmem_data += entry->vmem_data;
+  ps->vmem_code += entry->vmem_code;
+  ps->stack_size += entry->stack_size;
 
-      pse = new;
-    }
+  if ((entry->io_rchar != -1) && (entry->io_wchar != -1)) {
+    ps_update_counter(&ps->io_rchar, &pse->io_rchar, entry->io_rchar);
+    ps_update_counter(&ps->io_wchar, &pse->io_wchar, entry->io_wchar);
+  }
 
-    pse->age = 0;
+  if ((entry->io_syscr != -1) && (entry->io_syscw != -1)) {
+    ps_update_counter(&ps->io_syscr, &pse->io_syscr, entry->io_syscr);
+    ps_update_counter(&ps->io_syscw, &pse->io_syscw, entry->io_syscw);
+  }
 
-    ps->num_proc += entry->num_proc;
-    ps->num_lwp += entry->num_lwp;
-    ps->num_fd += entry->num_fd;
-    ps->vmem_size += entry->vmem_size;
-    ps->vmem_rss += entry->vmem_rss;
-    ps->vmem_data += entry->vmem_data;
-    ps->vmem_code += entry->vmem_code;
-    ps->stack_size += entry->stack_size;
+  if ((entry->io_diskr != -1) && (entry->io_diskw != -1)) {
+    ps_update_counter(&ps->io_diskr, &pse->io_diskr, entry->io_diskr);
+    ps_update_counter(&ps->io_diskw, &pse->io_diskw, entry->io_diskw);
+  }
 
-    if ((entry->io_rchar != -1) && (entry->io_wchar != -1)) {
-      ps_update_counter(&ps->io_rchar, &pse->io_rchar, entry->io_rchar);
-      ps_update_counter(&ps->io_wchar, &pse->io_wchar, entry->io_wchar);
-    }
+  if ((entry->cswitch_vol != -1) && (entry->cswitch_vol != -1)) {
+    ps_update_counter(&ps->cswitch_vol, &pse->cswitch_vol,
+                      entry->cswitch_vol);
+    ps_update_counter(&ps->cswitch_invol, &pse->cswitch_invol,
+                      entry->cswitch_invol);
+  }
 
-    if ((entry->io_syscr != -1) && (entry->io_syscw != -1)) {
-      ps_update_counter(&ps->io_syscr, &pse->io_syscr, entry->io_syscr);
-      ps_update_counter(&ps->io_syscw, &pse->io_syscw, entry->io_syscw);
-    }
+  ps_update_counter(&ps->vmem_minflt_counter, &pse->vmem_minflt_counter,
+                    entry->vmem_minflt_counter);
+  ps_update_counter(&ps->vmem_majflt_counter, &pse->vmem_majflt_counter,
+                    entry->vmem_majflt_counter);
 
-    if ((entry->io_diskr != -1) && (entry->io_diskw != -1)) {
-      ps_update_counter(&ps->io_diskr, &pse->io_diskr, entry->io_diskr);
-      ps_update_counter(&ps->io_diskw, &pse->io_diskw, entry->io_diskw);
-    }
+  ps_update_counter(&ps->cpu_user_counter, &pse->cpu_user_counter,
+                    entry->cpu_user_counter);
+  ps_update_counter(&ps->cpu_system_counter, &pse->cpu_system_counter,
+                    entry->cpu_system_counter);
+} /* void ps_list_update */
 
-    if ((entry->cswitch_vol != -1) && (entry->cswitch_vol != -1)) {
-      ps_update_counter(&ps->cswitch_vol, &pse->cswitch_vol,
-                        entry->cswitch_vol);
-      ps_update_counter(&ps->cswitch_invol, &pse->cswitch_invol,
-                        entry->cswitch_invol);
-    }
+#if !KERNEL_LINUX
+/* add process entry to 'instances' of process 'name' (or refresh it) */
+static void ps_list_add(const char *name, const char *cmdline,
+                        process_entry_t *entry) {
+  size_t matches_num;
 
-    ps_update_counter(&ps->vmem_minflt_counter, &pse->vmem_minflt_counter,
-                      entry->vmem_minflt_counter);
-    ps_update_counter(&ps->vmem_majflt_counter, &pse->vmem_majflt_counter,
-                      entry->vmem_majflt_counter);
+  if ((entry->id == 0) || (ps_index.procstat_num == 0))
+    return;
 
-    ps_update_counter(&ps->cpu_user_counter, &pse->cpu_user_counter,
-                      entry->cpu_user_counter);
-    ps_update_counter(&ps->cpu_system_counter, &pse->cpu_system_counter,
-                      entry->cpu_system_counter);
-  }
-}
+  matches_num =
+      ps_index_match(name, cmdline, ps_index.matches, ps_index.candidate);
+  for (size_t i = 0; i < matches_num; i++)
+    ps_list_update(ps_index.matches[i], entry);
+} /* void ps_list_add */
+#endif /* !KERNEL_LINUX */
 
 /* remove old entries from instances of processes in list_head_g */
 static void ps_list_reset(void) {
@@ -619,6 +830,34 @@ static int ps_config(oconfig_item_t *ci) {
       cf_util_get_boolean(c, &report_ctx_switch);
     } else if (strcasecmp(c->key, "CollectFileDescriptor") == 0) {
       cf_util_get_boolean(c, &report_fd_num);
+    } else if (strcasecmp(c->key, "ReadThreads") == 0) {
+#if KERNEL_LINUX
+      int tmp = 0;
+      if (cf_util_get_int(c, &tmp) != 0)
+        continue;
+      if (tmp < 1) {
+        ERROR("processes plugin: `ReadThreads' must be at least one.");
+        continue;
+      }
+      read_threads_num = (size_t)tmp;
+#else
+      WARNING("processes plugin: The `ReadThreads' option is only "
+              "supported on Linux and will be ignored.");
+#endif
+    } else if (strcasecmp(c->key, "ProcConnector") == 0) {
+#if KERNEL_LINUX && HAVE_LINUX_CN_PROC_H
+      cf_util_get_boolean(c, &use_proc_connector);
+#else
+      WARNING("processes plugin: The `ProcConnector' option is not "
+              "supported by this build and will be ignored.");
+#endif
+    } else if (strcasecmp(c->key, "Taskstats") == 0) {
+#if KERNEL_LINUX && HAVE_LINUX_TASKSTATS_H
+      cf_util_get_boolean(c, &use_taskstats);
+#else
+      WARNING("processes plugin: The `Taskstats' option is not "
+              "supported by this build and will be ignored.");
+#endif
     } else {
       ERROR("processes plugin: The `%s' configuration option is not "
             "understood and will be ignored.",
@@ -631,6 +870,11 @@ static int ps_config(oconfig_item_t *ci) {
 }
 
 static int ps_init(void) {
+  if (ps_index_create() != 0) {
+    ERROR("processes plugin: Creating the process index failed.");
+    return -1;
+  }
+
 #if HAVE_THREAD_INFO
   kern_return_t status;
 
@@ -656,6 +900,19 @@ static int ps_init(void) {
 #elif KERNEL_LINUX
   pagesize_g = sysconf(_SC_PAGESIZE);
   DEBUG("pagesize_g = %li; CONFIG_HZ = %i;", pagesize_g, CONFIG_HZ);
+
+#if HAVE_LINUX_CN_PROC_H
+  if (use_proc_connector && (proc_events_fd < 0) &&
+      (ps_proc_events_open() != 0))
+    WARNING("processes plugin: Not using the proc connector. Changes of a "
+            "process' command line will go unnoticed.");
+#endif
+#if HAVE_LINUX_TASKSTATS_H
+  if (use_taskstats && (taskstats_socks == NULL) &&
+      (ps_taskstats_open() != 0))
+    WARNING("processes plugin: Not using taskstats. Falling back to "
+            "reading context switches from /proc.");
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -1027,7 +1284,211 @@ static int ps_count_fd(int pid) {
   return (count >= 1) ? count : 1;
 } /* int ps_count_fd (pid) */
 
-static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
+#if HAVE_LINUX_TASKSTATS_H
+typedef union ps_genl_buffer_u {
+  struct nlmsghdr hdr;
+  char buffer[4096];
+} ps_genl_buffer_t;
+
+/* Returns the attribute "type" from a list of netlink attributes. */
+static struct nlattr *ps_nla_find(void *data, size_t data_len, uint16_t type) {
+  char *ptr = data;
+
+  while (data_len >= NLA_HDRLEN) {
+    struct nlattr *nla = (struct nlattr *)ptr;
+    size_t step;
+
+    if ((nla->nla_len < NLA_HDRLEN) || (nla->nla_len > data_len))
+      return NULL;
+
+    if ((nla->nla_type & NLA_TYPE_MASK) == type)
+      return nla;
+
+    step = NLA_ALIGN(nla->nla_len);
+    if (step >= data_len)
+      return NULL;
+    ptr += step;
+    data_len -= step;
+  }
+
+  return NULL;
+} /* struct nlattr *ps_nla_find */
+
+/* Sends a generic netlink request with a single attribute and waits for the
+ * matching reply. The socket must not be used by other threads at the same
+ * time. Returns the payload following the generic netlink header, or NULL on
+ * error. */
+static void *ps_genl_request(ps_taskstats_sock_t *sock, uint16_t family,
+                             uint8_t cmd, uint16_t attr_type, void const *attr,
+                             uint16_t attr_len, ps_genl_buffer_t *resp,
+                             size_t *ret_len) {
+  ps_genl_buffer_t req = {{0}};
+  struct nlmsghdr *nlh = &req.hdr;
+  struct genlmsghdr *genl;
+  struct nlattr *nla;
+  uint32_t seq = ++sock->seq;
+
+  if (NLMSG_SPACE(GENL_HDRLEN) + NLA_HDRLEN + attr_len > sizeof(req))
+    return NULL;
+
+  nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  nlh->nlmsg_type = family;
+  nlh->nlmsg_flags = NLM_F_REQUEST;
+  nlh->nlmsg_seq = seq;
+
+  genl = NLMSG_DATA(nlh);
+  genl->cmd = cmd;
+  genl->version = 1;
+
+  nla = (struct nlattr *)(req.buffer + NLMSG_ALIGN(nlh->nlmsg_len));
+  nla->nla_type = attr_type;
+  nla->nla_len = NLA_HDRLEN + attr_len;
+  memcpy((char *)nla + NLA_HDRLEN, attr, attr_len);
+  nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+
+  if (send(sock->fd, &req, nlh->nlmsg_len, /* flags = */ 0) < 0)
+    return NULL;
+
+  while (42) {
+    ssize_t status = recv(sock->fd, resp, sizeof(*resp), /* flags = */ 0);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      return NULL;
+    }
+
+    nlh = &resp->hdr;
+    if (!NLMSG_OK(nlh, (size_t)status))
+      return NULL;
+
+    /* Skip replies to requests that timed out earlier. */
+    if (nlh->nlmsg_seq != seq)
+      continue;
+
+    if (nlh->nlmsg_type == NLMSG_ERROR)
+      return NULL;
+    if (nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+      return NULL;
+
+    *ret_len = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    return (char *)NLMSG_DATA(nlh) + GENL_HDRLEN;
+  }
+} /* void *ps_genl_request */
+
+static void ps_taskstats_close(void) {
+  for (size_t i = 0; i < taskstats_socks_num; i++)
+    close(taskstats_socks[i].fd);
+  sfree(taskstats_socks);
+  taskstats_socks_num = 0;
+} /* void ps_taskstats_close */
+
+static int ps_taskstats_sock_open(ps_taskstats_sock_t *sock) {
+  struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+  struct timeval timeout = {.tv_sec = 1};
+
+  sock->seq = 0;
+  sock->fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+  if (sock->fd < 0) {
+    char errbuf[1024];
+    ERROR("processes plugin: Opening generic netlink socket failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  if ((bind(sock->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+      (setsockopt(sock->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                  sizeof(timeout)) != 0)) {
+    char errbuf[1024];
+    ERROR("processes plugin: Setting up generic netlink socket failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    close(sock->fd);
+    sock->fd = -1;
+    return -1;
+  }
+
+  return 0;
+} /* int ps_taskstats_sock_open */
+
+/* Opens one socket per scanner thread. Threads without a socket, e.g. because
+ * opening it failed, fall back to reading /proc. */
+static int ps_taskstats_open(void) {
+  ps_genl_buffer_t resp;
+  struct nlattr *nla;
+  void *payload;
+  size_t payload_len = 0;
+
+  taskstats_socks = calloc(read_threads_num, sizeof(*taskstats_socks));
+  if (taskstats_socks == NULL)
+    return -1;
+
+  for (taskstats_socks_num = 0; taskstats_socks_num < read_threads_num;
+       taskstats_socks_num++) {
+    if (ps_taskstats_sock_open(taskstats_socks + taskstats_socks_num) != 0)
+      break;
+  }
+  if (taskstats_socks_num == 0) {
+    ps_taskstats_close();
+    return -1;
+  }
+
+  payload = ps_genl_request(taskstats_socks, GENL_ID_CTRL, CTRL_CMD_GETFAMILY,
+                            CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME,
+                            sizeof(TASKSTATS_GENL_NAME), &resp, &payload_len);
+  nla = (payload != NULL)
+            ? ps_nla_find(payload, payload_len, CTRL_ATTR_FAMILY_ID)
+            : NULL;
+  if ((nla != NULL) && (nla->nla_len >= NLA_HDRLEN + sizeof(uint16_t)))
+    memcpy(&taskstats_family, (char *)nla + NLA_HDRLEN, sizeof(uint16_t));
+
+  if (taskstats_family == 0) {
+    ERROR("processes plugin: Resolving the \"" TASKSTATS_GENL_NAME "\" "
+          "generic netlink family failed. Is CONFIG_TASKSTATS enabled?");
+    ps_taskstats_close();
+    return -1;
+  }
+
+  return 0;
+} /* int ps_taskstats_open */
+
+/* Reads the context switches of all threads of a process with a single
+ * request, rather than reading /proc/pid/task/<tid>/status for each thread. */
+static int ps_taskstats_read(ps_taskstats_sock_t *sock, process_entry_t *ps) {
+  ps_genl_buffer_t resp;
+  struct taskstats stats = {0};
+  uint32_t tgid = (uint32_t)ps->id;
+  struct nlattr *aggr;
+  struct nlattr *nla = NULL;
+  void *payload;
+  size_t payload_len = 0;
+
+  payload = ps_genl_request(sock, taskstats_family, TASKSTATS_CMD_GET,
+                            TASKSTATS_CMD_ATTR_TGID, &tgid, sizeof(tgid),
+                            &resp, &payload_len);
+  aggr = (payload != NULL)
+             ? ps_nla_find(payload, payload_len, TASKSTATS_TYPE_AGGR_TGID)
+             : NULL;
+  if (aggr != NULL)
+    nla = ps_nla_find((char *)aggr + NLA_HDRLEN, aggr->nla_len - NLA_HDRLEN,
+                      TASKSTATS_TYPE_STATS);
+  if (nla != NULL) {
+    /* The structure only ever grows; older kernels send a shorter one. */
+    size_t len = nla->nla_len - NLA_HDRLEN;
+    if (len > sizeof(stats))
+      len = sizeof(stats);
+    memcpy(&stats, (char *)nla + NLA_HDRLEN, len);
+  }
+
+  if (nla == NULL)
+    return -1;
+
+  ps->cswitch_vol = (derive_t)stats.nvcsw;
+  ps->cswitch_invol = (derive_t)stats.nivcsw;
+  return 0;
+} /* int ps_taskstats_read */
+#endif /* HAVE_LINUX_TASKSTATS_H */
+
+static void ps_fill_details(const procstat_t *ps, process_entry_t *entry,
+                            ps_taskstats_sock_t *taskstats) {
   if (entry->has_io == 0) {
     ps_read_io(entry);
     entry->has_io = 1;
@@ -1035,7 +1496,13 @@ static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
 
   if (ps->report_ctx_switch) {
     if (entry->has_cswitch == 0) {
-      ps_read_tasks_status(entry);
+      int status = -1;
+#if HAVE_LINUX_TASKSTATS_H
+      if (taskstats != NULL)
+        status = ps_taskstats_read(taskstats, entry);
+#endif
+      if (status != 0)
+        ps_read_tasks_status(entry);
       entry->has_cswitch = 1;
     }
   }
@@ -1049,7 +1516,8 @@ static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
   }
 } /* void ps_fill_details (...) */
 
-static int ps_read_process(long pid, process_entry_t *ps, char *state) {
+static int ps_read_process(long pid, process_entry_t *ps, char *state,
+                           unsigned long long *starttime) {
   char filename[64];
   char buffer[1024];
 
@@ -1119,18 +1587,15 @@ static int ps_read_process(long pid, process_entry_t *ps, char *state) {
   }
 
   *state = fields[0][0];
+  *starttime = strtoull(fields[19], /* endptr = */ NULL, /* base = */ 10);
 
+  /* /proc/pid/status is only read for matched processes, see
+   * ps_read_details(). */
   if (*state == 'Z') {
     ps->num_lwp = 0;
     ps->num_proc = 0;
   } else {
     ps->num_lwp = strtoul(fields[17], /* endptr = */ NULL, /* base = */ 10);
-    if ((ps_read_status(pid, ps)) != 0) {
-      /* No VMem data */
-      ps->vmem_data = -1;
-      ps->vmem_code = -1;
-      DEBUG("ps_read_process: did not get vmem data for pid %li", pid);
-    }
     if (ps->num_lwp == 0)
       ps->num_lwp = 1;
     ps->num_proc = 1;
@@ -1318,6 +1783,647 @@ static int read_fork_rate(void) {
   ps_submit_fork_rate(value.derive);
   return 0;
 }
+
+static int ps_cache_compare(const void *a, const void *b) {
+  long pid_a = *((const long *)a);
+  long pid_b = *((const long *)b);
+
+  if (pid_a < pid_b)
+    return -1;
+  else if (pid_a > pid_b)
+    return 1;
+  return 0;
+} /* int ps_cache_compare */
+
+static void ps_cache_entry_free(ps_cache_entry_t *ce) {
+  if (ce == NULL)
+    return;
+
+  sfree(ce->name);
+  sfree(ce->matches);
+  sfree(ce);
+} /* void ps_cache_entry_free */
+
+/* Matches a process against all configured "Process" and "ProcessMatch"
+ * blocks. The command line is only read if a regular expression needs it. */
+static ps_cache_entry_t *ps_cache_entry_create(long pid,
+                                               unsigned long long starttime,
+                                               char *name, _Bool *candidate) {
+  ps_cache_entry_t *ce;
+  char cmdline_buffer[CMDLINE_BUFFER_SIZE];
+  char *cmdline = NULL;
+
+  ce = calloc(1, sizeof(*ce));
+  if (ce == NULL)
+    return NULL;
+
+  ce->pid = pid;
+  ce->starttime = starttime;
+  ce->name = strdup(name);
+  if (ce->name == NULL) {
+    sfree(ce);
+    return NULL;
+  }
+
+  if (ps_index.procstat_num == 0)
+    return ce;
+
+  ce->matches = calloc(ps_index.procstat_num, sizeof(*ce->matches));
+  if (ce->matches == NULL) {
+    ps_cache_entry_free(ce);
+    return NULL;
+  }
+
+  if (ps_index.regex_num > 0)
+    cmdline =
+        ps_get_cmdline(pid, name, cmdline_buffer, sizeof(cmdline_buffer));
+
+  ce->matches_num = ps_index_match(name, cmdline, ce->matches, candidate);
+  if (ce->matches_num == 0) {
+    sfree(ce->matches);
+  } else if (ce->matches_num < ps_index.procstat_num) {
+    procstat_t **tmp =
+        realloc(ce->matches, ce->matches_num * sizeof(*ce->matches));
+    if (tmp != NULL)
+      ce->matches = tmp;
+  }
+
+  return ce;
+} /* ps_cache_entry_t *ps_cache_entry_create */
+
+/* Reads the files only needed for processes that are reported individually. */
+static void ps_read_details(ps_cache_entry_t *ce, process_entry_t *entry,
+                            char state, ps_taskstats_sock_t *taskstats) {
+  if (state != 'Z') {
+    if (ps_read_status(entry->id, entry) != 0) {
+      /* No VMem data */
+      entry->vmem_data = -1;
+      entry->vmem_code = -1;
+      DEBUG("ps_read_details: did not get vmem data for pid %lu", entry->id);
+    }
+  }
+
+  for (size_t i = 0; i < ce->matches_num; i++)
+    ps_fill_details(ce->matches[i], entry, taskstats);
+} /* void ps_read_details */
+
+/* Called from the scanner threads. Only reads from "ps_cache"; new cache
+ * entries are returned in the slot and inserted by ps_read(). */
+static void ps_scan_pid(ps_scan_t *scan, ps_scan_slot_t *slot) {
+  process_entry_t pse = {0};
+  unsigned long long starttime;
+  ps_cache_entry_t *ce = NULL;
+
+  pse.id = (unsigned long)slot->pid;
+
+  if (ps_read_process(slot->pid, &pse, &slot->state, &starttime) != 0) {
+    DEBUG("processes plugin: ps_read_process (%li) failed.", slot->pid);
+    slot->state = 0;
+    return;
+  }
+
+  if ((c_avl_get(ps_cache, &slot->pid, (void *)&ce) != 0) ||
+      (ce->starttime != starttime) || (strcmp(ce->name, pse.name) != 0)) {
+    ce = ps_cache_entry_create(slot->pid, starttime, pse.name, scan->candidate);
+    if (ce == NULL) {
+      ERROR("processes plugin: ps_cache_entry_create failed.");
+      return;
+    }
+    slot->ce_new = 1;
+  }
+  slot->ce = ce;
+
+  if (ce->matches_num == 0)
+    return;
+
+  ps_read_details(ce, &pse, slot->state, scan->taskstats);
+
+  slot->entry = malloc(sizeof(*slot->entry));
+  if (slot->entry == NULL) {
+    ERROR("processes plugin: malloc failed.");
+    return;
+  }
+  memcpy(slot->entry, &pse, sizeof(*slot->entry));
+} /* void ps_scan_pid */
+
+static void *ps_scan_thread(void *arg) {
+  ps_scan_t *scan = arg;
+
+  for (size_t i = scan->offset; i < scan->slots_num; i += scan->stride)
+    ps_scan_pid(scan, scan->slots + i);
+
+  return NULL;
+} /* void *ps_scan_thread */
+
+/* Returns the taskstats socket of the scanner thread "index", if any. */
+static ps_taskstats_sock_t *ps_scan_taskstats(size_t index) {
+#if HAVE_LINUX_TASKSTATS_H
+  if (index < taskstats_socks_num)
+    return taskstats_socks + index;
+#endif
+  return NULL;
+} /* ps_taskstats_sock_t *ps_scan_taskstats */
+
+/* Distributes the slots over "read_threads_num" threads, one of which is the
+ * calling thread. */
+static void ps_scan(ps_scan_slot_t *slots, size_t slots_num) {
+  size_t threads_num = read_threads_num;
+  size_t candidate_num = ps_index.regex_num + 1;
+  ps_scan_t *scans;
+  pthread_t *threads;
+  _Bool *candidates;
+
+  if (threads_num > slots_num)
+    threads_num = slots_num;
+
+  scans = calloc(threads_num, sizeof(*scans));
+  threads = calloc(threads_num, sizeof(*threads));
+  candidates = calloc(threads_num * candidate_num, sizeof(*candidates));
+  if ((threads_num <= 1) || (scans == NULL) || (threads == NULL) ||
+      (candidates == NULL)) {
+    sfree(scans);
+    sfree(threads);
+    sfree(candidates);
+    ps_scan_thread(&(ps_scan_t){
+        .slots = slots,
+        .slots_num = slots_num,
+        .stride = 1,
+        .taskstats = ps_scan_taskstats(0),
+        .candidate = ps_index.candidate,
+    });
+    return;
+  }
+
+  for (size_t i = 0; i < threads_num; i++) {
+    scans[i].slots = slots;
+    scans[i].slots_num = slots_num;
+    scans[i].offset = i;
+    scans[i].stride = threads_num;
+    scans[i].taskstats = ps_scan_taskstats(i);
+    scans[i].candidate = candidates + i * candidate_num;
+  }
+
+  /* Slot zero is handled by the calling thread. A scan whose thread failed
+   * to start is marked by setting its stride to zero. */
+  for (size_t i = 1; i < threads_num; i++) {
+    int status = plugin_thread_create(&threads[i], /* attr = */ NULL,
+                                      ps_scan_thread, scans + i, "processes");
+    if (status != 0) {
+      char errbuf[1024];
+      WARNING("processes plugin: Starting scanner thread failed: %s",
+              sstrerror(status, errbuf, sizeof(errbuf)));
+      scans[i].stride = 0;
+    }
+  }
+
+  ps_scan_thread(scans);
+
+  for (size_t i = 1; i < threads_num; i++) {
+    if (scans[i].stride != 0) {
+      pthread_join(threads[i], /* retval = */ NULL);
+      continue;
+    }
+
+    scans[i].stride = threads_num;
+    ps_scan_thread(scans + i);
+  }
+
+  sfree(scans);
+  sfree(threads);
+  sfree(candidates);
+} /* void ps_scan */
+
+static int ps_slots_add(ps_scan_slot_t **slots, size_t *slots_num,
+                        size_t *slots_size, long pid) {
+  if (*slots_num >= *slots_size) {
+    size_t new_size = (*slots_size == 0) ? 1024 : 2 * *slots_size;
+    ps_scan_slot_t *tmp = realloc(*slots, new_size * sizeof(**slots));
+    if (tmp == NULL) {
+      ERROR("processes plugin: realloc failed.");
+      return ENOMEM;
+    }
+    *slots = tmp;
+    *slots_size = new_size;
+  }
+
+  (*slots)[*slots_num] = (ps_scan_slot_t){.pid = pid};
+  (*slots_num)++;
+  return 0;
+} /* int ps_slots_add */
+
+/* Lists the processes in /proc. */
+static int ps_slots_list(ps_scan_slot_t **slots, size_t *slots_num,
+                         size_t *slots_size) {
+  struct dirent *ent;
+  DIR *proc;
+  long pid;
+
+  if ((proc = opendir("/proc")) == NULL) {
+    char errbuf[1024];
+    ERROR("Cannot open `/proc': %s", sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  while ((ent = readdir(proc)) != NULL) {
+    if (!isdigit(ent->d_name[0]))
+      continue;
+
+    if ((pid = atol(ent->d_name)) < 1)
+      continue;
+
+    if (ps_slots_add(slots, slots_num, slots_size, pid) != 0)
+      break;
+  }
+
+  closedir(proc);
+  return 0;
+} /* int ps_slots_list */
+
+/* Inserts a new cache entry, replacing a stale entry for a reused PID. */
+static int ps_cache_insert(ps_cache_entry_t *ce) {
+  long *old_key = NULL;
+  ps_cache_entry_t *old = NULL;
+
+  if (c_avl_remove(ps_cache, &ce->pid, (void *)&old_key, (void *)&old) == 0)
+    ps_cache_entry_free(old);
+
+  if (c_avl_insert(ps_cache, &ce->pid, ce) != 0) {
+    ERROR("processes plugin: c_avl_insert failed.");
+    ps_cache_entry_free(ce);
+    return -1;
+  }
+
+  return 0;
+} /* int ps_cache_insert */
+
+/* Removes entries of processes which weren't seen during the last scan. */
+static void ps_cache_expire(void) {
+  c_avl_iterator_t *iter;
+  long *key;
+  ps_cache_entry_t *ce;
+  long *expired = NULL;
+  size_t expired_num = 0;
+
+  iter = c_avl_get_iterator(ps_cache);
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&ce) == 0) {
+    long *tmp;
+
+    if (ce->generation == ps_cache_generation)
+      continue;
+
+    tmp = realloc(expired, (expired_num + 1) * sizeof(*expired));
+    if (tmp == NULL)
+      break;
+    expired = tmp;
+    expired[expired_num] = ce->pid;
+    expired_num++;
+  }
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < expired_num; i++) {
+    if (c_avl_remove(ps_cache, &expired[i], (void *)&key, (void *)&ce) == 0)
+      ps_cache_entry_free(ce);
+  }
+  sfree(expired);
+} /* void ps_cache_expire */
+
+#if HAVE_LINUX_CN_PROC_H
+/* Adds a PID to the process table. Must be called with "proc_events_lock"
+ * held. */
+static int ps_proc_events_table_add(long pid) {
+  long *key = malloc(sizeof(*key));
+  if (key == NULL)
+    return ENOMEM;
+  *key = pid;
+
+  int status = c_avl_insert(proc_events_table, key, /* value = */ NULL);
+  if (status != 0) {
+    sfree(key);
+    /* Already in the table. */
+    if (status > 0)
+      return 0;
+  }
+  return status;
+} /* int ps_proc_events_table_add */
+
+/* Must be called with "proc_events_lock" held. */
+static void ps_proc_events_table_remove(long pid) {
+  long *key = NULL;
+  void *unused;
+
+  if (c_avl_remove(proc_events_table, &pid, (void *)&key, &unused) == 0)
+    sfree(key);
+} /* void ps_proc_events_table_remove */
+
+/* Must be called with "proc_events_lock" held. */
+static void ps_proc_events_table_clear(void) {
+  long *key;
+  void *unused;
+
+  if (proc_events_table == NULL)
+    return;
+
+  while (c_avl_pick(proc_events_table, (void *)&key, &unused) == 0)
+    sfree(key);
+} /* void ps_proc_events_table_clear */
+
+/* Must be called with "proc_events_lock" held. */
+static void ps_proc_events_add(long pid) {
+  if (proc_events_pids_num >= proc_events_pids_size) {
+    size_t new_size =
+        (proc_events_pids_size == 0) ? 256 : 2 * proc_events_pids_size;
+    long *tmp = realloc(proc_events_pids, new_size * sizeof(*tmp));
+    if (tmp == NULL) {
+      /* Treat like a lost event: ps_read() will start over. */
+      proc_events_lost = 1;
+      return;
+    }
+    proc_events_pids = tmp;
+    proc_events_pids_size = new_size;
+  }
+  proc_events_pids[proc_events_pids_num] = pid;
+  proc_events_pids_num++;
+} /* void ps_proc_events_add */
+
+static void ps_proc_events_handle(struct proc_event const *ev) {
+  pthread_mutex_lock(&proc_events_lock);
+  switch (ev->what) {
+  case PROC_EVENT_FORK:
+    /* Fork events are also sent for new threads, which aren't processes. */
+    if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+      break;
+    if (ps_proc_events_table_add((long)ev->event_data.fork.child_tgid) != 0)
+      proc_events_lost = 1;
+    break;
+
+  case PROC_EVENT_EXEC:
+    /* exec(2) keeps the PID and start time but changes the command line.
+     * PID reuse is detected by ps_scan_pid() using the start time. */
+    ps_proc_events_add((long)ev->event_data.exec.process_tgid);
+    break;
+
+  default:
+    break;
+  }
+  pthread_mutex_unlock(&proc_events_lock);
+} /* void ps_proc_events_handle */
+
+static void ps_proc_events_fail(void) {
+  pthread_mutex_lock(&proc_events_lock);
+  proc_events_lost = 1;
+  proc_events_thread_failed = 1;
+  pthread_mutex_unlock(&proc_events_lock);
+} /* void ps_proc_events_fail */
+
+static void *ps_proc_events_thread(void *arg __attribute__((unused))) {
+  union {
+    struct nlmsghdr hdr;
+    char buffer[8192];
+  } msg;
+
+  while (!proc_events_thread_shutdown) {
+    struct pollfd pfd = {.fd = proc_events_fd, .events = POLLIN};
+    ssize_t len;
+
+    if (poll(&pfd, 1, /* timeout = */ 1000) <= 0)
+      continue;
+
+    len = recv(proc_events_fd, &msg, sizeof(msg), /* flags = */ 0);
+    if (len < 0) {
+      char errbuf[1024];
+
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+
+      if (errno == ENOBUFS) {
+        /* The socket buffer overflowed and events were dropped. */
+        pthread_mutex_lock(&proc_events_lock);
+        proc_events_lost = 1;
+        pthread_mutex_unlock(&proc_events_lock);
+        continue;
+      }
+
+      /* ps_read() notices the failure and restarts the listener. */
+      ERROR("processes plugin: Receiving from the proc connector failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      ps_proc_events_fail();
+      break;
+    }
+
+    for (struct nlmsghdr *nlh = &msg.hdr; NLMSG_OK(nlh, (size_t)len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      struct cn_msg *cn;
+      struct proc_event ev = {0};
+
+      if ((nlh->nlmsg_type == NLMSG_ERROR) || (nlh->nlmsg_type == NLMSG_NOOP))
+        continue;
+
+      cn = NLMSG_DATA(nlh);
+      if ((cn->id.idx != CN_IDX_PROC) || (cn->id.val != CN_VAL_PROC))
+        continue;
+
+      /* The event follows the 20 byte connector header and is not aligned. */
+      memcpy(&ev, cn->data,
+             (cn->len < sizeof(ev)) ? (size_t)cn->len : sizeof(ev));
+      ps_proc_events_handle(&ev);
+    }
+  }
+
+  return NULL;
+} /* void *ps_proc_events_thread */
+
+static void ps_proc_events_close(void) {
+  if (proc_events_thread_running) {
+    proc_events_thread_shutdown = 1;
+    pthread_join(proc_events_thread, /* retval = */ NULL);
+    proc_events_thread_running = 0;
+  }
+
+  if (proc_events_fd >= 0)
+    close(proc_events_fd);
+  proc_events_fd = -1;
+
+  pthread_mutex_lock(&proc_events_lock);
+  sfree(proc_events_pids);
+  proc_events_pids_num = 0;
+  proc_events_pids_size = 0;
+  ps_proc_events_table_clear();
+  proc_events_lost = 1;
+  proc_events_thread_failed = 0;
+  pthread_mutex_unlock(&proc_events_lock);
+} /* void ps_proc_events_close */
+
+/* Subscribes to the kernel's proc connector. Requires CAP_NET_ADMIN. The
+ * process table starts out empty and is filled by the next ps_read(). */
+static int ps_proc_events_open(void) {
+  struct sockaddr_nl addr = {.nl_family = AF_NETLINK,
+                             .nl_groups = CN_IDX_PROC};
+  union {
+    struct nlmsghdr hdr;
+    char buffer[NLMSG_SPACE(sizeof(struct cn_msg) +
+                            sizeof(enum proc_cn_mcast_op))];
+  } req = {{0}};
+  struct cn_msg *cn;
+  enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+  int status;
+
+  pthread_mutex_lock(&proc_events_lock);
+  if (proc_events_table == NULL)
+    proc_events_table = c_avl_create(ps_cache_compare);
+  pthread_mutex_unlock(&proc_events_lock);
+  if (proc_events_table == NULL) {
+    ERROR("processes plugin: c_avl_create failed.");
+    return -1;
+  }
+
+  proc_events_fd =
+      socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (proc_events_fd < 0) {
+    char errbuf[1024];
+    ERROR("processes plugin: Opening proc connector socket failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(*cn) + sizeof(op));
+  req.hdr.nlmsg_type = NLMSG_DONE;
+  cn = NLMSG_DATA(&req.hdr);
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(op);
+  memcpy(cn->data, &op, sizeof(op));
+
+  if ((bind(proc_events_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+      (send(proc_events_fd, &req, req.hdr.nlmsg_len, /* flags = */ 0) < 0)) {
+    char errbuf[1024];
+    ERROR("processes plugin: Subscribing to the proc connector failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    ps_proc_events_close();
+    return -1;
+  }
+
+  proc_events_thread_shutdown = 0;
+  status = plugin_thread_create(&proc_events_thread, /* attr = */ NULL,
+                                ps_proc_events_thread, /* arg = */ NULL,
+                                "processes events");
+  if (status != 0) {
+    char errbuf[1024];
+    ERROR("processes plugin: Starting proc connector thread failed: %s",
+          sstrerror(status, errbuf, sizeof(errbuf)));
+    ps_proc_events_close();
+    return -1;
+  }
+  proc_events_thread_running = 1;
+
+  return 0;
+} /* int ps_proc_events_open */
+
+/* Restarts the listener thread if it exited because of an error. The restart
+ * is retried on every read until it succeeds. */
+static void ps_proc_events_check(void) {
+  static _Bool restart = 0;
+  _Bool failed;
+
+  pthread_mutex_lock(&proc_events_lock);
+  failed = proc_events_thread_failed;
+  pthread_mutex_unlock(&proc_events_lock);
+
+  if (failed) {
+    ps_proc_events_close();
+    restart = 1;
+  }
+
+  if (!restart)
+    return;
+
+  if (ps_proc_events_open() != 0) {
+    c_complain(LOG_ERR, &proc_events_complaint,
+               "processes plugin: Restarting the proc connector listener "
+               "failed. Listing /proc instead.");
+    return;
+  }
+
+  restart = 0;
+  c_release(LOG_INFO, &proc_events_complaint,
+            "processes plugin: The proc connector listener has been "
+            "restarted.");
+} /* void ps_proc_events_check */
+
+/* Drops cache entries of processes that called exec(2) since the last read
+ * and appends the PIDs in the process table to "slots". If events may have
+ * been lost, all cache entries are dropped and -1 is returned; the caller
+ * then lists /proc and passes the result to ps_proc_events_sync(). */
+static int ps_proc_events_apply(ps_scan_slot_t **slots, size_t *slots_num,
+                                size_t *slots_size) {
+  long *key;
+  ps_cache_entry_t *ce;
+  int status = 0;
+
+  ps_proc_events_check();
+  if (proc_events_fd < 0)
+    return -1;
+
+  pthread_mutex_lock(&proc_events_lock);
+  if (proc_events_lost) {
+    while (c_avl_pick(ps_cache, (void *)&key, (void *)&ce) == 0)
+      ps_cache_entry_free(ce);
+    /* Losses from here on are caught by the next read. */
+    proc_events_lost = 0;
+    status = -1;
+  } else {
+    for (size_t i = 0; i < proc_events_pids_num; i++) {
+      if (c_avl_remove(ps_cache, &proc_events_pids[i], (void *)&key,
+                       (void *)&ce) == 0)
+        ps_cache_entry_free(ce);
+    }
+
+    void *unused;
+    c_avl_iterator_t *iter = c_avl_get_iterator(proc_events_table);
+    while (c_avl_iterator_next(iter, (void *)&key, &unused) == 0) {
+      if (ps_slots_add(slots, slots_num, slots_size, *key) != 0) {
+        status = -1;
+        break;
+      }
+    }
+    c_avl_iterator_destroy(iter);
+  }
+  proc_events_pids_num = 0;
+  pthread_mutex_unlock(&proc_events_lock);
+
+  return status;
+} /* int ps_proc_events_apply */
+
+/* Adds the PIDs found in /proc to the process table. Processes which exited in
+ * the meantime are removed again by ps_proc_events_expire(). */
+static void ps_proc_events_sync(ps_scan_slot_t const *slots, size_t slots_num) {
+  if (proc_events_fd < 0)
+    return;
+
+  pthread_mutex_lock(&proc_events_lock);
+  for (size_t i = 0; i < slots_num; i++) {
+    if (ps_proc_events_table_add(slots[i].pid) != 0) {
+      proc_events_lost = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&proc_events_lock);
+} /* void ps_proc_events_sync */
+
+/* Removes processes that could not be read, i.e. that have exited and been
+ * reaped, from the process table. */
+static void ps_proc_events_expire(ps_scan_slot_t const *slots,
+                                  size_t slots_num) {
+  if (proc_events_fd < 0)
+    return;
+
+  pthread_mutex_lock(&proc_events_lock);
+  for (size_t i = 0; i < slots_num; i++) {
+    if (slots[i].state == 0)
+      ps_proc_events_table_remove(slots[i].pid);
+  }
+  pthread_mutex_unlock(&proc_events_lock);
+} /* void ps_proc_events_expire */
+#endif /* HAVE_LINUX_CN_PROC_H */
 #endif /*KERNEL_LINUX */
 
 #if KERNEL_SOLARIS
@@ -1352,7 +2458,8 @@ static char *ps_get_cmdline(long pid,
  * The values for input and ouput chars are calculated "by hand"
  * Added a few "solaris" specific process states as well
  */
-static int ps_read_process(long pid, process_entry_t *ps, char *state) {
+static int ps_read_process(long pid, process_entry_t *ps, char *state,
+                           unsigned long long *starttime) {
   char filename[64];
   char f_psinfo[64], f_usage[64];
   char *buffer;
@@ -1780,42 +2887,48 @@ static int ps_read(void) {
   int paging = 0;
   int blocked = 0;
 
-  struct dirent *ent;
-  DIR *proc;
-  long pid;
-
-  char cmdline[CMDLINE_BUFFER_SIZE];
+  ps_scan_slot_t *slots = NULL;
+  size_t slots_num = 0;
+  size_t slots_size = 0;
 
-  int status;
-  process_entry_t pse;
-  char state;
-
-  running = sleeping = zombies = stopped = paging = blocked = 0;
   ps_list_reset();
 
-  if ((proc = opendir("/proc")) == NULL) {
-    char errbuf[1024];
-    ERROR("Cannot open `/proc': %s", sstrerror(errno, errbuf, sizeof(errbuf)));
-    return -1;
+  if (ps_cache == NULL) {
+    ps_cache = c_avl_create(ps_cache_compare);
+    if (ps_cache == NULL) {
+      ERROR("processes plugin: c_avl_create failed.");
+      return -1;
+    }
   }
 
-  while ((ent = readdir(proc)) != NULL) {
-    if (!isdigit(ent->d_name[0]))
-      continue;
+  _Bool listed = 0;
+#if HAVE_LINUX_CN_PROC_H
+  if (use_proc_connector)
+    listed = (ps_proc_events_apply(&slots, &slots_num, &slots_size) == 0);
+#endif
 
-    if ((pid = atol(ent->d_name)) < 1)
-      continue;
+  if (!listed) {
+    slots_num = 0;
+    if (ps_slots_list(&slots, &slots_num, &slots_size) != 0) {
+      sfree(slots);
+      return -1;
+    }
+#if HAVE_LINUX_CN_PROC_H
+    ps_proc_events_sync(slots, slots_num);
+#endif
+  }
 
-    memset(&pse, 0, sizeof(pse));
-    pse.id = pid;
+  ps_scan(slots, slots_num);
+#if HAVE_LINUX_CN_PROC_H
+  ps_proc_events_expire(slots, slots_num);
+#endif
 
-    status = ps_read_process(pid, &pse, &state);
-    if (status != 0) {
-      DEBUG("ps_read_process failed: %i", status);
-      continue;
-    }
+  /* Merge the results. Everything below runs single-threaded again. */
+  ps_cache_generation++;
+  for (size_t i = 0; i < slots_num; i++) {
+    ps_scan_slot_t *slot = slots + i;
 
-    switch (state) {
+    switch (slot->state) {
     case 'R':
       running++;
       break;
@@ -1836,11 +2949,25 @@ static int ps_read(void) {
       break;
     }
 
-    ps_list_add(pse.name,
-                ps_get_cmdline(pid, pse.name, cmdline, sizeof(cmdline)), &pse);
+    if (slot->ce == NULL)
+      continue;
+
+    if (slot->ce_new && (ps_cache_insert(slot->ce) != 0)) {
+      sfree(slot->entry);
+      continue;
+    }
+    slot->ce->generation = ps_cache_generation;
+
+    if (slot->entry == NULL)
+      continue;
+
+    for (size_t j = 0; j < slot->ce->matches_num; j++)
+      ps_list_update(slot->ce->matches[j], slot->entry);
+    sfree(slot->entry);
   }
+  sfree(slots);
 
-  closedir(proc);
+  ps_cache_expire();
 
   ps_submit_state("running", running);
   ps_submit_state("sleeping", sleeping);
@@ -2389,8 +3516,38 @@ static int ps_read(void) {
   return 0;
 } /* int ps_read */
 
+static int ps_shutdown(void) {
+#if KERNEL_LINUX
+#if HAVE_LINUX_CN_PROC_H
+  ps_proc_events_close();
+  if (proc_events_table != NULL) {
+    c_avl_destroy(proc_events_table);
+    proc_events_table = NULL;
+  }
+#endif
+#if HAVE_LINUX_TASKSTATS_H
+  ps_taskstats_close();
+#endif
+
+  if (ps_cache != NULL) {
+    long *key;
+    ps_cache_entry_t *ce;
+
+    while (c_avl_pick(ps_cache, (void *)&key, (void *)&ce) == 0)
+      ps_cache_entry_free(ce);
+    c_avl_destroy(ps_cache);
+    ps_cache = NULL;
+  }
+#endif /* KERNEL_LINUX */
+
+  ps_index_destroy();
+
+  return 0;
+} /* int ps_shutdown */
+
 void module_register(void) {
   plugin_register_complex_config("processes", ps_config);
   plugin_register_init("processes", ps_init);
   plugin_register_read("processes", ps_read);
+  plugin_register_shutdown("processes", ps_shutdown);
 } /* void module_register */
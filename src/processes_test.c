@@ -0,0 +1,157 @@
+/**
+ * collectd - src/processes_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "processes.c" /* sic */
+#include "testing.h"
+
+#if KERNEL_LINUX
+static ps_scan_slot_t *find_slot(ps_scan_slot_t *slots, size_t slots_num,
+                                 long pid) {
+  for (size_t i = 0; i < slots_num; i++)
+    if (slots[i].pid == pid)
+      return slots + i;
+  return NULL;
+}
+
+DEF_TEST(slots_list) {
+  ps_scan_slot_t *slots = NULL;
+  size_t slots_num = 0;
+  size_t slots_size = 0;
+
+  EXPECT_EQ_INT(0, ps_slots_list(&slots, &slots_num, &slots_size));
+  OK(slots_num > 0);
+  OK(slots_num <= slots_size);
+  OK(find_slot(slots, slots_num, (long)getpid()) != NULL);
+
+  sfree(slots);
+  return 0;
+}
+#endif
+
+#if HAVE_LINUX_CN_PROC_H
+static void send_fork(pid_t pid, pid_t tgid) {
+  struct proc_event ev = {.what = PROC_EVENT_FORK};
+  ev.event_data.fork.child_pid = pid;
+  ev.event_data.fork.child_tgid = tgid;
+  ps_proc_events_handle(&ev);
+}
+
+static void send_exec(pid_t pid) {
+  struct proc_event ev = {.what = PROC_EVENT_EXEC};
+  ev.event_data.exec.process_pid = pid;
+  ev.event_data.exec.process_tgid = pid;
+  ps_proc_events_handle(&ev);
+}
+
+static void send_exit(pid_t pid) {
+  struct proc_event ev = {.what = PROC_EVENT_EXIT};
+  ev.event_data.exit.process_pid = pid;
+  ev.event_data.exit.process_tgid = pid;
+  ps_proc_events_handle(&ev);
+}
+
+static int cache_add(long pid) {
+  ps_cache_entry_t *ce = calloc(1, sizeof(*ce));
+  CHECK_NOT_NULL(ce);
+  ce->pid = pid;
+  ce->name = strdup("test");
+  return ps_cache_insert(ce);
+}
+
+DEF_TEST(proc_events) {
+  ps_scan_slot_t *slots = NULL;
+  size_t slots_num = 0;
+  size_t slots_size = 0;
+
+  CHECK_NOT_NULL(ps_cache = c_avl_create(ps_cache_compare));
+  CHECK_NOT_NULL(proc_events_table = c_avl_create(ps_cache_compare));
+  /* ps_proc_events_apply() only looks at the table if the connector is open.
+   * The descriptor is never used. */
+  proc_events_fd = 1000;
+
+  /* The table starts out unsynchronized, so /proc has to be listed. */
+  EXPECT_EQ_INT(0, cache_add(100));
+  EXPECT_EQ_INT(-1, ps_proc_events_apply(&slots, &slots_num, &slots_size));
+  EXPECT_EQ_INT(0, c_avl_size(ps_cache));
+
+  ps_scan_slot_t listed[] = {{.pid = 100}, {.pid = 101}};
+  ps_proc_events_sync(listed, STATIC_ARRAY_SIZE(listed));
+  EXPECT_EQ_INT(2, c_avl_size(proc_events_table));
+
+  /* New processes are added, new threads and exits are ignored. */
+  send_fork(102, 102);
+  send_fork(103, 102);
+  send_fork(101, 101);
+  send_exit(100);
+  EXPECT_EQ_INT(3, c_avl_size(proc_events_table));
+
+  /* exec(2) drops the cached match result of that process only. */
+  EXPECT_EQ_INT(0, cache_add(101));
+  EXPECT_EQ_INT(0, cache_add(102));
+  send_exec(102);
+  EXPECT_EQ_INT(0, ps_proc_events_apply(&slots, &slots_num, &slots_size));
+  EXPECT_EQ_INT(3, slots_num);
+  for (long pid = 100; pid <= 102; pid++)
+    OK(find_slot(slots, slots_num, pid) != NULL);
+  EXPECT_EQ_INT(1, c_avl_size(ps_cache));
+  EXPECT_EQ_INT(0, proc_events_pids_num);
+
+  /* Processes which couldn't be read have been reaped. */
+  find_slot(slots, slots_num, 100)->state = 0;
+  find_slot(slots, slots_num, 101)->state = 'S';
+  find_slot(slots, slots_num, 102)->state = 'Z';
+  ps_proc_events_expire(slots, slots_num);
+  EXPECT_EQ_INT(2, c_avl_size(proc_events_table));
+
+  /* After lost events, everything starts over. */
+  proc_events_lost = 1;
+  slots_num = 0;
+  EXPECT_EQ_INT(-1, ps_proc_events_apply(&slots, &slots_num, &slots_size));
+  EXPECT_EQ_INT(0, slots_num);
+  EXPECT_EQ_INT(0, c_avl_size(ps_cache));
+  slots_num = 0;
+  EXPECT_EQ_INT(0, ps_proc_events_apply(&slots, &slots_num, &slots_size));
+  EXPECT_EQ_INT(2, slots_num);
+
+  proc_events_fd = -1;
+  ps_proc_events_close();
+  EXPECT_EQ_INT(0, c_avl_size(proc_events_table));
+  EXPECT_EQ_INT(1, proc_events_lost);
+  c_avl_destroy(proc_events_table);
+  proc_events_table = NULL;
+  c_avl_destroy(ps_cache);
+  ps_cache = NULL;
+  sfree(slots);
+  return 0;
+}
+#endif
+
+int main(void) {
+#if KERNEL_LINUX
+  RUN_TEST(slots_list);
+#endif
+#if HAVE_LINUX_CN_PROC_H
+  RUN_TEST(proc_events);
+#endif
+
+  END_TEST;
+}
@@ -172,6 +172,36 @@ static char reg_write_doc[] =
     "data: The optional data parameter passed to the register function.\n"
     "    If the parameter was omitted it will be omitted here, too.";
 
+static char reg_write_batch_doc[] =
+    "register_write_batch(callback[, data][, name][, size][, timeout])\n"
+    "    -> identifier\n"
+    "\n"
+    "Register a callback function to receive values dispatched by other "
+    "plugins\n"
+    "in batches. Values are buffered without holding the GIL and handed to\n"
+    "the callback in a single call.\n"
+    "'callback' is a callable object that will be called with a batch of\n"
+    "    values.\n"
+    "'data' is an optional object that will be passed back to the callback\n"
+    "    function every time it is called.\n"
+    "'name' is an optional identifier for this callback. The default name\n"
+    "    is 'python.<module>'.\n"
+    "    Every callback needs a unique identifier, so if you want to\n"
+    "    register this callback multiple time from the same module you need\n"
+    "    to specify a name here.\n"
+    "'size' is the maximum number of value lists in a batch. Defaults to\n"
+    "    1024.\n"
+    "'timeout' is the maximum number of seconds a value list is buffered.\n"
+    "    Defaults to the interval of the plugin. Zero disables the limit.\n"
+    "'identifier' is the full identifier assigned to this callback.\n"
+    "\n"
+    "The callback function will be called with one or two parameters:\n"
+    "values: A list of tuples, one for each dispatched value list. Each tuple\n"
+    "    holds host, plugin, plugin_instance, type, type_instance, time,\n"
+    "    interval and a tuple of the values, in this order.\n"
+    "data: The optional data parameter passed to the register function.\n"
+    "    If the parameter was omitted it will be omitted here, too.";
+
 static char reg_notification_doc[] =
     "register_notification(callback[, data][, name]) -> identifier\n"
     "\n"
@@ -503,6 +533,319 @@ static int cpy_write_callback(const data_set_t *ds,
   return 0;
 }
 
+/* Batched write callbacks copy value lists into a buffer without holding the
+ * GIL. Once the buffer is full, too old or flushed, it is handed to Python as a
+ * list of tuples in a single call. */
+typedef struct cpy_batch_entry_s {
+  char host[DATA_MAX_NAME_LEN];
+  char plugin[DATA_MAX_NAME_LEN];
+  char plugin_instance[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+  char type_instance[DATA_MAX_NAME_LEN];
+  cdtime_t time;
+  cdtime_t interval;
+  size_t values_offset;
+  size_t values_len;
+} cpy_batch_entry_t;
+
+typedef struct cpy_batch_buffer_s {
+  cpy_batch_entry_t *entries;
+  size_t entries_num;
+  size_t entries_size;
+
+  value_t *values;
+  int *types;
+  size_t values_num;
+  size_t values_size;
+} cpy_batch_buffer_t;
+
+typedef struct cpy_batch_s {
+  cpy_callback_t *callback;
+  size_t size;
+  cdtime_t timeout;
+
+  /* "lock" protects "active", "spare", "first_time" and "refcount". The
+   * active buffer is detached when flushing and Python is called without
+   * holding the lock, so that writers don't wait for Python and the callback
+   * may call collectd.flush() itself. "spare" keeps a flushed buffer's memory
+   * for reuse. */
+  pthread_mutex_t lock;
+  cpy_batch_buffer_t active;
+  cpy_batch_buffer_t spare;
+  cdtime_t first_time;
+
+  /* The batch is registered as both, a write and a flush callback. */
+  int refcount;
+  struct cpy_batch_s *next;
+} cpy_batch_t;
+
+/* List of registered batches, used to unregister the flush callback together
+ * with the write callback. */
+static cpy_batch_t *cpy_batches;
+static pthread_mutex_t cpy_batches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static PyObject *cpy_value_to_object(int type, value_t value) {
+  switch (type) {
+  case DS_TYPE_COUNTER:
+    return PyLong_FromUnsignedLongLong(value.counter);
+  case DS_TYPE_GAUGE:
+    return PyFloat_FromDouble(value.gauge);
+  case DS_TYPE_DERIVE:
+    return PyLong_FromLongLong(value.derive);
+  case DS_TYPE_ABSOLUTE:
+    return PyLong_FromUnsignedLongLong(value.absolute);
+  }
+
+  PyErr_Format(PyExc_TypeError, "Unknown value type %d.", type);
+  return NULL;
+}
+
+static int cpy_batch_buffer_append(cpy_batch_buffer_t *buf,
+                                   const data_set_t *ds,
+                                   const value_list_t *vl) {
+  cpy_batch_entry_t *e;
+
+  if (buf->entries_num >= buf->entries_size) {
+    size_t size = (buf->entries_size == 0) ? 64 : 2 * buf->entries_size;
+    cpy_batch_entry_t *tmp = realloc(buf->entries, size * sizeof(*tmp));
+    if (tmp == NULL)
+      return ENOMEM;
+    buf->entries = tmp;
+    buf->entries_size = size;
+  }
+
+  if (buf->values_num + vl->values_len > buf->values_size) {
+    size_t size = (buf->values_size == 0) ? 64 : buf->values_size;
+    value_t *values;
+    int *types;
+
+    while (size < buf->values_num + vl->values_len)
+      size *= 2;
+
+    values = realloc(buf->values, size * sizeof(*values));
+    if (values == NULL)
+      return ENOMEM;
+    buf->values = values;
+
+    types = realloc(buf->types, size * sizeof(*types));
+    if (types == NULL)
+      return ENOMEM;
+    buf->types = types;
+
+    buf->values_size = size;
+  }
+
+  e = buf->entries + buf->entries_num;
+  sstrncpy(e->host, vl->host, sizeof(e->host));
+  sstrncpy(e->plugin, vl->plugin, sizeof(e->plugin));
+  sstrncpy(e->plugin_instance, vl->plugin_instance,
+           sizeof(e->plugin_instance));
+  sstrncpy(e->type, vl->type, sizeof(e->type));
+  sstrncpy(e->type_instance, vl->type_instance, sizeof(e->type_instance));
+  e->time = vl->time;
+  e->interval = vl->interval;
+  e->values_offset = buf->values_num;
+  e->values_len = vl->values_len;
+
+  memcpy(buf->values + buf->values_num, vl->values,
+         vl->values_len * sizeof(*buf->values));
+  for (size_t i = 0; i < vl->values_len; i++)
+    buf->types[buf->values_num + i] = ds->ds[i].type;
+
+  buf->values_num += vl->values_len;
+  buf->entries_num++;
+  return 0;
+}
+
+/* Converts the buffer to a list of tuples. Identifier strings that are equal
+ * to those of the previous entry share its string objects. You must hold the
+ * GIL to call this function. */
+static PyObject *cpy_batch_buffer_to_list(cpy_batch_buffer_t const *buf) {
+  char const *prev_names[5] = {NULL};
+  PyObject *list;
+
+  list = PyList_New(buf->entries_num); /* New reference. */
+  if (list == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < buf->entries_num; i++) {
+    cpy_batch_entry_t const *e = buf->entries + i;
+    char const *names[5] = {e->host, e->plugin, e->plugin_instance, e->type,
+                            e->type_instance};
+    PyObject *prev = (i > 0) ? PyList_GET_ITEM(list, i - 1) : NULL;
+    PyObject *tuple, *values, *obj;
+
+    tuple = PyTuple_New(8); /* New reference. */
+    if (tuple == NULL)
+      goto fail;
+    PyList_SET_ITEM(list, i, tuple); /* Steals a reference. */
+
+    for (size_t j = 0; j < STATIC_ARRAY_SIZE(names); j++) {
+      if ((prev != NULL) && (strcmp(names[j], prev_names[j]) == 0)) {
+        obj = PyTuple_GET_ITEM(prev, j); /* Borrowed reference. */
+        Py_INCREF(obj);
+      } else {
+        obj = cpy_string_to_unicode_or_bytes(names[j]); /* New reference. */
+        if (obj == NULL)
+          goto fail;
+      }
+      PyTuple_SET_ITEM(tuple, j, obj); /* Steals a reference. */
+      prev_names[j] = names[j];
+    }
+
+    obj = PyFloat_FromDouble(CDTIME_T_TO_DOUBLE(e->time));
+    if (obj == NULL)
+      goto fail;
+    PyTuple_SET_ITEM(tuple, 5, obj);
+
+    obj = PyFloat_FromDouble(CDTIME_T_TO_DOUBLE(e->interval));
+    if (obj == NULL)
+      goto fail;
+    PyTuple_SET_ITEM(tuple, 6, obj);
+
+    values = PyTuple_New(e->values_len); /* New reference. */
+    if (values == NULL)
+      goto fail;
+    PyTuple_SET_ITEM(tuple, 7, values);
+
+    for (size_t j = 0; j < e->values_len; j++) {
+      size_t k = e->values_offset + j;
+      obj = cpy_value_to_object(buf->types[k], buf->values[k]);
+      if (obj == NULL)
+        goto fail;
+      PyTuple_SET_ITEM(values, j, obj);
+    }
+  }
+
+  return list;
+
+fail:
+  Py_DECREF(list);
+  return NULL;
+}
+
+static void cpy_batch_buffer_free(cpy_batch_buffer_t *buf) {
+  sfree(buf->entries);
+  sfree(buf->values);
+  sfree(buf->types);
+}
+
+/* Hands all buffered values to Python. */
+static void cpy_batch_flush(cpy_batch_t *b) {
+  cpy_batch_buffer_t buf;
+  cpy_callback_t *c = b->callback;
+  PyObject *list, *ret;
+
+  pthread_mutex_lock(&b->lock);
+  buf = b->active;
+  b->active = b->spare;
+  memset(&b->spare, 0, sizeof(b->spare));
+  pthread_mutex_unlock(&b->lock);
+
+  if (buf.entries_num != 0) {
+    CPY_LOCK_THREADS
+    list = cpy_batch_buffer_to_list(&buf); /* New reference. */
+    if (list == NULL) {
+      cpy_log_exception("batched write callback");
+    } else {
+      ret = PyObject_CallFunctionObjArgs(c->callback, list, c->data,
+                                         (void *)0); /* New reference. */
+      Py_DECREF(list);
+      if (ret == NULL) {
+        cpy_log_exception("batched write callback");
+      } else {
+        Py_DECREF(ret);
+      }
+    }
+    CPY_RELEASE_THREADS
+  }
+
+  buf.entries_num = 0;
+  buf.values_num = 0;
+
+  /* Keep the memory for the next flush unless another flush got there first. */
+  pthread_mutex_lock(&b->lock);
+  if ((b->spare.entries == NULL) && (b->spare.values == NULL)) {
+    b->spare = buf;
+    memset(&buf, 0, sizeof(buf));
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  cpy_batch_buffer_free(&buf);
+}
+
+static int cpy_batch_write_callback(const data_set_t *ds,
+                                    const value_list_t *vl,
+                                    user_data_t *data) {
+  cpy_batch_t *b = data->data;
+  cdtime_t now = cdtime();
+  _Bool flush;
+  int status;
+
+  pthread_mutex_lock(&b->lock);
+  if (b->active.entries_num == 0)
+    b->first_time = now;
+  status = cpy_batch_buffer_append(&b->active, ds, vl);
+  flush = (b->active.entries_num >= b->size) ||
+          ((b->timeout != 0) && ((now - b->first_time) >= b->timeout));
+  pthread_mutex_unlock(&b->lock);
+
+  if (status != 0) {
+    ERROR("python plugin: %s: Buffering the values failed.",
+          b->callback->name);
+    return status;
+  }
+
+  if (flush)
+    cpy_batch_flush(b);
+  return 0;
+}
+
+static int cpy_batch_flush_callback(cdtime_t timeout, const char *identifier,
+                                    user_data_t *data) {
+  cpy_batch_t *b = data->data;
+  _Bool flush;
+
+  pthread_mutex_lock(&b->lock);
+  flush = (b->active.entries_num > 0) &&
+          ((timeout == 0) || ((cdtime() - b->first_time) >= timeout));
+  pthread_mutex_unlock(&b->lock);
+
+  if (flush)
+    cpy_batch_flush(b);
+  return 0;
+}
+
+static void cpy_batch_destroy(void *arg) {
+  cpy_batch_t *b = arg;
+  int refcount;
+
+  pthread_mutex_lock(&b->lock);
+  refcount = --b->refcount;
+  pthread_mutex_unlock(&b->lock);
+  if (refcount > 0)
+    return;
+
+  pthread_mutex_lock(&cpy_batches_lock);
+  for (cpy_batch_t **prev = &cpy_batches; *prev != NULL;
+       prev = &(*prev)->next) {
+    if (*prev == b) {
+      *prev = b->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&cpy_batches_lock);
+
+  /* Hand the remaining values to Python before the callback goes away. */
+  cpy_batch_flush(b);
+
+  cpy_batch_buffer_free(&b->active);
+  cpy_batch_buffer_free(&b->spare);
+  pthread_mutex_destroy(&b->lock);
+  cpy_destroy_user_data(b->callback);
+  free(b);
+}
+
 static int cpy_notification_callback(const notification_t *notification,
                                      user_data_t *data) {
   cpy_callback_t *c = data->data;
@@ -781,6 +1124,75 @@ static PyObject *cpy_register_write(PyObject *self, PyObject *args,
                                        (void *)cpy_write_callback, args, kwds);
 }
 
+static PyObject *cpy_register_write_batch(PyObject *self, PyObject *args,
+                                          PyObject *kwds) {
+  char buf[512];
+  cpy_batch_t *b;
+  cpy_callback_t *c;
+  char *name = NULL;
+  int size = 1024;
+  double timeout = CDTIME_T_TO_DOUBLE(plugin_get_interval());
+  PyObject *callback = NULL, *data = NULL;
+  static char *kwlist[] = {"callback", "data", "name",
+                           "size",     "timeout", NULL};
+
+  if (PyArg_ParseTupleAndKeywords(args, kwds, "O|Oetid", kwlist, &callback,
+                                  &data, NULL, &name, &size, &timeout) == 0)
+    return NULL;
+  if (PyCallable_Check(callback) == 0) {
+    PyMem_Free(name);
+    PyErr_SetString(PyExc_TypeError, "callback needs a be a callable object.");
+    return NULL;
+  }
+  if ((size < 1) || (timeout < 0)) {
+    PyMem_Free(name);
+    PyErr_SetString(PyExc_ValueError,
+                    "size needs to be positive and timeout not negative.");
+    return NULL;
+  }
+  cpy_build_name(buf, sizeof(buf), callback, name);
+  PyMem_Free(name);
+
+  c = calloc(1, sizeof(*c));
+  b = calloc(1, sizeof(*b));
+  if ((c == NULL) || (b == NULL)) {
+    free(c);
+    free(b);
+    return PyErr_NoMemory();
+  }
+
+  Py_INCREF(callback);
+  Py_XINCREF(data);
+
+  c->name = strdup(buf);
+  c->callback = callback;
+  c->data = data;
+  c->next = NULL;
+
+  b->callback = c;
+  b->size = (size_t)size;
+  b->timeout = DOUBLE_TO_CDTIME_T(timeout);
+  pthread_mutex_init(&b->lock, /* attr = */ NULL);
+  b->refcount = 2;
+
+  pthread_mutex_lock(&cpy_batches_lock);
+  b->next = cpy_batches;
+  cpy_batches = b;
+  pthread_mutex_unlock(&cpy_batches_lock);
+
+  ++cpy_num_callbacks;
+  plugin_register_write(buf, cpy_batch_write_callback,
+                        &(user_data_t){
+                            .data = b, .free_func = cpy_batch_destroy,
+                        });
+  plugin_register_flush(buf, cpy_batch_flush_callback,
+                        &(user_data_t){
+                            .data = b, .free_func = cpy_batch_destroy,
+                        });
+
+  return cpy_string_to_unicode_or_bytes(buf);
+}
+
 static PyObject *cpy_register_notification(PyObject *self, PyObject *args,
                                            PyObject *kwds) {
   return cpy_register_generic_userdata((void *)plugin_register_notification,
@@ -943,8 +1355,30 @@ static PyObject *cpy_unregister_read(PyObject *self, PyObject *arg) {
   return cpy_unregister_generic_userdata(plugin_unregister_read, arg, "read");
 }
 
+/* Unregisters a write callback and, if it was registered with
+ * register_write_batch, the accompanying flush callback. */
+static int cpy_unregister_write_and_batch(const char *name) {
+  _Bool is_batch = 0;
+  int status;
+
+  pthread_mutex_lock(&cpy_batches_lock);
+  for (cpy_batch_t *b = cpy_batches; b != NULL; b = b->next) {
+    if (strcmp(b->callback->name, name) == 0) {
+      is_batch = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&cpy_batches_lock);
+
+  status = plugin_unregister_write(name);
+  if ((status == 0) && is_batch)
+    plugin_unregister_flush(name);
+  return status;
+}
+
 static PyObject *cpy_unregister_write(PyObject *self, PyObject *arg) {
-  return cpy_unregister_generic_userdata(plugin_unregister_write, arg, "write");
+  return cpy_unregister_generic_userdata(cpy_unregister_write_and_batch, arg,
+                                         "write");
 }
 
 static PyObject *cpy_unregister_notification(PyObject *self, PyObject *arg) {
@@ -978,6 +1412,8 @@ static PyMethodDef cpy_methods[] = {
      METH_VARARGS | METH_KEYWORDS, reg_read_doc},
     {"register_write", (PyCFunction)cpy_register_write,
      METH_VARARGS | METH_KEYWORDS, reg_write_doc},
+    {"register_write_batch", (PyCFunction)cpy_register_write_batch,
+     METH_VARARGS | METH_KEYWORDS, reg_write_batch_doc},
     {"register_notification", (PyCFunction)cpy_register_notification,
      METH_VARARGS | METH_KEYWORDS, reg_notification_doc},
     {"register_flush", (PyCFunction)cpy_register_flush,
@@ -0,0 +1,479 @@
+/**
+ * collectd - src/segment.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_segment.h"
+
+/* Each series collects its points in memory, one column for the times (in
+ * milliseconds) and one per data source. Once "BlockSize" points have been
+ * collected, the columns are appended to the current segment file as one
+ * block. A new segment file is started every "RotationInterval", going by
+ * the local clock rather than the time of the values, so that a host with a
+ * wrong clock can't cause rotations. Series are numbered per segment file;
+ * a series record is written before the first block of a series in each
+ * file. */
+typedef struct seg_series_s {
+  char *identifier;
+  uint32_t id;
+  uint64_t generation; /* segment file `id' is valid for */
+  uint64_t seen;       /* segment file a value was last written to */
+
+  size_t ds_num;
+  data_source_t *ds;
+  segment_column_t *columns; /* times, then one per data source */
+
+  size_t count;
+  uint64_t t_min;
+  uint64_t t_max;
+} seg_series_t;
+
+static char *datadir = NULL;
+static cdtime_t rotation_interval = TIME_T_TO_CDTIME_T_STATIC(86400);
+static int block_size = 120;
+
+static pthread_mutex_t seg_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_avl_tree_t *seg_series = NULL;
+static segment_file_t *seg_file = NULL;
+static uint64_t seg_generation = 0;
+static cdtime_t seg_end = 0;
+
+static void seg_series_free(seg_series_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  if (s->columns != NULL) {
+    for (size_t i = 0; i < s->ds_num + 1; i++)
+      segment_column_destroy(s->columns + i);
+  }
+  sfree(s->columns);
+  sfree(s->ds);
+  sfree(s->identifier);
+  sfree(s);
+} /* }}} void seg_series_free */
+
+/* Sets up the columns for the data sources of `ds', dropping any points. */
+static int seg_series_init_columns(seg_series_t *s, /* {{{ */
+                                   data_set_t const *ds) {
+  if (s->columns != NULL) {
+    for (size_t i = 0; i < s->ds_num + 1; i++)
+      segment_column_destroy(s->columns + i);
+  }
+  sfree(s->columns);
+  sfree(s->ds);
+  s->ds_num = 0;
+  s->count = 0;
+
+  s->ds = calloc(ds->ds_num, sizeof(*s->ds));
+  s->columns = calloc(ds->ds_num + 1, sizeof(*s->columns));
+  if ((s->ds == NULL) || (s->columns == NULL)) {
+    sfree(s->ds);
+    sfree(s->columns);
+    return ENOMEM;
+  }
+
+  memcpy(s->ds, ds->ds, ds->ds_num * sizeof(*s->ds));
+  s->ds_num = ds->ds_num;
+
+  segment_column_init(s->columns, SEGMENT_ENCODING_INT64);
+  for (size_t i = 0; i < s->ds_num; i++)
+    segment_column_init(s->columns + i + 1,
+                        (s->ds[i].type == DS_TYPE_GAUGE)
+                            ? SEGMENT_ENCODING_DOUBLE
+                            : SEGMENT_ENCODING_INT64);
+
+  /* Force a new series record, in case the data sources changed. */
+  s->generation = 0;
+  return 0;
+} /* }}} int seg_series_init_columns */
+
+static void seg_series_reset(seg_series_t *s) /* {{{ */
+{
+  for (size_t i = 0; i < s->ds_num + 1; i++)
+    segment_column_reset(s->columns + i);
+  s->count = 0;
+} /* }}} void seg_series_reset */
+
+/* Appends the collected points of `s' to the segment file. Must hold
+ * seg_lock. */
+static int seg_series_write(seg_series_t *s) /* {{{ */
+{
+  int status;
+
+  if (s->count == 0)
+    return 0;
+
+  if (seg_file == NULL) {
+    seg_series_reset(s);
+    return -1;
+  }
+
+  if (s->generation != seg_generation) {
+    uint8_t ds_types[SEGMENT_DS_MAX];
+    char const *ds_names[SEGMENT_DS_MAX];
+
+    for (size_t i = 0; i < s->ds_num; i++) {
+      ds_types[i] = (uint8_t)s->ds[i].type;
+      ds_names[i] = s->ds[i].name;
+    }
+
+    s->id = segment_file_next_id(seg_file);
+    status = segment_file_add_series(seg_file, s->id, s->identifier,
+                                     s->ds_num, ds_types, ds_names);
+    if (status != 0) {
+      char errbuf[1024];
+      ERROR("segment plugin: Adding series \"%s\" failed: %s", s->identifier,
+            sstrerror(status, errbuf, sizeof(errbuf)));
+      seg_series_reset(s);
+      return -1;
+    }
+    s->generation = seg_generation;
+  }
+
+  status = segment_file_add_block(seg_file, s->id, s->count, s->t_min,
+                                  s->t_max, s->columns, s->ds_num + 1);
+  if (status != 0) {
+    char errbuf[1024];
+    ERROR("segment plugin: Adding %zu points of \"%s\" failed: %s", s->count,
+          s->identifier, sstrerror(status, errbuf, sizeof(errbuf)));
+  }
+
+  seg_series_reset(s);
+  return (status == 0) ? 0 : -1;
+} /* }}} int seg_series_write */
+
+/* Writes the collected points of all series, closes the segment file and
+ * forgets series that haven't been written to since the file was opened.
+ * Must hold seg_lock. */
+static void seg_file_close(void) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  char *key;
+  seg_series_t *s;
+  char **stale = NULL;
+  size_t stale_num = 0;
+
+  if (seg_series != NULL) {
+    iter = c_avl_get_iterator(seg_series);
+    while (c_avl_iterator_next(iter, (void *)&key, (void *)&s) == 0) {
+      seg_series_write(s);
+
+      if (s->seen != seg_generation) {
+        char **tmp = realloc(stale, (stale_num + 1) * sizeof(*stale));
+        if (tmp == NULL)
+          continue;
+        stale = tmp;
+        stale[stale_num++] = key;
+      }
+    }
+    c_avl_iterator_destroy(iter);
+
+    for (size_t i = 0; i < stale_num; i++) {
+      if (c_avl_remove(seg_series, stale[i], NULL, (void *)&s) == 0)
+        seg_series_free(s);
+    }
+    sfree(stale);
+  }
+
+  if (seg_file != NULL) {
+    int status = segment_file_close(seg_file);
+    if (status != 0) {
+      char errbuf[1024];
+      ERROR("segment plugin: Closing the segment file failed: %s",
+            sstrerror(status, errbuf, sizeof(errbuf)));
+    }
+    seg_file = NULL;
+  }
+} /* }}} void seg_file_close */
+
+/* Closes the current segment file and opens the one covering `now'. Must
+ * hold seg_lock. */
+static int seg_file_open(cdtime_t now) /* {{{ */
+{
+  cdtime_t start = now - (now % rotation_interval);
+  time_t start_time = CDTIME_T_TO_TIME_T(start);
+  struct tm tm;
+  char filename[PATH_MAX];
+  int status;
+
+  seg_file_close();
+  seg_generation++;
+  /* Retry opening no earlier than in a minute if anything fails. */
+  seg_end = now + TIME_T_TO_CDTIME_T(60);
+
+  if (gmtime_r(&start_time, &tm) == NULL) {
+    ERROR("segment plugin: gmtime_r failed.");
+    return -1;
+  }
+
+  status = snprintf(filename, sizeof(filename), "%s/", datadir);
+  if ((status < 0) || ((size_t)status >= sizeof(filename)) ||
+      (strftime(filename + status, sizeof(filename) - status,
+                "%Y%m%d-%H%M%S.seg", &tm) == 0)) {
+    ERROR("segment plugin: Segment file name is too long.");
+    return -1;
+  }
+
+  if (check_create_dir(filename) != 0)
+    return -1;
+
+  seg_file = segment_file_open(filename, CDTIME_T_TO_MS(start));
+  if (seg_file == NULL) {
+    char errbuf[1024];
+    ERROR("segment plugin: Opening \"%s\" failed: %s", filename,
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  seg_end = start + rotation_interval;
+  DEBUG("segment plugin: Writing to \"%s\".", filename);
+  return 0;
+} /* }}} int seg_file_open */
+
+/* Appends the values of `vl' to the columns of `s'. */
+static int seg_series_add(seg_series_t *s, value_list_t const *vl) /* {{{ */
+{
+  uint64_t t = CDTIME_T_TO_MS(vl->time);
+  int status;
+
+  status = segment_column_add_int64(s->columns, (int64_t)t);
+  for (size_t i = 0; (status == 0) && (i < s->ds_num); i++) {
+    segment_column_t *c = s->columns + i + 1;
+
+    switch (s->ds[i].type) {
+    case DS_TYPE_GAUGE:
+      status = segment_column_add_double(c, vl->values[i].gauge);
+      break;
+    case DS_TYPE_COUNTER:
+      status = segment_column_add_int64(c, (int64_t)vl->values[i].counter);
+      break;
+    case DS_TYPE_DERIVE:
+      status = segment_column_add_int64(c, vl->values[i].derive);
+      break;
+    case DS_TYPE_ABSOLUTE:
+      status = segment_column_add_int64(c, (int64_t)vl->values[i].absolute);
+      break;
+    default:
+      status = EINVAL;
+    }
+  }
+
+  if (status != 0) {
+    /* The columns are out of step now, so the whole block is lost. */
+    ERROR("segment plugin: Encoding a value of \"%s\" failed. Dropping %zu "
+          "points.",
+          s->identifier, s->count);
+    seg_series_reset(s);
+    return -1;
+  }
+
+  if ((s->count == 0) || (t < s->t_min))
+    s->t_min = t;
+  if ((s->count == 0) || (t > s->t_max))
+    s->t_max = t;
+  s->count++;
+  s->seen = seg_generation;
+
+  return 0;
+} /* }}} int seg_series_add */
+
+static int seg_write(data_set_t const *ds, value_list_t const *vl, /* {{{ */
+                     user_data_t __attribute__((unused)) * user_data) {
+  char identifier[6 * DATA_MAX_NAME_LEN];
+  seg_series_t *s = NULL;
+  cdtime_t now;
+  int status = 0;
+
+  if (0 != strcmp(ds->type, vl->type)) {
+    ERROR("segment plugin: DS type does not match value list type");
+    return -1;
+  }
+  if (ds->ds_num > SEGMENT_DS_MAX) {
+    ERROR("segment plugin: Type \"%s\" has too many data sources.", ds->type);
+    return -1;
+  }
+
+  if (FORMAT_VL(identifier, sizeof(identifier), vl) != 0)
+    return -1;
+
+  now = cdtime();
+
+  pthread_mutex_lock(&seg_lock);
+
+  if (now >= seg_end)
+    seg_file_open(now);
+  if (seg_file == NULL) {
+    pthread_mutex_unlock(&seg_lock);
+    return -1;
+  }
+
+  if (seg_series == NULL) {
+    seg_series = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (seg_series == NULL) {
+      pthread_mutex_unlock(&seg_lock);
+      ERROR("segment plugin: c_avl_create failed.");
+      return -1;
+    }
+  }
+
+  if (c_avl_get(seg_series, identifier, (void *)&s) != 0) {
+    s = calloc(1, sizeof(*s));
+    if (s != NULL)
+      s->identifier = strdup(identifier);
+    if ((s == NULL) || (s->identifier == NULL) ||
+        (seg_series_init_columns(s, ds) != 0) ||
+        (c_avl_insert(seg_series, s->identifier, s) != 0)) {
+      pthread_mutex_unlock(&seg_lock);
+      ERROR("segment plugin: Creating series \"%s\" failed.", identifier);
+      seg_series_free(s);
+      return -1;
+    }
+  } else if (s->ds_num != ds->ds_num) {
+    seg_series_write(s);
+    if (seg_series_init_columns(s, ds) != 0) {
+      pthread_mutex_unlock(&seg_lock);
+      ERROR("segment plugin: Resizing series \"%s\" failed.", identifier);
+      return -1;
+    }
+  }
+
+  status = seg_series_add(s, vl);
+  if ((status == 0) && (s->count >= (size_t)block_size))
+    status = seg_series_write(s);
+
+  pthread_mutex_unlock(&seg_lock);
+  return status;
+} /* }}} int seg_write */
+
+static int seg_flush(cdtime_t __attribute__((unused)) timeout, /* {{{ */
+                     char const *identifier,
+                     user_data_t __attribute__((unused)) * user_data) {
+  seg_series_t *s;
+
+  pthread_mutex_lock(&seg_lock);
+
+  if (seg_series == NULL) {
+    pthread_mutex_unlock(&seg_lock);
+    return 0;
+  }
+
+  if (identifier != NULL) {
+    if (c_avl_get(seg_series, identifier, (void *)&s) == 0)
+      seg_series_write(s);
+  } else {
+    c_avl_iterator_t *iter = c_avl_get_iterator(seg_series);
+    char *key;
+
+    while (c_avl_iterator_next(iter, (void *)&key, (void *)&s) == 0)
+      seg_series_write(s);
+    c_avl_iterator_destroy(iter);
+  }
+
+  pthread_mutex_unlock(&seg_lock);
+  return 0;
+} /* }}} int seg_flush */
+
+static int seg_shutdown(void) /* {{{ */
+{
+  char *key;
+  seg_series_t *s;
+
+  pthread_mutex_lock(&seg_lock);
+
+  seg_file_close();
+
+  if (seg_series != NULL) {
+    while (c_avl_pick(seg_series, (void *)&key, (void *)&s) == 0)
+      seg_series_free(s);
+    c_avl_destroy(seg_series);
+    seg_series = NULL;
+  }
+
+  pthread_mutex_unlock(&seg_lock);
+
+  sfree(datadir);
+  return 0;
+} /* }}} int seg_shutdown */
+
+static int seg_config(oconfig_item_t *ci) /* {{{ */
+{
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+    int status = 0;
+
+    if (strcasecmp("DataDir", child->key) == 0) {
+      status = cf_util_get_string(child, &datadir);
+      if (status == 0) {
+        size_t len = strlen(datadir);
+        while ((len > 1) && (datadir[len - 1] == '/'))
+          datadir[--len] = 0;
+      }
+    } else if (strcasecmp("RotationInterval", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &rotation_interval);
+      if ((status == 0) && (rotation_interval < TIME_T_TO_CDTIME_T(60))) {
+        ERROR("segment plugin: RotationInterval must be at least 60 "
+              "seconds.");
+        status = -1;
+      }
+    } else if (strcasecmp("BlockSize", child->key) == 0) {
+      status = cf_util_get_int(child, &block_size);
+      if ((status == 0) && (block_size < 1)) {
+        ERROR("segment plugin: BlockSize must be positive.");
+        status = -1;
+      }
+    } else {
+      ERROR("segment plugin: Invalid configuration option: `%s'.",
+            child->key);
+      status = -1;
+    }
+
+    if (status != 0)
+      return -1;
+  }
+
+  return 0;
+} /* }}} int seg_config */
+
+static int seg_init(void) /* {{{ */
+{
+  if (datadir == NULL) {
+    datadir = strdup("segment");
+    if (datadir == NULL) {
+      ERROR("segment plugin: strdup failed.");
+      return -1;
+    }
+  }
+
+  return 0;
+} /* }}} int seg_init */
+
+void module_register(void) {
+  plugin_register_complex_config("segment", seg_config);
+  plugin_register_init("segment", seg_init);
+  plugin_register_write("segment", seg_write, /* user_data = */ NULL);
+  plugin_register_flush("segment", seg_flush, /* user_data = */ NULL);
+  plugin_register_shutdown("segment", seg_shutdown);
+}
@@ -32,6 +32,7 @@
 
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
+#include <net-snmp/library/large_fd_set.h>
 
 #include <fnmatch.h>
 
@@ -86,11 +87,31 @@ struct host_definition_s {
   int security_level;
   char *context;
 
+  cdtime_t timeout;
+  int retries;
+  int bulk_size;
+  cdtime_t instance_cache_timeout;
+
   void *sess_handle;
   c_complain_t complaint;
   cdtime_t interval;
   data_definition_t **data_list;
   int data_list_len;
+
+  /* Instance names of tables, one entry per element of "data_list". */
+  struct csnmp_instance_cache_s *instance_cache;
+
+  /* Asynchronous mode. "async_state" is protected by "async_lock", all other
+   * fields are only used by the engine thread once a host has been queued. */
+  int async_state;
+  int async_data_index;
+  int async_success;
+  _Bool async_done;
+  _Bool async_failed;
+  struct csnmp_table_walk_s *async_walk;
+  struct host_definition_s *async_next;
+
+  struct host_definition_s *next;
 };
 typedef struct host_definition_s host_definition_t;
 
@@ -103,6 +124,14 @@ struct csnmp_list_instances_s {
 };
 typedef struct csnmp_list_instances_s csnmp_list_instances_t;
 
+/* Instance names are cached for "InstanceCacheTimeout", so that only the value
+ * columns of a table need to be walked every interval. */
+struct csnmp_instance_cache_s {
+  csnmp_list_instances_t *head;
+  cdtime_t last_update;
+};
+typedef struct csnmp_instance_cache_s csnmp_instance_cache_t;
+
 struct csnmp_table_values_s {
   oid_t suffix;
   value_t value;
@@ -110,11 +139,67 @@ struct csnmp_table_values_s {
 };
 typedef struct csnmp_table_values_s csnmp_table_values_t;
 
+/* State of walking a table with GETNEXT requests. Shared by the synchronous
+ * and the asynchronous code path. */
+struct csnmp_table_walk_s {
+  host_definition_t *host;
+  data_definition_t *data;
+  const data_set_t *ds;
+
+  /* Holds the last OID returned by the device. We use this in the GETNEXT
+   * request to proceed. */
+  oid_t *oid_list;
+  /* Set to false when an OID has left its subtree so we don't re-request it
+   * again. */
+  _Bool *oid_list_todo;
+  size_t oid_list_len;
+
+  /* Indexes into "oid_list" of the variables in the last request. GETBULK
+   * responses repeat them once per row. */
+  size_t *req_columns;
+  size_t req_columns_num;
+
+  /* Non-NULL if instance names are cached. If "use_cache" is set, the
+   * instance column isn't walked and the cached names are used. */
+  csnmp_instance_cache_t *cache;
+  _Bool use_cache;
+  cdtime_t start_time;
+
+  /* `value_list_head' and `value_list_tail' implement a linked list for each
+   * value. `instance_list_head' and `instance_list_tail' implement a linked
+   * list of instance names. This is used to jump gaps in the table. */
+  csnmp_list_instances_t *instance_list_head;
+  csnmp_list_instances_t *instance_list_tail;
+  csnmp_table_values_t **value_list_head;
+  csnmp_table_values_t **value_list_tail;
+};
+typedef struct csnmp_table_walk_s csnmp_table_walk_t;
+
+#define CSNMP_ASYNC_IDLE 0
+#define CSNMP_ASYNC_QUEUED 1
+#define CSNMP_ASYNC_ACTIVE 2
+
 /*
  * Private variables
  */
 static data_definition_t *data_head = NULL;
 
+/* All hosts, so they outlive the read callbacks in asynchronous mode. */
+static host_definition_t *host_head = NULL;
+
+/* In asynchronous mode, the read callbacks only queue their host. A single
+ * engine thread sends the requests of up to "async_concurrency" hosts at a
+ * time and handles responses, timeouts and retries in an event loop. */
+static _Bool async_enabled = 0;
+static int async_concurrency = 128;
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_definition_t *async_queue_head = NULL;
+static host_definition_t *async_queue_tail = NULL;
+static pthread_t async_thread;
+static _Bool async_thread_running = 0;
+static _Bool async_shutdown = 0;
+static int async_wake_fd[2] = {-1, -1};
+
 /*
  * Prototypes
  */
@@ -170,6 +255,14 @@ static void csnmp_host_close_session(host_definition_t *host) /* {{{ */
   host->sess_handle = NULL;
 } /* }}} void csnmp_host_close_session */
 
+static void csnmp_instance_list_free(csnmp_list_instances_t *head) {
+  while (head != NULL) {
+    csnmp_list_instances_t *next = head->next;
+    sfree(head);
+    head = next;
+  }
+} /* void csnmp_instance_list_free */
+
 static void csnmp_host_definition_destroy(void *arg) /* {{{ */
 {
   host_definition_t *hd;
@@ -192,6 +285,12 @@ static void csnmp_host_definition_destroy(void *arg) /* {{{ */
   sfree(hd->auth_passphrase);
   sfree(hd->priv_passphrase);
   sfree(hd->context);
+
+  if (hd->instance_cache != NULL) {
+    for (int i = 0; i < hd->data_list_len; i++)
+      csnmp_instance_list_free(hd->instance_cache[i].head);
+    sfree(hd->instance_cache);
+  }
   sfree(hd->data_list);
 
   sfree(hd);
@@ -596,6 +695,7 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
 
   hd->sess_handle = NULL;
   hd->interval = 0;
+  hd->retries = -1;
 
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *option = ci->children + i;
@@ -625,6 +725,14 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
       status = csnmp_config_add_host_security_level(hd, option);
     else if (strcasecmp("Context", option->key) == 0)
       status = cf_util_get_string(option, &hd->context);
+    else if (strcasecmp("Timeout", option->key) == 0)
+      status = cf_util_get_cdtime(option, &hd->timeout);
+    else if (strcasecmp("Retries", option->key) == 0)
+      status = cf_util_get_int(option, &hd->retries);
+    else if (strcasecmp("BulkSize", option->key) == 0)
+      status = cf_util_get_int(option, &hd->bulk_size);
+    else if (strcasecmp("InstanceCacheTimeout", option->key) == 0)
+      status = cf_util_get_cdtime(option, &hd->instance_cache_timeout);
     else {
       WARNING(
           "snmp plugin: csnmp_config_add_host: Option `%s' not allowed here.",
@@ -642,6 +750,18 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
       status = -1;
       break;
     }
+    if (hd->bulk_size < 0) {
+      WARNING("snmp plugin: `BulkSize' must not be negative for host `%s'",
+              hd->name);
+      status = -1;
+      break;
+    }
+    if ((hd->bulk_size > 0) && (hd->version == 1)) {
+      WARNING("snmp plugin: host `%s': GETBULK requires SNMPv2c or later; "
+              "ignoring `BulkSize'.",
+              hd->name);
+      hd->bulk_size = 0;
+    }
     if (hd->community == NULL && hd->version < 3) {
       WARNING("snmp plugin: `Community' not given for host `%s'", hd->name);
       status = -1;
@@ -704,16 +824,22 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
 
   snprintf(cb_name, sizeof(cb_name), "snmp-%s", hd->name);
 
+  /* The host is freed in csnmp_shutdown(), after the engine thread has been
+   * stopped, rather than together with the read callback. */
   status = plugin_register_complex_read(
       /* group = */ NULL, cb_name, csnmp_read_host, hd->interval,
       &(user_data_t){
-          .data = hd, .free_func = csnmp_host_definition_destroy,
+          .data = hd,
       });
   if (status != 0) {
     ERROR("snmp plugin: Registering complex read function failed.");
+    csnmp_host_definition_destroy(hd);
     return -1;
   }
 
+  hd->next = host_head;
+  host_head = hd;
+
   return 0;
 } /* int csnmp_config_add_host */
 
@@ -726,7 +852,16 @@ static int csnmp_config(oconfig_item_t *ci) {
       csnmp_config_add_data(child);
     else if (strcasecmp("Host", child->key) == 0)
       csnmp_config_add_host(child);
-    else {
+    else if (strcasecmp("Asynchronous", child->key) == 0)
+      cf_util_get_boolean(child, &async_enabled);
+    else if (strcasecmp("AsyncConcurrency", child->key) == 0) {
+      int tmp = async_concurrency;
+      if ((cf_util_get_int(child, &tmp) == 0) && (tmp > 0))
+        async_concurrency = tmp;
+      else
+        WARNING("snmp plugin: `AsyncConcurrency' must be a positive "
+                "number.");
+    } else {
       WARNING("snmp plugin: Ignoring unknown config option `%s'.", child->key);
     }
   } /* for (ci->children) */
@@ -803,6 +938,11 @@ static void csnmp_host_open_session(host_definition_t *host) {
     sess.community_len = strlen(host->community);
   }
 
+  if (host->timeout != 0)
+    sess.timeout = (long)CDTIME_T_TO_US(host->timeout);
+  if (host->retries >= 0)
+    sess.retries = host->retries;
+
   /* snmp_sess_open will copy the `struct snmp_session *'. */
   host->sess_handle = snmp_sess_open(&sess);
 
@@ -1025,22 +1165,14 @@ static int csnmp_strvbcopy(char *dst, /* {{{ */
 
 static int csnmp_instance_list_add(csnmp_list_instances_t **head,
                                    csnmp_list_instances_t **tail,
-                                   const struct snmp_pdu *res,
+                                   struct variable_list *vb,
                                    const host_definition_t *hd,
                                    const data_definition_t *dd) {
   csnmp_list_instances_t *il;
-  struct variable_list *vb;
   oid_t vb_name;
   int status;
   uint32_t is_matched;
 
-  /* Set vb on the last variable */
-  for (vb = res->variables; (vb != NULL) && (vb->next_variable != NULL);
-       vb = vb->next_variable)
-    /* do nothing */;
-  if (vb == NULL)
-    return -1;
-
   csnmp_oid_init(&vb_name, vb->name, vb->name_length);
 
   il = calloc(1, sizeof(*il));
@@ -1251,109 +1383,325 @@ static int csnmp_dispatch_table(host_definition_t *host,
   return (0);
 } /* int csnmp_dispatch_table */
 
-static int csnmp_read_table(host_definition_t *host, data_definition_t *data) {
-  struct snmp_pdu *req;
-  struct snmp_pdu *res = NULL;
-  struct variable_list *vb;
-
-  const data_set_t *ds;
-
-  size_t oid_list_len = data->values_len + 1;
-  /* Holds the last OID returned by the device. We use this in the GETNEXT
-   * request to proceed. */
-  oid_t oid_list[oid_list_len];
-  /* Set to false when an OID has left its subtree so we don't re-request it
-   * again. */
-  _Bool oid_list_todo[oid_list_len];
+/* Returns the instance cache of "data", or NULL if caching is disabled. */
+static csnmp_instance_cache_t *
+csnmp_instance_cache_get(host_definition_t *host, /* {{{ */
+                         data_definition_t const *data) {
+  if ((host->instance_cache_timeout == 0) || (data->instance.oid.oid_len == 0))
+    return NULL;
+
+  if (host->instance_cache == NULL) {
+    host->instance_cache =
+        calloc(host->data_list_len, sizeof(*host->instance_cache));
+    if (host->instance_cache == NULL)
+      return NULL;
+  }
 
-  int status;
-  size_t i;
+  for (int i = 0; i < host->data_list_len; i++)
+    if (host->data_list[i] == data)
+      return host->instance_cache + i;
 
-  /* `value_list_head' and `value_list_tail' implement a linked list for each
-   * value. `instance_list_head' and `instance_list_tail' implement a linked
-   * list of
-   * instance names. This is used to jump gaps in the table. */
-  csnmp_list_instances_t *instance_list_head;
-  csnmp_list_instances_t *instance_list_tail;
-  csnmp_table_values_t **value_list_head;
-  csnmp_table_values_t **value_list_tail;
+  return NULL;
+} /* }}} csnmp_instance_cache_t *csnmp_instance_cache_get */
 
-  DEBUG("snmp plugin: csnmp_read_table (host = %s, data = %s)", host->name,
-        data->name);
+static void csnmp_table_walk_destroy(csnmp_table_walk_t *walk) /* {{{ */
+{
+  if (walk == NULL)
+    return;
 
-  if (host->sess_handle == NULL) {
-    DEBUG("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
-    return -1;
+  /* Free all allocated variables here */
+  csnmp_instance_list_free(walk->instance_list_head);
+
+  if (walk->value_list_head != NULL) {
+    for (size_t i = 0; i < walk->data->values_len; i++) {
+      while (walk->value_list_head[i] != NULL) {
+        csnmp_table_values_t *next = walk->value_list_head[i]->next;
+        sfree(walk->value_list_head[i]);
+        walk->value_list_head[i] = next;
+      }
+    }
   }
 
+  sfree(walk->value_list_head);
+  sfree(walk->value_list_tail);
+  sfree(walk->oid_list);
+  sfree(walk->oid_list_todo);
+  sfree(walk->req_columns);
+  sfree(walk);
+} /* }}} void csnmp_table_walk_destroy */
+
+static csnmp_table_walk_t *
+csnmp_table_walk_create(host_definition_t *host, /* {{{ */
+                        data_definition_t *data) {
+  csnmp_table_walk_t *walk;
+  const data_set_t *ds;
+
   ds = plugin_get_ds(data->type);
   if (!ds) {
     ERROR("snmp plugin: DataSet `%s' not defined.", data->type);
-    return -1;
+    return NULL;
   }
 
   if (ds->ds_num != data->values_len) {
     ERROR("snmp plugin: DataSet `%s' requires %zu values, but config talks "
           "about %zu",
           data->type, ds->ds_num, data->values_len);
-    return -1;
+    return NULL;
   }
   assert(data->values_len > 0);
 
-  /* We need a copy of all the OIDs, because GETNEXT will destroy them. */
-  memcpy(oid_list, data->values, data->values_len * sizeof(oid_t));
-  if (data->instance.oid.oid_len > 0)
-    memcpy(oid_list + data->values_len, &data->instance.oid, sizeof(oid_t));
-  else /* no InstanceFrom option specified. */
-    oid_list_len--;
-
-  for (i = 0; i < oid_list_len; i++)
-    oid_list_todo[i] = 1;
+  walk = calloc(1, sizeof(*walk));
+  if (walk == NULL) {
+    ERROR("snmp plugin: csnmp_table_walk_create: calloc failed.");
+    return NULL;
+  }
+  walk->host = host;
+  walk->data = data;
+  walk->ds = ds;
+  walk->start_time = cdtime();
+
+  /* An empty cache isn't used: dispatching without instance names would use
+   * the OID suffixes instead. */
+  walk->cache = csnmp_instance_cache_get(host, data);
+  walk->use_cache =
+      (walk->cache != NULL) && (walk->cache->head != NULL) &&
+      ((walk->start_time - walk->cache->last_update) <
+       host->instance_cache_timeout);
+
+  walk->oid_list_len = data->values_len + 1;
+  walk->oid_list = calloc(walk->oid_list_len, sizeof(*walk->oid_list));
+  walk->oid_list_todo =
+      calloc(walk->oid_list_len, sizeof(*walk->oid_list_todo));
+  walk->req_columns = calloc(walk->oid_list_len, sizeof(*walk->req_columns));
 
   /* We're going to construct n linked lists, one for each "value".
    * value_list_head will contain pointers to the heads of these linked lists,
    * value_list_tail will contain pointers to the tail of the lists. */
-  value_list_head = calloc(data->values_len, sizeof(*value_list_head));
-  value_list_tail = calloc(data->values_len, sizeof(*value_list_tail));
-  if ((value_list_head == NULL) || (value_list_tail == NULL)) {
-    ERROR("snmp plugin: csnmp_read_table: calloc failed.");
-    sfree(value_list_head);
-    sfree(value_list_tail);
-    return -1;
+  walk->value_list_head =
+      calloc(data->values_len, sizeof(*walk->value_list_head));
+  walk->value_list_tail =
+      calloc(data->values_len, sizeof(*walk->value_list_tail));
+  if ((walk->oid_list == NULL) || (walk->oid_list_todo == NULL) ||
+      (walk->req_columns == NULL) || (walk->value_list_head == NULL) ||
+      (walk->value_list_tail == NULL)) {
+    ERROR("snmp plugin: csnmp_table_walk_create: calloc failed.");
+    csnmp_table_walk_destroy(walk);
+    return NULL;
   }
 
-  instance_list_head = NULL;
-  instance_list_tail = NULL;
+  /* We need a copy of all the OIDs, because GETNEXT will destroy them. */
+  memcpy(walk->oid_list, data->values, data->values_len * sizeof(oid_t));
+  if ((data->instance.oid.oid_len > 0) && !walk->use_cache)
+    memcpy(walk->oid_list + data->values_len, &data->instance.oid,
+           sizeof(oid_t));
+  else /* no InstanceFrom option specified, or the names are cached. */
+    walk->oid_list_len--;
+
+  for (size_t i = 0; i < walk->oid_list_len; i++)
+    walk->oid_list_todo[i] = 1;
+
+  return walk;
+} /* }}} csnmp_table_walk_t *csnmp_table_walk_create */
+
+/* Creates the next GETNEXT or GETBULK request of the walk in "ret". Sets "ret"
+ * to NULL when all variables have left their subtree. */
+static int csnmp_table_walk_request(csnmp_table_walk_t *walk, /* {{{ */
+                                    struct snmp_pdu **ret) {
+  struct snmp_pdu *req;
 
-  status = 0;
-  while (status == 0) {
-    int oid_list_todo_num;
+  *ret = NULL;
 
-    req = snmp_pdu_create(SNMP_MSG_GETNEXT);
-    if (req == NULL) {
-      ERROR("snmp plugin: snmp_pdu_create failed.");
-      status = -1;
-      break;
+  if (walk->host->bulk_size > 0) {
+    req = snmp_pdu_create(SNMP_MSG_GETBULK);
+    if (req != NULL) {
+      req->non_repeaters = 0;
+      req->max_repetitions = walk->host->bulk_size;
     }
+  } else {
+    req = snmp_pdu_create(SNMP_MSG_GETNEXT);
+  }
+  if (req == NULL) {
+    ERROR("snmp plugin: snmp_pdu_create failed.");
+    return -1;
+  }
 
-    oid_list_todo_num = 0;
-    for (i = 0; i < oid_list_len; i++) {
-      /* Do not rerequest already finished OIDs */
-      if (!oid_list_todo[i])
+  walk->req_columns_num = 0;
+  for (size_t i = 0; i < walk->oid_list_len; i++) {
+    /* Do not rerequest already finished OIDs */
+    if (!walk->oid_list_todo[i])
+      continue;
+    walk->req_columns[walk->req_columns_num++] = i;
+    snmp_add_null_var(req, walk->oid_list[i].oid, walk->oid_list[i].oid_len);
+  }
+
+  if (walk->req_columns_num == 0) {
+    /* The request is still empty - so we are finished */
+    DEBUG("snmp plugin: all variables have left their subtree");
+    snmp_free_pdu(req);
+    return 0;
+  }
+
+  *ret = req;
+  return 0;
+} /* }}} int csnmp_table_walk_request */
+
+/* Adds the variables in "res", the response to the last request created by
+ * csnmp_table_walk_request(), to the walk. */
+static int csnmp_table_walk_response(csnmp_table_walk_t *walk, /* {{{ */
+                                     const struct snmp_pdu *res) {
+  host_definition_t *host = walk->host;
+  data_definition_t *data = walk->data;
+  struct variable_list *vb;
+  size_t k;
+
+  vb = res->variables;
+  if ((vb == NULL) || (walk->req_columns_num == 0))
+    return -1;
+
+  /* GETNEXT responses hold one variable per requested column, GETBULK
+   * responses repeat the columns once per row. */
+  for (vb = res->variables, k = 0; (vb != NULL); vb = vb->next_variable, k++) {
+    size_t i = walk->req_columns[k % walk->req_columns_num];
+
+    /* The column left its subtree in an earlier row of this response. */
+    if (!walk->oid_list_todo[i])
+      continue;
+
+    /* An instance is configured and the res variable we process is the
+     * instance value (last index) */
+    if ((data->instance.oid.oid_len > 0) && (i == data->values_len)) {
+      if ((vb->type == SNMP_ENDOFMIBVIEW) ||
+          (snmp_oid_ncompare(data->instance.oid.oid, data->instance.oid.oid_len,
+                             vb->name, vb->name_length,
+                             data->instance.oid.oid_len) != 0)) {
+        DEBUG("snmp plugin: host = %s; data = %s; Instance left its subtree.",
+              host->name, data->name);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      /* Allocate a new `csnmp_list_instances_t', insert the instance name and
+       * add it to the list */
+      if (csnmp_instance_list_add(&walk->instance_list_head,
+                                  &walk->instance_list_tail, vb, host,
+                                  data) != 0) {
+        ERROR("snmp plugin: host %s: csnmp_instance_list_add failed.",
+              host->name);
+        return -1;
+      }
+    } else /* The variable we are processing is a normal value */
+    {
+      csnmp_table_values_t *vt;
+      oid_t vb_name;
+      oid_t suffix;
+      int ret;
+
+      csnmp_oid_init(&vb_name, vb->name, vb->name_length);
+
+      /* Calculate the current suffix. This is later used to check that the
+       * suffix is increasing. This also checks if we left the subtree */
+      ret = csnmp_oid_suffix(&suffix, &vb_name, data->values + i);
+      if (ret != 0) {
+        DEBUG("snmp plugin: host = %s; data = %s; i = %zu; "
+              "Value probably left its subtree.",
+              host->name, data->name, i);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      /* Make sure the OIDs returned by the agent are increasing. Otherwise
+       * our
+       * table matching algorithm will get confused. */
+      if ((walk->value_list_tail[i] != NULL) &&
+          (csnmp_oid_compare(&suffix, &walk->value_list_tail[i]->suffix) <=
+           0)) {
+        DEBUG("snmp plugin: host = %s; data = %s; i = %zu; "
+              "Suffix is not increasing.",
+              host->name, data->name, i);
+        walk->oid_list_todo[i] = 0;
         continue;
-      oid_list_todo_num++;
-      snmp_add_null_var(req, oid_list[i].oid, oid_list[i].oid_len);
+      }
+
+      vt = calloc(1, sizeof(*vt));
+      if (vt == NULL) {
+        ERROR("snmp plugin: calloc failed.");
+        return -1;
+      }
+
+      vt->value =
+          csnmp_value_list_to_value(vb, walk->ds->ds[i].type, data->scale,
+                                    data->shift, host->name, data->name);
+      memcpy(&vt->suffix, &suffix, sizeof(vt->suffix));
+      vt->next = NULL;
+
+      if (walk->value_list_tail[i] == NULL)
+        walk->value_list_head[i] = vt;
+      else
+        walk->value_list_tail[i]->next = vt;
+      walk->value_list_tail[i] = vt;
     }
 
-    if (oid_list_todo_num == 0) {
-      /* The request is still empty - so we are finished */
-      DEBUG("snmp plugin: all variables have left their subtree");
-      status = 0;
+    /* Copy OID to oid_list[i] */
+    memcpy(walk->oid_list[i].oid, vb->name, sizeof(oid) * vb->name_length);
+    walk->oid_list[i].oid_len = vb->name_length;
+
+  } /* for (vb = res->variables ...) */
+
+  return 0;
+} /* }}} int csnmp_table_walk_response */
+
+/* Dispatches the values of a complete walk and updates the instance cache. */
+static int csnmp_table_walk_dispatch(csnmp_table_walk_t *walk) /* {{{ */
+{
+  csnmp_list_instances_t *instance_list = walk->instance_list_head;
+  int status;
+
+  if (walk->use_cache)
+    instance_list = walk->cache->head;
+
+  status = csnmp_dispatch_table(walk->host, walk->data, instance_list,
+                                walk->value_list_head);
+
+  if ((walk->cache != NULL) && !walk->use_cache &&
+      (walk->instance_list_head != NULL)) {
+    DEBUG("snmp plugin: host = %s; data = %s; Updating the instance cache.",
+          walk->host->name, walk->data->name);
+    csnmp_instance_list_free(walk->cache->head);
+    walk->cache->head = walk->instance_list_head;
+    walk->cache->last_update = walk->start_time;
+    walk->instance_list_head = NULL;
+    walk->instance_list_tail = NULL;
+  }
+
+  return status;
+} /* }}} int csnmp_table_walk_dispatch */
+
+static int csnmp_read_table(host_definition_t *host, data_definition_t *data) {
+  csnmp_table_walk_t *walk;
+  struct snmp_pdu *req = NULL;
+  struct snmp_pdu *res = NULL;
+  int status;
+
+  DEBUG("snmp plugin: csnmp_read_table (host = %s, data = %s)", host->name,
+        data->name);
+
+  if (host->sess_handle == NULL) {
+    DEBUG("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
+    return -1;
+  }
+
+  walk = csnmp_table_walk_create(host, data);
+  if (walk == NULL)
+    return -1;
+
+  while ((status = csnmp_table_walk_request(walk, &req)) == 0) {
+    if (req == NULL)
       break;
-    }
 
     res = NULL;
     status = snmp_sess_synch_response(host->sess_handle, req, &res);
+    /* snmp_synch_response frees our PDU */
+    req = NULL;
     if ((status != STAT_SUCCESS) || (res == NULL)) {
       char *errstr = NULL;
 
@@ -1367,8 +1715,6 @@ static int csnmp_read_table(host_definition_t *host, data_definition_t *data) {
         snmp_free_pdu(res);
       res = NULL;
 
-      /* snmp_synch_response already freed our PDU */
-      req = NULL;
       sfree(errstr);
       csnmp_host_close_session(host);
 
@@ -1376,160 +1722,53 @@ static int csnmp_read_table(host_definition_t *host, data_definition_t *data) {
       break;
     }
 
-    status = 0;
-    assert(res != NULL);
     c_release(LOG_INFO, &host->complaint,
               "snmp plugin: host %s: snmp_sess_synch_response successful.",
               host->name);
 
-    vb = res->variables;
-    if (vb == NULL) {
-      status = -1;
-      break;
-    }
-
-    for (vb = res->variables, i = 0; (vb != NULL);
-         vb = vb->next_variable, i++) {
-      /* Calculate value index from todo list */
-      while ((i < oid_list_len) && !oid_list_todo[i])
-        i++;
-
-      /* An instance is configured and the res variable we process is the
-       * instance value (last index) */
-      if ((data->instance.oid.oid_len > 0) && (i == data->values_len)) {
-        if ((vb->type == SNMP_ENDOFMIBVIEW) ||
-            (snmp_oid_ncompare(
-                 data->instance.oid.oid, data->instance.oid.oid_len, vb->name,
-                 vb->name_length, data->instance.oid.oid_len) != 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; Instance left its subtree.",
-                host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
-
-        /* Allocate a new `csnmp_list_instances_t', insert the instance name and
-         * add it to the list */
-        if (csnmp_instance_list_add(&instance_list_head, &instance_list_tail,
-                                    res, host, data) != 0) {
-          ERROR("snmp plugin: host %s: csnmp_instance_list_add failed.",
-                host->name);
-          status = -1;
-          break;
-        }
-      } else /* The variable we are processing is a normal value */
-      {
-        csnmp_table_values_t *vt;
-        oid_t vb_name;
-        oid_t suffix;
-        int ret;
-
-        csnmp_oid_init(&vb_name, vb->name, vb->name_length);
-
-        /* Calculate the current suffix. This is later used to check that the
-         * suffix is increasing. This also checks if we left the subtree */
-        ret = csnmp_oid_suffix(&suffix, &vb_name, data->values + i);
-        if (ret != 0) {
-          DEBUG("snmp plugin: host = %s; data = %s; i = %zu; "
-                "Value probably left its subtree.",
-                host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
-
-        /* Make sure the OIDs returned by the agent are increasing. Otherwise
-         * our
-         * table matching algorithm will get confused. */
-        if ((value_list_tail[i] != NULL) &&
-            (csnmp_oid_compare(&suffix, &value_list_tail[i]->suffix) <= 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; i = %zu; "
-                "Suffix is not increasing.",
-                host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
-
-        vt = calloc(1, sizeof(*vt));
-        if (vt == NULL) {
-          ERROR("snmp plugin: calloc failed.");
-          status = -1;
-          break;
-        }
-
-        vt->value =
-            csnmp_value_list_to_value(vb, ds->ds[i].type, data->scale,
-                                      data->shift, host->name, data->name);
-        memcpy(&vt->suffix, &suffix, sizeof(vt->suffix));
-        vt->next = NULL;
-
-        if (value_list_tail[i] == NULL)
-          value_list_head[i] = vt;
-        else
-          value_list_tail[i]->next = vt;
-        value_list_tail[i] = vt;
-      }
-
-      /* Copy OID to oid_list[i] */
-      memcpy(oid_list[i].oid, vb->name, sizeof(oid) * vb->name_length);
-      oid_list[i].oid_len = vb->name_length;
-
-    } /* for (vb = res->variables ...) */
-
-    if (res != NULL)
-      snmp_free_pdu(res);
-    res = NULL;
-  } /* while (status == 0) */
-
-  if (res != NULL)
+    status = csnmp_table_walk_response(walk, res);
     snmp_free_pdu(res);
-  res = NULL;
+    res = NULL;
 
-  if (req != NULL)
-    snmp_free_pdu(req);
-  req = NULL;
+    if (status != 0)
+      break;
+  } /* while (csnmp_table_walk_request) */
 
   if (status == 0)
-    csnmp_dispatch_table(host, data, instance_list_head, value_list_head);
-
-  /* Free all allocated variables here */
-  while (instance_list_head != NULL) {
-    csnmp_list_instances_t *next = instance_list_head->next;
-    sfree(instance_list_head);
-    instance_list_head = next;
-  }
-
-  for (i = 0; i < data->values_len; i++) {
-    while (value_list_head[i] != NULL) {
-      csnmp_table_values_t *next = value_list_head[i]->next;
-      sfree(value_list_head[i]);
-      value_list_head[i] = next;
-    }
-  }
+    csnmp_table_walk_dispatch(walk);
 
-  sfree(value_list_head);
-  sfree(value_list_tail);
+  csnmp_table_walk_destroy(walk);
 
   return 0;
 } /* int csnmp_read_table */
 
-static int csnmp_read_value(host_definition_t *host, data_definition_t *data) {
+/* Creates the GET request for a non-table data definition. */
+static struct snmp_pdu *csnmp_value_request(data_definition_t *data) {
   struct snmp_pdu *req;
-  struct snmp_pdu *res = NULL;
+
+  req = snmp_pdu_create(SNMP_MSG_GET);
+  if (req == NULL) {
+    ERROR("snmp plugin: snmp_pdu_create failed.");
+    return NULL;
+  }
+
+  for (size_t i = 0; i < data->values_len; i++)
+    snmp_add_null_var(req, data->values[i].oid, data->values[i].oid_len);
+
+  return req;
+} /* struct snmp_pdu *csnmp_value_request */
+
+/* Dispatches the values in "res", the response to csnmp_value_request(). */
+static int csnmp_value_response(host_definition_t *host,
+                                data_definition_t *data,
+                                const struct snmp_pdu *res) {
   struct variable_list *vb;
 
   const data_set_t *ds;
   value_list_t vl = VALUE_LIST_INIT;
 
-  int status;
   size_t i;
 
-  DEBUG("snmp plugin: csnmp_read_value (host = %s, data = %s)", host->name,
-        data->name);
-
-  if (host->sess_handle == NULL) {
-    DEBUG("snmp plugin: csnmp_read_value: host->sess_handle == NULL");
-    return -1;
-  }
-
   ds = plugin_get_ds(data->type);
   if (!ds) {
     ERROR("snmp plugin: DataSet `%s' not defined.", data->type);
@@ -1561,15 +1800,44 @@ static int csnmp_read_value(host_definition_t *host, data_definition_t *data) {
 
   vl.interval = host->interval;
 
-  req = snmp_pdu_create(SNMP_MSG_GET);
-  if (req == NULL) {
-    ERROR("snmp plugin: snmp_pdu_create failed.");
-    sfree(vl.values);
+  for (vb = res->variables; vb != NULL; vb = vb->next_variable) {
+#if COLLECT_DEBUG
+    char buffer[1024];
+    snprint_variable(buffer, sizeof(buffer), vb->name, vb->name_length, vb);
+    DEBUG("snmp plugin: Got this variable: %s", buffer);
+#endif /* COLLECT_DEBUG */
+
+    for (i = 0; i < data->values_len; i++)
+      if (snmp_oid_compare(data->values[i].oid, data->values[i].oid_len,
+                           vb->name, vb->name_length) == 0)
+        vl.values[i] =
+            csnmp_value_list_to_value(vb, ds->ds[i].type, data->scale,
+                                      data->shift, host->name, data->name);
+  } /* for (res->variables) */
+
+  DEBUG("snmp plugin: -> plugin_dispatch_values (&vl);");
+  plugin_dispatch_values(&vl);
+  sfree(vl.values);
+
+  return 0;
+} /* int csnmp_value_response */
+
+static int csnmp_read_value(host_definition_t *host, data_definition_t *data) {
+  struct snmp_pdu *req;
+  struct snmp_pdu *res = NULL;
+  int status;
+
+  DEBUG("snmp plugin: csnmp_read_value (host = %s, data = %s)", host->name,
+        data->name);
+
+  if (host->sess_handle == NULL) {
+    DEBUG("snmp plugin: csnmp_read_value: host->sess_handle == NULL");
     return -1;
   }
 
-  for (i = 0; i < data->values_len; i++)
-    snmp_add_null_var(req, data->values[i].oid, data->values[i].oid_len);
+  req = csnmp_value_request(data);
+  if (req == NULL)
+    return -1;
 
   status = snmp_sess_synch_response(host->sess_handle, req, &res);
 
@@ -1584,35 +1852,362 @@ static int csnmp_read_value(host_definition_t *host, data_definition_t *data) {
       snmp_free_pdu(res);
 
     sfree(errstr);
-    sfree(vl.values);
     csnmp_host_close_session(host);
 
     return -1;
   }
 
-  for (vb = res->variables; vb != NULL; vb = vb->next_variable) {
-#if COLLECT_DEBUG
-    char buffer[1024];
-    snprint_variable(buffer, sizeof(buffer), vb->name, vb->name_length, vb);
-    DEBUG("snmp plugin: Got this variable: %s", buffer);
-#endif /* COLLECT_DEBUG */
+  status = csnmp_value_response(host, data, res);
+  snmp_free_pdu(res);
 
-    for (i = 0; i < data->values_len; i++)
-      if (snmp_oid_compare(data->values[i].oid, data->values[i].oid_len,
-                           vb->name, vb->name_length) == 0)
-        vl.values[i] =
-            csnmp_value_list_to_value(vb, ds->ds[i].type, data->scale,
-                                      data->shift, host->name, data->name);
-  } /* for (res->variables) */
+  return status;
+} /* int csnmp_read_value */
 
-  snmp_free_pdu(res);
+/* Asynchronous mode {{{ */
+static int csnmp_async_callback(int operation, netsnmp_session *sess,
+                                int reqid, netsnmp_pdu *pdu, void *magic);
 
-  DEBUG("snmp plugin: -> plugin_dispatch_values (&vl);");
-  plugin_dispatch_values(&vl);
-  sfree(vl.values);
+/* Sends the next request of "host", moving on to the next data definition
+ * when the current one is complete. Returns zero if a request is in flight,
+ * and non-zero if the host is done. */
+static int csnmp_async_send_next(host_definition_t *host) /* {{{ */
+{
+  while (host->async_data_index < host->data_list_len) {
+    data_definition_t *data = host->data_list[host->async_data_index];
+    struct snmp_pdu *req = NULL;
+
+    if (data->is_table) {
+      if (host->async_walk == NULL) {
+        DEBUG("snmp plugin: csnmp_async_send_next (host = %s, data = %s)",
+              host->name, data->name);
+        host->async_walk = csnmp_table_walk_create(host, data);
+        if (host->async_walk == NULL) {
+          host->async_data_index++;
+          continue;
+        }
+      }
+
+      if (csnmp_table_walk_request(host->async_walk, &req) != 0) {
+        csnmp_table_walk_destroy(host->async_walk);
+        host->async_walk = NULL;
+        host->async_data_index++;
+        continue;
+      } else if (req == NULL) {
+        /* All variables have left their subtree. */
+        if (csnmp_table_walk_dispatch(host->async_walk) == 0)
+          host->async_success++;
+        csnmp_table_walk_destroy(host->async_walk);
+        host->async_walk = NULL;
+        host->async_data_index++;
+        continue;
+      }
+    } else {
+      req = csnmp_value_request(data);
+      if (req == NULL) {
+        host->async_data_index++;
+        continue;
+      }
+    }
+
+    if (snmp_sess_async_send(host->sess_handle, req, csnmp_async_callback,
+                             host) == 0) {
+      char *errstr = NULL;
+
+      snmp_sess_error(host->sess_handle, NULL, NULL, &errstr);
+      c_complain(LOG_ERR, &host->complaint,
+                 "snmp plugin: host %s: snmp_sess_async_send failed: %s",
+                 host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+      sfree(errstr);
+      snmp_free_pdu(req);
+
+      host->async_failed = 1;
+      return -1;
+    }
+
+    return 0;
+  }
+
+  return 1;
+} /* }}} int csnmp_async_send_next */
+
+/* Called by net-snmp from within snmp_sess_read2() and snmp_sess_timeout().
+ * The PDU is freed by the library. */
+static int csnmp_async_callback(int operation, /* {{{ */
+                                netsnmp_session __attribute__((unused)) *
+                                    sess,
+                                int __attribute__((unused)) reqid,
+                                netsnmp_pdu *pdu, void *magic) {
+  host_definition_t *host = magic;
+  data_definition_t *data;
+
+  if (host->async_done)
+    return 1;
+
+  if ((operation != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) || (pdu == NULL)) {
+    c_complain(LOG_ERR, &host->complaint,
+               "snmp plugin: host %s: Request timed out.", host->name);
+    /* The session is closed once the library is done with it. */
+    host->async_failed = 1;
+    host->async_done = 1;
+    return 1;
+  }
+
+  c_release(LOG_INFO, &host->complaint,
+            "snmp plugin: host %s: Asynchronous request successful.",
+            host->name);
+
+  data = host->data_list[host->async_data_index];
+  if (data->is_table) {
+    if (csnmp_table_walk_response(host->async_walk, pdu) != 0) {
+      /* Same as the synchronous code: drop the partial table. */
+      csnmp_table_walk_destroy(host->async_walk);
+      host->async_walk = NULL;
+      host->async_data_index++;
+    }
+  } else {
+    if (csnmp_value_response(host, data, pdu) == 0)
+      host->async_success++;
+    host->async_data_index++;
+  }
+
+  if (csnmp_async_send_next(host) != 0)
+    host->async_done = 1;
+
+  return 1;
+} /* }}} int csnmp_async_callback */
+
+/* Starts polling "host". Returns non-zero if the host is done already. */
+static int csnmp_async_host_start(host_definition_t *host) /* {{{ */
+{
+  host->async_data_index = 0;
+  host->async_success = 0;
+  host->async_done = 0;
+  host->async_failed = 0;
+  host->async_walk = NULL;
+
+  if (host->sess_handle == NULL)
+    csnmp_host_open_session(host);
+  if (host->sess_handle == NULL)
+    return -1;
+
+  return csnmp_async_send_next(host);
+} /* }}} int csnmp_async_host_start */
+
+static void csnmp_async_host_finish(host_definition_t *host) /* {{{ */
+{
+  csnmp_table_walk_destroy(host->async_walk);
+  host->async_walk = NULL;
+
+  if (host->async_failed)
+    csnmp_host_close_session(host);
+
+  DEBUG("snmp plugin: host %s: Asynchronous poll done, %i of %i data "
+        "definitions successful.",
+        host->name, host->async_success, host->data_list_len);
+
+  pthread_mutex_lock(&async_lock);
+  host->async_state = CSNMP_ASYNC_IDLE;
+  pthread_mutex_unlock(&async_lock);
+} /* }}} void csnmp_async_host_finish */
+
+static void *csnmp_async_thread(void __attribute__((unused)) * arg) /* {{{ */
+{
+  host_definition_t *active = NULL;
+  int active_num = 0;
+  netsnmp_large_fd_set fdset;
+
+  netsnmp_large_fd_set_init(&fdset, FD_SETSIZE);
+
+  while (42) {
+    host_definition_t **prev;
+    struct timeval timeout = {0};
+    int numfds;
+    int block;
+    int status;
+
+    /* Start queued hosts while below the concurrency limit. */
+    pthread_mutex_lock(&async_lock);
+    if (async_shutdown) {
+      pthread_mutex_unlock(&async_lock);
+      break;
+    }
+    while ((async_queue_head != NULL) && (active_num < async_concurrency)) {
+      host_definition_t *host = async_queue_head;
+
+      async_queue_head = host->async_next;
+      if (async_queue_head == NULL)
+        async_queue_tail = NULL;
+      host->async_state = CSNMP_ASYNC_ACTIVE;
+      pthread_mutex_unlock(&async_lock);
+
+      if (csnmp_async_host_start(host) != 0) {
+        csnmp_async_host_finish(host);
+      } else {
+        host->async_next = active;
+        active = host;
+        active_num++;
+      }
+
+      pthread_mutex_lock(&async_lock);
+    }
+    pthread_mutex_unlock(&async_lock);
+
+    NETSNMP_LARGE_FD_ZERO(&fdset);
+    NETSNMP_LARGE_FD_SET(async_wake_fd[0], &fdset);
+    numfds = async_wake_fd[0] + 1;
+    block = 1;
+
+    for (host_definition_t *host = active; host != NULL;
+         host = host->async_next)
+      snmp_sess_select_info2(host->sess_handle, &numfds, &fdset, &timeout,
+                             &block);
+
+    /* Wake up at least once a second, so timeouts are handled even if the
+     * library didn't report any. */
+    if (block || (timeout.tv_sec >= 1))
+      timeout = (struct timeval){.tv_sec = 1};
+
+    status = netsnmp_large_fd_set_select(numfds, &fdset, NULL, NULL, &timeout);
+    if ((status < 0) && (errno != EINTR)) {
+      char errbuf[1024];
+      ERROR("snmp plugin: select failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      sleep(1);
+      continue;
+    }
+
+    if ((status > 0) && NETSNMP_LARGE_FD_ISSET(async_wake_fd[0], &fdset)) {
+      char buffer[64];
+      while (read(async_wake_fd[0], buffer, sizeof(buffer)) > 0)
+        /* drain */;
+    }
+
+    for (host_definition_t *host = active; host != NULL;
+         host = host->async_next) {
+      if (status > 0)
+        snmp_sess_read2(host->sess_handle, &fdset);
+      if (!host->async_done)
+        snmp_sess_timeout(host->sess_handle);
+    }
+
+    /* Remove hosts that are done from the active list. */
+    prev = &active;
+    while (*prev != NULL) {
+      host_definition_t *host = *prev;
+
+      if (!host->async_done) {
+        prev = &host->async_next;
+        continue;
+      }
+
+      *prev = host->async_next;
+      host->async_next = NULL;
+      active_num--;
+      csnmp_async_host_finish(host);
+    }
+  } /* while (42) */
+
+  while (active != NULL) {
+    host_definition_t *next = active->async_next;
+    active->async_failed = 1;
+    csnmp_async_host_finish(active);
+    active = next;
+  }
+
+  netsnmp_large_fd_set_cleanup(&fdset);
+  return NULL;
+} /* }}} void *csnmp_async_thread */
+
+static void csnmp_async_wake(void) /* {{{ */
+{
+  char c = 0;
 
+  /* If the pipe is full, the engine thread is awake anyway. */
+  if (write(async_wake_fd[1], &c, sizeof(c)) < 0) {
+    DEBUG("snmp plugin: csnmp_async_wake: write failed.");
+  }
+} /* }}} void csnmp_async_wake */
+
+/* Queues "host" for the engine thread. */
+static int csnmp_async_submit(host_definition_t *host) /* {{{ */
+{
+  pthread_mutex_lock(&async_lock);
+  if (host->async_state != CSNMP_ASYNC_IDLE) {
+    pthread_mutex_unlock(&async_lock);
+    c_complain(LOG_WARNING, &host->complaint,
+               "snmp plugin: host %s: The previous poll has not finished yet; "
+               "skipping this interval.",
+               host->name);
+    return 0;
+  }
+
+  host->async_state = CSNMP_ASYNC_QUEUED;
+  host->async_next = NULL;
+  if (async_queue_tail == NULL)
+    async_queue_head = host;
+  else
+    async_queue_tail->async_next = host;
+  async_queue_tail = host;
+  pthread_mutex_unlock(&async_lock);
+
+  csnmp_async_wake();
   return 0;
-} /* int csnmp_read_value */
+} /* }}} int csnmp_async_submit */
+
+static int csnmp_async_start(void) /* {{{ */
+{
+  int status;
+
+  if (async_thread_running)
+    return 0;
+
+  if (pipe(async_wake_fd) != 0) {
+    char errbuf[1024];
+    ERROR("snmp plugin: pipe failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return -1;
+  }
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(async_wake_fd); i++) {
+    int flags = fcntl(async_wake_fd[i], F_GETFL);
+    fcntl(async_wake_fd[i], F_SETFL, flags | O_NONBLOCK);
+  }
+
+  async_shutdown = 0;
+  status = plugin_thread_create(&async_thread, /* attr = */ NULL,
+                                csnmp_async_thread, /* arg = */ NULL,
+                                "snmp async");
+  if (status != 0) {
+    ERROR("snmp plugin: Starting the engine thread failed.");
+    close(async_wake_fd[0]);
+    close(async_wake_fd[1]);
+    async_wake_fd[0] = async_wake_fd[1] = -1;
+    return -1;
+  }
+  async_thread_running = 1;
+
+  return 0;
+} /* }}} int csnmp_async_start */
+
+static void csnmp_async_stop(void) /* {{{ */
+{
+  if (!async_thread_running)
+    return;
+
+  pthread_mutex_lock(&async_lock);
+  async_shutdown = 1;
+  async_queue_head = async_queue_tail = NULL;
+  pthread_mutex_unlock(&async_lock);
+
+  csnmp_async_wake();
+  pthread_join(async_thread, NULL);
+  async_thread_running = 0;
+
+  close(async_wake_fd[0]);
+  close(async_wake_fd[1]);
+  async_wake_fd[0] = async_wake_fd[1] = -1;
+} /* }}} void csnmp_async_stop */
+/* }}} Asynchronous mode */
 
 static int csnmp_read_host(user_data_t *ud) {
   host_definition_t *host;
@@ -1625,6 +2220,9 @@ static int csnmp_read_host(user_data_t *ud) {
   if (host->interval == 0)
     host->interval = plugin_get_interval();
 
+  if (async_enabled)
+    return csnmp_async_submit(host);
+
   if (host->sess_handle == NULL)
     csnmp_host_open_session(host);
 
@@ -1653,6 +2251,9 @@ static int csnmp_read_host(user_data_t *ud) {
 static int csnmp_init(void) {
   call_snmp_init_once();
 
+  if (async_enabled)
+    return csnmp_async_start();
+
   return 0;
 } /* int csnmp_init */
 
@@ -1660,8 +2261,16 @@ static int csnmp_shutdown(void) {
   data_definition_t *data_this;
   data_definition_t *data_next;
 
-  /* When we get here, the read threads have been stopped and all the
-   * `host_definition_t' will be freed. */
+  /* When we get here, the read threads have been stopped. Stop the engine
+   * thread before freeing the hosts it may still be polling. */
+  csnmp_async_stop();
+
+  while (host_head != NULL) {
+    host_definition_t *next = host_head->next;
+    csnmp_host_definition_destroy(host_head);
+    host_head = next;
+  }
+
   DEBUG("snmp plugin: Destroying all data definitions.");
 
   data_this = data_head;
@@ -24,10 +24,13 @@
  *   Florian octo Forster <octo at collectd.org>
  */
 
+#define _GNU_SOURCE /* For recvmmsg */
+
 #include "collectd.h"
 
 #include "common.h"
 #include "plugin.h"
+#include "meta_data.h"
 #include "utils_avltree.h"
 #include "utils_latency.h"
 
@@ -48,6 +51,35 @@
 #define STATSD_DEFAULT_SERVICE "8125"
 #endif
 
+/* Number of independently locked partitions of the metrics table. Must be a
+ * power of two. */
+#ifndef STATSD_SHARDS_NUM
+#define STATSD_SHARDS_NUM 64
+#endif
+
+/* Number of datagrams received with a single recvmmsg(2) call. */
+#ifndef STATSD_RECV_BATCH
+#define STATSD_RECV_BATCH 16
+#endif
+
+#define STATSD_BUFFER_SIZE 4096
+
+/* Time in milliseconds after which the network threads check whether they
+ * should exit, even if no datagram arrives. */
+#ifndef STATSD_POLL_TIMEOUT
+#define STATSD_POLL_TIMEOUT 1000
+#endif
+
+/* Maximum number of DogStatsD tags per line. */
+#ifndef STATSD_MAX_TAGS
+#define STATSD_MAX_TAGS 32
+#endif
+
+/* Number of HyperLogLog registers used to estimate the size of sets, as a
+ * power of two. 2^12 registers give a standard error of about 1.6%. */
+#define STATSD_HLL_BITS 12
+#define STATSD_HLL_REGISTERS (1 << STATSD_HLL_BITS)
+
 enum metric_type_e { STATSD_COUNTER, STATSD_TIMER, STATSD_GAUGE, STATSD_SET };
 typedef enum metric_type_e metric_type_t;
 
@@ -57,25 +89,41 @@ struct statsd_metric_s {
   derive_t counter;
   latency_counter_t *latency;
   c_avl_tree_t *set;
+  uint8_t *hll; /* STATSD_HLL_REGISTERS registers, if SetEstimate is enabled */
+  meta_data_t *meta; /* DogStatsD tags, if any */
   unsigned long updates_num;
 };
 typedef struct statsd_metric_s statsd_metric_t;
 
-static c_avl_tree_t *metrics_tree = NULL;
+/* The metrics are partitioned into shards based on a hash of their key, so
+ * that updates to different metrics from different network threads don't
+ * contend for the same lock. */
+struct statsd_shard_s {
+  c_avl_tree_t *tree;
+  pthread_mutex_t lock;
+};
+typedef struct statsd_shard_s statsd_shard_t;
+
+static statsd_shard_t metrics_shards[STATSD_SHARDS_NUM];
+static _Bool metrics_shards_init = 0;
+/* Protects metrics_shards_init and the network threads. */
 static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static pthread_t network_thread;
-static _Bool network_thread_running = 0;
+static pthread_t *network_threads = NULL;
+static size_t network_threads_num = 0;
 static _Bool network_thread_shutdown = 0;
 
 static char *conf_node = NULL;
 static char *conf_service = NULL;
+static int conf_network_threads = 1;
 
 static _Bool conf_delete_counters = 0;
 static _Bool conf_delete_timers = 0;
 static _Bool conf_delete_gauges = 0;
 static _Bool conf_delete_sets = 0;
 
+static _Bool conf_set_estimate = 0;
+
 static double *conf_timer_percentile = NULL;
 static size_t conf_timer_percentile_num = 0;
 
@@ -85,14 +133,25 @@ static _Bool conf_timer_upper = 0;
 static _Bool conf_timer_sum = 0;
 static _Bool conf_timer_count = 0;
 
-/* Must hold metrics_lock when calling this function. */
-static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
-                                                    metric_type_t type) {
-  char key[DATA_MAX_NAME_LEN + 2];
-  char *key_copy;
-  statsd_metric_t *metric;
-  int status;
+/* FNV-1a */
+static uint32_t statsd_hash(char const *key) /* {{{ */
+{
+  uint32_t hash = 2166136261U;
+
+  for (unsigned char const *ptr = (unsigned char const *)key; *ptr != 0;
+       ptr++) {
+    hash ^= (uint32_t)*ptr;
+    hash *= 16777619U;
+  }
+
+  return hash;
+} /* }}} uint32_t statsd_hash */
 
+/* Builds the key of the metric, e.g. "c:name" or "c:name|#tag:value", and
+ * returns the shard it belongs to. Returns NULL if the type is invalid. */
+static statsd_shard_t *statsd_metric_key(char *key, /* {{{ */
+                                         size_t key_size, char const *name,
+                                         char const *tags, metric_type_t type) {
   switch (type) {
   case STATSD_COUNTER:
     key[0] = 'c';
@@ -111,20 +170,76 @@ static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
   }
 
   key[1] = ':';
-  sstrncpy(&key[2], name, sizeof(key) - 2);
+  sstrncpy(&key[2], name, DATA_MAX_NAME_LEN);
+  if (tags != NULL) {
+    size_t len = strlen(key);
+    sstrncpy(&key[len], "|#", key_size - len);
+    sstrncpy(&key[len + 2], tags, key_size - (len + 2));
+  }
+
+  return &metrics_shards[statsd_hash(key) & (STATSD_SHARDS_NUM - 1)];
+} /* }}} statsd_shard_t *statsd_metric_key */
+
+/* Creates the meta data holding the tags of a metric. "tags" is the canonical
+ * tag list created by statsd_parse_tags(). */
+static meta_data_t *statsd_tags_to_meta(char const *tags) /* {{{ */
+{
+  char buffer[DATA_MAX_NAME_LEN];
+  char *saveptr = NULL;
+  meta_data_t *meta;
+
+  meta = meta_data_create();
+  if (meta == NULL)
+    return NULL;
 
-  status = c_avl_get(metrics_tree, key, (void *)&metric);
+  sstrncpy(buffer, tags, sizeof(buffer));
+  for (char *tag = strtok_r(buffer, ",", &saveptr); tag != NULL;
+       tag = strtok_r(NULL, ",", &saveptr)) {
+    char *value = strchr(tag, ':');
+    if (value != NULL) {
+      *value = 0;
+      value++;
+    }
+
+    meta_data_add_string(meta, tag, (value != NULL) ? value : "");
+  }
+
+  return meta;
+} /* }}} meta_data_t *statsd_tags_to_meta */
+
+/* Looks up, or creates, the metric and returns it with the lock of its shard
+ * held. The caller must release the lock using statsd_metric_release(). */
+static statsd_metric_t *statsd_metric_acquire(char const *name, /* {{{ */
+                                              char const *tags,
+                                              metric_type_t type,
+                                              statsd_shard_t **ret_shard) {
+  char key[2 * DATA_MAX_NAME_LEN + 4];
+  char *key_copy;
+  statsd_shard_t *shard;
+  statsd_metric_t *metric;
+  int status;
+
+  shard = statsd_metric_key(key, sizeof(key), name, tags, type);
+  if (shard == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&shard->lock);
+  *ret_shard = shard;
+
+  status = c_avl_get(shard->tree, key, (void *)&metric);
   if (status == 0)
     return metric;
 
   key_copy = strdup(key);
   if (key_copy == NULL) {
+    pthread_mutex_unlock(&shard->lock);
     ERROR("statsd plugin: strdup failed.");
     return NULL;
   }
 
   metric = calloc(1, sizeof(*metric));
   if (metric == NULL) {
+    pthread_mutex_unlock(&shard->lock);
     ERROR("statsd plugin: calloc failed.");
     sfree(key_copy);
     return NULL;
@@ -133,54 +248,69 @@ static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
   metric->type = type;
   metric->latency = NULL;
   metric->set = NULL;
+  metric->hll = NULL;
+  metric->meta = NULL;
+
+  /* Tags are converted to meta data once, when the metric is created. */
+  if (tags != NULL) {
+    metric->meta = statsd_tags_to_meta(tags);
+    if (metric->meta == NULL) {
+      pthread_mutex_unlock(&shard->lock);
+      ERROR("statsd plugin: meta_data_create failed.");
+      sfree(key_copy);
+      sfree(metric);
+      return NULL;
+    }
+  }
 
-  status = c_avl_insert(metrics_tree, key_copy, metric);
+  status = c_avl_insert(shard->tree, key_copy, metric);
   if (status != 0) {
+    pthread_mutex_unlock(&shard->lock);
     ERROR("statsd plugin: c_avl_insert failed.");
     sfree(key_copy);
+    meta_data_destroy(metric->meta);
     sfree(metric);
     return NULL;
   }
 
   return metric;
-} /* }}} statsd_metric_lookup_unsafe */
+} /* }}} statsd_metric_acquire */
 
-static int statsd_metric_set(char const *name, double value, /* {{{ */
-                             metric_type_t type) {
-  statsd_metric_t *metric;
+static void statsd_metric_release(statsd_shard_t *shard) /* {{{ */
+{
+  pthread_mutex_unlock(&shard->lock);
+} /* }}} void statsd_metric_release */
 
-  pthread_mutex_lock(&metrics_lock);
+static int statsd_metric_set(char const *name, char const *tags, /* {{{ */
+                             double value, metric_type_t type) {
+  statsd_shard_t *shard;
+  statsd_metric_t *metric;
 
-  metric = statsd_metric_lookup_unsafe(name, type);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_acquire(name, tags, type, &shard);
+  if (metric == NULL)
     return -1;
-  }
 
   metric->value = value;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  statsd_metric_release(shard);
 
   return 0;
 } /* }}} int statsd_metric_set */
 
-static int statsd_metric_add(char const *name, double delta, /* {{{ */
-                             metric_type_t type) {
+static int statsd_metric_add(char const *name, char const *tags, /* {{{ */
+                             double delta, metric_type_t type) {
+  statsd_shard_t *shard;
   statsd_metric_t *metric;
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, type);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_acquire(name, tags, type, &shard);
+  if (metric == NULL)
     return -1;
-  }
 
   metric->value += delta;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  statsd_metric_release(shard);
 
   return 0;
 } /* }}} int statsd_metric_add */
@@ -208,6 +338,8 @@ static void statsd_metric_free(statsd_metric_t *metric) /* {{{ */
     metric->set = NULL;
   }
 
+  sfree(metric->hll);
+  meta_data_destroy(metric->meta);
   sfree(metric);
 } /* }}} void statsd_metric_free */
 
@@ -222,7 +354,7 @@ static int statsd_parse_value(char const *str, value_t *ret_value) /* {{{ */
   return 0;
 } /* }}} int statsd_parse_value */
 
-static int statsd_handle_counter(char const *name, /* {{{ */
+static int statsd_handle_counter(char const *name, char const *tags, /* {{{ */
                                  char const *value_str, char const *extra) {
   value_t value;
   value_t scale;
@@ -248,11 +380,11 @@ static int statsd_handle_counter(char const *name, /* {{{ */
 
   /* Changes to the counter are added to (statsd_metric_t*)->value. ->counter is
    * only updated in statsd_metric_submit_unsafe(). */
-  return statsd_metric_add(name, (double)(value.gauge / scale.gauge),
+  return statsd_metric_add(name, tags, (double)(value.gauge / scale.gauge),
                            STATSD_COUNTER);
 } /* }}} int statsd_handle_counter */
 
-static int statsd_handle_gauge(char const *name, /* {{{ */
+static int statsd_handle_gauge(char const *name, char const *tags, /* {{{ */
                                char const *value_str) {
   value_t value;
   int status;
@@ -263,13 +395,14 @@ static int statsd_handle_gauge(char const *name, /* {{{ */
     return status;
 
   if ((value_str[0] == '+') || (value_str[0] == '-'))
-    return statsd_metric_add(name, (double)value.gauge, STATSD_GAUGE);
+    return statsd_metric_add(name, tags, (double)value.gauge, STATSD_GAUGE);
   else
-    return statsd_metric_set(name, (double)value.gauge, STATSD_GAUGE);
+    return statsd_metric_set(name, tags, (double)value.gauge, STATSD_GAUGE);
 } /* }}} int statsd_handle_gauge */
 
-static int statsd_handle_timer(char const *name, /* {{{ */
+static int statsd_handle_timer(char const *name, char const *tags, /* {{{ */
                                char const *value_str, char const *extra) {
+  statsd_shard_t *shard;
   statsd_metric_t *metric;
   value_t value_ms;
   value_t scale;
@@ -296,40 +429,110 @@ static int statsd_handle_timer(char const *name, /* {{{ */
 
   value = MS_TO_CDTIME_T(value_ms.gauge / scale.gauge);
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, STATSD_TIMER);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_acquire(name, tags, STATSD_TIMER, &shard);
+  if (metric == NULL)
     return -1;
-  }
 
   if (metric->latency == NULL)
     metric->latency = latency_counter_create();
   if (metric->latency == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    statsd_metric_release(shard);
     return -1;
   }
 
   latency_counter_add(metric->latency, value);
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  statsd_metric_release(shard);
   return 0;
 } /* }}} int statsd_handle_timer */
 
-static int statsd_handle_set(char const *name, /* {{{ */
+/* 64 bit FNV-1a followed by the MurmurHash3 finalizer, so that all bits of
+ * the result are well distributed, as required by HyperLogLog. */
+static uint64_t statsd_hll_hash(char const *key) /* {{{ */
+{
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (unsigned char const *ptr = (unsigned char const *)key; *ptr != 0;
+       ptr++) {
+    hash ^= (uint64_t)*ptr;
+    hash *= 1099511628211ULL;
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+
+  return hash;
+} /* }}} uint64_t statsd_hll_hash */
+
+static void statsd_hll_add(uint8_t *hll, char const *key) /* {{{ */
+{
+  uint64_t hash = statsd_hll_hash(key);
+  size_t index = (size_t)(hash >> (64 - STATSD_HLL_BITS));
+  uint64_t rest = hash << STATSD_HLL_BITS;
+  uint8_t rank = 1;
+
+  /* rank is the position of the first set bit in the remaining bits. */
+  while ((rank <= (64 - STATSD_HLL_BITS)) && ((rest & (1ULL << 63)) == 0)) {
+    rank++;
+    rest <<= 1;
+  }
+
+  if (hll[index] < rank)
+    hll[index] = rank;
+} /* }}} void statsd_hll_add */
+
+static gauge_t statsd_hll_estimate(uint8_t const *hll) /* {{{ */
+{
+  double m = (double)STATSD_HLL_REGISTERS;
+  double alpha = 0.7213 / (1.0 + 1.079 / m);
+  double sum = 0.0;
+  size_t zeros = 0;
+
+  for (size_t i = 0; i < STATSD_HLL_REGISTERS; i++) {
+    sum += ldexp(1.0, -(int)hll[i]);
+    if (hll[i] == 0)
+      zeros++;
+  }
+
+  double estimate = alpha * m * m / sum;
+
+  /* Small range correction: use linear counting. */
+  if ((estimate <= 2.5 * m) && (zeros > 0))
+    estimate = m * log(m / (double)zeros);
+
+  return (gauge_t)nearbyint(estimate);
+} /* }}} gauge_t statsd_hll_estimate */
+
+static int statsd_handle_set(char const *name, char const *tags, /* {{{ */
                              char const *set_key_orig) {
+  statsd_shard_t *shard;
   statsd_metric_t *metric = NULL;
   char *set_key;
   int status;
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, STATSD_SET);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  metric = statsd_metric_acquire(name, tags, STATSD_SET, &shard);
+  if (metric == NULL)
     return -1;
+
+  /* Only keep track of the set's size, rather than copying every member. */
+  if (conf_set_estimate) {
+    if (metric->hll == NULL)
+      metric->hll = calloc(STATSD_HLL_REGISTERS, sizeof(*metric->hll));
+    if (metric->hll == NULL) {
+      statsd_metric_release(shard);
+      ERROR("statsd plugin: calloc failed.");
+      return -1;
+    }
+
+    statsd_hll_add(metric->hll, set_key_orig);
+    metric->updates_num++;
+
+    statsd_metric_release(shard);
+    return 0;
   }
 
   /* Make sure metric->set exists. */
@@ -337,21 +540,28 @@ static int statsd_handle_set(char const *name, /* {{{ */
     metric->set = c_avl_create((int (*)(const void *, const void *))strcmp);
 
   if (metric->set == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    statsd_metric_release(shard);
     ERROR("statsd plugin: c_avl_create failed.");
     return -1;
   }
 
+  /* Only copy the key if it isn't a member of the set yet. */
+  if (c_avl_get(metric->set, set_key_orig, /* value = */ NULL) == 0) {
+    metric->updates_num++;
+    statsd_metric_release(shard);
+    return 0;
+  }
+
   set_key = strdup(set_key_orig);
   if (set_key == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    statsd_metric_release(shard);
     ERROR("statsd plugin: strdup failed.");
     return -1;
   }
 
   status = c_avl_insert(metric->set, set_key, /* value = */ NULL);
   if (status < 0) {
-    pthread_mutex_unlock(&metrics_lock);
+    statsd_metric_release(shard);
     if (status < 0)
       ERROR("statsd plugin: c_avl_insert (\"%s\") failed with status %i.",
             set_key, status);
@@ -364,83 +574,215 @@ static int statsd_handle_set(char const *name, /* {{{ */
 
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  statsd_metric_release(shard);
   return 0;
 } /* }}} int statsd_handle_set */
 
-static int statsd_parse_line(char *buffer) /* {{{ */
-{
-  char *name = buffer;
-  char *value;
-  char *type;
-  char *extra;
-
-  type = strchr(name, '|');
-  if (type == NULL)
-    return -1;
-  *type = 0;
-  type++;
-
-  value = strrchr(name, ':');
-  if (value == NULL)
-    return -1;
-  *value = 0;
-  value++;
-
-  extra = strchr(type, '|');
-  if (extra != NULL) {
-    *extra = 0;
-    extra++;
-  }
-
+static int statsd_parse_line(char const *name, char const *tags, /* {{{ */
+                             char const *value, char const *type,
+                             char const *extra) {
   if (strcmp("c", type) == 0)
-    return statsd_handle_counter(name, value, extra);
+    return statsd_handle_counter(name, tags, value, extra);
   else if (strcmp("ms", type) == 0)
-    return statsd_handle_timer(name, value, extra);
+    return statsd_handle_timer(name, tags, value, extra);
 
   /* extra is only valid for counters and timers */
   if (extra != NULL)
     return -1;
 
   if (strcmp("g", type) == 0)
-    return statsd_handle_gauge(name, value);
+    return statsd_handle_gauge(name, tags, value);
   else if (strcmp("s", type) == 0)
-    return statsd_handle_set(name, value);
+    return statsd_handle_set(name, tags, value);
   else
     return -1;
 } /* }}} void statsd_parse_line */
 
-static void statsd_parse_buffer(char *buffer) /* {{{ */
+static int statsd_tag_compare(const void *a, const void *b) /* {{{ */
 {
-  while (buffer != NULL) {
-    char orig[64];
-    char *next;
-    int status;
-
-    next = strchr(buffer, '\n');
+  return strcmp(*(char *const *)a, *(char *const *)b);
+} /* }}} int statsd_tag_compare */
+
+/* Converts the comma separated DogStatsD tag list into its canonical form,
+ * i.e. sorted, so that the same set of tags always maps to the same metric.
+ * "tags" is modified in place. Returns NULL if there are no tags and sets
+ * "ret_status" to non-zero if the tags are invalid. */
+static char const *statsd_parse_tags(char *tags, char *buffer, /* {{{ */
+                                     size_t buffer_size, int *ret_status) {
+  char *fields[STATSD_MAX_TAGS];
+  size_t fields_num = 0;
+  size_t offset = 0;
+
+  *ret_status = 0;
+
+  for (char *ptr = tags; ptr != NULL;) {
+    char *next = strchr(ptr, ',');
     if (next != NULL) {
       *next = 0;
       next++;
     }
 
-    if (*buffer == 0) {
-      buffer = next;
-      continue;
+    if (*ptr != 0) {
+      if (fields_num >= STATSD_MAX_TAGS) {
+        *ret_status = -1;
+        return NULL;
+      }
+      fields[fields_num] = ptr;
+      fields_num++;
     }
 
-    sstrncpy(orig, buffer, sizeof(orig));
+    ptr = next;
+  }
+
+  if (fields_num == 0)
+    return NULL;
+
+  if (fields_num > 1)
+    qsort(fields, fields_num, sizeof(*fields), statsd_tag_compare);
 
-    status = statsd_parse_line(buffer);
-    if (status != 0)
-      ERROR("statsd plugin: Unable to parse line: \"%s\"", orig);
+  for (size_t i = 0; i < fields_num; i++) {
+    size_t len = strlen(fields[i]);
 
-    buffer = next;
+    /* The tags must fit into the plugin instance. */
+    if (offset + len + 1 > buffer_size) {
+      *ret_status = -1;
+      return NULL;
+    }
+
+    if (i > 0)
+      buffer[offset - 1] = ',';
+    memcpy(buffer + offset, fields[i], len + 1);
+    offset += len + 1;
+  }
+
+  return buffer;
+} /* }}} char const *statsd_parse_tags */
+
+/* Undoes the changes made to a line by statsd_parse_buffer() and
+ * statsd_parse_tags(), so that the line can be quoted in error messages.
+ * "end" points to the end of the line. */
+static void statsd_restore_line(char *end, char *value, char *type, /* {{{ */
+                                char *extra, char *tags) {
+  *value = ':';
+  *type = '|';
+  if (extra != NULL)
+    *extra = '|';
+  if (tags != NULL) {
+    *tags = '|';
+    /* statsd_parse_tags() replaces the commas between tags. */
+    for (char *ptr = tags + 2; ptr < end; ptr++)
+      if (*ptr == 0)
+        *ptr = ',';
+  }
+} /* }}} void statsd_restore_line */
+
+/* Splits the buffer into lines and lines into "name:value|type|extra|#tags" in
+ * a single pass. The buffer is modified in place; nothing is copied. Any
+ * number of lines may be sent in one packet. */
+static void statsd_parse_buffer(char *buffer) /* {{{ */
+{
+  char *ptr = buffer;
+
+  while (*ptr != 0) {
+    char *line = ptr;
+    char *end;
+    char *value = NULL;
+    char *type = NULL;
+    char *extra = NULL;
+    char *tags = NULL;
+    char tags_buffer[DATA_MAX_NAME_LEN];
+    char const *tags_canonical = NULL;
+    int status;
+
+    for (; (*ptr != 0) && (*ptr != '\n'); ptr++) {
+      if ((*ptr == ':') && (type == NULL))
+        value = ptr; /* last colon before the first pipe */
+      else if ((*ptr == '|') && (type == NULL))
+        type = ptr;
+      else if ((*ptr == '|') && (ptr[1] == '#') && (tags == NULL))
+        tags = ptr;
+      else if ((*ptr == '|') && (extra == NULL))
+        extra = ptr;
+    }
+    end = ptr;
+    if (*ptr == '\n') {
+      *ptr = 0;
+      ptr++;
+    }
+
+    if (*line == 0)
+      continue;
+
+    if ((type == NULL) || (value == NULL)) {
+      ERROR("statsd plugin: Unable to parse line: \"%s\"", line);
+      continue;
+    }
+
+    *value = 0;
+    *type = 0;
+    if (extra != NULL)
+      *extra = 0;
+    if (tags != NULL) {
+      *tags = 0;
+      tags_canonical = statsd_parse_tags(tags + 2, tags_buffer,
+                                         sizeof(tags_buffer), &status);
+      if (status != 0) {
+        statsd_restore_line(end, value, type, extra, tags);
+        ERROR("statsd plugin: Too many or too long tags in line: \"%s\"",
+              line);
+        continue;
+      }
+    }
+
+    status = statsd_parse_line(line, tags_canonical, value + 1, type + 1,
+                               (extra != NULL) ? extra + 1 : NULL);
+    if (status != 0) {
+      statsd_restore_line(end, value, type, extra, tags);
+      ERROR("statsd plugin: Unable to parse line: \"%s\"", line);
+    }
   }
 } /* }}} void statsd_parse_buffer */
 
+#if HAVE_RECVMMSG
+/* Reads up to STATSD_RECV_BATCH datagrams with one system call. */
 static void statsd_network_read(int fd) /* {{{ */
 {
-  char buffer[4096];
+  char buffers[STATSD_RECV_BATCH][STATSD_BUFFER_SIZE];
+  struct iovec iovecs[STATSD_RECV_BATCH];
+  struct mmsghdr msgs[STATSD_RECV_BATCH];
+  int status;
+
+  memset(msgs, 0, sizeof(msgs));
+  for (size_t i = 0; i < STATSD_RECV_BATCH; i++) {
+    /* Leave room for the terminating null byte. */
+    iovecs[i].iov_base = buffers[i];
+    iovecs[i].iov_len = sizeof(buffers[i]) - 1;
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  status = recvmmsg(fd, msgs, STATSD_RECV_BATCH, /* flags = */ MSG_DONTWAIT,
+                    /* timeout = */ NULL);
+  if (status < 0) {
+    char errbuf[1024];
+
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      return;
+
+    ERROR("statsd plugin: recvmmsg(2) failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return;
+  }
+
+  for (int i = 0; i < status; i++) {
+    buffers[i][msgs[i].msg_len] = 0;
+    statsd_parse_buffer(buffers[i]);
+  }
+} /* }}} void statsd_network_read */
+#else
+static void statsd_network_read(int fd) /* {{{ */
+{
+  char buffer[STATSD_BUFFER_SIZE];
   size_t buffer_size;
   ssize_t status;
 
@@ -463,6 +805,7 @@ static void statsd_network_read(int fd) /* {{{ */
 
   statsd_parse_buffer(buffer);
 } /* }}} void statsd_network_read */
+#endif /* !HAVE_RECVMMSG */
 
 static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
                                size_t *ret_fds_num) {
@@ -509,6 +852,22 @@ static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
     DEBUG("statsd plugin: Trying to bind to [%s]:%s ...", dbg_node,
           dbg_service);
 
+#ifdef SO_REUSEPORT
+    /* With multiple network threads, each thread binds its own socket to the
+     * same address and the kernel distributes the datagrams between them. */
+    if (conf_network_threads > 1) {
+      int yes = 1;
+      status = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+      if (status != 0) {
+        char errbuf[1024];
+        ERROR("statsd plugin: setsockopt(SO_REUSEPORT) failed: %s",
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+        close(fd);
+        continue;
+      }
+    }
+#endif
+
     status = bind(fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
     if (status != 0) {
       char errbuf[1024];
@@ -559,7 +918,7 @@ static void *statsd_network_thread(void *args) /* {{{ */
   }
 
   while (!network_thread_shutdown) {
-    status = poll(fds, (nfds_t)fds_num, /* timeout = */ -1);
+    status = poll(fds, (nfds_t)fds_num, STATSD_POLL_TIMEOUT);
     if (status < 0) {
       char errbuf[1024];
 
@@ -628,6 +987,8 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_string(child, &conf_node);
     else if (strcasecmp("Port", child->key) == 0)
       cf_util_get_service(child, &conf_service);
+    else if (strcasecmp("NetworkThreads", child->key) == 0)
+      cf_util_get_int(child, &conf_network_threads);
     else if (strcasecmp("DeleteCounters", child->key) == 0)
       cf_util_get_boolean(child, &conf_delete_counters);
     else if (strcasecmp("DeleteTimers", child->key) == 0)
@@ -636,6 +997,8 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_boolean(child, &conf_delete_gauges);
     else if (strcasecmp("DeleteSets", child->key) == 0)
       cf_util_get_boolean(child, &conf_delete_sets);
+    else if (strcasecmp("SetEstimate", child->key) == 0)
+      cf_util_get_boolean(child, &conf_set_estimate);
     else if (strcasecmp("CounterSum", child->key) == 0)
       cf_util_get_boolean(child, &conf_counter_sum);
     else if (strcasecmp("TimerLower", child->key) == 0)
@@ -653,37 +1016,107 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
             child->key);
   }
 
+  if (conf_network_threads < 1) {
+    WARNING("statsd plugin: NetworkThreads must be at least 1. "
+            "Using a single network thread.");
+    conf_network_threads = 1;
+  }
+#ifndef SO_REUSEPORT
+  if (conf_network_threads > 1) {
+    WARNING("statsd plugin: NetworkThreads > 1 requires SO_REUSEPORT, which is "
+            "not available on this system. Using a single network thread.");
+    conf_network_threads = 1;
+  }
+#endif
+
   return 0;
 } /* }}} int statsd_config */
 
+/* Creates the shards of the metrics table. Must hold metrics_lock when calling
+ * this function. */
+static int statsd_metrics_init(void) /* {{{ */
+{
+  if (metrics_shards_init)
+    return 0;
+
+  for (size_t i = 0; i < STATSD_SHARDS_NUM; i++) {
+    metrics_shards[i].tree =
+        c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (metrics_shards[i].tree == NULL) {
+      ERROR("statsd plugin: c_avl_create failed.");
+      while (i > 0) {
+        i--;
+        c_avl_destroy(metrics_shards[i].tree);
+        metrics_shards[i].tree = NULL;
+        pthread_mutex_destroy(&metrics_shards[i].lock);
+      }
+      return -1;
+    }
+    pthread_mutex_init(&metrics_shards[i].lock, /* attr = */ NULL);
+  }
+  metrics_shards_init = 1;
+
+  return 0;
+} /* }}} int statsd_metrics_init */
+
+/* Stops and joins the network threads. Sending SIGTERM interrupts poll(2)
+ * right away, but the daemon exits on SIGTERM, so it is only sent on
+ * shutdown. Otherwise, the threads exit within STATSD_POLL_TIMEOUT. */
+static void statsd_network_threads_stop(_Bool send_signal) /* {{{ */
+{
+  network_thread_shutdown = 1;
+  if (send_signal)
+    for (size_t i = 0; i < network_threads_num; i++)
+      pthread_kill(network_threads[i], SIGTERM);
+  for (size_t i = 0; i < network_threads_num; i++)
+    pthread_join(network_threads[i], /* retval = */ NULL);
+  sfree(network_threads);
+  network_threads_num = 0;
+  network_thread_shutdown = 0;
+} /* }}} void statsd_network_threads_stop */
+
 static int statsd_init(void) /* {{{ */
 {
   pthread_mutex_lock(&metrics_lock);
-  if (metrics_tree == NULL)
-    metrics_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
-
-  if (!network_thread_running) {
-    int status;
+  if (statsd_metrics_init() != 0) {
+    pthread_mutex_unlock(&metrics_lock);
+    return -1;
+  }
 
-    status = pthread_create(&network_thread,
-                            /* attr = */ NULL, statsd_network_thread,
-                            /* args = */ NULL);
-    if (status != 0) {
-      char errbuf[1024];
+  if (network_threads == NULL) {
+    network_threads =
+        calloc((size_t)conf_network_threads, sizeof(*network_threads));
+    if (network_threads == NULL) {
       pthread_mutex_unlock(&metrics_lock);
-      ERROR("statsd plugin: pthread_create failed: %s",
-            sstrerror(errno, errbuf, sizeof(errbuf)));
-      return status;
+      ERROR("statsd plugin: calloc failed.");
+      return -1;
+    }
+
+    while (network_threads_num < (size_t)conf_network_threads) {
+      int status;
+
+      status = pthread_create(&network_threads[network_threads_num],
+                              /* attr = */ NULL, statsd_network_thread,
+                              /* args = */ NULL);
+      if (status != 0) {
+        char errbuf[1024];
+        ERROR("statsd plugin: pthread_create failed: %s",
+              sstrerror(status, errbuf, sizeof(errbuf)));
+        /* Don't leave the threads started so far running. */
+        statsd_network_threads_stop(/* send_signal = */ 0);
+        pthread_mutex_unlock(&metrics_lock);
+        return status;
+      }
+      network_threads_num++;
     }
   }
-  network_thread_running = 1;
 
   pthread_mutex_unlock(&metrics_lock);
 
   return 0;
 } /* }}} int statsd_init */
 
-/* Must hold metrics_lock when calling this function. */
+/* Must hold the lock of the metric's shard when calling this function. */
 static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
 {
   void *key;
@@ -692,6 +1125,9 @@ static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
   if ((metric == NULL) || (metric->type != STATSD_SET))
     return EINVAL;
 
+  if (metric->hll != NULL)
+    memset(metric->hll, 0, STATSD_HLL_REGISTERS * sizeof(*metric->hll));
+
   if (metric->set == NULL)
     return 0;
 
@@ -703,16 +1139,32 @@ static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
   return 0;
 } /* }}} int statsd_metric_clear_set_unsafe */
 
-/* Must hold metrics_lock when calling this function. */
-static int statsd_metric_submit_unsafe(char const *name,
+/* Must hold the lock of the metric's shard when calling this function. */
+static int statsd_metric_submit_unsafe(char const *key,
                                        statsd_metric_t *metric) /* {{{ */
 {
   value_list_t vl = VALUE_LIST_INIT;
+  char const *name;
+  int name_len;
+  char const *tags;
 
   vl.values = &(value_t){.gauge = NAN};
   vl.values_len = 1;
   sstrncpy(vl.plugin, "statsd", sizeof(vl.plugin));
 
+  /* Keys have a prefix, e.g. "c:", which determines the (statsd) type, and
+   * optionally a "|#" suffix with the tags. The tags are used as the plugin
+   * instance, so that differently tagged metrics are distinct. */
+  name = key + 2;
+  tags = strstr(name, "|#");
+  if (tags != NULL) {
+    name_len = (int)(tags - name);
+    sstrncpy(vl.plugin_instance, tags + 2, sizeof(vl.plugin_instance));
+    vl.meta = metric->meta;
+  } else {
+    name_len = (int)strlen(name);
+  }
+
   if (metric->type == STATSD_GAUGE)
     sstrncpy(vl.type, "gauge", sizeof(vl.type));
   else if (metric->type == STATSD_TIMER)
@@ -722,7 +1174,7 @@ static int statsd_metric_submit_unsafe(char const *name,
   else /* if (metric->type == STATSD_COUNTER) */
     sstrncpy(vl.type, "derive", sizeof(vl.type));
 
-  sstrncpy(vl.type_instance, name, sizeof(vl.type_instance));
+  snprintf(vl.type_instance, sizeof(vl.type_instance), "%.*s", name_len, name);
 
   if (metric->type == STATSD_GAUGE)
     vl.values[0].gauge = (gauge_t)metric->value;
@@ -732,7 +1184,8 @@ static int statsd_metric_submit_unsafe(char const *name,
     /* Make sure all timer metrics share the *same* timestamp. */
     vl.time = cdtime();
 
-    snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-average", name);
+    snprintf(vl.type_instance, sizeof(vl.type_instance), "%.*s-average",
+             name_len, name);
     vl.values[0].gauge =
         have_events
             ? CDTIME_T_TO_DOUBLE(latency_counter_get_average(metric->latency))
@@ -740,7 +1193,8 @@ static int statsd_metric_submit_unsafe(char const *name,
     plugin_dispatch_values(&vl);
 
     if (conf_timer_lower) {
-      snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-lower", name);
+      snprintf(vl.type_instance, sizeof(vl.type_instance), "%.*s-lower",
+               name_len, name);
       vl.values[0].gauge =
           have_events
               ? CDTIME_T_TO_DOUBLE(latency_counter_get_min(metric->latency))
@@ -749,7 +1203,8 @@ static int statsd_metric_submit_unsafe(char const *name,
     }
 
     if (conf_timer_upper) {
-      snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-upper", name);
+      snprintf(vl.type_instance, sizeof(vl.type_instance), "%.*s-upper",
+               name_len, name);
       vl.values[0].gauge =
           have_events
               ? CDTIME_T_TO_DOUBLE(latency_counter_get_max(metric->latency))
@@ -758,7 +1213,8 @@ static int statsd_metric_submit_unsafe(char const *name,
     }
 
     if (conf_timer_sum) {
-      snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-sum", name);
+      snprintf(vl.type_instance, sizeof(vl.type_instance), "%.*s-sum",
+               name_len, name);
       vl.values[0].gauge =
           have_events
               ? CDTIME_T_TO_DOUBLE(latency_counter_get_sum(metric->latency))
@@ -767,8 +1223,9 @@ static int statsd_metric_submit_unsafe(char const *name,
     }
 
     for (size_t i = 0; i < conf_timer_percentile_num; i++) {
-      snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-percentile-%.0f",
-               name, conf_timer_percentile[i]);
+      snprintf(vl.type_instance, sizeof(vl.type_instance),
+               "%.*s-percentile-%.0f", name_len, name,
+               conf_timer_percentile[i]);
       vl.values[0].gauge =
           have_events ? CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(
                             metric->latency, conf_timer_percentile[i]))
@@ -780,7 +1237,8 @@ static int statsd_metric_submit_unsafe(char const *name,
      * vl.type's above are implicitly set to "latency". */
     if (conf_timer_count) {
       sstrncpy(vl.type, "gauge", sizeof(vl.type));
-      snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-count", name);
+      snprintf(vl.type_instance, sizeof(vl.type_instance), "%.*s-count",
+               name_len, name);
       vl.values[0].gauge = latency_counter_get_num(metric->latency);
       plugin_dispatch_values(&vl);
     }
@@ -788,7 +1246,9 @@ static int statsd_metric_submit_unsafe(char const *name,
     latency_counter_reset(metric->latency);
     return 0;
   } else if (metric->type == STATSD_SET) {
-    if (metric->set == NULL)
+    if (metric->hll != NULL)
+      vl.values[0].gauge = statsd_hll_estimate(metric->hll);
+    else if (metric->set == NULL)
       vl.values[0].gauge = 0.0;
     else
       vl.values[0].gauge = (gauge_t)c_avl_size(metric->set);
@@ -819,7 +1279,7 @@ static int statsd_metric_submit_unsafe(char const *name,
   return plugin_dispatch_values(&vl);
 } /* }}} int statsd_metric_submit_unsafe */
 
-static int statsd_read(void) /* {{{ */
+static int statsd_read_shard(statsd_shard_t *shard) /* {{{ */
 {
   c_avl_iterator_t *iter;
   char *name;
@@ -828,14 +1288,9 @@ static int statsd_read(void) /* {{{ */
   char **to_be_deleted = NULL;
   size_t to_be_deleted_num = 0;
 
-  pthread_mutex_lock(&metrics_lock);
-
-  if (metrics_tree == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
-    return 0;
-  }
+  pthread_mutex_lock(&shard->lock);
 
-  iter = c_avl_get_iterator(metrics_tree);
+  iter = c_avl_get_iterator(shard->tree);
   while (c_avl_iterator_next(iter, (void *)&name, (void *)&metric) == 0) {
     if ((metric->updates_num == 0) &&
         ((conf_delete_counters && (metric->type == STATSD_COUNTER)) ||
@@ -847,9 +1302,7 @@ static int statsd_read(void) /* {{{ */
       continue;
     }
 
-    /* Names have a prefix, e.g. "c:", which determines the (statsd) type.
-     * Remove this here. */
-    statsd_metric_submit_unsafe(name + 2, metric);
+    statsd_metric_submit_unsafe(name, metric);
 
     /* Reset the metric. */
     metric->updates_num = 0;
@@ -861,7 +1314,7 @@ static int statsd_read(void) /* {{{ */
   for (size_t i = 0; i < to_be_deleted_num; i++) {
     int status;
 
-    status = c_avl_remove(metrics_tree, to_be_deleted[i], (void *)&name,
+    status = c_avl_remove(shard->tree, to_be_deleted[i], (void *)&name,
                           (void *)&metric);
     if (status != 0) {
       ERROR("stats plugin: c_avl_remove (\"%s\") failed with status %i.",
@@ -873,10 +1326,23 @@ static int statsd_read(void) /* {{{ */
     statsd_metric_free(metric);
   }
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   strarray_free(to_be_deleted, to_be_deleted_num);
 
+  return 0;
+} /* }}} int statsd_read_shard */
+
+static int statsd_read(void) /* {{{ */
+{
+  /* Only one shard is locked at a time, so the network threads can continue
+   * to update metrics in all other shards. */
+  if (!metrics_shards_init)
+    return 0;
+
+  for (size_t i = 0; i < STATSD_SHARDS_NUM; i++)
+    statsd_read_shard(&metrics_shards[i]);
+
   return 0;
 } /* }}} int statsd_read */
 
@@ -885,21 +1351,24 @@ static int statsd_shutdown(void) /* {{{ */
   void *key;
   void *value;
 
-  if (network_thread_running) {
-    network_thread_shutdown = 1;
-    pthread_kill(network_thread, SIGTERM);
-    pthread_join(network_thread, /* retval = */ NULL);
-  }
-  network_thread_running = 0;
+  statsd_network_threads_stop(/* send_signal = */ 1);
 
   pthread_mutex_lock(&metrics_lock);
 
-  while (c_avl_pick(metrics_tree, &key, &value) == 0) {
-    sfree(key);
-    statsd_metric_free(value);
+  if (metrics_shards_init) {
+    for (size_t i = 0; i < STATSD_SHARDS_NUM; i++) {
+      statsd_shard_t *shard = &metrics_shards[i];
+
+      while (c_avl_pick(shard->tree, &key, &value) == 0) {
+        sfree(key);
+        statsd_metric_free(value);
+      }
+      c_avl_destroy(shard->tree);
+      shard->tree = NULL;
+      pthread_mutex_destroy(&shard->lock);
+    }
+    metrics_shards_init = 0;
   }
-  c_avl_destroy(metrics_tree);
-  metrics_tree = NULL;
 
   sfree(conf_node);
   sfree(conf_service);
@@ -0,0 +1,143 @@
+/**
+ * collectd - src/statsd_bench.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "statsd.c" /* sic */
+
+#include <time.h>
+
+/* Size of the synthetic datagrams, about the MTU of an Ethernet link. */
+#define BENCH_PACKET_SIZE 1400
+#define BENCH_PACKETS_NUM 2000
+#define BENCH_METRICS_NUM 5000
+#define BENCH_ROUNDS 10
+#define BENCH_THREADS_MAX 8
+
+static char *packets[BENCH_PACKETS_NUM];
+static size_t lines_num;
+
+static double elapsed_ns(struct timespec const *begin) {
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return 1e9 * (double)(end.tv_sec - begin->tv_sec) +
+         (double)(end.tv_nsec - begin->tv_nsec);
+}
+
+/* Fills the datagrams with lines of all types for BENCH_METRICS_NUM metrics,
+ * a quarter of them with DogStatsD tags and some with a sample rate. */
+static int make_packets(void) {
+  unsigned int seed = 42;
+
+  for (size_t i = 0; i < BENCH_PACKETS_NUM; i++) {
+    char *packet = calloc(1, BENCH_PACKET_SIZE);
+    size_t len = 0;
+
+    if (packet == NULL)
+      return -1;
+
+    while (42) {
+      char line[256];
+      int metric = rand_r(&seed) % BENCH_METRICS_NUM;
+      int value = rand_r(&seed) % 1000;
+      char const *types[] = {"c", "ms", "g", "s"};
+      char const *type = types[metric % 4];
+      int status;
+
+      status = snprintf(
+          line, sizeof(line), "app.server%02d.metric%d:%d|%s%s%s\n",
+          metric % 50, metric, value, type,
+          ((metric % 8 == 0) && (type[0] == 'c')) ? "|@0.5" : "",
+          (metric % 4 == 1) ? "|#env:prod,host:web1,az:b" : "");
+      if ((len + (size_t)status) >= BENCH_PACKET_SIZE)
+        break;
+
+      memcpy(packet + len, line, (size_t)status + 1);
+      len += (size_t)status;
+      lines_num++;
+    }
+
+    packets[i] = packet;
+  }
+
+  return 0;
+}
+
+/* Parses every packet BENCH_ROUNDS times, as a network thread would. */
+static void *bench_thread(void *arg) {
+  char buffer[STATSD_BUFFER_SIZE];
+
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    for (size_t i = 0; i < BENCH_PACKETS_NUM; i++) {
+      memcpy(buffer, packets[i], strlen(packets[i]) + 1);
+      statsd_parse_buffer(buffer);
+    }
+  }
+
+  return NULL;
+}
+
+/* Measures the throughput of statsd_parse_buffer() with one or more threads
+ * updating the metrics concurrently, and the time it takes to submit the
+ * metrics afterwards. */
+int main(void) {
+  conf_timer_lower = 1;
+  conf_timer_upper = 1;
+
+  if ((make_packets() != 0) || (statsd_metrics_init() != 0))
+    return 1;
+
+  for (int threads_num = 1; threads_num <= BENCH_THREADS_MAX;
+       threads_num *= 2) {
+    pthread_t threads[BENCH_THREADS_MAX];
+    struct timespec begin;
+    double ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < threads_num; i++)
+      pthread_create(&threads[i], NULL, bench_thread, NULL);
+    for (int i = 0; i < threads_num; i++)
+      pthread_join(threads[i], NULL);
+    ns = elapsed_ns(&begin);
+
+    printf("%d thread%s: %.0f lines/s, %.1f ns/line\n", threads_num,
+           (threads_num == 1) ? "" : "s",
+           1e9 * (double)(threads_num * BENCH_ROUNDS * lines_num) / ns,
+           ns / (double)(threads_num * BENCH_ROUNDS * lines_num));
+  }
+
+  for (int estimate = 0; estimate <= 1; estimate++) {
+    struct timespec begin;
+
+    conf_set_estimate = (_Bool)estimate;
+    bench_thread(NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    statsd_read();
+    printf("statsd_read (SetEstimate %s): %.2f ms\n",
+           estimate ? "true" : "false", elapsed_ns(&begin) / 1e6);
+  }
+
+  statsd_shutdown();
+  for (size_t i = 0; i < BENCH_PACKETS_NUM; i++)
+    free(packets[i]);
+  return 0;
+}
@@ -0,0 +1,263 @@
+/**
+ * collectd - src/statsd_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/* The mock's plugin_dispatch_values() discards the values; capture them
+ * instead so the submitted value lists can be checked. */
+#define plugin_dispatch_values test_dispatch_values
+
+#include "statsd.c" /* sic */
+#include "testing.h"
+
+/* HyperLogLog with 4096 registers has a standard error of about 1.6%. */
+#define TEST_HLL_ERROR 0.05
+
+static value_list_t last_vl;
+static value_t last_value;
+static int dispatch_count;
+
+int test_dispatch_values(value_list_t const *vl) {
+  last_vl = *vl;
+  last_value = vl->values[0];
+  last_vl.values = &last_value;
+  last_vl.meta = NULL;
+  dispatch_count++;
+  return 0;
+}
+
+/* Returns the metric stored under "key", e.g. "c:name", or NULL. */
+static statsd_metric_t *test_metric_get(char const *key) {
+  statsd_shard_t *shard =
+      &metrics_shards[statsd_hash(key) & (STATSD_SHARDS_NUM - 1)];
+  statsd_metric_t *metric = NULL;
+
+  if (c_avl_get(shard->tree, key, (void *)&metric) != 0)
+    return NULL;
+  return metric;
+}
+
+static void test_parse(char const *str) {
+  char buffer[STATSD_BUFFER_SIZE];
+
+  sstrncpy(buffer, str, sizeof(buffer));
+  statsd_parse_buffer(buffer);
+}
+
+DEF_TEST(hll_estimate) {
+  uint8_t *hll = calloc(STATSD_HLL_REGISTERS, sizeof(*hll));
+  size_t added = 0;
+
+  CHECK_NOT_NULL(hll);
+  EXPECT_EQ_DOUBLE(0.0, statsd_hll_estimate(hll));
+
+  for (size_t n = 10; n <= 1000000; n *= 10) {
+    gauge_t estimate;
+
+    for (; added < n; added++) {
+      char key[32];
+      snprintf(key, sizeof(key), "member%zu", added);
+      statsd_hll_add(hll, key);
+    }
+
+    /* Adding members again must not change the estimate. */
+    estimate = statsd_hll_estimate(hll);
+    for (size_t i = 0; i < 10; i++) {
+      char key[32];
+      snprintf(key, sizeof(key), "member%zu", i);
+      statsd_hll_add(hll, key);
+    }
+    EXPECT_EQ_DOUBLE(estimate, statsd_hll_estimate(hll));
+
+    printf("n = %zu, estimate = %.0f\n", n, estimate);
+    OK(fabs(estimate - (double)n) <= TEST_HLL_ERROR * (double)n);
+  }
+
+  sfree(hll);
+  return 0;
+}
+
+DEF_TEST(set_estimate) {
+  char line[64];
+
+  CHECK_ZERO(statsd_metrics_init());
+  conf_set_estimate = 1;
+
+  for (int i = 0; i < 20000; i++) {
+    snprintf(line, sizeof(line), "users:user%d|s\nusers:user%d|s", i, i / 2);
+    test_parse(line);
+  }
+
+  dispatch_count = 0;
+  CHECK_ZERO(statsd_read());
+  EXPECT_EQ_INT(1, dispatch_count);
+  EXPECT_EQ_STR("objects", last_vl.type);
+  EXPECT_EQ_STR("users", last_vl.type_instance);
+  printf("estimate = %.0f\n", last_value.gauge);
+  OK(fabs(last_value.gauge - 20000.0) <= TEST_HLL_ERROR * 20000.0);
+
+  /* The registers are cleared after each read. */
+  CHECK_ZERO(statsd_read());
+  EXPECT_EQ_DOUBLE(0.0, last_value.gauge);
+
+  conf_set_estimate = 0;
+  statsd_shutdown();
+  return 0;
+}
+
+DEF_TEST(parse_buffer) {
+  struct {
+    char const *line;
+    char const *key; /* NULL if the line must be rejected */
+    double value;
+  } cases[] = {
+      {"counter:1|c", "c:counter", 1.0},
+      {"gauge:-5|g", "g:gauge", -5.0},
+      /* The name is everything before the last colon. */
+      {"a:b:2|c", "c:a:b", 2.0},
+      {"host:port:3|g", "g:host:port", 3.0},
+      /* The counter is scaled by the sample rate. */
+      {"sampled:1|c|@0.5", "c:sampled", 2.0},
+      {"sampled_one:4|c|@1", "c:sampled_one", 4.0},
+      {"rate_zero:1|c|@0", NULL, 0.0},
+      {"rate_high:1|c|@2", NULL, 0.0},
+      {"rate_empty:1|c|@", NULL, 0.0},
+      {"rate_invalid:1|c|0.5", NULL, 0.0},
+      /* Sample rates are only valid for counters and timers. */
+      {"rate_gauge:1|g|@0.5", NULL, 0.0},
+      /* Truncated lines. */
+      {"truncated", NULL, 0.0},
+      {"truncated_value:1", NULL, 0.0},
+      {"truncated_type:1|", NULL, 0.0},
+      {"truncated_colon|c", NULL, 0.0},
+      {"truncated_empty:|g", NULL, 0.0},
+      {"unknown_type:1|x", NULL, 0.0},
+      {"trailing_garbage:1x|g", NULL, 0.0},
+  };
+
+  CHECK_ZERO(statsd_metrics_init());
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    char buffer[STATSD_BUFFER_SIZE];
+    char key[DATA_MAX_NAME_LEN];
+    statsd_metric_t *metric;
+
+    printf("## Case %zu: \"%s\"\n", i, cases[i].line);
+
+    sstrncpy(buffer, cases[i].line, sizeof(buffer));
+    statsd_parse_buffer(buffer);
+
+    if (cases[i].key == NULL) {
+      /* Rejected lines are restored for the error message. */
+      EXPECT_EQ_STR(cases[i].line, buffer);
+
+      snprintf(key, sizeof(key), "c:%s", cases[i].line);
+      key[2 + strcspn(key + 2, ":|")] = 0;
+      OK(test_metric_get(key) == NULL);
+      key[0] = 'g';
+      OK(test_metric_get(key) == NULL);
+      continue;
+    }
+
+    metric = test_metric_get(cases[i].key);
+    CHECK_NOT_NULL(metric);
+    EXPECT_EQ_DOUBLE(cases[i].value, metric->value);
+  }
+
+  statsd_shutdown();
+  return 0;
+}
+
+DEF_TEST(parse_buffer_lines) {
+  statsd_metric_t *metric;
+
+  CHECK_ZERO(statsd_metrics_init());
+
+  /* Empty lines are skipped, the last line needs no newline, and an invalid
+   * line doesn't affect the lines after it. */
+  test_parse("");
+  test_parse("\n\n");
+  test_parse("\nlines:1|c\n\nlines:2|c\ninvalid\nlines:3|c");
+
+  metric = test_metric_get("c:lines");
+  CHECK_NOT_NULL(metric);
+  EXPECT_EQ_DOUBLE(6.0, metric->value);
+  EXPECT_EQ_INT(3, metric->updates_num);
+
+  statsd_shutdown();
+  return 0;
+}
+
+DEF_TEST(parse_tags) {
+  char buffer[] = "tagged:1|g|#b:2,,a:1|@0.5";
+  statsd_metric_t *metric;
+  char *value = NULL;
+
+  CHECK_ZERO(statsd_metrics_init());
+
+  /* The order of the tags doesn't matter. */
+  test_parse("tagged:1|g|#b:2,a:1\ntagged:+2|g|#a:1,b:2");
+  metric = test_metric_get("g:tagged|#a:1,b:2");
+  CHECK_NOT_NULL(metric);
+  EXPECT_EQ_DOUBLE(3.0, metric->value);
+  OK(test_metric_get("g:tagged|#b:2,a:1") == NULL);
+
+  CHECK_NOT_NULL(metric->meta);
+  CHECK_ZERO(meta_data_get_string(metric->meta, "b", &value));
+  EXPECT_EQ_STR("2", value);
+  sfree(value);
+
+  /* Untagged metrics are distinct from tagged ones. */
+  test_parse("tagged:7|g");
+  metric = test_metric_get("g:tagged");
+  CHECK_NOT_NULL(metric);
+  EXPECT_EQ_DOUBLE(7.0, metric->value);
+
+  /* The tags are restored along with the line on errors. */
+  statsd_parse_buffer(buffer);
+  EXPECT_EQ_STR("tagged:1|g|#b:2,,a:1|@0.5", buffer);
+
+  /* The sorted tags become the plugin instance. */
+  statsd_shutdown();
+  CHECK_ZERO(statsd_metrics_init());
+  test_parse("sorted:1|c|#zone:b,env:prod,host:web1");
+
+  dispatch_count = 0;
+  CHECK_ZERO(statsd_read());
+  EXPECT_EQ_INT(1, dispatch_count);
+  EXPECT_EQ_STR("statsd", last_vl.plugin);
+  EXPECT_EQ_STR("env:prod,host:web1,zone:b", last_vl.plugin_instance);
+  EXPECT_EQ_STR("derive", last_vl.type);
+  EXPECT_EQ_STR("sorted", last_vl.type_instance);
+  EXPECT_EQ_INT(1, last_value.derive);
+
+  statsd_shutdown();
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(hll_estimate);
+  RUN_TEST(set_estimate);
+  RUN_TEST(parse_buffer);
+  RUN_TEST(parse_buffer_lines);
+  RUN_TEST(parse_tags);
+
+  END_TEST;
+}
@@ -233,7 +233,12 @@ static int ctail_config_add_file(oconfig_item_t *ci) {
       status = cf_util_get_string(option, &plugin_instance);
     else if (strcasecmp("Interval", option->key) == 0)
       cf_util_get_cdtime(option, &interval);
-    else if (strcasecmp("Match", option->key) == 0) {
+    else if (strcasecmp("ReportStats", option->key) == 0) {
+      _Bool report_stats = 0;
+      status = cf_util_get_boolean(option, &report_stats);
+      if ((status == 0) && report_stats)
+        status = tail_match_report_stats(tm, "tail", plugin_instance, interval);
+    } else if (strcasecmp("Match", option->key) == 0) {
       status = ctail_config_add_match(tm, plugin_instance, option, interval);
       if (status == 0)
         num_matches++;
@@ -204,8 +204,15 @@ static int tcsv_read_buffer(instance_definition_t *id, char *buffer,
   return 0;
 }
 
+static int tcsv_read_line(void *data, char *buf, int buflen) {
+  /* Errors are logged by tcsv_read_buffer() and must not stop reading. */
+  tcsv_read_buffer(data, buf, (size_t)buflen);
+  return 0;
+}
+
 static int tcsv_read(user_data_t *ud) {
   instance_definition_t *id;
+  int status;
   id = ud->data;
 
   if (id->tail == NULL) {
@@ -216,24 +223,12 @@ static int tcsv_read(user_data_t *ud) {
     }
   }
 
-  while (42) {
-    char buffer[1024];
-    size_t buffer_len;
-    int status;
-
-    status = cu_tail_readline(id->tail, buffer, (int)sizeof(buffer));
-    if (status != 0) {
-      ERROR("tail_csv plugin: File \"%s\": cu_tail_readline failed "
-            "with status %i.",
-            id->path, status);
-      return -1;
-    }
-
-    buffer_len = strlen(buffer);
-    if (buffer_len == 0)
-      break;
-
-    tcsv_read_buffer(id, buffer, buffer_len);
+  status = cu_tail_read(id->tail, tcsv_read_line, id);
+  if (status != 0) {
+    ERROR("tail_csv plugin: File \"%s\": cu_tail_read failed "
+          "with status %i.",
+          id->path, status);
+    return -1;
   }
 
   return 0;
@@ -24,18 +24,22 @@
  *   Florian octo Forster <octo at collectd.org>
  **/
 
+#define _GNU_SOURCE /* For fopencookie */
+
 #include "collectd.h"
 
 #include "common.h"
 #include "plugin.h"
 
 #include "utils_cmd_flush.h"
+#include "utils_cmd_gethistory.h"
 #include "utils_cmd_getthreshold.h"
 #include "utils_cmd_getval.h"
 #include "utils_cmd_listval.h"
 #include "utils_cmd_putnotif.h"
 #include "utils_cmd_putval.h"
 
+#include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 
@@ -47,6 +51,9 @@
 
 #define US_DEFAULT_PATH LOCALSTATEDIR "/run/" PACKAGE_NAME "-unixsock"
 
+/* Maximum length of a command, e.g. a GETVAL with many identifiers. */
+#define US_MAX_LINE (1024 * 1024)
+
 /*
  * Private variables
  */
@@ -163,10 +170,182 @@ static int us_open_socket(void) {
   return 0;
 } /* int us_open_socket */
 
+/* Reads one line of arbitrary length (up to US_MAX_LINE bytes) into
+ * `*buffer', growing it as necessary. Returns zero on success, a positive
+ * value if the line was too long (and has been skipped), and a negative value
+ * on end of file or error. */
+static int us_read_line(FILE *fh, char **buffer, size_t *buffer_size) {
+  size_t len = 0;
+  _Bool too_long = 0;
+
+  while (42) {
+    if (*buffer_size - len < 2) {
+      size_t new_size = (*buffer_size == 0) ? 1024 : 2 * *buffer_size;
+      char *tmp;
+
+      if (new_size > US_MAX_LINE) {
+        /* Discard the remainder of the line. */
+        too_long = 1;
+        len = 0;
+        continue;
+      }
+
+      tmp = realloc(*buffer, new_size);
+      if (tmp == NULL) {
+        ERROR("unixsock plugin: realloc failed.");
+        return -1;
+      }
+      *buffer = tmp;
+      *buffer_size = new_size;
+    }
+
+    errno = 0;
+    if (fgets(*buffer + len, (int)(*buffer_size - len), fh) == NULL) {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+
+      if (errno != 0) {
+        char errbuf[1024];
+        WARNING("unixsock plugin: failed to read from socket #%i: %s",
+                fileno(fh), sstrerror(errno, errbuf, sizeof(errbuf)));
+      }
+      /* Handle a last line without newline like fgets() does. */
+      if ((len == 0) || too_long)
+        return -1;
+      return 0;
+    }
+
+    len += strlen(*buffer + len);
+    if ((len > 0) && ((*buffer)[len - 1] == '\n'))
+      return too_long ? 1 : 0;
+  }
+} /* int us_read_line */
+
+/* Reads a command in binary framing mode: its length as a 32 bit integer in
+ * network byte order, followed by the command. Returns like us_read_line(). */
+static int us_read_frame(FILE *fh, char **buffer, size_t *buffer_size) {
+  uint32_t len;
+
+  if (fread(&len, sizeof(len), 1, fh) != 1)
+    return -1;
+  len = ntohl(len);
+
+  if (len > US_MAX_LINE) {
+    char tmp[4096];
+
+    /* Discard the command. */
+    while (len > 0) {
+      size_t n = (len < sizeof(tmp)) ? len : sizeof(tmp);
+      if (fread(tmp, 1, n, fh) != n)
+        return -1;
+      len -= (uint32_t)n;
+    }
+    return 1;
+  }
+
+  if (*buffer_size < (size_t)len + 1) {
+    char *tmp = realloc(*buffer, (size_t)len + 1);
+    if (tmp == NULL) {
+      ERROR("unixsock plugin: realloc failed.");
+      return -1;
+    }
+    *buffer = tmp;
+    *buffer_size = (size_t)len + 1;
+  }
+
+  if ((len > 0) && (fread(*buffer, 1, len, fh) != len))
+    return -1;
+  (*buffer)[len] = 0;
+
+  return 0;
+} /* int us_read_frame */
+
+#if HAVE_FOPENCOOKIE
+/* Writes a part of a response in binary framing mode as one frame: its
+ * length as a 32 bit integer in network byte order, followed by the data. A
+ * frame of length zero marks the end of a response. */
+static ssize_t us_frame_write(void *cookie, const char *buf, size_t size) {
+  FILE *fh = cookie;
+  uint32_t len = htonl((uint32_t)size);
+
+  if (size == 0)
+    return 0;
+
+  if ((fwrite(&len, sizeof(len), 1, fh) != 1) ||
+      (fwrite(buf, 1, size, fh) != size))
+    return -1;
+
+  return (ssize_t)size;
+} /* ssize_t us_frame_write */
+
+/* Returns a stream that writes to `fh' in frames of up to the size of the
+ * stream's buffer. */
+static FILE *us_frame_open(FILE *fh) {
+  FILE *fhframe;
+
+  fhframe = fopencookie(fh, "w", (cookie_io_functions_t){
+                                     .write = us_frame_write,
+                                 });
+  if (fhframe == NULL) {
+    char errbuf[1024];
+    ERROR("unixsock plugin: fopencookie failed: %s",
+          sstrerror(errno, errbuf, sizeof(errbuf)));
+    return NULL;
+  }
+
+  return fhframe;
+} /* FILE *us_frame_open */
+#endif /* HAVE_FOPENCOOKIE */
+
+/* Sends the response to the client. In binary framing mode, the remaining
+ * part of the response is written as a frame, followed by the empty frame
+ * marking the end of the response. */
+static void us_end_response(FILE *fhout, FILE *fhframe) {
+  if (fhframe != NULL) {
+    uint32_t len = 0;
+
+    fflush(fhframe);
+    fwrite(&len, sizeof(len), 1, fhout);
+  }
+  fflush(fhout);
+} /* void us_end_response */
+
+/* Handles "FRAMING binary|text". Returns the new framing mode, one for binary
+ * and zero for text, or `binary' if it doesn't change. */
+static int us_handle_framing(FILE *fh, char **fields, int fields_num,
+                             int binary) {
+  if ((fields_num != 2) || ((strcasecmp("binary", fields[1]) != 0) &&
+                            (strcasecmp("text", fields[1]) != 0))) {
+    fprintf(fh, "-1 Usage: FRAMING binary|text\n");
+    return binary;
+  }
+
+  if (strcasecmp("text", fields[1]) == 0) {
+    fprintf(fh, "0 Success\n");
+    return 0;
+  }
+
+#if HAVE_FOPENCOOKIE
+  fprintf(fh, "0 Success\n");
+  return 1;
+#else
+  fprintf(fh, "-1 Binary framing is not supported on this system.\n");
+  return binary;
+#endif
+} /* int us_handle_framing */
+
 static void *us_handle_client(void *arg) {
   int fdin;
   int fdout;
   FILE *fhin, *fhout;
+  /* Responses are written to fhframe in binary framing mode. */
+  FILE *fhframe = NULL;
+  char *buffer = NULL;
+  size_t buffer_size = 0;
+  cmd_putval_stream_t putval_stream;
+  int status;
+
+  cmd_putval_stream_init(&putval_stream);
 
   fdin = *((int *)arg);
   free(arg);
@@ -205,35 +384,30 @@ static void *us_handle_client(void *arg) {
     return (void *)1;
   }
 
-  /* change output buffer to line buffered mode */
-  if (setvbuf(fhout, NULL, _IOLBF, 0) != 0) {
-    char errbuf[1024];
-    ERROR("unixsock plugin: setvbuf failed: %s",
-          sstrerror(errno, errbuf, sizeof(errbuf)));
-    fclose(fhin);
-    fclose(fhout);
-    pthread_exit((void *)1);
-    return (void *)0;
-  }
-
+  /* The output is fully buffered and flushed after each command, so that
+   * responses of many lines are written in few system calls. */
   while (42) {
-    char buffer[1024];
+    /* Lines may be up to US_MAX_LINE bytes long, but the split copy only
+     * provides the command name and the argument of FRAMING. The other
+     * handlers parse the complete line in `buffer', so truncating the copy
+     * doesn't lose anything. */
     char buffer_copy[1024];
     char *fields[128];
     int fields_num;
-    int len;
-
-    errno = 0;
-    if (fgets(buffer, sizeof(buffer), fhin) == NULL) {
-      if ((errno == EINTR) || (errno == EAGAIN))
-        continue;
+    size_t len;
+    FILE *fh = (fhframe != NULL) ? fhframe : fhout;
+    int binary = (fhframe != NULL);
 
-      if (errno != 0) {
-        char errbuf[1024];
-        WARNING("unixsock plugin: failed to read from socket #%i: %s",
-                fileno(fhin), sstrerror(errno, errbuf, sizeof(errbuf)));
-      }
+    if (binary)
+      status = us_read_frame(fhin, &buffer, &buffer_size);
+    else
+      status = us_read_line(fhin, &buffer, &buffer_size);
+    if (status < 0)
       break;
+    if (status > 0) {
+      fprintf(fh, "-1 Command too long.\n");
+      us_end_response(fhout, fhframe);
+      continue;
     }
 
     len = strlen(buffer);
@@ -241,15 +415,26 @@ static void *us_handle_client(void *arg) {
            ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
       buffer[--len] = '\0';
 
-    if (len == 0)
+    if (len == 0) {
+      /* Every frame is answered, so that clients don't wait forever. */
+      if (binary) {
+        fprintf(fh, "-1 Empty command.\n");
+        us_end_response(fhout, fhframe);
+      }
       continue;
+    }
 
     sstrncpy(buffer_copy, buffer, sizeof(buffer_copy));
 
     fields_num =
         strsplit(buffer_copy, fields, sizeof(fields) / sizeof(fields[0]));
     if (fields_num < 1) {
-      fprintf(fhout, "-1 Internal error\n");
+      fprintf(fh, "-1 Internal error\n");
+      us_end_response(fhout, fhframe);
+      cmd_putval_stream_destroy(&putval_stream);
+      sfree(buffer);
+      if (fhframe != NULL)
+        fclose(fhframe);
       fclose(fhin);
       fclose(fhout);
       pthread_exit((void *)1);
@@ -257,28 +442,55 @@ static void *us_handle_client(void *arg) {
     }
 
     if (strcasecmp(fields[0], "getval") == 0) {
-      cmd_handle_getval(fhout, buffer);
+      cmd_handle_getval(fh, buffer);
+    } else if (strcasecmp(fields[0], "gethistory") == 0) {
+      cmd_handle_gethistory(fh, buffer);
     } else if (strcasecmp(fields[0], "getthreshold") == 0) {
-      handle_getthreshold(fhout, buffer);
+      handle_getthreshold(fh, buffer);
     } else if (strcasecmp(fields[0], "putval") == 0) {
-      cmd_handle_putval(fhout, buffer);
+      cmd_handle_putval_stream(fh, &putval_stream, buffer);
     } else if (strcasecmp(fields[0], "listval") == 0) {
-      cmd_handle_listval(fhout, buffer);
+      /* The end of a response is marked in binary framing mode, so the
+       * values can be written while they are copied from the cache. */
+      if (binary)
+        cmd_handle_listval_stream(fh, buffer);
+      else
+        cmd_handle_listval(fh, buffer);
     } else if (strcasecmp(fields[0], "putnotif") == 0) {
-      handle_putnotif(fhout, buffer);
+      handle_putnotif(fh, buffer);
     } else if (strcasecmp(fields[0], "flush") == 0) {
-      cmd_handle_flush(fhout, buffer);
+      cmd_handle_flush(fh, buffer);
+    } else if (strcasecmp(fields[0], "framing") == 0) {
+      binary = us_handle_framing(fh, fields, fields_num, binary);
     } else {
-      if (fprintf(fhout, "-1 Unknown command: %s\n", fields[0]) < 0) {
+      if (fprintf(fh, "-1 Unknown command: %s\n", fields[0]) < 0) {
         char errbuf[1024];
         WARNING("unixsock plugin: failed to write to socket #%i: %s",
                 fileno(fhout), sstrerror(errno, errbuf, sizeof(errbuf)));
         break;
       }
     }
-  } /* while (fgets) */
+    us_end_response(fhout, fhframe);
+
+    /* A new framing mode applies to the next command. */
+#if HAVE_FOPENCOOKIE
+    if (binary && (fhframe == NULL)) {
+      fhframe = us_frame_open(fhout);
+      if (fhframe == NULL)
+        break;
+    }
+#endif
+    if (!binary && (fhframe != NULL)) {
+      fclose(fhframe);
+      fhframe = NULL;
+    }
+  } /* while (us_read_line) */
 
   DEBUG("unixsock plugin: us_handle_client: Exiting..");
+  cmd_putval_stream_destroy(&putval_stream);
+  sfree(buffer);
+  if (fhframe != NULL)
+    fclose(fhframe);
   fclose(fhin);
   fclose(fhout);
 
@@ -0,0 +1,224 @@
+/**
+ * collectd - src/utils_cmd_gethistory.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "plugin.h"
+
+#include "utils_cache.h"
+#include "utils_cmd_gethistory.h"
+#include "utils_format_number.h"
+
+/* Parses an epoch in seconds. Negative values are relative to now. */
+static int parse_history_time(char const *str, cdtime_t *ret_time) /* {{{ */
+{
+  char *endptr = NULL;
+  double t;
+
+  errno = 0;
+  t = strtod(str, &endptr);
+  if ((endptr == str) || (*endptr != 0) || (errno != 0) || !isfinite(t))
+    return -1;
+
+  if (t < 0.0) {
+    cdtime_t now = cdtime();
+    cdtime_t ago = DOUBLE_TO_CDTIME_T(-t);
+    *ret_time = (ago < now) ? now - ago : 0;
+  } else {
+    *ret_time = DOUBLE_TO_CDTIME_T(t);
+  }
+
+  return 0;
+} /* }}} int parse_history_time */
+
+cmd_status_t cmd_parse_gethistory(size_t argc, char **argv, /* {{{ */
+                                  cmd_gethistory_t *ret_gethistory,
+                                  const cmd_options_t *opts,
+                                  cmd_error_handler_t *err) {
+  char *identifier_copy;
+  int status;
+
+  if ((ret_gethistory == NULL) || (opts == NULL)) {
+    errno = EINVAL;
+    cmd_error(CMD_ERROR, err, "Invalid arguments to cmd_parse_gethistory.");
+    return CMD_ERROR;
+  }
+
+  if (argc < 1) {
+    cmd_error(CMD_PARSE_ERROR, err, "Missing identifier.");
+    return CMD_PARSE_ERROR;
+  }
+
+  ret_gethistory->start = 0;
+  ret_gethistory->end = (cdtime_t)UINT64_MAX;
+
+  for (size_t i = 1; i < argc; i++) {
+    char *opt_key = NULL;
+    char *opt_value = NULL;
+
+    status = cmd_parse_option(argv[i], &opt_key, &opt_value, err);
+    if (status != CMD_OK) {
+      if (status == CMD_NO_OPTION)
+        cmd_error(CMD_PARSE_ERROR, err, "Garbage after identifier: `%s'.",
+                  argv[i]);
+      return CMD_PARSE_ERROR;
+    }
+
+    if (strcasecmp("start", opt_key) == 0)
+      status = parse_history_time(opt_value, &ret_gethistory->start);
+    else if (strcasecmp("end", opt_key) == 0)
+      status = parse_history_time(opt_value, &ret_gethistory->end);
+    else {
+      cmd_error(CMD_PARSE_ERROR, err, "Cannot parse option `%s'.", opt_key);
+      return CMD_PARSE_ERROR;
+    }
+
+    if (status != 0) {
+      cmd_error(CMD_PARSE_ERROR, err, "Invalid value for option `%s': %s",
+                opt_key, opt_value);
+      return CMD_PARSE_ERROR;
+    }
+  }
+
+  /* parse_identifier() modifies its first argument,
+   * returning pointers into it */
+  identifier_copy = sstrdup(argv[0]);
+
+  status = parse_identifier(argv[0], &ret_gethistory->identifier.host,
+                            &ret_gethistory->identifier.plugin,
+                            &ret_gethistory->identifier.plugin_instance,
+                            &ret_gethistory->identifier.type,
+                            &ret_gethistory->identifier.type_instance,
+                            opts->identifier_default_host);
+  if (status != 0) {
+    DEBUG("cmd_parse_gethistory: Cannot parse identifier `%s'.",
+          identifier_copy);
+    cmd_error(CMD_PARSE_ERROR, err, "Cannot parse identifier `%s'.",
+              identifier_copy);
+    sfree(identifier_copy);
+    return CMD_PARSE_ERROR;
+  }
+
+  ret_gethistory->raw_identifier = identifier_copy;
+  return CMD_OK;
+} /* }}} cmd_status_t cmd_parse_gethistory */
+
+cmd_status_t cmd_handle_gethistory(FILE *fh, char *buffer) /* {{{ */
+{
+  cmd_error_handler_t err = {cmd_error_fh, fh};
+  cmd_status_t status;
+  cmd_t cmd;
+
+  cdtime_t *times = NULL;
+  gauge_t *values = NULL;
+  size_t points_num = 0;
+  size_t values_num = 0;
+
+  const data_set_t *ds;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return -1;
+
+  DEBUG("utils_cmd_gethistory: cmd_handle_gethistory (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  if ((status = cmd_parse(buffer, &cmd, NULL, &err)) != CMD_OK)
+    return status;
+  if (cmd.type != CMD_GETHISTORY) {
+    cmd_error(CMD_UNKNOWN_COMMAND, &err, "Unexpected command: `%s'.",
+              CMD_TO_STRING(cmd.type));
+    cmd_destroy(&cmd);
+    return CMD_UNKNOWN_COMMAND;
+  }
+
+  ds = plugin_get_ds(cmd.cmd.gethistory.identifier.type);
+  if (ds == NULL) {
+    cmd_error(CMD_ERROR, &err, "Type `%s' is unknown.",
+              cmd.cmd.gethistory.identifier.type);
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
+  }
+
+  status = uc_get_history_range_by_name(
+      cmd.cmd.gethistory.raw_identifier, cmd.cmd.gethistory.start,
+      cmd.cmd.gethistory.end, &times, &values, &points_num, &values_num);
+  if (status == -ENOTSUP) {
+    cmd_error(CMD_ERROR, &err, "History is disabled (see CacheHistory).");
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
+  } else if (status != 0) {
+    cmd_error(CMD_ERROR, &err, "No such value.");
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
+  }
+
+  if (ds->ds_num != values_num) {
+    ERROR("ds[%s]->ds_num = %zu, "
+          "but uc_get_history_range_by_name returned %zu values.",
+          ds->type, ds->ds_num, values_num);
+    cmd_error(CMD_ERROR, &err, "Error reading value from cache.");
+    sfree(times);
+    sfree(values);
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
+  }
+
+  /* The socket is only flushed once, after the last point. */
+  status = CMD_OK;
+  if (fprintf(fh, "%zu Point%s found\n", points_num,
+              (points_num == 1) ? "" : "s") < 0)
+    status = CMD_ERROR;
+  for (size_t i = 0; (i < points_num) && (status == CMD_OK); i++) {
+    gauge_t *v = values + i * values_num;
+
+    fprintf(fh, "%.3f", CDTIME_T_TO_DOUBLE(times[i]));
+    for (size_t j = 0; j < values_num; j++) {
+      char tmp[FORMAT_NUMBER_BUFSIZE];
+
+      format_double(tmp, v[j]);
+      fprintf(fh, " %s=%s", ds->ds[j].name, tmp);
+    }
+    if (fputc('\n', fh) == EOF)
+      status = CMD_ERROR;
+  }
+  if ((status != CMD_OK) || (fflush(fh) != 0)) {
+    char errbuf[1024];
+    WARNING("cmd_handle_gethistory: failed to write to socket #%i: %s",
+            fileno(fh), sstrerror(errno, errbuf, sizeof(errbuf)));
+    status = CMD_ERROR;
+  }
+
+  sfree(times);
+  sfree(values);
+  cmd_destroy(&cmd);
+
+  return status;
+} /* }}} cmd_status_t cmd_handle_gethistory */
+
+void cmd_destroy_gethistory(cmd_gethistory_t *gethistory) /* {{{ */
+{
+  if (gethistory == NULL)
+    return;
+
+  sfree(gethistory->raw_identifier);
+} /* }}} void cmd_destroy_gethistory */
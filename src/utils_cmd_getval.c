@@ -31,13 +31,13 @@
 
 #include "utils_cache.h"
 #include "utils_cmd_getval.h"
+#include "utils_format_number.h"
 #include "utils_parse_option.h"
 
 cmd_status_t cmd_parse_getval(size_t argc, char **argv,
                               cmd_getval_t *ret_getval,
                               const cmd_options_t *opts,
                               cmd_error_handler_t *err) {
-  char *identifier_copy;
   int status;
 
   if ((ret_getval == NULL) || (opts == NULL)) {
@@ -46,32 +46,54 @@ cmd_status_t cmd_parse_getval(size_t argc, char **argv,
     return CMD_ERROR;
   }
 
-  if (argc != 1) {
-    if (argc == 0)
-      cmd_error(CMD_PARSE_ERROR, err, "Missing identifier.");
-    else
-      cmd_error(CMD_PARSE_ERROR, err, "Garbage after identifier: `%s'.",
-                argv[1]);
+  ret_getval->multiple = 0;
+  if ((argc > 0) && (strcmp("-m", argv[0]) == 0)) {
+    ret_getval->multiple = 1;
+    argc--;
+    argv++;
+  }
+
+  if (argc == 0) {
+    cmd_error(CMD_PARSE_ERROR, err, "Missing identifier.");
+    return CMD_PARSE_ERROR;
+  }
+  if ((argc > 1) && !ret_getval->multiple) {
+    cmd_error(CMD_PARSE_ERROR, err,
+              "Use `GETVAL -m' to query more than one identifier.");
     return CMD_PARSE_ERROR;
   }
 
-  /* parse_identifier() modifies its first argument,
-   * returning pointers into it */
-  identifier_copy = sstrdup(argv[0]);
+  ret_getval->raw_identifiers =
+      calloc(argc, sizeof(*ret_getval->raw_identifiers));
+  ret_getval->identifiers = calloc(argc, sizeof(*ret_getval->identifiers));
+  if ((ret_getval->raw_identifiers == NULL) ||
+      (ret_getval->identifiers == NULL)) {
+    cmd_error(CMD_ERROR, err, "calloc failed.");
+    cmd_destroy_getval(ret_getval);
+    return CMD_ERROR;
+  }
 
-  status = parse_identifier(
-      argv[0], &ret_getval->identifier.host, &ret_getval->identifier.plugin,
-      &ret_getval->identifier.plugin_instance, &ret_getval->identifier.type,
-      &ret_getval->identifier.type_instance, opts->identifier_default_host);
-  if (status != 0) {
-    DEBUG("cmd_parse_getval: Cannot parse identifier `%s'.", identifier_copy);
-    cmd_error(CMD_PARSE_ERROR, err, "Cannot parse identifier `%s'.",
-              identifier_copy);
-    sfree(identifier_copy);
-    return CMD_PARSE_ERROR;
+  for (size_t i = 0; i < argc; i++) {
+    identifier_t *id = ret_getval->identifiers + i;
+
+    /* parse_identifier() modifies its first argument,
+     * returning pointers into it */
+    ret_getval->raw_identifiers[i] = sstrdup(argv[i]);
+    ret_getval->identifiers_num++;
+
+    status = parse_identifier(argv[i], &id->host, &id->plugin,
+                              &id->plugin_instance, &id->type,
+                              &id->type_instance, opts->identifier_default_host);
+    if (status != 0) {
+      DEBUG("cmd_parse_getval: Cannot parse identifier `%s'.",
+            ret_getval->raw_identifiers[i]);
+      cmd_error(CMD_PARSE_ERROR, err, "Cannot parse identifier `%s'.",
+                ret_getval->raw_identifiers[i]);
+      cmd_destroy_getval(ret_getval);
+      return CMD_PARSE_ERROR;
+    }
   }
 
-  ret_getval->raw_identifier = identifier_copy;
   return CMD_OK;
 } /* cmd_status_t cmd_parse_getval */
 
@@ -86,6 +108,94 @@ cmd_status_t cmd_parse_getval(size_t argc, char **argv,
     fflush(fh);                                                                \
   } while (0)
 
+/* Looks up the rates of one identifier. Returns NULL if the identifier is
+ * unknown or its data set doesn't match the cache. */
+static gauge_t *getval_lookup(cmd_getval_t const *getval, size_t i, /* {{{ */
+                              data_set_t const **ret_ds) {
+  gauge_t *values = NULL;
+  size_t values_num = 0;
+  data_set_t const *ds;
+
+  ds = plugin_get_ds(getval->identifiers[i].type);
+  if (ds == NULL)
+    return NULL;
+
+  if (uc_get_rate_by_name(getval->raw_identifiers[i], &values, &values_num) !=
+      0)
+    return NULL;
+
+  if (ds->ds_num != values_num) {
+    ERROR("ds[%s]->ds_num = %zu, "
+          "but uc_get_rate_by_name returned %zu values.",
+          ds->type, ds->ds_num, values_num);
+    sfree(values);
+    return NULL;
+  }
+
+  *ret_ds = ds;
+  return values;
+} /* }}} gauge_t *getval_lookup */
+
+/* Answers a GETVAL command with the "-m" option: one line per identifier, in
+ * the order of the request, holding the (escaped) identifier followed by the
+ * name-value-pairs. Unknown identifiers get a line without values. The socket
+ * is flushed only once, after the last line. */
+static cmd_status_t getval_batch(FILE *fh, /* {{{ */
+                                 cmd_getval_t const *getval) {
+  size_t num = getval->identifiers_num;
+  gauge_t **values;
+  data_set_t const **ds;
+  size_t found = 0;
+  cmd_status_t status = CMD_OK;
+
+  values = calloc(num, sizeof(*values));
+  ds = calloc(num, sizeof(*ds));
+  if ((values == NULL) || (ds == NULL)) {
+    cmd_error_handler_t err = {cmd_error_fh, fh};
+    cmd_error(CMD_ERROR, &err, "calloc failed.");
+    sfree(values);
+    sfree(ds);
+    return CMD_ERROR;
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    values[i] = getval_lookup(getval, i, ds + i);
+    if (values[i] != NULL)
+      found++;
+  }
+
+  if (fprintf(fh, "%zu Value lists, %zu found\n", num, found) < 0)
+    status = CMD_ERROR;
+  for (size_t i = 0; (i < num) && (status == CMD_OK); i++) {
+    char ident[6 * DATA_MAX_NAME_LEN];
+
+    sstrncpy(ident, getval->raw_identifiers[i], sizeof(ident));
+    escape_string(ident, sizeof(ident));
+    fputs(ident, fh);
+
+    for (size_t j = 0; (values[i] != NULL) && (j < ds[i]->ds_num); j++) {
+      char tmp[FORMAT_NUMBER_BUFSIZE];
+
+      format_double(tmp, values[i][j]);
+      fprintf(fh, " %s=%s", ds[i]->ds[j].name, tmp);
+    }
+    if (fputc('\n', fh) == EOF)
+      status = CMD_ERROR;
+  }
+  if ((status != CMD_OK) || (fflush(fh) != 0)) {
+    char errbuf[1024];
+    WARNING("cmd_handle_getval: failed to write to socket #%i: %s", fileno(fh),
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+    status = CMD_ERROR;
+  }
+
+  for (size_t i = 0; i < num; i++)
+    sfree(values[i]);
+  sfree(values);
+  sfree(ds);
+  return status;
+} /* }}} cmd_status_t getval_batch */
+
 cmd_status_t cmd_handle_getval(FILE *fh, char *buffer) {
   cmd_error_handler_t err = {cmd_error_fh, fh};
   cmd_status_t status;
@@ -111,20 +221,26 @@ cmd_status_t cmd_handle_getval(FILE *fh, char *buffer) {
     return CMD_UNKNOWN_COMMAND;
   }
 
-  ds = plugin_get_ds(cmd.cmd.getval.identifier.type);
+  if (cmd.cmd.getval.multiple) {
+    status = getval_batch(fh, &cmd.cmd.getval);
+    cmd_destroy(&cmd);
+    return status;
+  }
+
+  ds = plugin_get_ds(cmd.cmd.getval.identifiers[0].type);
   if (ds == NULL) {
     DEBUG("cmd_handle_getval: plugin_get_ds (%s) == NULL;",
-          cmd.cmd.getval.identifier.type);
+          cmd.cmd.getval.identifiers[0].type);
     cmd_error(CMD_ERROR, &err, "Type `%s' is unknown.\n",
-              cmd.cmd.getval.identifier.type);
+              cmd.cmd.getval.identifiers[0].type);
     cmd_destroy(&cmd);
     return -1;
   }
 
   values = NULL;
   values_num = 0;
-  status =
-      uc_get_rate_by_name(cmd.cmd.getval.raw_identifier, &values, &values_num);
+  status = uc_get_rate_by_name(cmd.cmd.getval.raw_identifiers[0], &values,
+                               &values_num);
   if (status != 0) {
     cmd_error(CMD_ERROR, &err, "No such value.");
     cmd_destroy(&cmd);
@@ -162,5 +278,8 @@ void cmd_destroy_getval(cmd_getval_t *getval) {
   if (getval == NULL)
     return;
 
-  sfree(getval->raw_identifier);
+  strarray_free(getval->raw_identifiers, getval->identifiers_num);
+  getval->raw_identifiers = NULL;
+  sfree(getval->identifiers);
+  getval->identifiers_num = 0;
 } /* void cmd_destroy_getval */
@@ -48,6 +48,9 @@ cmd_status_t cmd_parse_listval(size_t argc, char **argv,
   return CMD_OK;
 } /* cmd_status_t cmd_parse_listval */
 
+/* Number of names copied from the cache while holding its lock. */
+#define LISTVAL_CHUNK_SIZE 1024
+
 #define free_everything_and_return(status)                                     \
   do {                                                                         \
     for (size_t j = 0; j < number; j++) {                                      \
@@ -59,6 +62,7 @@ cmd_status_t cmd_parse_listval(size_t argc, char **argv,
     return status;                                                             \
   } while (0)
 
+/* The socket is flushed once, after the last line. */
 #define print_to_socket(fh, ...)                                               \
   do {                                                                         \
     if (fprintf(fh, __VA_ARGS__) < 0) {                                        \
@@ -67,7 +71,6 @@ cmd_status_t cmd_parse_listval(size_t argc, char **argv,
               sstrerror(errno, errbuf, sizeof(errbuf)));                       \
       free_everything_and_return(CMD_ERROR);                                   \
     }                                                                          \
-    fflush(fh);                                                                \
   } while (0)
 
 cmd_status_t cmd_handle_listval(FILE *fh, char *buffer) {
@@ -78,6 +81,7 @@ cmd_status_t cmd_handle_listval(FILE *fh, char *buffer) {
   char **names = NULL;
   cdtime_t *times = NULL;
   size_t number = 0;
+  size_t size = 0;
 
   DEBUG("utils_cmd_listval: handle_listval (fh = %p, buffer = %s);", (void *)fh,
         buffer);
@@ -90,21 +94,127 @@ cmd_status_t cmd_handle_listval(FILE *fh, char *buffer) {
     free_everything_and_return(CMD_UNKNOWN_COMMAND);
   }
 
-  status = uc_get_names(&names, &times, &number);
-  if (status != 0) {
-    DEBUG("command listval: uc_get_names failed with status %i", status);
-    cmd_error(CMD_ERROR, &err, "uc_get_names failed.");
-    free_everything_and_return(CMD_ERROR);
+  /* Copy the names in chunks, releasing the cache lock in between, so that
+   * listing a large cache doesn't block all updates. */
+  while (42) {
+    size_t chunk_num = 0;
+
+    if (size - number < LISTVAL_CHUNK_SIZE) {
+      size_t new_size = (size == 0) ? LISTVAL_CHUNK_SIZE : 2 * size;
+      char **tmp_names;
+      cdtime_t *tmp_times;
+
+      tmp_names = realloc(names, new_size * sizeof(*names));
+      if (tmp_names != NULL)
+        names = tmp_names;
+      tmp_times = realloc(times, new_size * sizeof(*times));
+      if (tmp_times != NULL)
+        times = tmp_times;
+      if ((tmp_names == NULL) || (tmp_times == NULL)) {
+        cmd_error(CMD_ERROR, &err, "realloc failed.");
+        free_everything_and_return(CMD_ERROR);
+      }
+      size = new_size;
+    }
+
+    status = uc_get_names_after((number > 0) ? names[number - 1] : NULL,
+                                names + number, times + number,
+                                LISTVAL_CHUNK_SIZE, &chunk_num);
+    if (status != 0) {
+      DEBUG("command listval: uc_get_names_after failed with status %i",
+            status);
+      cmd_error(CMD_ERROR, &err, "uc_get_names_after failed.");
+      free_everything_and_return(CMD_ERROR);
+    }
+
+    number += chunk_num;
+    if (chunk_num < LISTVAL_CHUNK_SIZE)
+      break;
   }
 
   print_to_socket(fh, "%i Value%s found\n", (int)number,
                   (number == 1) ? "" : "s");
   for (size_t i = 0; i < number; i++)
     print_to_socket(fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE(times[i]), names[i]);
+  fflush(fh);
 
   free_everything_and_return(CMD_OK);
 } /* cmd_status_t cmd_handle_listval */
 
+/* Like cmd_handle_listval(), but writes each chunk of names as soon as it has
+ * been copied from the cache, so the list is never held in memory as a whole.
+ * Since the number of values isn't known up front, the status line doesn't
+ * contain it and the caller has to mark the end of the response. */
+cmd_status_t cmd_handle_listval_stream(FILE *fh, char *buffer) {
+  cmd_error_handler_t err = {cmd_error_fh, fh};
+  cmd_status_t status;
+  cmd_t cmd;
+
+  char *names[LISTVAL_CHUNK_SIZE];
+  cdtime_t times[LISTVAL_CHUNK_SIZE];
+  char after[6 * DATA_MAX_NAME_LEN] = "";
+  size_t number = 0;
+
+  DEBUG("utils_cmd_listval: handle_listval_stream (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  if ((status = cmd_parse(buffer, &cmd, NULL, &err)) != CMD_OK)
+    return status;
+  if (cmd.type != CMD_LISTVAL) {
+    cmd_error(CMD_UNKNOWN_COMMAND, &err, "Unexpected command: `%s'.",
+              CMD_TO_STRING(cmd.type));
+    cmd_destroy(&cmd);
+    return CMD_UNKNOWN_COMMAND;
+  }
+
+  if (fprintf(fh, "0 Listing values\n") < 0) {
+    char errbuf[1024];
+    WARNING("handle_listval: failed to write to socket #%i: %s", fileno(fh),
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+    return CMD_ERROR;
+  }
+
+  while (42) {
+    size_t chunk_num = 0;
+    int write_failed = 0;
+
+    status = uc_get_names_after((after[0] != 0) ? after : NULL, names, times,
+                                LISTVAL_CHUNK_SIZE, &chunk_num);
+    if (status != 0) {
+      /* The status line has been sent already, so the list just ends. */
+      ERROR("command listval: uc_get_names_after failed with status %i",
+            status);
+      return CMD_ERROR;
+    }
+
+    for (size_t i = 0; i < chunk_num; i++) {
+      if (!write_failed &&
+          (fprintf(fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE(times[i]), names[i]) <
+           0))
+        write_failed = 1;
+    }
+    if (chunk_num > 0)
+      sstrncpy(after, names[chunk_num - 1], sizeof(after));
+    for (size_t i = 0; i < chunk_num; i++)
+      sfree(names[i]);
+
+    if (write_failed) {
+      char errbuf[1024];
+      WARNING("handle_listval: failed to write to socket #%i: %s", fileno(fh),
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+      return CMD_ERROR;
+    }
+
+    number += chunk_num;
+    if (chunk_num < LISTVAL_CHUNK_SIZE)
+      break;
+  }
+
+  DEBUG("utils_cmd_listval: handle_listval_stream: %zu values", number);
+  fflush(fh);
+  return CMD_OK;
+} /* cmd_status_t cmd_handle_listval_stream */
+
 void cmd_destroy_listval(cmd_listval_t *listval __attribute__((unused))) {
   /* nothing to do */
 } /* void cmd_destroy_listval */
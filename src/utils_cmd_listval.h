@@ -38,6 +38,8 @@ cmd_status_t cmd_parse_listval(size_t argc, char **argv,
 
 cmd_status_t cmd_handle_listval(FILE *fh, char *buffer);
 
+cmd_status_t cmd_handle_listval_stream(FILE *fh, char *buffer);
+
 void cmd_destroy_listval(cmd_listval_t *listval);
 
 #endif /* UTILS_CMD_LISTVAL_H */
@@ -35,8 +35,8 @@
  * private helper functions
  */
 
-static int set_option(value_list_t *vl, const char *key, const char *value) {
-  if ((vl == NULL) || (key == NULL) || (value == NULL))
+static int set_option(cdtime_t *interval, const char *key, const char *value) {
+  if ((interval == NULL) || (key == NULL) || (value == NULL))
     return -1;
 
   if (strcasecmp("interval", key) == 0) {
@@ -48,167 +48,248 @@ static int set_option(value_list_t *vl, const char *key, const char *value) {
     tmp = strtod(value, &endptr);
 
     if ((errno == 0) && (endptr != NULL) && (endptr != value) && (tmp > 0.0))
-      vl->interval = DOUBLE_TO_CDTIME_T(tmp);
+      *interval = DOUBLE_TO_CDTIME_T(tmp);
   } else
     return 1;
 
   return 0;
 } /* int set_option */
 
-/*
- * public API
- */
-
-cmd_status_t cmd_parse_putval(size_t argc, char **argv,
-                              cmd_putval_t *ret_putval,
-                              const cmd_options_t *opts,
-                              cmd_error_handler_t *err) {
-  cmd_status_t result;
-
-  char *identifier;
+/* Parses `identifier' into the value list template and data set of `s',
+ * unless it is the identifier of the previous line. */
+static cmd_status_t putval_stream_identifier(cmd_putval_stream_t *s, /* {{{ */
+                                             char const *identifier,
+                                             const cmd_options_t *opts,
+                                             cmd_error_handler_t *err) {
+  char buffer[sizeof(s->identifier)];
+  size_t identifier_len;
   char *hostname;
   char *plugin;
   char *plugin_instance;
   char *type;
   char *type_instance;
-  int status;
+  const data_set_t *ds = s->ds;
+  value_list_t *vl = &s->vl;
 
-  char *identifier_copy;
+  if ((ds != NULL) && (strcmp(identifier, s->identifier) == 0))
+    return CMD_OK;
 
-  const data_set_t *ds;
-  value_list_t vl = VALUE_LIST_INIT;
+  /* The template is overwritten below; invalidate the cache until done. */
+  s->ds = NULL;
 
-  if ((ret_putval == NULL) || (opts == NULL)) {
-    errno = EINVAL;
-    cmd_error(CMD_ERROR, err, "Invalid arguments to cmd_parse_putval.");
-    return CMD_ERROR;
-  }
-
-  if (argc < 2) {
-    cmd_error(CMD_PARSE_ERROR, err, "Missing identifier and/or value-list.");
+  identifier_len = strlen(identifier);
+  if (identifier_len >= sizeof(buffer)) {
+    cmd_error(CMD_PARSE_ERROR, err, "Identifier too long.");
     return CMD_PARSE_ERROR;
   }
-
-  identifier = argv[0];
-
-  /* parse_identifier() modifies its first argument, returning pointers into
-   * it; retain the old value for later. */
-  identifier_copy = sstrdup(identifier);
-
-  status =
-      parse_identifier(identifier, &hostname, &plugin, &plugin_instance, &type,
-                       &type_instance, opts->identifier_default_host);
-  if (status != 0) {
-    DEBUG("cmd_handle_putval: Cannot parse identifier `%s'.", identifier_copy);
+  /* parse_identifier() modifies its first argument. The lengths are known, so
+   * memcpy() is used instead of sstrncpy(), which pads the whole buffer. */
+  memcpy(buffer, identifier, identifier_len + 1);
+
+  if (parse_identifier(buffer, &hostname, &plugin, &plugin_instance, &type,
+                       &type_instance,
+                       (opts != NULL) ? opts->identifier_default_host
+                                      : NULL) != 0) {
+    DEBUG("cmd_putval_stream_parse: Cannot parse identifier `%s'.",
+          identifier);
     cmd_error(CMD_PARSE_ERROR, err, "Cannot parse identifier `%s'.",
-              identifier_copy);
-    sfree(identifier_copy);
+              identifier);
     return CMD_PARSE_ERROR;
   }
 
-  if ((strlen(hostname) >= sizeof(vl.host)) ||
-      (strlen(plugin) >= sizeof(vl.plugin)) ||
+  if ((strlen(hostname) >= sizeof(vl->host)) ||
+      (strlen(plugin) >= sizeof(vl->plugin)) ||
+      (strlen(type) >= sizeof(vl->type)) ||
       ((plugin_instance != NULL) &&
-       (strlen(plugin_instance) >= sizeof(vl.plugin_instance))) ||
+       (strlen(plugin_instance) >= sizeof(vl->plugin_instance))) ||
       ((type_instance != NULL) &&
-       (strlen(type_instance) >= sizeof(vl.type_instance)))) {
+       (strlen(type_instance) >= sizeof(vl->type_instance)))) {
     cmd_error(CMD_PARSE_ERROR, err, "Identifier too long.");
-    sfree(identifier_copy);
     return CMD_PARSE_ERROR;
   }
 
-  sstrncpy(vl.host, hostname, sizeof(vl.host));
-  sstrncpy(vl.plugin, plugin, sizeof(vl.plugin));
-  sstrncpy(vl.type, type, sizeof(vl.type));
-  if (plugin_instance != NULL)
-    sstrncpy(vl.plugin_instance, plugin_instance, sizeof(vl.plugin_instance));
-  if (type_instance != NULL)
-    sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
-
-  ds = plugin_get_ds(type);
+  /* Consecutive lines often share the type even if the identifier differs. */
+  if ((ds == NULL) || (strcmp(type, ds->type) != 0))
+    ds = plugin_get_ds(type);
   if (ds == NULL) {
     cmd_error(CMD_PARSE_ERROR, err, "1 Type `%s' isn't defined.", type);
-    sfree(identifier_copy);
     return CMD_PARSE_ERROR;
   }
 
-  hostname = NULL;
-  plugin = NULL;
-  plugin_instance = NULL;
-  type = NULL;
-  type_instance = NULL;
+  memcpy(vl->host, hostname, strlen(hostname) + 1);
+  memcpy(vl->plugin, plugin, strlen(plugin) + 1);
+  memcpy(vl->type, type, strlen(type) + 1);
+  if (plugin_instance != NULL)
+    memcpy(vl->plugin_instance, plugin_instance, strlen(plugin_instance) + 1);
+  else
+    vl->plugin_instance[0] = '\0';
+  if (type_instance != NULL)
+    memcpy(vl->type_instance, type_instance, strlen(type_instance) + 1);
+  else
+    vl->type_instance[0] = '\0';
+
+  memcpy(s->identifier, identifier, identifier_len + 1);
+  s->ds = ds;
+  return CMD_OK;
+} /* }}} cmd_status_t putval_stream_identifier */
+
+/* Makes room for one more value list with `values_num' values. */
+static int putval_stream_reserve(cmd_putval_stream_t *s, /* {{{ */
+                                 size_t values_num) {
+  if (s->batch_num >= s->batch_size) {
+    size_t size = (s->batch_size == 0) ? 8 : 2 * s->batch_size;
+    value_list_t *tmp;
+
+    tmp = realloc(s->batch, size * sizeof(*s->batch));
+    if (tmp == NULL)
+      return ENOMEM;
+    s->batch = tmp;
+    s->batch_size = size;
+  }
 
-  ret_putval->raw_identifier = identifier_copy;
+  if (s->values_num + values_num > s->values_size) {
+    size_t size = (s->values_size == 0) ? 64 : 2 * s->values_size;
+    value_t *tmp;
+    size_t offset = 0;
+
+    if (size < s->values_num + values_num)
+      size = s->values_num + values_num;
+
+    tmp = realloc(s->values, size * sizeof(*s->values));
+    if (tmp == NULL)
+      return ENOMEM;
+    s->values = tmp;
+    s->values_size = size;
+
+    /* The values of the batch are stored consecutively; point the value
+     * lists into the new buffer. */
+    for (size_t i = 0; i < s->batch_num; i++) {
+      s->batch[i].values = s->values + offset;
+      offset += s->batch[i].values_len;
+    }
+  }
+
+  return 0;
+} /* }}} int putval_stream_reserve */
+
+/* Parses one field of a PUTVAL command following the identifier: either an
+ * option, which applies to the value lists after it, or a value list, which
+ * is added to the batch of `s'. */
+static cmd_status_t putval_stream_field(cmd_putval_stream_t *s, /* {{{ */
+                                        char *field, cdtime_t *interval,
+                                        cmd_error_handler_t *err) {
+  value_list_t *vl;
+  char *key = NULL;
+  char *value = NULL;
+  cmd_status_t status;
+
+  status = cmd_parse_option(field, &key, &value, err);
+  if (status == CMD_OK) {
+    set_option(interval, key, value);
+    return CMD_OK;
+  } else if (status != CMD_NO_OPTION) {
+    return status;
+  }
+
+  if (putval_stream_reserve(s, s->ds->ds_num) != 0) {
+    cmd_error(CMD_ERROR, err, "realloc failed.");
+    return CMD_ERROR;
+  }
+
+  vl = s->batch + s->batch_num;
+  memcpy(vl, &s->vl, sizeof(*vl));
+  vl->interval = *interval;
+  vl->values = s->values + s->values_num;
+  vl->values_len = s->ds->ds_num;
+  memset(vl->values, 0, vl->values_len * sizeof(*vl->values));
+
+  if (parse_values(field, vl, s->ds) != 0) {
+    cmd_error(CMD_PARSE_ERROR, err, "Parsing the values string failed.");
+    return CMD_PARSE_ERROR;
+  }
+
+  s->batch_num++;
+  s->values_num += vl->values_len;
+  return CMD_OK;
+} /* }}} cmd_status_t putval_stream_field */
+
+/* Copies the value lists of the batch of `s' to `ret_putval', each with its
+ * own values, as cmd_destroy_putval() expects. */
+static cmd_status_t putval_stream_copy(cmd_putval_stream_t *s, /* {{{ */
+                                       char const *identifier,
+                                       cmd_putval_t *ret_putval,
+                                       cmd_error_handler_t *err) {
+  ret_putval->raw_identifier = strdup(identifier);
   if (ret_putval->raw_identifier == NULL) {
     cmd_error(CMD_ERROR, err, "malloc failed.");
-    cmd_destroy_putval(ret_putval);
-    sfree(vl.values);
     return CMD_ERROR;
   }
 
-  /* All the remaining fields are part of the option list. */
-  result = CMD_OK;
-  for (size_t i = 1; i < argc; ++i) {
-    value_list_t *tmp;
+  if (s->batch_num == 0)
+    return CMD_OK;
 
-    char *key = NULL;
-    char *value = NULL;
-
-    status = cmd_parse_option(argv[i], &key, &value, err);
-    if (status == CMD_OK) {
-      assert(key != NULL);
-      assert(value != NULL);
-      set_option(&vl, key, value);
-      continue;
-    } else if (status != CMD_NO_OPTION) {
-      /* parse_option failed, buffer has been modified.
-       * => we need to abort */
-      result = status;
-      break;
-    }
-    /* else: cmd_parse_option did not find an option; treat this as a
-     * value list. */
+  ret_putval->vl = calloc(s->batch_num, sizeof(*ret_putval->vl));
+  if (ret_putval->vl == NULL) {
+    cmd_error(CMD_ERROR, err, "malloc failed.");
+    cmd_destroy_putval(ret_putval);
+    return CMD_ERROR;
+  }
 
-    vl.values_len = ds->ds_num;
-    vl.values = calloc(vl.values_len, sizeof(*vl.values));
-    if (vl.values == NULL) {
+  for (size_t i = 0; i < s->batch_num; i++) {
+    value_list_t *vl = ret_putval->vl + i;
+
+    memcpy(vl, s->batch + i, sizeof(*vl));
+    vl->values = calloc(vl->values_len, sizeof(*vl->values));
+    if (vl->values == NULL) {
       cmd_error(CMD_ERROR, err, "malloc failed.");
-      result = CMD_ERROR;
-      break;
+      cmd_destroy_putval(ret_putval);
+      return CMD_ERROR;
     }
+    memcpy(vl->values, s->batch[i].values,
+           vl->values_len * sizeof(*vl->values));
+    ret_putval->vl_num++;
+  }
 
-    status = parse_values(argv[i], &vl, ds);
-    if (status != 0) {
-      cmd_error(CMD_PARSE_ERROR, err, "Parsing the values string failed.");
-      result = CMD_PARSE_ERROR;
-      vl.values_len = 0;
-      sfree(vl.values);
-      break;
-    }
+  return CMD_OK;
+} /* }}} cmd_status_t putval_stream_copy */
 
-    tmp = realloc(ret_putval->vl,
-                  (ret_putval->vl_num + 1) * sizeof(*ret_putval->vl));
-    if (tmp == NULL) {
-      cmd_error(CMD_ERROR, err, "realloc failed.");
-      cmd_destroy_putval(ret_putval);
-      result = CMD_ERROR;
-      vl.values_len = 0;
-      sfree(vl.values);
-      break;
-    }
+/*
+ * public API
+ */
 
-    ret_putval->vl = tmp;
-    ret_putval->vl_num++;
-    memcpy(&ret_putval->vl[ret_putval->vl_num - 1], &vl, sizeof(vl));
+cmd_status_t cmd_parse_putval(size_t argc, char **argv,
+                              cmd_putval_t *ret_putval,
+                              const cmd_options_t *opts,
+                              cmd_error_handler_t *err) {
+  cmd_putval_stream_t s;
+  cdtime_t interval = 0;
+  cmd_status_t result;
 
-    /* pointer is now owned by ret_putval->vl[] */
-    vl.values_len = 0;
-    vl.values = NULL;
-  } /* while (*buffer != 0) */
-  /* Done parsing the options. */
+  if ((ret_putval == NULL) || (opts == NULL)) {
+    errno = EINVAL;
+    cmd_error(CMD_ERROR, err, "Invalid arguments to cmd_parse_putval.");
+    return CMD_ERROR;
+  }
 
-  if (result != CMD_OK)
-    cmd_destroy_putval(ret_putval);
+  if (argc < 2) {
+    cmd_error(CMD_PARSE_ERROR, err, "Missing identifier and/or value-list.");
+    return CMD_PARSE_ERROR;
+  }
+
+  /* The fields are parsed like those of a PUTVAL line of a stream, but the
+   * value lists are handed to the caller instead of being dispatched. */
+  cmd_putval_stream_init(&s);
+
+  result = putval_stream_identifier(&s, argv[0], opts, err);
+  /* All the remaining fields are options or value lists. */
+  for (size_t i = 1; (result == CMD_OK) && (i < argc); i++)
+    result = putval_stream_field(&s, argv[i], &interval, err);
+  if (result == CMD_OK)
+    result = putval_stream_copy(&s, argv[0], ret_putval, err);
+
+  s.batch_num = 0;
+  s.values_num = 0;
+  cmd_putval_stream_destroy(&s);
 
   return result;
 } /* cmd_status_t cmd_parse_putval */
@@ -229,34 +310,143 @@ void cmd_destroy_putval(cmd_putval_t *putval) {
   putval->vl_num = 0;
 } /* void cmd_destroy_putval */
 
-cmd_status_t cmd_handle_putval(FILE *fh, char *buffer) {
-  cmd_error_handler_t err = {cmd_error_fh, fh};
-  cmd_t cmd;
+void cmd_putval_stream_init(cmd_putval_stream_t *s) {
+  memset(s, 0, sizeof(*s));
+} /* void cmd_putval_stream_init */
+
+cmd_status_t cmd_putval_stream_parse(cmd_putval_stream_t *s, char *buffer,
+                                     const cmd_options_t *opts,
+                                     cmd_error_handler_t *err,
+                                     size_t *ret_vl_num) {
+  char *command = NULL;
+  char *identifier = NULL;
+  char *field = NULL;
+  cdtime_t interval = 0;
+  size_t vl_num = 0;
+  cmd_status_t status;
+
+  /* Where this line's value lists start, to remove them on error. */
+  size_t batch_num;
+  size_t values_num;
+
+  if ((s == NULL) || (buffer == NULL)) {
+    errno = EINVAL;
+    cmd_error(CMD_ERROR, err, "Invalid arguments to cmd_putval_stream_parse.");
+    return CMD_ERROR;
+  }
 
-  int status;
+  if ((status = cmd_next_field(&buffer, &command, err)) != CMD_OK)
+    return status;
+  if (command == NULL) {
+    cmd_error(CMD_ERROR, err, "Missing command.");
+    return CMD_ERROR;
+  }
+  if (strcasecmp("PUTVAL", command) != 0) {
+    cmd_error(CMD_UNKNOWN_COMMAND, err, "Unexpected command: `%s'.", command);
+    return CMD_UNKNOWN_COMMAND;
+  }
 
-  DEBUG("utils_cmd_putval: cmd_handle_putval (fh = %p, buffer = %s);",
-        (void *)fh, buffer);
+  if ((status = cmd_next_field(&buffer, &identifier, err)) != CMD_OK)
+    return status;
+  if (identifier != NULL)
+    status = cmd_next_field(&buffer, &field, err);
+  if (status != CMD_OK)
+    return status;
+  if (field == NULL) {
+    cmd_error(CMD_PARSE_ERROR, err, "Missing identifier and/or value-list.");
+    return CMD_PARSE_ERROR;
+  }
 
-  if ((status = cmd_parse(buffer, &cmd, NULL, &err)) != CMD_OK)
+  if ((status = putval_stream_identifier(s, identifier, opts, err)) != CMD_OK)
     return status;
-  if (cmd.type != CMD_PUTVAL) {
-    cmd_error(CMD_UNKNOWN_COMMAND, &err, "Unexpected command: `%s'.",
-              CMD_TO_STRING(cmd.type));
-    cmd_destroy(&cmd);
-    return CMD_UNKNOWN_COMMAND;
+
+  batch_num = s->batch_num;
+  values_num = s->values_num;
+
+  /* All the remaining fields are options or value lists. */
+  while (field != NULL) {
+    size_t before;
+
+    if (s->batch_num >= CMD_PUTVAL_BATCH_SIZE) {
+      cmd_putval_stream_flush(s);
+      /* This line's value lists so far have been dispatched. */
+      batch_num = 0;
+      values_num = 0;
+    }
+
+    before = s->batch_num;
+    if ((status = putval_stream_field(s, field, &interval, err)) != CMD_OK)
+      break;
+    vl_num += s->batch_num - before;
+
+    if ((status = cmd_next_field(&buffer, &field, err)) != CMD_OK)
+      break;
   }
 
-  for (size_t i = 0; i < cmd.cmd.putval.vl_num; ++i)
-    plugin_dispatch_values(&cmd.cmd.putval.vl[i]);
+  if (status != CMD_OK) {
+    s->batch_num = batch_num;
+    s->values_num = values_num;
+    return status;
+  }
+
+  if (ret_vl_num != NULL)
+    *ret_vl_num = vl_num;
+  return CMD_OK;
+} /* cmd_status_t cmd_putval_stream_parse */
+
+int cmd_putval_stream_flush(cmd_putval_stream_t *s) {
+  int failed = 0;
+
+  if ((s == NULL) || (s->batch_num == 0))
+    return 0;
+
+  failed = plugin_dispatch_values_batch(s->batch, s->batch_num);
+  s->batch_num = 0;
+  s->values_num = 0;
+  return failed;
+} /* int cmd_putval_stream_flush */
+
+void cmd_putval_stream_destroy(cmd_putval_stream_t *s) {
+  if (s == NULL)
+    return;
+
+  cmd_putval_stream_flush(s);
+  sfree(s->batch);
+  sfree(s->values);
+  cmd_putval_stream_init(s);
+} /* void cmd_putval_stream_destroy */
+
+cmd_status_t cmd_handle_putval_stream(FILE *fh, cmd_putval_stream_t *s,
+                                      char *buffer) {
+  cmd_error_handler_t err = {cmd_error_fh, fh};
+  size_t vl_num = 0;
+  cmd_status_t status;
+
+  DEBUG("utils_cmd_putval: cmd_handle_putval_stream (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  status = cmd_putval_stream_parse(s, buffer, NULL, &err, &vl_num);
+  if (status != CMD_OK)
+    return status;
+
+  cmd_putval_stream_flush(s);
 
   if (fh != stdout)
-    cmd_error(CMD_OK, &err, "Success: %i %s been dispatched.",
-              (int)cmd.cmd.putval.vl_num,
-              (cmd.cmd.putval.vl_num == 1) ? "value has" : "values have");
+    cmd_error(CMD_OK, &err, "Success: %i %s been dispatched.", (int)vl_num,
+              (vl_num == 1) ? "value has" : "values have");
 
-  cmd_destroy(&cmd);
   return CMD_OK;
+} /* cmd_status_t cmd_handle_putval_stream */
+
+cmd_status_t cmd_handle_putval(FILE *fh, char *buffer) {
+  cmd_putval_stream_t s;
+  cmd_status_t status;
+
+  cmd_putval_stream_init(&s);
+  status = cmd_handle_putval_stream(fh, &s, buffer);
+  cmd_putval_stream_destroy(&s);
+
+  return status;
 } /* int cmd_handle_putval */
 
 int cmd_create_putval(char *ret, size_t ret_len, /* {{{ */
@@ -44,4 +44,74 @@ void cmd_destroy_putval(cmd_putval_t *putval);
 int cmd_create_putval(char *ret, size_t ret_len, const data_set_t *ds,
                       const value_list_t *vl);
 
+/* Maximum number of value lists parsed before they are dispatched. */
+#define CMD_PUTVAL_BATCH_SIZE 256
+
+/*
+ * State kept across the PUTVAL lines of one source, such as an exec'd
+ * program or a unixsock connection. Lines are parsed in place; the identifier
+ * of the previous line is not parsed again if it is repeated, and the value
+ * lists are collected and dispatched in batches. Once the buffers have grown
+ * to their working size, parsing a line does not allocate any memory.
+ */
+typedef struct {
+  /* The identifier of the previous line, its value list template and its
+   * data set. */
+  char identifier[6 * DATA_MAX_NAME_LEN];
+  value_list_t vl;
+  const data_set_t *ds;
+
+  /* Value lists not yet dispatched. Their values are stored consecutively in
+   * `values'. */
+  value_list_t *batch;
+  size_t batch_num;
+  size_t batch_size;
+  value_t *values;
+  size_t values_num;
+  size_t values_size;
+} cmd_putval_stream_t;
+
+void cmd_putval_stream_init(cmd_putval_stream_t *s);
+
+/*
+ * NAME
+ *   cmd_putval_stream_parse
+ *
+ * DESCRIPTION
+ *   Parses the PUTVAL command in `buffer', modifying it, and adds its value
+ *   lists to the batch of `s'. If the batch is full, it is dispatched first.
+ *   `opts' must be the same for all lines of one stream.
+ *
+ * RETURN VALUE
+ *   CMD_OK on success or the respective error code otherwise. On error, the
+ *   value lists of the line are discarded, unless a full batch had to be
+ *   dispatched while parsing it. On success, the number of value lists added
+ *   is stored at `ret_vl_num' unless it is NULL.
+ */
+cmd_status_t cmd_putval_stream_parse(cmd_putval_stream_t *s, char *buffer,
+                                     const cmd_options_t *opts,
+                                     cmd_error_handler_t *err,
+                                     size_t *ret_vl_num);
+
+/*
+ * NAME
+ *   cmd_putval_stream_flush
+ *
+ * DESCRIPTION
+ *   Dispatches all value lists of the batch using
+ *   plugin_dispatch_values_batch().
+ *
+ * RETURN VALUE
+ *   The number of value lists that could not be dispatched.
+ */
+int cmd_putval_stream_flush(cmd_putval_stream_t *s);
+
+/* Dispatches the remaining value lists and frees the buffers. */
+void cmd_putval_stream_destroy(cmd_putval_stream_t *s);
+
+/* Like cmd_handle_putval(), but using the state in `s'. The value lists are
+ * dispatched before the status is written to `fh'. */
+cmd_status_t cmd_handle_putval_stream(FILE *fh, cmd_putval_stream_t *s,
+                                      char *buffer);
+
 #endif /* UTILS_CMD_PUTVAL_H */
@@ -29,6 +29,7 @@
 #include "utils_cmds.h"
 #include "daemon/common.h"
 #include "utils_cmd_flush.h"
+#include "utils_cmd_gethistory.h"
 #include "utils_cmd_getval.h"
 #include "utils_cmd_listval.h"
 #include "utils_cmd_putval.h"
@@ -47,8 +48,7 @@ static cmd_options_t default_options = {
 
 static cmd_status_t cmd_split(char *buffer, size_t *ret_len, char ***ret_fields,
                               cmd_error_handler_t *err) {
-  char *field;
-  bool in_field, in_quotes;
+  bool in_field;
 
   size_t estimate, len;
   char **fields;
@@ -57,8 +57,11 @@ static cmd_status_t cmd_split(char *buffer, size_t *ret_len, char ***ret_fields,
   in_field = false;
   for (char *string = buffer; *string != '\0'; ++string) {
     /* Make a quick worst-case estimate of the number of fields by
-     * counting spaces and ignoring quotation marks. */
-    if (!isspace((int)*string)) {
+     * counting spaces. A quotation mark may end a field without a space. */
+    if (*string == '"') {
+      estimate++;
+      in_field = false;
+    } else if (!isspace((int)*string)) {
       if (!in_field) {
         estimate++;
         in_field = true;
@@ -75,85 +78,24 @@ static cmd_status_t cmd_split(char *buffer, size_t *ret_len, char ***ret_fields,
     return CMD_ERROR;
   }
 
-#define END_FIELD()                                                            \
-  do {                                                                         \
-    *field = '\0';                                                             \
-    field = NULL;                                                              \
-    in_field = false;                                                          \
-  } while (0)
-#define NEW_FIELD()                                                            \
-  do {                                                                         \
-    field = string;                                                            \
-    in_field = true;                                                           \
-    assert(len < estimate);                                                    \
-    fields[len] = field;                                                       \
-    field++;                                                                   \
-    len++;                                                                     \
-  } while (0)
-
   len = 0;
-  field = NULL;
-  in_field = false;
-  in_quotes = false;
-  for (char *string = buffer; *string != '\0'; string++) {
-    if (isspace((int)string[0])) {
-      if (!in_quotes) {
-        if (in_field)
-          END_FIELD();
-
-        /* skip space */
-        continue;
-      }
-    } else if (string[0] == '"') {
-      /* Note: Two consecutive quoted fields not separated by space are
-       * treated as different fields. This is the collectd 5.x behavior
-       * around splitting fields. */
-
-      if (in_quotes) {
-        /* end of quoted field */
-        if (!in_field) /* empty quoted string */
-          NEW_FIELD();
-        END_FIELD();
-        in_quotes = false;
-        continue;
-      }
-
-      in_quotes = true;
-      /* if (! in_field): add new field on next iteration
-       * else: quoted string following an unquoted string (one field)
-       * in either case: skip quotation mark */
-      continue;
-    } else if ((string[0] == '\\') && in_quotes) {
-      /* Outside of quotes, a backslash is a regular character (mostly
-       * for backward compatibility). */
-
-      if (string[1] == '\0') {
-        free(fields);
-        cmd_error(CMD_PARSE_ERROR, err, "Backslash at end of string.");
-        return CMD_PARSE_ERROR;
-      }
-
-      /* un-escape the next character; skip backslash */
-      string++;
-    }
-
-    if (!in_field)
-      NEW_FIELD();
-    else {
-      *field = string[0];
-      field++;
+  while (42) {
+    char *field = NULL;
+    cmd_status_t status;
+
+    status = cmd_next_field(&buffer, &field, err);
+    if (status != CMD_OK) {
+      free(fields);
+      return status;
     }
-  }
+    if (field == NULL)
+      break;
 
-  if (in_quotes) {
-    free(fields);
-    cmd_error(CMD_PARSE_ERROR, err, "Unterminated quoted string.");
-    return CMD_PARSE_ERROR;
+    assert(len < estimate);
+    fields[len] = field;
+    len++;
   }
 
-#undef NEW_FIELD
-#undef END_FIELD
-
   fields[len] = NULL;
   if (ret_len != NULL)
     *ret_len = len;
@@ -204,6 +146,10 @@ cmd_status_t cmd_parsev(size_t argc, char **argv, cmd_t *ret_cmd,
     ret_cmd->type = CMD_GETVAL;
     status =
         cmd_parse_getval(argc - 1, argv + 1, &ret_cmd->cmd.getval, opts, err);
+  } else if (strcasecmp("GETHISTORY", command) == 0) {
+    ret_cmd->type = CMD_GETHISTORY;
+    status = cmd_parse_gethistory(argc - 1, argv + 1,
+                                  &ret_cmd->cmd.gethistory, opts, err);
   } else if (strcasecmp("LISTVAL", command) == 0) {
     ret_cmd->type = CMD_LISTVAL;
     status =
@@ -257,9 +203,99 @@ void cmd_destroy(cmd_t *cmd) {
   case CMD_PUTVAL:
     cmd_destroy_putval(&cmd->cmd.putval);
     break;
+  case CMD_GETHISTORY:
+    cmd_destroy_gethistory(&cmd->cmd.gethistory);
+    break;
   }
 } /* void cmd_destroy */
 
+cmd_status_t cmd_next_field(char **buffer, char **ret_field,
+                            cmd_error_handler_t *err) {
+  char *string;
+  char *field = NULL;
+  bool in_quotes = false;
+
+  if ((buffer == NULL) || (*buffer == NULL) || (ret_field == NULL)) {
+    errno = EINVAL;
+    cmd_error(CMD_ERROR, err, "Invalid argument to cmd_next_field.");
+    return CMD_ERROR;
+  }
+
+  *ret_field = NULL;
+
+  /* Fast path: an unquoted field is returned as-is, without copying. */
+  string = *buffer;
+  while (isspace((int)*string))
+    string++;
+  if ((*string != '\0') && (*string != '"')) {
+    *ret_field = string;
+    while ((*string != '\0') && (*string != '"') && !isspace((int)*string))
+      string++;
+    field = string;
+  }
+
+  for (; *string != '\0'; string++) {
+    if (isspace((int)string[0])) {
+      if (!in_quotes) {
+        if (*ret_field != NULL)
+          break;
+
+        /* skip space */
+        continue;
+      }
+    } else if (string[0] == '"') {
+      /* Note: Two consecutive quoted fields not separated by space are
+       * treated as different fields. This is the collectd 5.x behavior
+       * around splitting fields. */
+
+      if (in_quotes) {
+        /* end of quoted field */
+        if (*ret_field == NULL) /* empty quoted string */
+          *ret_field = field = string;
+        in_quotes = false;
+        break;
+      }
+
+      in_quotes = true;
+      /* if (field == NULL): start the field with the next character
+       * else: quoted string following an unquoted string (one field)
+       * in either case: skip quotation mark */
+      continue;
+    } else if ((string[0] == '\\') && in_quotes) {
+      /* Outside of quotes, a backslash is a regular character (mostly
+       * for backward compatibility). */
+
+      if (string[1] == '\0') {
+        cmd_error(CMD_PARSE_ERROR, err, "Backslash at end of string.");
+        return CMD_PARSE_ERROR;
+      }
+
+      /* un-escape the next character; skip backslash */
+      string++;
+    }
+
+    if (*ret_field == NULL)
+      *ret_field = field = string;
+    *field = string[0];
+    field++;
+  }
+
+  if (in_quotes) {
+    *ret_field = NULL;
+    cmd_error(CMD_PARSE_ERROR, err, "Unterminated quoted string.");
+    return CMD_PARSE_ERROR;
+  }
+
+  /* Skip the character terminating the field before overwriting it. */
+  if (*string != '\0')
+    string++;
+  if (field != NULL)
+    *field = '\0';
+
+  *buffer = string;
+  return CMD_OK;
+} /* cmd_status_t cmd_next_field */
+
 cmd_status_t cmd_parse_option(char *field, char **ret_key, char **ret_value,
                               cmd_error_handler_t *err) {
   char *key, *value;
@@ -37,15 +37,19 @@ typedef enum {
   CMD_GETVAL = 2,
   CMD_LISTVAL = 3,
   CMD_PUTVAL = 4,
+  CMD_GETHISTORY = 5,
 } cmd_type_t;
 #define CMD_TO_STRING(type)                                                    \
-  ((type) == CMD_FLUSH) ? "FLUSH" : ((type) == CMD_GETVAL)                     \
-                                        ? "GETVAL"                             \
-                                        : ((type) == CMD_LISTVAL)              \
-                                              ? "LISTVAL"                      \
-                                              : ((type) == CMD_PUTVAL)         \
-                                                    ? "PUTVAL"                 \
-                                                    : "UNKNOWN"
+  ((type) == CMD_FLUSH)                                                        \
+      ? "FLUSH"                                                                \
+      : ((type) == CMD_GETVAL)                                                 \
+            ? "GETVAL"                                                         \
+            : ((type) == CMD_LISTVAL)                                          \
+                  ? "LISTVAL"                                                  \
+                  : ((type) == CMD_PUTVAL)                                     \
+                        ? "PUTVAL"                                             \
+                        : ((type) == CMD_GETHISTORY) ? "GETHISTORY"            \
+                                                     : "UNKNOWN"
 
 typedef struct {
   double timeout;
@@ -57,13 +61,27 @@ typedef struct {
 } cmd_flush_t;
 
 typedef struct {
-  char *raw_identifier;
-  identifier_t identifier;
+  /* The raw identifiers as provided by the user and their parsed form. With
+   * the "-m" option, a single GETVAL command may query many identifiers and
+   * is answered with one line per identifier. */
+  char **raw_identifiers;
+  identifier_t *identifiers;
+  size_t identifiers_num;
+  _Bool multiple;
 } cmd_getval_t;
 
 typedef struct {
 } cmd_listval_t;
 
+typedef struct {
+  char *raw_identifier;
+  identifier_t identifier;
+
+  /* Only points with start <= time <= end are returned. */
+  cdtime_t start;
+  cdtime_t end;
+} cmd_gethistory_t;
+
 typedef struct {
   /* The raw identifier as provided by the user. */
   char *raw_identifier;
@@ -88,6 +106,7 @@ typedef struct {
     cmd_getval_t getval;
     cmd_listval_t listval;
     cmd_putval_t putval;
+    cmd_gethistory_t gethistory;
   } cmd;
 } cmd_t;
 
@@ -169,6 +188,28 @@ cmd_status_t cmd_parsev(size_t argc, char **argv, cmd_t *ret_cmd,
 
 void cmd_destroy(cmd_t *cmd);
 
+/*
+ * NAME
+ *   cmd_next_field
+ *
+ * DESCRIPTION
+ *   Splits off the next field of a command string in place, using the same
+ *   quoting rules as cmd_parse(), but without allocating any memory.
+ *
+ * PARAMETERS
+ *   `buffer'    Pointer to the remainder of the command string. It is
+ *               advanced past the returned field.
+ *   `ret_field' The field, with any quotes removed and special characters
+ *               unescaped, will be stored at this location. NULL is stored if
+ *               there are no more fields.
+ *   `err'       An optional error handler to invoke on error.
+ *
+ * RETURN VALUE
+ *   CMD_OK on success or the respective error code otherwise.
+ */
+cmd_status_t cmd_next_field(char **buffer, char **ret_field,
+                            cmd_error_handler_t *err);
+
 /*
  * NAME
  *   cmd_parse_option
@@ -0,0 +1,98 @@
+/**
+ * collectd - src/utils_cmds_bench.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "utils_cmd_putval.h"
+#include "utils_cmds.h"
+
+#include <time.h>
+
+static double elapsed_ns(struct timespec const *begin) {
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return 1e9 * (double)(end.tv_sec - begin->tv_sec) +
+         (double)(end.tv_nsec - begin->tv_nsec);
+}
+
+/* Compares cmd_parse() with cmd_putval_stream_parse() on a stream of PUTVAL
+ * lines as written by an exec'd program: a hundred hosts, each reporting ten
+ * value lists, some with multiple lines per identifier. Dispatching isn't
+ * included. */
+int main(void) {
+  size_t const lines_num = 2000;
+  int const rounds = 20;
+  char **lines;
+  char buffer[1024];
+  struct timespec begin;
+  cmd_putval_stream_t s;
+  double ns_parse;
+  double ns_stream;
+
+  lines = calloc(lines_num, sizeof(*lines));
+  if (lines == NULL)
+    return 1;
+  for (size_t i = 0; i < lines_num; i++) {
+    size_t series = (i % 4 == 3) ? (i - 1) : i;
+
+    snprintf(buffer, sizeof(buffer),
+             "PUTVAL \"host%03zu.example.com/exec-%zu/MAGIC\" interval=10 "
+             "%zu.%03zu:%zu",
+             series / 10, series % 10, 1500000000 + i / 100, i % 1000, i * 17);
+    lines[i] = strdup(buffer);
+    if (lines[i] == NULL)
+      return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < lines_num; i++) {
+      cmd_t cmd;
+
+      memcpy(buffer, lines[i], strlen(lines[i]) + 1);
+      if (cmd_parse(buffer, &cmd, NULL, NULL) == CMD_OK)
+        cmd_destroy(&cmd);
+    }
+  }
+  ns_parse = elapsed_ns(&begin) / (double)(rounds * lines_num);
+
+  cmd_putval_stream_init(&s);
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < lines_num; i++) {
+      memcpy(buffer, lines[i], strlen(lines[i]) + 1);
+      cmd_putval_stream_parse(&s, buffer, NULL, NULL, NULL);
+    }
+  }
+  ns_stream = elapsed_ns(&begin) / (double)(rounds * lines_num);
+  cmd_putval_stream_destroy(&s);
+
+  printf("cmd_parse: %.1f ns/line, cmd_putval_stream_parse: %.1f ns/line\n",
+         ns_parse, ns_stream);
+
+  for (size_t i = 0; i < lines_num; i++)
+    free(lines[i]);
+  free(lines);
+  return 0;
+}
@@ -26,6 +26,7 @@
 
 #include "common.h"
 #include "testing.h"
+#include "utils_cmd_putval.h"
 #include "utils_cmds.h"
 
 static void error_cb(void *ud, cmd_status_t status, const char *format,
@@ -91,6 +92,14 @@ static struct {
     {
         "GETVAL magic/MAGIC", &default_host_opts, CMD_OK, CMD_GETVAL,
     },
+    {
+        "GETVAL -m myhost/magic/MAGIC myhost/magic/MAGIC-2 "
+        "\"my host/magic/MAGIC\"",
+        NULL, CMD_OK, CMD_GETVAL,
+    },
+    {
+        "GETVAL -m myhost/magic/MAGIC", NULL, CMD_OK, CMD_GETVAL,
+    },
 
     /* Invalid GETVAL commands. */
     {
@@ -102,6 +111,50 @@ static struct {
     {
         "GETVAL invalid", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
     },
+    {
+        "GETVAL myhost/magic/MAGIC invalid", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
+    },
+    {
+        /* More than one identifier requires "-m". */
+        "GETVAL myhost/magic/MAGIC myhost/magic/MAGIC-2", NULL, CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+    {
+        "GETVAL -m", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
+    },
+
+    /* Valid GETHISTORY commands. */
+    {
+        "GETHISTORY myhost/magic/MAGIC", NULL, CMD_OK, CMD_GETHISTORY,
+    },
+    {
+        "GETHISTORY magic/MAGIC start=1234.5", &default_host_opts, CMD_OK,
+        CMD_GETHISTORY,
+    },
+    {
+        "GETHISTORY myhost/magic/MAGIC start=-300 end=-60", NULL, CMD_OK,
+        CMD_GETHISTORY,
+    },
+
+    /* Invalid GETHISTORY commands. */
+    {
+        "GETHISTORY", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
+    },
+    {
+        "GETHISTORY magic/MAGIC", NULL, CMD_PARSE_ERROR, CMD_UNKNOWN,
+    },
+    {
+        "GETHISTORY myhost/magic/MAGIC start=A", NULL, CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+    {
+        "GETHISTORY myhost/magic/MAGIC 1234", NULL, CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+    {
+        "GETHISTORY myhost/magic/MAGIC invalid=option", NULL, CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
 
     /* Valid LISTVAL commands. */
     {
@@ -218,7 +271,114 @@ DEF_TEST(parse) {
   return test_result;
 }
 
+DEF_TEST(parse_putval) {
+  cmd_error_handler_t err = {error_cb, NULL};
+  char buffer[] = "PUTVAL myhost/magic/MAGIC 1234:1 interval=5 1235:2";
+  cmd_t cmd;
+
+  EXPECT_EQ_INT(CMD_OK, cmd_parse(buffer, &cmd, NULL, &err));
+  EXPECT_EQ_INT(CMD_PUTVAL, cmd.type);
+  EXPECT_EQ_STR("myhost/magic/MAGIC", cmd.cmd.putval.raw_identifier);
+  EXPECT_EQ_INT(2, (int)cmd.cmd.putval.vl_num);
+  EXPECT_EQ_STR("myhost", cmd.cmd.putval.vl[1].host);
+  EXPECT_EQ_STR("MAGIC", cmd.cmd.putval.vl[1].type);
+  EXPECT_EQ_UINT64(0, cmd.cmd.putval.vl[0].interval);
+  EXPECT_EQ_UINT64(TIME_T_TO_CDTIME_T(5), cmd.cmd.putval.vl[1].interval);
+  EXPECT_EQ_UINT64(TIME_T_TO_CDTIME_T(1235), cmd.cmd.putval.vl[1].time);
+  EXPECT_EQ_INT(1, (int)cmd.cmd.putval.vl[0].values[0].derive);
+  EXPECT_EQ_INT(2, (int)cmd.cmd.putval.vl[1].values[0].derive);
+  /* Each value list owns its values. */
+  OK(cmd.cmd.putval.vl[0].values + 1 != cmd.cmd.putval.vl[1].values);
+
+  cmd_destroy(&cmd);
+  return 0;
+}
+
+static cmd_status_t stream_parse(cmd_putval_stream_t *s, char const *line,
+                                 size_t *ret_vl_num) {
+  cmd_error_handler_t err = {error_cb, NULL};
+  char buffer[1024];
+
+  sstrncpy(buffer, line, sizeof(buffer));
+  return cmd_putval_stream_parse(s, buffer, NULL, &err, ret_vl_num);
+}
+
+DEF_TEST(putval_stream) {
+  cmd_putval_stream_t s;
+  size_t vl_num = 0;
+
+  cmd_putval_stream_init(&s);
+
+  EXPECT_EQ_INT(CMD_OK,
+                stream_parse(&s, "PUTVAL myhost/magic/MAGIC N:1 interval=5 "
+                                 "1234:2",
+                             &vl_num));
+  EXPECT_EQ_INT(2, (int)vl_num);
+  EXPECT_EQ_INT(2, (int)s.batch_num);
+  EXPECT_EQ_STR("myhost", s.batch[0].host);
+  EXPECT_EQ_STR("magic", s.batch[0].plugin);
+  EXPECT_EQ_STR("MAGIC", s.batch[0].type);
+  EXPECT_EQ_UINT64(0, s.batch[0].interval);
+  EXPECT_EQ_UINT64(TIME_T_TO_CDTIME_T(5), s.batch[1].interval);
+  EXPECT_EQ_UINT64(TIME_T_TO_CDTIME_T(1234), s.batch[1].time);
+  EXPECT_EQ_INT(2, (int)s.batch[1].values[0].derive);
+
+  /* The identifier is taken from the cache. */
+  EXPECT_EQ_INT(CMD_OK, stream_parse(&s, "PUTVAL myhost/magic/MAGIC 1235:3",
+                                     &vl_num));
+  EXPECT_EQ_INT(1, (int)vl_num);
+  EXPECT_EQ_STR("myhost", s.batch[2].host);
+  EXPECT_EQ_INT(3, (int)s.batch[2].values[0].derive);
+
+  EXPECT_EQ_INT(CMD_OK,
+                stream_parse(&s, "putval \"my host/magic-\\\"x\\\"/MAGIC\" "
+                                 "1236:4",
+                             NULL));
+  EXPECT_EQ_STR("my host", s.batch[3].host);
+  EXPECT_EQ_STR("\"x\"", s.batch[3].plugin_instance);
+
+  /* Lines with errors don't add any value lists. */
+  EXPECT_EQ_INT(CMD_PARSE_ERROR,
+                stream_parse(&s, "PUTVAL myhost/magic/MAGIC 1237:5 invalid",
+                             NULL));
+  EXPECT_EQ_INT(CMD_PARSE_ERROR,
+                stream_parse(&s, "PUTVAL myhost/magic/MAGIC", NULL));
+  EXPECT_EQ_INT(CMD_PARSE_ERROR,
+                stream_parse(&s, "PUTVAL myhost/magic/UNKNOWN 1237:5", NULL));
+  EXPECT_EQ_INT(CMD_PARSE_ERROR,
+                stream_parse(&s, "PUTVAL \"myhost/magic/MAGIC 1237:5", NULL));
+  EXPECT_EQ_INT(CMD_UNKNOWN_COMMAND,
+                stream_parse(&s, "GETVAL myhost/magic/MAGIC", NULL));
+  EXPECT_EQ_INT(4, (int)s.batch_num);
+  EXPECT_EQ_INT(4, (int)s.values_num);
+
+  /* plugin_mock fails to dispatch all value lists. */
+  EXPECT_EQ_INT(4, cmd_putval_stream_flush(&s));
+  EXPECT_EQ_INT(0, (int)s.batch_num);
+
+  /* Growing the buffers keeps the values; full batches are dispatched. */
+  for (int i = 0; i < CMD_PUTVAL_BATCH_SIZE + 10; i++) {
+    char line[256];
+
+    snprintf(line, sizeof(line), "PUTVAL myhost/magic-%d/MAGIC %d:%d", i,
+             1000 + i, i);
+    EXPECT_EQ_INT(CMD_OK, stream_parse(&s, line, NULL));
+  }
+  EXPECT_EQ_INT(10, (int)s.batch_num);
+  for (size_t i = 0; i < s.batch_num; i++) {
+    EXPECT_EQ_INT(CMD_PUTVAL_BATCH_SIZE + (int)i,
+                  (int)s.batch[i].values[0].derive);
+    OK(s.batch[i].values == s.values + i);
+  }
+
+  cmd_putval_stream_destroy(&s);
+  OK(s.batch == NULL);
+  return 0;
+}
+
 int main(int argc, char **argv) {
   RUN_TEST(parse);
+  RUN_TEST(parse_putval);
+  RUN_TEST(putval_stream);
   END_TEST;
 }
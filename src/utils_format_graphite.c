@@ -28,50 +28,123 @@
 
 #include "utils_cache.h"
 #include "utils_format_graphite.h"
+#include "utils_format_number.h"
 
 #define GRAPHITE_FORBIDDEN " \t\"\\:!/()\n\r"
 
+/* Flags that change the metric name. */
+#define GRAPHITE_NAME_FLAGS                                                    \
+  (GRAPHITE_SEPARATE_INSTANCES | GRAPHITE_DROP_DUPE_FIELDS |                   \
+   GRAPHITE_PRESERVE_SEPARATOR)
+
+/* Default maximum number of identifiers in the metric name cache, see
+ * format_graphite_set_cache_size(). The cache is split into shards by the
+ * hash of the identifier, so that concurrent writers rarely use the same
+ * lock. When a shard is full, the entries of the bucket the new entry goes to
+ * are evicted, so identifiers that are no longer used don't accumulate. */
+#ifndef GRAPHITE_NAME_CACHE_SIZE
+#define GRAPHITE_NAME_CACHE_SIZE 65536
+#endif
+#define GRAPHITE_NAME_SHARDS_NUM 16
+
+/* Number of lookups after which a shard checks its miss rate. If more than
+ * half of them missed while the shard was full, the working set doesn't fit
+ * and inserting only evicts names that are still needed, so the shard is
+ * bypassed and names are rendered without looking them up. Every
+ * GRAPHITE_NAME_BYPASS_SAMPLE-th name is still looked up and inserted, so
+ * that the cache is used again once the working set shrinks. */
+#define GRAPHITE_NAME_WINDOW 4096
+#define GRAPHITE_NAME_BYPASS_SAMPLE 16
+
+/* Everything a metric name depends on. `id' holds host, plugin, plugin
+ * instance, type, type instance, prefix and postfix, each terminated by a
+ * null byte; `hash' is its FNV-1a hash. GRAPHITE_ALWAYS_APPEND_DS is set in
+ * `flags' if a data source name is going to be appended to the name. */
+typedef struct {
+  uint32_t hash;
+  unsigned int flags;
+  char escape_char;
+  size_t id_len;
+  char const *id;
+} gr_name_key_t;
+
+/* Escaped metric name of an identifier, stored in a single allocation after
+ * the copy of the key's `id' and null terminated. If a data source name is
+ * going to be appended, the name ends in the dot in front of it. */
+typedef struct gr_name_s {
+  struct gr_name_s *next;
+  uint32_t hash;
+  unsigned int flags;
+  char escape_char;
+  size_t id_len;
+  size_t name_len;
+  char data[];
+} gr_name_t;
+
+/* A chained hash table. Lookups touch about two cache lines, which matters
+ * because every value list is looked up. */
+typedef struct {
+  gr_name_t **buckets;
+  size_t buckets_num; /* power of two */
+  size_t size;
+  pthread_rwlock_t lock;
+
+  /* Miss rate of the current window, protected by `stats_lock'. */
+  pthread_mutex_t stats_lock;
+  size_t calls;
+  size_t lookups;
+  size_t misses;
+  _Bool full;
+  _Bool bypass;
+} gr_name_shard_t;
+
+static gr_name_shard_t name_shards[GRAPHITE_NAME_SHARDS_NUM];
+static pthread_once_t name_shards_once = PTHREAD_ONCE_INIT;
+static size_t name_cache_size = GRAPHITE_NAME_CACHE_SIZE;
+
+static void gr_name_shards_init(void) /* {{{ */
+{
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(name_shards); i++) {
+    pthread_rwlock_init(&name_shards[i].lock, /* attr = */ NULL);
+    pthread_mutex_init(&name_shards[i].stats_lock, /* attr = */ NULL);
+  }
+} /* }}} void gr_name_shards_init */
+
+void format_graphite_set_cache_size(size_t size) /* {{{ */
+{
+  name_cache_size = size;
+} /* }}} void format_graphite_set_cache_size */
+
 /* Utils functions to format data sets in graphite format.
  * Largely taken from write_graphite.c as it remains the same formatting */
 
 static int gr_format_values(char *ret, size_t ret_len, int ds_num,
                             const data_set_t *ds, const value_list_t *vl,
                             gauge_t const *rates) {
-  size_t offset = 0;
-  int status;
+  char tmp[FORMAT_NUMBER_BUFSIZE];
+  size_t len;
 
   assert(0 == strcmp(ds->type, vl->type));
 
-  memset(ret, 0, ret_len);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(ret + offset, ret_len - offset, __VA_ARGS__);            \
-    if (status < 1) {                                                          \
-      return -1;                                                               \
-    } else if (((size_t)status) >= (ret_len - offset)) {                       \
-      return -1;                                                               \
-    } else                                                                     \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
   if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-    BUFFER_ADD(GAUGE_FORMAT, vl->values[ds_num].gauge);
+    len = format_double(tmp, vl->values[ds_num].gauge);
   else if (rates != NULL)
-    BUFFER_ADD("%f", rates[ds_num]);
+    len = format_double(tmp, rates[ds_num]);
   else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-    BUFFER_ADD("%llu", vl->values[ds_num].counter);
+    len = format_uint64(tmp, (uint64_t)vl->values[ds_num].counter);
   else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-    BUFFER_ADD("%" PRIi64, vl->values[ds_num].derive);
+    len = format_int64(tmp, vl->values[ds_num].derive);
   else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-    BUFFER_ADD("%" PRIu64, vl->values[ds_num].absolute);
+    len = format_uint64(tmp, vl->values[ds_num].absolute);
   else {
     ERROR("gr_format_values plugin: Unknown data source type: %i",
           ds->ds[ds_num].type);
     return -1;
   }
 
-#undef BUFFER_ADD
+  if (len >= ret_len)
+    return -1;
+  memcpy(ret, tmp, len + 1);
 
   return 0;
 }
@@ -172,6 +245,262 @@ static void escape_graphite_string(char *buffer, char escape_char) {
     *head = escape_char;
 }
 
+/* Packs the identifier and the settings into `buffer'. Returns non-zero if
+ * they don't fit. */
+static int gr_name_key_init(gr_name_key_t *key, char *buffer, /* {{{ */
+                            size_t buffer_size, value_list_t const *vl,
+                            _Bool with_ds, char const *prefix,
+                            char const *postfix, char escape_char,
+                            unsigned int flags) {
+  char const *fields[] = {vl->host,          vl->plugin, vl->plugin_instance,
+                          vl->type,          vl->type_instance,
+                          prefix ? prefix : "", postfix ? postfix : ""};
+  uint32_t hash = 2166136261u;
+  size_t len = 0;
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fields); i++) {
+    char const *ptr = fields[i];
+    do {
+      if (len >= buffer_size)
+        return -1;
+      buffer[len++] = *ptr;
+      hash = (hash ^ (uint32_t)(unsigned char)*ptr) * 16777619u;
+    } while (*ptr++ != 0);
+  }
+
+  *key = (gr_name_key_t){
+      .hash = hash,
+      .flags = (flags & GRAPHITE_NAME_FLAGS) |
+               (with_ds ? GRAPHITE_ALWAYS_APPEND_DS : 0),
+      .escape_char = escape_char,
+      .id_len = len,
+      .id = buffer,
+  };
+  return 0;
+} /* }}} int gr_name_key_init */
+
+static _Bool gr_name_match(gr_name_t const *n, /* {{{ */
+                           gr_name_key_t const *key) {
+  return (n->hash == key->hash) && (n->flags == key->flags) &&
+         (n->escape_char == key->escape_char) && (n->id_len == key->id_len) &&
+         (memcmp(n->data, key->id, key->id_len) == 0);
+} /* }}} _Bool gr_name_match */
+
+/* Renders the name of an identifier. */
+static gr_name_t *gr_name_create(gr_name_key_t const *key, /* {{{ */
+                                 value_list_t const *vl, char const *prefix,
+                                 char const *postfix, char escape_char) {
+  char name[10 * DATA_MAX_NAME_LEN];
+  _Bool with_ds = (key->flags & GRAPHITE_ALWAYS_APPEND_DS) ? 1 : 0;
+  size_t name_len;
+  gr_name_t *n;
+
+  /* The data source name is appended by format_graphite(). */
+  gr_format_name(name, sizeof(name), vl, with_ds ? "" : NULL, prefix, postfix,
+                 escape_char, key->flags);
+  escape_graphite_string(name, escape_char);
+  name_len = strlen(name);
+
+  n = malloc(sizeof(*n) + key->id_len + name_len + 1);
+  if (n == NULL)
+    return NULL;
+
+  n->next = NULL;
+  n->hash = key->hash;
+  n->flags = key->flags;
+  n->escape_char = key->escape_char;
+  n->id_len = key->id_len;
+  n->name_len = name_len;
+  memcpy(n->data, key->id, key->id_len);
+  memcpy(n->data + key->id_len, name, name_len + 1);
+
+  return n;
+} /* }}} gr_name_t *gr_name_create */
+
+/* Copies the name of `n' to `ret'. Returns the length of the name, or zero if
+ * it doesn't fit. */
+static size_t gr_name_copy(char *ret, size_t ret_size, /* {{{ */
+                           gr_name_t const *n) {
+  if (n->name_len >= ret_size)
+    return 0;
+  memcpy(ret, n->data + n->id_len, n->name_len + 1);
+  return n->name_len;
+} /* }}} size_t gr_name_copy */
+
+/* Removes the entries of the first non-empty bucket starting at `hash'. Must
+ * hold the shard's write lock. */
+static void gr_name_shard_evict(gr_name_shard_t *shard, /* {{{ */
+                                uint32_t hash) {
+  for (size_t i = 0; i < shard->buckets_num; i++) {
+    gr_name_t **bucket =
+        shard->buckets + ((hash + i) & (shard->buckets_num - 1));
+
+    if (*bucket == NULL)
+      continue;
+
+    while (*bucket != NULL) {
+      gr_name_t *n = *bucket;
+      *bucket = n->next;
+      sfree(n);
+      shard->size--;
+    }
+    return;
+  }
+} /* }}} void gr_name_shard_evict */
+
+/* Adds `n' to a shard holding at most `capacity' entries, growing the table
+ * if it is fuller than one entry per bucket. Must hold the shard's write
+ * lock. */
+static int gr_name_shard_insert(gr_name_shard_t *shard, /* {{{ */
+                                gr_name_t *n, size_t capacity) {
+  if (shard->size >= capacity)
+    gr_name_shard_evict(shard, n->hash);
+
+  if (shard->size >= shard->buckets_num) {
+    size_t buckets_num =
+        (shard->buckets_num == 0) ? 64 : 2 * shard->buckets_num;
+    gr_name_t **buckets = calloc(buckets_num, sizeof(*buckets));
+    if (buckets == NULL)
+      return ENOMEM;
+
+    for (size_t i = 0; i < shard->buckets_num; i++) {
+      while (shard->buckets[i] != NULL) {
+        gr_name_t *tmp = shard->buckets[i];
+        shard->buckets[i] = tmp->next;
+        tmp->next = buckets[tmp->hash & (buckets_num - 1)];
+        buckets[tmp->hash & (buckets_num - 1)] = tmp;
+      }
+    }
+    sfree(shard->buckets);
+    shard->buckets = buckets;
+    shard->buckets_num = buckets_num;
+  }
+
+  n->next = shard->buckets[n->hash & (shard->buckets_num - 1)];
+  shard->buckets[n->hash & (shard->buckets_num - 1)] = n;
+  shard->size++;
+  return 0;
+} /* }}} int gr_name_shard_insert */
+
+/* Returns true if the name is to be looked up in the shard, counting the
+ * lookup in the current window. */
+static _Bool gr_name_shard_probe(gr_name_shard_t *shard) /* {{{ */
+{
+  _Bool probe;
+
+  pthread_mutex_lock(&shard->stats_lock);
+  if (shard->lookups >= GRAPHITE_NAME_WINDOW) {
+    shard->bypass = shard->full && (2 * shard->misses > shard->lookups);
+    shard->lookups = 0;
+    shard->misses = 0;
+  }
+  shard->calls++;
+  probe = !shard->bypass ||
+          ((shard->calls % GRAPHITE_NAME_BYPASS_SAMPLE) == 0);
+  if (probe)
+    shard->lookups++;
+  pthread_mutex_unlock(&shard->stats_lock);
+
+  return probe;
+} /* }}} _Bool gr_name_shard_probe */
+
+/* Counts a miss. `full' is whether the shard was full at the time. */
+static void gr_name_shard_miss(gr_name_shard_t *shard, /* {{{ */
+                               _Bool full) {
+  pthread_mutex_lock(&shard->stats_lock);
+  shard->misses++;
+  shard->full = full;
+  pthread_mutex_unlock(&shard->stats_lock);
+} /* }}} void gr_name_shard_miss */
+
+/* Renders the metric name of `vl' into `ret' without using the cache.
+ * Returns the length of the name, or zero if it doesn't fit. */
+static size_t gr_name_render(char *ret, size_t ret_size, /* {{{ */
+                             value_list_t const *vl, _Bool with_ds,
+                             char const *prefix, char const *postfix,
+                             char escape_char, unsigned int flags) {
+  size_t len;
+
+  gr_format_name(ret, (int)ret_size, vl, with_ds ? "" : NULL, prefix, postfix,
+                 escape_char, flags);
+  escape_graphite_string(ret, escape_char);
+  len = strlen(ret);
+  return (len + 1 < ret_size) ? len : 0;
+} /* }}} size_t gr_name_render */
+
+/* Copies the cached metric name of `vl' to `ret', rendering and caching it
+ * first if necessary. If `with_ds' is true, the name up to and including the
+ * dot in front of the data source name is copied. Returns the length of the
+ * name, or zero if it doesn't fit into `ret'. */
+static size_t gr_name_get(char *ret, size_t ret_size, /* {{{ */
+                          value_list_t const *vl, _Bool with_ds,
+                          char const *prefix, char const *postfix,
+                          char escape_char, unsigned int flags) {
+  char id[8 * DATA_MAX_NAME_LEN];
+  gr_name_key_t key;
+  gr_name_shard_t *shard;
+  gr_name_t *n;
+  size_t capacity;
+  size_t len;
+  _Bool full;
+
+  /* Very long prefixes are not cached. */
+  if ((name_cache_size == 0) ||
+      (gr_name_key_init(&key, id, sizeof(id), vl, with_ds, prefix, postfix,
+                        escape_char, flags) != 0))
+    return gr_name_render(ret, ret_size, vl, with_ds, prefix, postfix,
+                          escape_char, flags);
+
+  pthread_once(&name_shards_once, gr_name_shards_init);
+  /* The low bits select the bucket. */
+  shard = name_shards + ((key.hash >> 24) % GRAPHITE_NAME_SHARDS_NUM);
+  capacity = name_cache_size / GRAPHITE_NAME_SHARDS_NUM;
+  if (capacity == 0)
+    capacity = 1;
+
+  if (!gr_name_shard_probe(shard))
+    return gr_name_render(ret, ret_size, vl, with_ds, prefix, postfix,
+                          escape_char, flags);
+
+  pthread_rwlock_rdlock(&shard->lock);
+  full = (shard->size >= capacity);
+  if (shard->buckets_num > 0) {
+    for (n = shard->buckets[key.hash & (shard->buckets_num - 1)]; n != NULL;
+         n = n->next) {
+      if (gr_name_match(n, &key)) {
+        len = gr_name_copy(ret, ret_size, n);
+        pthread_rwlock_unlock(&shard->lock);
+        return len;
+      }
+    }
+  }
+  pthread_rwlock_unlock(&shard->lock);
+  gr_name_shard_miss(shard, full);
+
+  n = gr_name_create(&key, vl, prefix, postfix, escape_char);
+  if (n == NULL)
+    return 0;
+  len = gr_name_copy(ret, ret_size, n);
+
+  pthread_rwlock_wrlock(&shard->lock);
+  if (shard->buckets_num > 0) {
+    for (gr_name_t *tmp = shard->buckets[key.hash & (shard->buckets_num - 1)];
+         tmp != NULL; tmp = tmp->next) {
+      if (gr_name_match(tmp, &key)) {
+        /* Another thread was faster. */
+        pthread_rwlock_unlock(&shard->lock);
+        sfree(n);
+        return len;
+      }
+    }
+  }
+  if (gr_name_shard_insert(shard, n, capacity) != 0)
+    sfree(n);
+  pthread_rwlock_unlock(&shard->lock);
+
+  return len;
+} /* }}} size_t gr_name_get */
+
 int format_graphite(char *buffer, size_t buffer_size, data_set_t const *ds,
                     value_list_t const *vl, char const *prefix,
                     char const *postfix, char const escape_char,
@@ -188,26 +517,42 @@ int format_graphite(char *buffer, size_t buffer_size, data_set_t const *ds,
     }
   }
 
+  /* The data source name is appended to the cached name if there is more
+   * than one data source. */
+  _Bool with_ds = (flags & GRAPHITE_ALWAYS_APPEND_DS) || (ds->ds_num > 1);
+  char key[10 * DATA_MAX_NAME_LEN];
+  size_t name_len = gr_name_get(key, sizeof(key), vl, with_ds, prefix,
+                                postfix, escape_char, flags);
+  if (name_len == 0) {
+    ERROR("format_graphite: error with gr_format_name");
+    sfree(rates);
+    return -1;
+  }
+
+  char timestamp[FORMAT_NUMBER_BUFSIZE];
+  size_t timestamp_len =
+      format_uint64(timestamp, (uint64_t)CDTIME_T_TO_TIME_T(vl->time));
+
   for (size_t i = 0; i < ds->ds_num; i++) {
-    char const *ds_name = NULL;
-    char key[10 * DATA_MAX_NAME_LEN];
-    char values[512];
+    char values[FORMAT_NUMBER_BUFSIZE];
+    size_t key_len = name_len;
+    size_t values_len;
     size_t message_len;
-    char message[1024];
-
-    if ((flags & GRAPHITE_ALWAYS_APPEND_DS) || (ds->ds_num > 1))
-      ds_name = ds->ds[i].name;
 
-    /* Copy the identifier to `key' and escape it. */
-    status = gr_format_name(key, sizeof(key), vl, ds_name, prefix, postfix,
-                            escape_char, flags);
-    if (status != 0) {
-      ERROR("format_graphite: error with gr_format_name");
-      sfree(rates);
-      return status;
+    if (with_ds) {
+      char const *ds_name = ds->ds[i].name;
+      size_t ds_name_len = strlen(ds_name);
+
+      if (key_len + ds_name_len >= sizeof(key)) {
+        ERROR("format_graphite: error with gr_format_name");
+        sfree(rates);
+        return -1;
+      }
+      memcpy(key + key_len, ds_name, ds_name_len + 1);
+      escape_graphite_string(key + key_len, escape_char);
+      key_len += ds_name_len;
     }
 
-    escape_graphite_string(key, escape_char);
     /* Convert the values to an ASCII representation and put that into
      * `values'. */
     status = gr_format_values(values, sizeof(values), i, ds, vl, rates);
@@ -217,17 +562,9 @@ int format_graphite(char *buffer, size_t buffer_size, data_set_t const *ds,
       return status;
     }
 
-    /* Compute the graphite command */
-    message_len =
-        (size_t)snprintf(message, sizeof(message), "%s %s %u\r\n", key, values,
-                         (unsigned int)CDTIME_T_TO_TIME_T(vl->time));
-    if (message_len >= sizeof(message)) {
-      ERROR("format_graphite: message buffer too small: "
-            "Need %zu bytes.",
-            message_len + 1);
-      sfree(rates);
-      return -ENOMEM;
-    }
+    /* Compute the graphite command: "<key> <value> <timestamp>\r\n" */
+    values_len = strlen(values);
+    message_len = key_len + 1 + values_len + 1 + timestamp_len + 2;
 
     /* Append it in case we got multiple data set */
     if ((buffer_pos + message_len) >= buffer_size) {
@@ -235,7 +572,16 @@ int format_graphite(char *buffer, size_t buffer_size, data_set_t const *ds,
       sfree(rates);
       return -ENOMEM;
     }
-    memcpy((void *)(buffer + buffer_pos), message, message_len);
+    char *ptr = buffer + buffer_pos;
+    memcpy(ptr, key, key_len);
+    ptr += key_len;
+    *ptr++ = ' ';
+    memcpy(ptr, values, values_len);
+    ptr += values_len;
+    *ptr++ = ' ';
+    memcpy(ptr, timestamp, timestamp_len);
+    ptr += timestamp_len;
+    memcpy(ptr, "\r\n", 2);
     buffer_pos += message_len;
     buffer[buffer_pos] = '\0';
   }
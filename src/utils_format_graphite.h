@@ -37,4 +37,8 @@ int format_graphite(char *buffer, size_t buffer_size, const data_set_t *ds,
                     const char *postfix, const char escape_char,
                     unsigned int flags);
 
+/* Sets the maximum number of identifiers whose metric names are cached. Zero
+ * disables the cache. Must be called before the first value is formatted. */
+void format_graphite_set_cache_size(size_t size);
+
 #endif /* UTILS_FORMAT_GRAPHITE_H */
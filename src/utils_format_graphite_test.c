@@ -36,16 +36,14 @@ static data_set_t ds_single = {
     .ds = &(data_source_t){"value", DS_TYPE_GAUGE, NAN, NAN},
 };
 
-/*
 static data_set_t ds_double = {
     .type = "double",
     .ds_num = 2,
     .ds =
         (data_source_t[]){
-            {"one", DS_TYPE_DERIVE, 0, NAN}, {"two", DS_TYPE_DERIVE, 0, NAN},
+            {"one", DS_TYPE_DERIVE, 0, NAN}, {"two:2", DS_TYPE_DERIVE, 0, NAN},
         },
 };
-*/
 
 DEF_TEST(metric_name) {
   struct {
@@ -183,9 +181,124 @@ DEF_TEST(null_termination) {
   return 0;
 }
 
+/* Metric names are cached per identifier and settings, so formatting the
+ * same value list repeatedly and with different settings must not mix them
+ * up. */
+DEF_TEST(name_cache) {
+  value_list_t vl = {
+      .values = (value_t[]){{.derive = 1}, {.derive = 2}},
+      .values_len = 2,
+      .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+      .interval = TIME_T_TO_CDTIME_T_STATIC(10),
+      .host = "example.com",
+      .plugin = "double",
+      .plugin_instance = "foo",
+      .type = "double",
+  };
+  struct {
+    char const *prefix;
+    unsigned int flags;
+    char const *want;
+  } cases[] = {
+      {NULL, 0, "example_com.double-foo.double.one 1 1480063672\r\n"
+                "example_com.double-foo.double.two_2 2 1480063672\r\n"},
+      {"pre.", 0, "pre.example_com.double-foo.double.one 1 1480063672\r\n"
+                  "pre.example_com.double-foo.double.two_2 2 1480063672\r\n"},
+      {NULL, GRAPHITE_SEPARATE_INSTANCES,
+       "example_com.double.foo.double.one 1 1480063672\r\n"
+       "example_com.double.foo.double.two_2 2 1480063672\r\n"},
+      {NULL, GRAPHITE_DROP_DUPE_FIELDS,
+       "example_com.double-foo.double.one 1 1480063672\r\n"
+       "example_com.double-foo.double.two_2 2 1480063672\r\n"},
+  };
+
+  for (int round = 0; round < 2; round++) {
+    for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+      char got[1024];
+
+      printf("# round %d, case %zu\n", round, i);
+      EXPECT_EQ_INT(0, format_graphite(got, sizeof(got), &ds_double, &vl,
+                                       cases[i].prefix, NULL, '_',
+                                       cases[i].flags));
+      EXPECT_EQ_STR(cases[i].want, got);
+    }
+  }
+
+  /* Identical plugin and type instance: the type is dropped. */
+  sstrncpy(vl.plugin_instance, "", sizeof(vl.plugin_instance));
+  for (int round = 0; round < 2; round++) {
+    char got[1024];
+
+    EXPECT_EQ_INT(0, format_graphite(got, sizeof(got), &ds_double, &vl, NULL,
+                                     NULL, '_', GRAPHITE_DROP_DUPE_FIELDS));
+    EXPECT_EQ_STR("example_com.double.one 1 1480063672\r\n"
+                  "example_com.double.two_2 2 1480063672\r\n",
+                  got);
+  }
+
+  /* Names with very long prefixes are not cached. */
+  char prefix[900];
+  memset(prefix, 'p', sizeof(prefix) - 1);
+  prefix[sizeof(prefix) - 1] = 0;
+  for (int round = 0; round < 2; round++) {
+    char want[4096];
+    char got[4096];
+
+    snprintf(want, sizeof(want), "%sexample_com.double.one 1 1480063672\r\n"
+                                 "%sexample_com.double.two_2 2 1480063672\r\n",
+             prefix, prefix);
+    EXPECT_EQ_INT(0, format_graphite(got, sizeof(got), &ds_double, &vl, prefix,
+                                     NULL, '_', GRAPHITE_DROP_DUPE_FIELDS));
+    EXPECT_EQ_STR(want, got);
+  }
+
+  return 0;
+}
+
+/* More identifiers than fit into the cache, so that it is bypassed, and no
+ * cache at all. */
+DEF_TEST(name_cache_size) {
+  value_list_t vl = {
+      .values = &(value_t){.gauge = 42},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T_STATIC(1480063672),
+      .interval = TIME_T_TO_CDTIME_T_STATIC(10),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "single",
+  };
+  size_t sizes[] = {32, 0};
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(sizes); i++) {
+    format_graphite_set_cache_size(sizes[i]);
+
+    for (int round = 0; round < 2; round++) {
+      for (int n = 0; n < 100000; n++) {
+        char want[256];
+        char got[256];
+
+        snprintf(vl.type_instance, sizeof(vl.type_instance), "%d", n);
+        snprintf(want, sizeof(want),
+                 "example_com.test.single-%d 42 1480063672\r\n", n);
+        if (format_graphite(got, sizeof(got), &ds_single, &vl, NULL, NULL,
+                            '_', 0) != 0 ||
+            strcmp(want, got) != 0) {
+          EXPECT_EQ_STR(want, got);
+        }
+      }
+    }
+  }
+  OK(1);
+
+  format_graphite_set_cache_size(65536);
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(metric_name);
   RUN_TEST(null_termination);
+  RUN_TEST(name_cache);
+  RUN_TEST(name_cache_size);
 
   END_TEST;
 }
@@ -30,7 +30,9 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_format_number.h"
 
 #if HAVE_LIBYAJL
 #include <yajl/yajl_common.h>
@@ -43,318 +45,415 @@
 #endif
 #endif
 
-static int json_escape_string(char *buffer, size_t buffer_size, /* {{{ */
-                              const char *string) {
-  size_t dst_pos;
+/* Output of the value list serializer. Fixed buffers are provided by the
+ * caller of format_json_value_list(); all other buffers are grown as needed.
+ * "buf->data" is kept null terminated. */
+typedef struct {
+  format_json_buffer_t *buf;
+  _Bool fixed;
+} json_writer_t;
+
+/* Pre-rendered `,"dstypes":[...],"dsnames":[...]' fragment of a data set. */
+typedef struct {
+  char *fragment;
+  size_t fragment_len;
+  size_t ds_num;
+} json_ds_fragment_t;
+
+static c_avl_tree_t *ds_fragments = NULL;
+static pthread_rwlock_t ds_fragments_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Makes sure "size" more bytes plus the terminating null byte fit. */
+static int jw_reserve(json_writer_t *w, size_t size) /* {{{ */
+{
+  format_json_buffer_t *buf = w->buf;
+  size_t new_size;
+  char *tmp;
 
-  if ((buffer == NULL) || (string == NULL))
-    return -EINVAL;
+  if ((buf->len + size) < buf->size)
+    return 0;
+  else if (w->fixed)
+    return -ENOMEM;
+
+  new_size = (buf->size > 0) ? buf->size : 1024;
+  while (new_size <= (buf->len + size))
+    new_size *= 2;
 
-  if (buffer_size < 3)
+  tmp = realloc(buf->data, new_size);
+  if (tmp == NULL)
     return -ENOMEM;
+  buf->data = tmp;
+  buf->size = new_size;
 
-  dst_pos = 0;
+  return 0;
+} /* }}} int jw_reserve */
 
-#define BUFFER_ADD(c)                                                          \
-  do {                                                                         \
-    if (dst_pos >= (buffer_size - 1)) {                                        \
-      buffer[buffer_size - 1] = 0;                                             \
-      return -ENOMEM;                                                          \
-    }                                                                          \
-    buffer[dst_pos] = (c);                                                     \
-    dst_pos++;                                                                 \
-  } while (0)
+static int jw_add(json_writer_t *w, char const *str, size_t len) /* {{{ */
+{
+  int status = jw_reserve(w, len);
+  if (status != 0)
+    return status;
 
-  /* Escape special characters */
-  BUFFER_ADD('"');
-  for (size_t src_pos = 0; string[src_pos] != 0; src_pos++) {
-    if ((string[src_pos] == '"') || (string[src_pos] == '\\')) {
-      BUFFER_ADD('\\');
-      BUFFER_ADD(string[src_pos]);
-    } else if (string[src_pos] <= 0x001F)
-      BUFFER_ADD('?');
-    else
-      BUFFER_ADD(string[src_pos]);
-  } /* for */
-  BUFFER_ADD('"');
-  buffer[dst_pos] = 0;
+  memcpy(w->buf->data + w->buf->len, str, len);
+  w->buf->len += len;
+  w->buf->data[w->buf->len] = 0;
+
+  return 0;
+} /* }}} int jw_add */
+
+#define JW_ADD_LITERAL(w, str) jw_add((w), (str), sizeof(str) - 1)
+
+static int jw_add_string(json_writer_t *w, char const *str) /* {{{ */
+{
+  size_t len = 0;
+  size_t escaped_len = 2;
+  char *ptr;
+  int status;
+
+  for (; str[len] != 0; len++)
+    escaped_len += ((str[len] == '"') || (str[len] == '\\')) ? 2 : 1;
 
-#undef BUFFER_ADD
+  status = jw_reserve(w, escaped_len);
+  if (status != 0)
+    return status;
+
+  ptr = w->buf->data + w->buf->len;
+  *ptr++ = '"';
+  for (size_t i = 0; i < len; i++) {
+    if ((str[i] == '"') || (str[i] == '\\')) {
+      *ptr++ = '\\';
+      *ptr++ = str[i];
+    } else if (str[i] <= 0x001F)
+      *ptr++ = '?';
+    else
+      *ptr++ = str[i];
+  }
+  *ptr++ = '"';
+  *ptr = 0;
+  w->buf->len = (size_t)(ptr - w->buf->data);
 
   return 0;
-} /* }}} int json_escape_string */
+} /* }}} int jw_add_string */
+
+static int jw_add_key(json_writer_t *w, char const *key) /* {{{ */
+{
+  int status;
+
+  status = JW_ADD_LITERAL(w, ",");
+  if (status == 0)
+    status = jw_add_string(w, key);
+  if (status == 0)
+    status = JW_ADD_LITERAL(w, ":");
+
+  return status;
+} /* }}} int jw_add_key */
+
+static int jw_add_uint(json_writer_t *w, uint64_t value) /* {{{ */
+{
+  char temp[FORMAT_NUMBER_BUFSIZE];
+  return jw_add(w, temp, format_uint64(temp, value));
+} /* }}} int jw_add_uint */
+
+static int jw_add_int(json_writer_t *w, int64_t value) /* {{{ */
+{
+  char temp[FORMAT_NUMBER_BUFSIZE];
+  return jw_add(w, temp, format_int64(temp, value));
+} /* }}} int jw_add_int */
 
-static int values_to_json(char *buffer, size_t buffer_size, /* {{{ */
+/* Non-finite values can't be represented in JSON and are added as "null". */
+static int jw_add_double(json_writer_t *w, double value) /* {{{ */
+{
+  char temp[FORMAT_NUMBER_BUFSIZE];
+
+  if (!isfinite(value))
+    return JW_ADD_LITERAL(w, "null");
+
+  return jw_add(w, temp, format_double(temp, value));
+} /* }}} int jw_add_double */
+
+/* Adds a time in seconds with millisecond precision, e.g. "1474889462.123". */
+static int jw_add_time(json_writer_t *w, cdtime_t t) /* {{{ */
+{
+  uint64_t ms = CDTIME_T_TO_MS(t);
+  char frac[4] = {'.', (char)('0' + (ms / 100) % 10),
+                  (char)('0' + (ms / 10) % 10), (char)('0' + ms % 10)};
+  int status;
+
+  status = jw_add_uint(w, ms / 1000);
+  if (status != 0)
+    return status;
+
+  return jw_add(w, frac, sizeof(frac));
+} /* }}} int jw_add_time */
+
+static int values_to_json(json_writer_t *w, /* {{{ */
                           const data_set_t *ds, const value_list_t *vl,
                           int store_rates) {
-  size_t offset = 0;
   gauge_t *rates = NULL;
+  int status = JW_ADD_LITERAL(w, "\"values\":[");
 
-  memset(buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    int status;                                                                \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1) {                                                          \
-      sfree(rates);                                                            \
-      return -1;                                                               \
-    } else if (((size_t)status) >= (buffer_size - offset)) {                   \
-      sfree(rates);                                                            \
-      return -ENOMEM;                                                          \
-    } else                                                                     \
-      offset += ((size_t)status);                                              \
-  } while (0)
+  for (size_t i = 0; (status == 0) && (i < ds->ds_num); i++) {
+    if (i > 0) {
+      status = JW_ADD_LITERAL(w, ",");
+      if (status != 0)
+        break;
+    }
 
-  BUFFER_ADD("[");
-  for (size_t i = 0; i < ds->ds_num; i++) {
-    if (i > 0)
-      BUFFER_ADD(",");
-
-    if (ds->ds[i].type == DS_TYPE_GAUGE) {
-      if (isfinite(vl->values[i].gauge))
-        BUFFER_ADD(JSON_GAUGE_FORMAT, vl->values[i].gauge);
-      else
-        BUFFER_ADD("null");
-    } else if (store_rates) {
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+      status = jw_add_double(w, vl->values[i].gauge);
+    else if (store_rates) {
       if (rates == NULL)
         rates = uc_get_rate(ds, vl);
       if (rates == NULL) {
         WARNING("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
         return -1;
       }
-
-      if (isfinite(rates[i]))
-        BUFFER_ADD(JSON_GAUGE_FORMAT, rates[i]);
-      else
-        BUFFER_ADD("null");
+      status = jw_add_double(w, rates[i]);
     } else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD("%llu", vl->values[i].counter);
+      status = jw_add_uint(w, (uint64_t)vl->values[i].counter);
     else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD("%" PRIi64, vl->values[i].derive);
+      status = jw_add_int(w, vl->values[i].derive);
     else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD("%" PRIu64, vl->values[i].absolute);
+      status = jw_add_uint(w, vl->values[i].absolute);
     else {
       ERROR("format_json: Unknown data source type: %i", ds->ds[i].type);
-      sfree(rates);
-      return -1;
+      status = -1;
     }
   } /* for ds->ds_num */
-  BUFFER_ADD("]");
 
-#undef BUFFER_ADD
+  if (status == 0)
+    status = JW_ADD_LITERAL(w, "]");
 
-  DEBUG("format_json: values_to_json: buffer = %s;", buffer);
   sfree(rates);
-  return 0;
+  return status;
 } /* }}} int values_to_json */
 
-static int dstypes_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                           const data_set_t *ds) {
-  size_t offset = 0;
-
-  memset(buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    int status;                                                                \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
+/* Renders the parts of a value list that only depend on the data set. */
+static int ds_fragment_create(json_ds_fragment_t *f, /* {{{ */
+                              const data_set_t *ds) {
+  format_json_buffer_t buf = FORMAT_JSON_BUFFER_INIT;
+  json_writer_t w = {&buf, /* fixed = */ 0};
+  int status = JW_ADD_LITERAL(&w, ",\"dstypes\":[");
 
-  BUFFER_ADD("[");
-  for (size_t i = 0; i < ds->ds_num; i++) {
+  for (size_t i = 0; (status == 0) && (i < ds->ds_num); i++) {
     if (i > 0)
-      BUFFER_ADD(",");
-
-    BUFFER_ADD("\"%s\"", DS_TYPE_TO_STRING(ds->ds[i].type));
-  } /* for ds->ds_num */
-  BUFFER_ADD("]");
-
-#undef BUFFER_ADD
+      status = JW_ADD_LITERAL(&w, ",");
+    if (status == 0)
+      status = jw_add_string(&w, DS_TYPE_TO_STRING(ds->ds[i].type));
+  }
+  if (status == 0)
+    status = JW_ADD_LITERAL(&w, "],\"dsnames\":[");
+  for (size_t i = 0; (status == 0) && (i < ds->ds_num); i++) {
+    if (i > 0)
+      status = JW_ADD_LITERAL(&w, ",");
+    if (status == 0)
+      status = jw_add_string(&w, ds->ds[i].name);
+  }
+  if (status == 0)
+    status = JW_ADD_LITERAL(&w, "]");
 
-  DEBUG("format_json: dstypes_to_json: buffer = %s;", buffer);
+  if (status != 0) {
+    format_json_buffer_free(&buf);
+    return status;
+  }
 
+  f->fragment = buf.data;
+  f->fragment_len = buf.len;
+  f->ds_num = ds->ds_num;
   return 0;
-} /* }}} int dstypes_to_json */
-
-static int dsnames_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                           const data_set_t *ds) {
-  size_t offset = 0;
-
-  memset(buffer, 0, buffer_size);
+} /* }}} int ds_fragment_create */
 
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    int status;                                                                \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
-  BUFFER_ADD("[");
-  for (size_t i = 0; i < ds->ds_num; i++) {
-    if (i > 0)
-      BUFFER_ADD(",");
-
-    BUFFER_ADD("\"%s\"", ds->ds[i].name);
-  } /* for ds->ds_num */
-  BUFFER_ADD("]");
-
-#undef BUFFER_ADD
+/* Looks up the fragment of "ds" in the cache, creating it if necessary. The
+ * fragment is only valid while the caller holds a read lock on
+ * "ds_fragments_lock"; the lock is acquired on success. */
+static json_ds_fragment_t *ds_fragment_get(const data_set_t *ds) /* {{{ */
+{
+  json_ds_fragment_t *f = NULL;
+  json_ds_fragment_t new_f = {0};
+  char *key;
+
+  pthread_rwlock_rdlock(&ds_fragments_lock);
+  if ((ds_fragments != NULL) &&
+      (c_avl_get(ds_fragments, ds->type, (void *)&f) == 0) &&
+      (f->ds_num == ds->ds_num))
+    return f;
+  pthread_rwlock_unlock(&ds_fragments_lock);
+
+  if (ds_fragment_create(&new_f, ds) != 0)
+    return NULL;
+
+  pthread_rwlock_wrlock(&ds_fragments_lock);
+  if (ds_fragments == NULL)
+    ds_fragments = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (ds_fragments == NULL) {
+    pthread_rwlock_unlock(&ds_fragments_lock);
+    sfree(new_f.fragment);
+    return NULL;
+  }
 
-  DEBUG("format_json: dsnames_to_json: buffer = %s;", buffer);
+  if (c_avl_get(ds_fragments, ds->type, (void *)&f) == 0) {
+    /* The data set was re-defined with a different number of sources. */
+    sfree(f->fragment);
+    *f = new_f;
+  } else {
+    key = strdup(ds->type);
+    f = malloc(sizeof(*f));
+    if ((key == NULL) || (f == NULL) || (c_avl_insert(ds_fragments, key, f))) {
+      pthread_rwlock_unlock(&ds_fragments_lock);
+      sfree(key);
+      sfree(f);
+      sfree(new_f.fragment);
+      return NULL;
+    }
+    *f = new_f;
+  }
+  pthread_rwlock_unlock(&ds_fragments_lock);
 
-  return 0;
-} /* }}} int dsnames_to_json */
+  /* Start over with a read lock; the fragment may have been replaced by
+   * another thread in the meantime. */
+  return ds_fragment_get(ds);
+} /* }}} json_ds_fragment_t *ds_fragment_get */
 
-static int meta_data_keys_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                                  meta_data_t *meta, char **keys,
-                                  size_t keys_num) {
-  size_t offset = 0;
+static int dstypes_dsnames_to_json(json_writer_t *w, /* {{{ */
+                                   const data_set_t *ds) {
+  json_ds_fragment_t *f;
   int status;
 
-  buffer[0] = 0;
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
-  for (size_t i = 0; i < keys_num; ++i) {
-    int type;
-    char *key = keys[i];
+  f = ds_fragment_get(ds);
+  if (f == NULL)
+    return -1;
 
-    type = meta_data_type(meta, key);
-    if (type == MD_TYPE_STRING) {
-      char *value = NULL;
-      if (meta_data_get_string(meta, key, &value) == 0) {
-        char temp[512] = "";
+  status = jw_add(w, f->fragment, f->fragment_len);
+  pthread_rwlock_unlock(&ds_fragments_lock);
 
-        status = json_escape_string(temp, sizeof(temp), value);
-        sfree(value);
-        if (status != 0)
-          return status;
+  return status;
+} /* }}} int dstypes_dsnames_to_json */
 
-        BUFFER_ADD(",\"%s\":%s", key, temp);
-      }
-    } else if (type == MD_TYPE_SIGNED_INT) {
-      int64_t value = 0;
-      if (meta_data_get_signed_int(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%" PRIi64, key, value);
-    } else if (type == MD_TYPE_UNSIGNED_INT) {
-      uint64_t value = 0;
-      if (meta_data_get_unsigned_int(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%" PRIu64, key, value);
-    } else if (type == MD_TYPE_DOUBLE) {
-      double value = 0.0;
-      if (meta_data_get_double(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%f", key, value);
-    } else if (type == MD_TYPE_BOOLEAN) {
-      _Bool value = 0;
-      if (meta_data_get_boolean(meta, key, &value) == 0)
-        BUFFER_ADD(",\"%s\":%s", key, value ? "true" : "false");
-    }
-  } /* for (keys) */
+static int meta_data_key_to_json(json_writer_t *w, /* {{{ */
+                                 meta_data_t *meta, char const *key,
+                                 _Bool *first) {
+  size_t start = w->buf->len;
+  int type = meta_data_type(meta, key);
+  int status;
 
-  if (offset == 0)
-    return ENOENT;
+  status = JW_ADD_LITERAL(w, ",");
+  if (status == 0)
+    status = jw_add_string(w, key);
+  if (status == 0)
+    status = JW_ADD_LITERAL(w, ":");
+  if (status != 0)
+    return status;
 
-  buffer[0] = '{'; /* replace leading ',' */
-  BUFFER_ADD("}");
+  if (type == MD_TYPE_STRING) {
+    char *value = NULL;
+    status = meta_data_get_string(meta, key, &value);
+    if (status == 0)
+      status = jw_add_string(w, value);
+    sfree(value);
+  } else if (type == MD_TYPE_SIGNED_INT) {
+    int64_t value = 0;
+    status = meta_data_get_signed_int(meta, key, &value);
+    if (status == 0)
+      status = jw_add_int(w, value);
+  } else if (type == MD_TYPE_UNSIGNED_INT) {
+    uint64_t value = 0;
+    status = meta_data_get_unsigned_int(meta, key, &value);
+    if (status == 0)
+      status = jw_add_uint(w, value);
+  } else if (type == MD_TYPE_DOUBLE) {
+    double value = 0.0;
+    status = meta_data_get_double(meta, key, &value);
+    if (status == 0)
+      status = jw_add_double(w, value);
+  } else if (type == MD_TYPE_BOOLEAN) {
+    _Bool value = 0;
+    status = meta_data_get_boolean(meta, key, &value);
+    if (status == 0)
+      status = value ? JW_ADD_LITERAL(w, "true") : JW_ADD_LITERAL(w, "false");
+  } else {
+    status = ENOENT;
+  }
 
-#undef BUFFER_ADD
+  if (status == -ENOMEM)
+    return status;
+  else if (status != 0) {
+    /* Skip keys that vanished or have an unsupported type. */
+    w->buf->len = start;
+    w->buf->data[start] = 0;
+    return 0;
+  }
 
+  if (*first) {
+    w->buf->data[start] = '{'; /* replace leading ',' */
+    *first = 0;
+  }
   return 0;
-} /* }}} int meta_data_keys_to_json */
+} /* }}} int meta_data_key_to_json */
 
-static int meta_data_to_json(char *buffer, size_t buffer_size, /* {{{ */
-                             meta_data_t *meta) {
+static int meta_data_to_json(json_writer_t *w, meta_data_t *meta) /* {{{ */
+{
+  size_t start = w->buf->len;
   char **keys = NULL;
-  size_t keys_num;
+  int keys_num;
+  _Bool first = 1;
   int status;
 
-  if ((buffer == NULL) || (buffer_size == 0) || (meta == NULL))
-    return EINVAL;
-
-  status = meta_data_toc(meta, &keys);
-  if (status <= 0)
-    return status;
-  keys_num = (size_t)status;
+  keys_num = meta_data_toc(meta, &keys);
+  if (keys_num <= 0)
+    return keys_num;
 
-  status = meta_data_keys_to_json(buffer, buffer_size, meta, keys, keys_num);
+  status = JW_ADD_LITERAL(w, ",\"meta\":");
+  for (int i = 0; (status == 0) && (i < keys_num); i++)
+    status = meta_data_key_to_json(w, meta, keys[i], &first);
 
-  for (size_t i = 0; i < keys_num; ++i)
+  for (int i = 0; i < keys_num; i++)
     sfree(keys[i]);
   sfree(keys);
 
-  return status;
+  if (status != 0)
+    return status;
+
+  if (first) {
+    /* None of the keys could be serialized: omit "meta" altogether. */
+    w->buf->len = start;
+    w->buf->data[start] = 0;
+    return 0;
+  }
+
+  return JW_ADD_LITERAL(w, "}");
 } /* }}} int meta_data_to_json */
 
-static int value_list_to_json(char *buffer, size_t buffer_size, /* {{{ */
+/* Appends `,{...}' to the writer's buffer. On failure the buffer is restored
+ * to its previous content. */
+static int value_list_to_json(json_writer_t *w, /* {{{ */
                               const data_set_t *ds, const value_list_t *vl,
                               int store_rates) {
-  char temp[512];
-  size_t offset = 0;
+  size_t start = w->buf->len;
   int status;
 
-  memset(buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(buffer + offset, buffer_size - offset, __VA_ARGS__);     \
-    if (status < 1)                                                            \
-      return -1;                                                               \
-    else if (((size_t)status) >= (buffer_size - offset))                       \
-      return -ENOMEM;                                                          \
-    else                                                                       \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
   /* All value lists have a leading comma. The first one will be replaced with
    * a square bracket in `format_json_finalize'. */
-  BUFFER_ADD(",{");
-
-  status = values_to_json(temp, sizeof(temp), ds, vl, store_rates);
-  if (status != 0)
-    return status;
-  BUFFER_ADD("\"values\":%s", temp);
-
-  status = dstypes_to_json(temp, sizeof(temp), ds);
-  if (status != 0)
-    return status;
-  BUFFER_ADD(",\"dstypes\":%s", temp);
-
-  status = dsnames_to_json(temp, sizeof(temp), ds);
-  if (status != 0)
-    return status;
-  BUFFER_ADD(",\"dsnames\":%s", temp);
-
-  BUFFER_ADD(",\"time\":%.3f", CDTIME_T_TO_DOUBLE(vl->time));
-  BUFFER_ADD(",\"interval\":%.3f", CDTIME_T_TO_DOUBLE(vl->interval));
+  status = JW_ADD_LITERAL(w, ",{");
+  if (status == 0)
+    status = values_to_json(w, ds, vl, store_rates);
+  if (status == 0)
+    status = dstypes_dsnames_to_json(w, ds);
+
+  if (status == 0)
+    status = JW_ADD_LITERAL(w, ",\"time\":");
+  if (status == 0)
+    status = jw_add_time(w, vl->time);
+  if (status == 0)
+    status = JW_ADD_LITERAL(w, ",\"interval\":");
+  if (status == 0)
+    status = jw_add_time(w, vl->interval);
 
 #define BUFFER_ADD_KEYVAL(key, value)                                          \
   do {                                                                         \
-    status = json_escape_string(temp, sizeof(temp), (value));                  \
-    if (status != 0)                                                           \
-      return status;                                                           \
-    BUFFER_ADD(",\"%s\":%s", (key), temp);                                     \
+    if (status == 0)                                                           \
+      status = jw_add_key(w, (key));                                           \
+    if (status == 0)                                                           \
+      status = jw_add_string(w, (value));                                      \
   } while (0)
 
   BUFFER_ADD_KEYVAL("host", vl->host);
@@ -363,46 +462,25 @@ static int value_list_to_json(char *buffer, size_t buffer_size, /* {{{ */
   BUFFER_ADD_KEYVAL("type", vl->type);
   BUFFER_ADD_KEYVAL("type_instance", vl->type_instance);
 
-  if (vl->meta != NULL) {
-    char meta_buffer[buffer_size];
-    memset(meta_buffer, 0, sizeof(meta_buffer));
-    status = meta_data_to_json(meta_buffer, sizeof(meta_buffer), vl->meta);
-    if (status != 0)
-      return status;
-
-    BUFFER_ADD(",\"meta\":%s", meta_buffer);
-  } /* if (vl->meta != NULL) */
-
-  BUFFER_ADD("}");
-
 #undef BUFFER_ADD_KEYVAL
-#undef BUFFER_ADD
 
-  DEBUG("format_json: value_list_to_json: buffer = %s;", buffer);
+  if ((status == 0) && (vl->meta != NULL))
+    status = meta_data_to_json(w, vl->meta);
 
-  return 0;
-} /* }}} int value_list_to_json */
+  if (status == 0)
+    status = JW_ADD_LITERAL(w, "}");
 
-static int format_json_value_list_nocheck(char *buffer, /* {{{ */
-                                          size_t *ret_buffer_fill,
-                                          size_t *ret_buffer_free,
-                                          const data_set_t *ds,
-                                          const value_list_t *vl,
-                                          int store_rates, size_t temp_size) {
-  char temp[temp_size];
-  int status;
-
-  status = value_list_to_json(temp, sizeof(temp), ds, vl, store_rates);
-  if (status != 0)
+  if (status != 0) {
+    w->buf->len = start;
+    if (w->buf->data != NULL)
+      w->buf->data[start] = 0;
     return status;
-  temp_size = strlen(temp);
+  }
 
-  memcpy(buffer + (*ret_buffer_fill), temp, temp_size + 1);
-  (*ret_buffer_fill) += temp_size;
-  (*ret_buffer_free) -= temp_size;
+  DEBUG("format_json: value_list_to_json: buffer = %s;", w->buf->data + start);
 
   return 0;
-} /* }}} int format_json_value_list_nocheck */
+} /* }}} int value_list_to_json */
 
 int format_json_initialize(char *buffer, /* {{{ */
                            size_t *ret_buffer_fill, size_t *ret_buffer_free) {
@@ -467,11 +545,67 @@ int format_json_value_list(char *buffer, /* {{{ */
   if (*ret_buffer_free < 3)
     return -ENOMEM;
 
-  return format_json_value_list_nocheck(buffer, ret_buffer_fill,
-                                        ret_buffer_free, ds, vl, store_rates,
-                                        (*ret_buffer_free) - 2);
+  /* Serialize in place, keeping two bytes for `format_json_finalize'. */
+  format_json_buffer_t buf = {
+      .data = buffer,
+      .len = *ret_buffer_fill,
+      .size = *ret_buffer_fill + *ret_buffer_free - 2,
+  };
+  json_writer_t w = {&buf, /* fixed = */ 1};
+
+  int status = value_list_to_json(&w, ds, vl, store_rates);
+  if (status != 0)
+    return status;
+
+  *ret_buffer_free -= buf.len - *ret_buffer_fill;
+  *ret_buffer_fill = buf.len;
+  return 0;
 } /* }}} int format_json_value_list */
 
+int format_json_buffer_value_list(format_json_buffer_t *buf, /* {{{ */
+                                  const data_set_t *ds, const value_list_t *vl,
+                                  int store_rates) {
+  if ((buf == NULL) || (ds == NULL) || (vl == NULL))
+    return -EINVAL;
+
+  json_writer_t w = {buf, /* fixed = */ 0};
+  return value_list_to_json(&w, ds, vl, store_rates);
+} /* }}} int format_json_buffer_value_list */
+
+int format_json_buffer_finalize(format_json_buffer_t *buf) /* {{{ */
+{
+  if ((buf == NULL) || (buf->len == 0) || (buf->data[0] != ','))
+    return -EINVAL;
+
+  json_writer_t w = {buf, /* fixed = */ 0};
+  int status = JW_ADD_LITERAL(&w, "]");
+  if (status != 0)
+    return status;
+
+  buf->data[0] = '[';
+  return 0;
+} /* }}} int format_json_buffer_finalize */
+
+void format_json_buffer_reset(format_json_buffer_t *buf) /* {{{ */
+{
+  if (buf == NULL)
+    return;
+
+  buf->len = 0;
+  if (buf->data != NULL)
+    buf->data[0] = 0;
+} /* }}} void format_json_buffer_reset */
+
+void format_json_buffer_free(format_json_buffer_t *buf) /* {{{ */
+{
+  if (buf == NULL)
+    return;
+
+  sfree(buf->data);
+  buf->len = 0;
+  buf->size = 0;
+} /* }}} void format_json_buffer_free */
+
 #if HAVE_LIBYAJL
 static int json_add_string(yajl_gen g, char const *str) /* {{{ */
 {
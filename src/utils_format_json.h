@@ -35,6 +35,16 @@
 #define JSON_GAUGE_FORMAT GAUGE_FORMAT
 #endif
 
+/* Output buffer that grows as needed. Initialize it with
+ * FORMAT_JSON_BUFFER_INIT and release it with format_json_buffer_free(). */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+} format_json_buffer_t;
+#define FORMAT_JSON_BUFFER_INIT                                                \
+  { NULL, 0, 0 }
+
 int format_json_initialize(char *buffer, size_t *ret_buffer_fill,
                            size_t *ret_buffer_free);
 int format_json_value_list(char *buffer, size_t *ret_buffer_fill,
@@ -42,6 +52,17 @@ int format_json_value_list(char *buffer, size_t *ret_buffer_fill,
                            const value_list_t *vl, int store_rates);
 int format_json_finalize(char *buffer, size_t *ret_buffer_fill,
                          size_t *ret_buffer_free);
+
+/* Appends a value list to "buf", which is enlarged as necessary. Like
+ * format_json_value_list(), the serialized value lists are separated by a
+ * leading comma that format_json_buffer_finalize() turns into an array. */
+int format_json_buffer_value_list(format_json_buffer_t *buf,
+                                  const data_set_t *ds, const value_list_t *vl,
+                                  int store_rates);
+int format_json_buffer_finalize(format_json_buffer_t *buf);
+void format_json_buffer_reset(format_json_buffer_t *buf);
+void format_json_buffer_free(format_json_buffer_t *buf);
+
 int format_json_notification(char *buffer, size_t buffer_size,
                              notification_t const *n);
 
@@ -176,8 +176,63 @@ DEF_TEST(notification) {
   return expect_json_labels(got, labels, STATIC_ARRAY_SIZE(labels));
 }
 
+DEF_TEST(value_list) {
+  data_source_t dsrc[] = {
+      {"rx", DS_TYPE_DERIVE, 0, NAN}, {"tx", DS_TYPE_GAUGE, 0, NAN},
+  };
+  data_set_t ds = {"if_octets", STATIC_ARRAY_SIZE(dsrc), dsrc};
+  value_t values[] = {{.derive = -42}, {.gauge = 0.5}};
+  value_list_t vl = {
+      .values = values,
+      .values_len = STATIC_ARRAY_SIZE(values),
+      .time = 1555083754651779072ULL, /* 1448284606.125 */
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "example.com",
+      .plugin = "interface",
+      .plugin_instance = "eth0",
+      .type = "if_octets",
+  };
+  char const *want_vl =
+      "{\"values\":[-42,0.5],\"dstypes\":[\"derive\",\"gauge\"],"
+      "\"dsnames\":[\"rx\",\"tx\"],\"time\":1448284606.125,"
+      "\"interval\":10.000,\"host\":\"example.com\",\"plugin\":\"interface\","
+      "\"plugin_instance\":\"eth0\",\"type\":\"if_octets\","
+      "\"type_instance\":\"\"}";
+  char want[1024];
+
+  /* Fixed buffer: a value list that doesn't fit leaves the buffer as is. */
+  char got[1024];
+  size_t fill = 0;
+  size_t bfree = strlen(want_vl) + 4;
+  CHECK_ZERO(format_json_initialize(got, &fill, &bfree));
+  CHECK_ZERO(format_json_value_list(got, &fill, &bfree, &ds, &vl, 0));
+  EXPECT_EQ_INT(-ENOMEM,
+                format_json_value_list(got, &fill, &bfree, &ds, &vl, 0));
+  EXPECT_EQ_INT((int)strlen(want_vl) + 1, (int)fill);
+  EXPECT_EQ_INT(3, (int)bfree);
+  CHECK_ZERO(format_json_finalize(got, &fill, &bfree));
+  snprintf(want, sizeof(want), "[%s]", want_vl);
+  EXPECT_EQ_STR(want, got);
+
+  /* Growable buffer. */
+  format_json_buffer_t buf = FORMAT_JSON_BUFFER_INIT;
+  CHECK_ZERO(format_json_buffer_value_list(&buf, &ds, &vl, 0));
+  CHECK_ZERO(format_json_buffer_value_list(&buf, &ds, &vl, 0));
+  CHECK_ZERO(format_json_buffer_finalize(&buf));
+  snprintf(want, sizeof(want), "[%s,%s]", want_vl, want_vl);
+  EXPECT_EQ_STR(want, buf.data);
+  EXPECT_EQ_INT((int)strlen(want), (int)buf.len);
+
+  format_json_buffer_reset(&buf);
+  EXPECT_EQ_INT(-EINVAL, format_json_buffer_finalize(&buf));
+  format_json_buffer_free(&buf);
+
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(notification);
+  RUN_TEST(value_list);
 
   END_TEST;
 }
@@ -37,10 +37,12 @@
 #define LLONG_MAX 9223372036854775807LL
 #endif
 
-#ifndef HISTOGRAM_DEFAULT_BIN_WIDTH
-/* 1048576 = 2^20 ^= 1/1024 s */
-#define HISTOGRAM_DEFAULT_BIN_WIDTH 1048576
-#endif
+/* Number of sub-buckets each power of two is divided into, as a power of two.
+ * With 2^6 = 64 sub-buckets the width of a bucket is at most 1/64 of its lower
+ * bound, i.e. every value reported by the histogram is within ~1.6% of the
+ * true value. */
+#define HISTOGRAM_SUB_BITS 6
+#define HISTOGRAM_SUB_BUCKETS (((size_t)1) << HISTOGRAM_SUB_BITS)
 
 struct latency_counter_s {
   cdtime_t start_time;
@@ -51,8 +53,12 @@ struct latency_counter_s {
   cdtime_t min;
   cdtime_t max;
 
-  cdtime_t bin_width;
-  int histogram[HISTOGRAM_NUM_BINS];
+  /* Counts of the buckets [bucket_first, bucket_first + buckets_num). The
+   * array is grown on demand and only covers the range of buckets that have
+   * actually been hit. */
+  size_t bucket_first;
+  size_t buckets_num;
+  uint32_t *buckets;
 };
 
 /*
@@ -60,58 +66,101 @@ struct latency_counter_s {
 * Each bin represents an interval and has a count (frequency) of
 * number of values fall within its interval.
 *
-* Histogram's range is determined by the number of bins and the bin width,
-* There are 1000 bins and all bins have the same width of default 1 millisecond.
-* When a value above this range is added, Histogram's range is increased by
-* increasing the bin width (note that number of bins remains always at 1000).
-* This operation of increasing bin width is little expensive as each bin need
-* to be visited to update it's count. To reduce frequent change of bin width,
-* new bin width will be the next nearest power of 2. Example: 2, 4, 8, 16, 32,
-* 64, 128, 256, 512, 1024, 2048, 5086, ...
+* The bins are logarithmically spaced, similar to HdrHistogram: every power of
+* two is divided into HISTOGRAM_SUB_BUCKETS bins of equal width. Latencies
+* smaller than HISTOGRAM_SUB_BUCKETS (in cdtime_t units) each get their own
+* bin. This gives a constant *relative* error over the whole range of
+* cdtime_t, independent of how heavy-tailed the distribution is.
+*
+* Since the layout of the bins is the same for all counters, the bin index of
+* a value can be computed in constant time and two counters can be merged by
+* simply adding up their bins.
 *
-* So, if the required bin width is 300, then new bin width will be 512 as it is
-* the next nearest power of 2.
+* Bins have an exclusive lower bound and an inclusive upper bound, i.e. a
+* latency of _exactly_ 1.0 ms is stored in the bin ending at 1.0 ms. That's
+* why one is subtracted from the latency before determining the bin.
 */
-static void change_bin_width(latency_counter_t *lc, cdtime_t latency) /* {{{ */
+static int latency_msb(uint64_t x) /* {{{ */
+{
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll((unsigned long long)x);
+#else
+  int msb = 0;
+  while (x >>= 1)
+    msb++;
+  return msb;
+#endif
+} /* }}} int latency_msb */
+
+static size_t latency_to_bucket(cdtime_t latency) /* {{{ */
 {
-  /* This function is called because the new value is above histogram's range.
-   * First find the required bin width:
-   *           requiredBinWidth = (value + 1) / numBins
-   * then get the next nearest power of 2
-   *           newBinWidth = 2^(ceil(log2(requiredBinWidth)))
-   */
-  double required_bin_width =
-      ((double)(latency + 1)) / ((double)HISTOGRAM_NUM_BINS);
-  double required_bin_width_logbase2 = log(required_bin_width) / log(2.0);
-  cdtime_t new_bin_width =
-      (cdtime_t)(pow(2.0, ceil(required_bin_width_logbase2)) + .5);
-  cdtime_t old_bin_width = lc->bin_width;
-
-  lc->bin_width = new_bin_width;
-
-  /* bin_width has been increased, now iterate through all bins and move the
-   * old bin's count to new bin. */
-  if (lc->num > 0) // if the histogram has data then iterate else skip
-  {
-    double width_change_ratio =
-        ((double)old_bin_width) / ((double)new_bin_width);
-
-    for (size_t i = 0; i < HISTOGRAM_NUM_BINS; i++) {
-      size_t new_bin = (size_t)(((double)i) * width_change_ratio);
-      if (i == new_bin)
-        continue;
-      assert(new_bin < i);
-
-      lc->histogram[new_bin] += lc->histogram[i];
-      lc->histogram[i] = 0;
-    }
+  uint64_t x = (uint64_t)(latency - 1);
+
+  if (x < HISTOGRAM_SUB_BUCKETS)
+    return (size_t)x;
+
+  int shift = latency_msb(x) - HISTOGRAM_SUB_BITS;
+  return ((size_t)(shift + 1) << HISTOGRAM_SUB_BITS) +
+         (size_t)((x >> shift) - HISTOGRAM_SUB_BUCKETS);
+} /* }}} size_t latency_to_bucket */
+
+/* bucket_bounds returns the exclusive lower bound and the width of a bucket.
+ * The inclusive upper bound is lower + width. */
+static void bucket_bounds(size_t bucket, cdtime_t *lower, /* {{{ */
+                          cdtime_t *width) {
+  size_t group = bucket >> HISTOGRAM_SUB_BITS;
+
+  if (group == 0) {
+    *lower = (cdtime_t)bucket;
+    *width = 1;
+    return;
   }
 
-  DEBUG("utils_latency: change_bin_width: latency = %.3f; "
-        "old_bin_width = %.3f; new_bin_width = %.3f;",
-        CDTIME_T_TO_DOUBLE(latency), CDTIME_T_TO_DOUBLE(old_bin_width),
-        CDTIME_T_TO_DOUBLE(new_bin_width));
-} /* }}} void change_bin_width */
+  int shift = (int)group - 1;
+  cdtime_t sub = (cdtime_t)(bucket & (HISTOGRAM_SUB_BUCKETS - 1));
+  *lower = (sub + HISTOGRAM_SUB_BUCKETS) << shift;
+  *width = ((cdtime_t)1) << shift;
+} /* }}} void bucket_bounds */
+
+/* Makes sure the buckets [first, last] are backed by memory. The range is
+ * extended to whole powers of two so that the array is only grown a handful
+ * of times over the lifetime of a counter. */
+static int reserve_buckets(latency_counter_t *lc, size_t first, /* {{{ */
+                           size_t last) {
+  if ((lc->buckets != NULL) && (first >= lc->bucket_first) &&
+      (last < lc->bucket_first + lc->buckets_num))
+    return 0;
+
+  if (lc->buckets != NULL) {
+    if (lc->bucket_first < first)
+      first = lc->bucket_first;
+    if (lc->bucket_first + lc->buckets_num - 1 > last)
+      last = lc->bucket_first + lc->buckets_num - 1;
+  }
+
+  first &= ~(HISTOGRAM_SUB_BUCKETS - 1);
+  last |= (HISTOGRAM_SUB_BUCKETS - 1);
+
+  size_t num = last - first + 1;
+  uint32_t *tmp = calloc(num, sizeof(*tmp));
+  if (tmp == NULL)
+    return ENOMEM;
+
+  if (lc->buckets != NULL)
+    memcpy(tmp + (lc->bucket_first - first), lc->buckets,
+           lc->buckets_num * sizeof(*tmp));
+
+  DEBUG("utils_latency: reserve_buckets: old range = [%zu, %zu); "
+        "new range = [%zu, %zu);",
+        lc->bucket_first, lc->bucket_first + lc->buckets_num, first,
+        first + num);
+
+  sfree(lc->buckets);
+  lc->buckets = tmp;
+  lc->bucket_first = first;
+  lc->buckets_num = num;
+  return 0;
+} /* }}} int reserve_buckets */
 
 latency_counter_t *latency_counter_create(void) /* {{{ */
 {
@@ -121,19 +170,22 @@ latency_counter_t *latency_counter_create(void) /* {{{ */
   if (lc == NULL)
     return NULL;
 
-  lc->bin_width = HISTOGRAM_DEFAULT_BIN_WIDTH;
   latency_counter_reset(lc);
   return lc;
 } /* }}} latency_counter_t *latency_counter_create */
 
 void latency_counter_destroy(latency_counter_t *lc) /* {{{ */
 {
+  if (lc == NULL)
+    return;
+
+  sfree(lc->buckets);
   sfree(lc);
 } /* }}} void latency_counter_destroy */
 
 void latency_counter_add(latency_counter_t *lc, cdtime_t latency) /* {{{ */
 {
-  cdtime_t bin;
+  size_t bucket;
 
   if ((lc == NULL) || (latency == 0) || (latency > ((cdtime_t)LLONG_MAX)))
     return;
@@ -148,50 +200,61 @@ void latency_counter_add(latency_counter_t *lc, cdtime_t latency) /* {{{ */
   if (lc->max < latency)
     lc->max = latency;
 
-  /* A latency of _exactly_ 1.0 ms is stored in the buffer 0, so
-   * subtract one from the cdtime_t value so that exactly 1.0 ms get sorted
-   * accordingly. */
-  bin = (latency - 1) / lc->bin_width;
-  if (bin >= HISTOGRAM_NUM_BINS) {
-    change_bin_width(lc, latency);
-    bin = (latency - 1) / lc->bin_width;
-    if (bin >= HISTOGRAM_NUM_BINS) {
-      ERROR("utils_latency: latency_counter_add: Invalid bin: %" PRIu64, bin);
-      return;
-    }
+  bucket = latency_to_bucket(latency);
+  if (reserve_buckets(lc, bucket, bucket) != 0) {
+    ERROR("utils_latency: latency_counter_add: Allocating bucket %zu failed.",
+          bucket);
+    return;
   }
-  lc->histogram[bin]++;
+  lc->buckets[bucket - lc->bucket_first]++;
 } /* }}} void latency_counter_add */
 
+int latency_counter_merge(latency_counter_t *dst, /* {{{ */
+                          latency_counter_t const *src) {
+  if ((dst == NULL) || (src == NULL))
+    return EINVAL;
+
+  if (src->num == 0)
+    return 0;
+
+  if (src->buckets != NULL) {
+    int status = reserve_buckets(dst, src->bucket_first,
+                                 src->bucket_first + src->buckets_num - 1);
+    if (status != 0)
+      return status;
+
+    uint32_t *b = dst->buckets + (src->bucket_first - dst->bucket_first);
+    for (size_t i = 0; i < src->buckets_num; i++)
+      b[i] += src->buckets[i];
+  }
+
+  if ((dst->num == 0) || (dst->min > src->min))
+    dst->min = src->min;
+  if ((dst->num == 0) || (dst->max < src->max))
+    dst->max = src->max;
+  dst->sum += src->sum;
+  dst->num += src->num;
+
+  if (dst->start_time > src->start_time)
+    dst->start_time = src->start_time;
+
+  return 0;
+} /* }}} int latency_counter_merge */
+
 void latency_counter_reset(latency_counter_t *lc) /* {{{ */
 {
   if (lc == NULL)
     return;
 
-  cdtime_t bin_width = lc->bin_width;
-  cdtime_t max_bin = (lc->max - 1) / lc->bin_width;
-
-/*
-  If max latency is REDUCE_THRESHOLD times less than histogram's range,
-  then cut it in half. REDUCE_THRESHOLD must be >= 2.
-  Value of 4 is selected to reduce frequent changes of bin width.
-*/
-#define REDUCE_THRESHOLD 4
-  if ((lc->num > 0) && (lc->bin_width >= HISTOGRAM_DEFAULT_BIN_WIDTH * 2) &&
-      (max_bin < HISTOGRAM_NUM_BINS / REDUCE_THRESHOLD)) {
-    /* new bin width will be the previous power of 2 */
-    bin_width = bin_width / 2;
-
-    DEBUG("utils_latency: latency_counter_reset: max_latency = %.3f; "
-          "max_bin = %" PRIu64 "; old_bin_width = %.3f; new_bin_width = %.3f;",
-          CDTIME_T_TO_DOUBLE(lc->max), max_bin,
-          CDTIME_T_TO_DOUBLE(lc->bin_width), CDTIME_T_TO_DOUBLE(bin_width));
-  }
-
-  memset(lc, 0, sizeof(*lc));
+  /* preserve the bucket memory, the next interval will most likely hit the
+   * same range of buckets again. */
+  if (lc->buckets != NULL)
+    memset(lc->buckets, 0, lc->buckets_num * sizeof(*lc->buckets));
 
-  /* preserve bin width */
-  lc->bin_width = bin_width;
+  lc->sum = 0;
+  lc->num = 0;
+  lc->min = 0;
+  lc->max = 0;
   lc->start_time = cdtime();
 } /* }}} void latency_counter_reset */
 
@@ -240,49 +303,76 @@ cdtime_t latency_counter_get_percentile(latency_counter_t *lc, /* {{{ */
   double percent_lower;
   double p;
   cdtime_t latency_lower;
+  cdtime_t bucket_width;
   cdtime_t latency_interpolated;
-  int sum;
+  uint64_t sum;
   size_t i;
 
   if ((lc == NULL) || (lc->num == 0) || !((percent > 0.0) && (percent < 100.0)))
     return 0;
 
-  /* Find index i so that at least "percent" events are within i+1 ms. */
+  /* Find bucket i so that at least "percent" events are within its upper
+   * bound. */
   percent_upper = 0.0;
   percent_lower = 0.0;
   sum = 0;
-  for (i = 0; i < HISTOGRAM_NUM_BINS; i++) {
+  for (i = 0; i < lc->buckets_num; i++) {
+    if (lc->buckets[i] == 0)
+      continue;
+
     percent_lower = percent_upper;
-    sum += lc->histogram[i];
-    if (sum == 0)
-      percent_upper = 0.0;
-    else
-      percent_upper = 100.0 * ((double)sum) / ((double)lc->num);
+    sum += lc->buckets[i];
+    percent_upper = 100.0 * ((double)sum) / ((double)lc->num);
 
     if (percent_upper >= percent)
       break;
   }
 
-  if (i >= HISTOGRAM_NUM_BINS)
+  if (i >= lc->buckets_num)
     return 0;
 
   assert(percent_upper >= percent);
   assert(percent_lower < percent);
 
-  if (i == 0)
-    return lc->bin_width;
-
-  latency_lower = ((cdtime_t)i) * lc->bin_width;
+  bucket_bounds(lc->bucket_first + i, &latency_lower, &bucket_width);
   p = (percent - percent_lower) / (percent_upper - percent_lower);
 
   latency_interpolated =
-      latency_lower + DOUBLE_TO_CDTIME_T(p * CDTIME_T_TO_DOUBLE(lc->bin_width));
+      latency_lower + DOUBLE_TO_CDTIME_T(p * CDTIME_T_TO_DOUBLE(bucket_width));
 
   DEBUG("latency_counter_get_percentile: latency_interpolated = %.3f",
         CDTIME_T_TO_DOUBLE(latency_interpolated));
   return latency_interpolated;
 } /* }}} cdtime_t latency_counter_get_percentile */
 
+/* count_le returns the (approximate) number of latencies <= "latency". Events
+ * are assumed to be distributed uniformly within a bucket. */
+static double count_le(const latency_counter_t *lc, cdtime_t latency) /* {{{ */
+{
+  if (latency == 0)
+    return 0;
+
+  size_t bucket = latency_to_bucket(latency);
+  if (bucket < lc->bucket_first)
+    return 0;
+
+  size_t last = bucket - lc->bucket_first;
+  if (last >= lc->buckets_num)
+    return (double)lc->num;
+
+  double sum = 0;
+  for (size_t i = 0; i < last; i++)
+    sum += lc->buckets[i];
+
+  cdtime_t lower;
+  cdtime_t width;
+  bucket_bounds(bucket, &lower, &width);
+  assert(latency > lower);
+  sum += ((double)(latency - lower)) / ((double)width) * lc->buckets[last];
+
+  return sum;
+} /* }}} double count_le */
+
 double latency_counter_get_rate(const latency_counter_t *lc, /* {{{ */
                                 cdtime_t lower, cdtime_t upper,
                                 const cdtime_t now) {
@@ -294,51 +384,11 @@ double latency_counter_get_rate(const latency_counter_t *lc, /* {{{ */
   if (lower == upper)
     return 0;
 
-  /* Buckets have an exclusive lower bound and an inclusive upper bound. That
-   * means that the first bucket, index 0, represents (0-bin_width]. That means
-   * that latency==bin_width needs to result in bin=0, that's why we need to
-   * subtract one before dividing by bin_width. */
-  cdtime_t lower_bin = 0;
+  /* The interval is (lower, upper], so the rate is the number of events less
+   * than or equal to upper minus those less than or equal to lower. */
+  double sum = (upper ? count_le(lc, upper) : (double)lc->num);
   if (lower)
-    /* lower is *exclusive* => determine bucket for lower+1 */
-    lower_bin = ((lower + 1) - 1) / lc->bin_width;
-
-  /* lower is greater than the longest latency observed => rate is zero. */
-  if (lower_bin >= HISTOGRAM_NUM_BINS)
-    return 0;
-
-  cdtime_t upper_bin = HISTOGRAM_NUM_BINS - 1;
-  if (upper)
-    upper_bin = (upper - 1) / lc->bin_width;
-
-  if (upper_bin >= HISTOGRAM_NUM_BINS) {
-    upper_bin = HISTOGRAM_NUM_BINS - 1;
-    upper = 0;
-  }
-
-  double sum = 0;
-  for (size_t i = lower_bin; i <= upper_bin; i++)
-    sum += lc->histogram[i];
-
-  if (lower) {
-    /* Approximate ratio of requests in lower_bin, that fall between
-     * lower_bin_boundary and lower. This ratio is then subtracted from sum to
-     * increase accuracy. */
-    cdtime_t lower_bin_boundary = lower_bin * lc->bin_width;
-    assert(lower >= lower_bin_boundary);
-    double lower_ratio =
-        (double)(lower - lower_bin_boundary) / ((double)lc->bin_width);
-    sum -= lower_ratio * lc->histogram[lower_bin];
-  }
-
-  if (upper) {
-    /* As above: approximate ratio of requests in upper_bin, that fall between
-     * upper and upper_bin_boundary. */
-    cdtime_t upper_bin_boundary = (upper_bin + 1) * lc->bin_width;
-    assert(upper <= upper_bin_boundary);
-    double ratio = (double)(upper_bin_boundary - upper) / (double)lc->bin_width;
-    sum -= ratio * lc->histogram[upper_bin];
-  }
+    sum -= count_le(lc, lower);
 
   return sum / (CDTIME_T_TO_DOUBLE(now - lc->start_time));
 } /* }}} double latency_counter_get_rate */
@@ -28,10 +28,6 @@
 
 #include "utils_time.h"
 
-#ifndef HISTOGRAM_NUM_BINS
-#define HISTOGRAM_NUM_BINS 1000
-#endif
-
 struct latency_counter_s;
 typedef struct latency_counter_s latency_counter_t;
 
@@ -48,6 +44,17 @@ size_t latency_counter_get_num(latency_counter_t *lc);
 cdtime_t latency_counter_get_average(latency_counter_t *lc);
 cdtime_t latency_counter_get_percentile(latency_counter_t *lc, double percent);
 
+/*
+ * NAME
+ *  latency_counter_merge(dst,src)
+ *
+ * DESCRIPTION
+ *   Adds all values recorded in "src" to "dst", as if they had been passed to
+ *   latency_counter_add() of "dst" directly. "src" is not modified.
+ *   Returns zero on success, an errno value otherwise.
+ */
+int latency_counter_merge(latency_counter_t *dst, latency_counter_t const *src);
+
 /*
  * NAME
  *  latency_counter_get_rate(counter,lower,upper,now)
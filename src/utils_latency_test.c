@@ -109,8 +109,6 @@ DEF_TEST(get_rate) {
     size_t num;
     cdtime_t min;
     cdtime_t max;
-    cdtime_t bin_width;
-    int histogram[HISTOGRAM_NUM_BINS];
   } * peek;
   latency_counter_t *l;
 
@@ -121,71 +119,35 @@ DEF_TEST(get_rate) {
     latency_counter_add(l, TIME_T_TO_CDTIME_T(i));
   }
 
-  /* We expect a bucket width of 125ms. */
-  EXPECT_EQ_UINT64(DOUBLE_TO_CDTIME_T(0.125), peek->bin_width);
-
-  struct {
-    size_t index;
-    int want;
-  } bucket_cases[] = {
-      {0, 0},  /* (0.000-0.125] */
-      {1, 0},  /* (0.125-0.250] */
-      {2, 0},  /* (0.250-0.375] */
-      {3, 0},  /* (0.375-0.500] */
-      {4, 0},  /* (0.500-0.625] */
-      {5, 0},  /* (0.625-0.750] */
-      {6, 0},  /* (0.750-0.875] */
-      {7, 1},  /* (0.875-1.000] */
-      {8, 0},  /* (1.000-1.125] */
-      {9, 0},  /* (1.125-1.250] */
-      {10, 0}, /* (1.250-1.375] */
-      {11, 0}, /* (1.375-1.500] */
-      {12, 0}, /* (1.500-1.625] */
-      {13, 0}, /* (1.625-1.750] */
-      {14, 0}, /* (1.750-1.875] */
-      {15, 1}, /* (1.875-2.000] */
-      {16, 0}, /* (2.000-2.125] */
-  };
-
-  for (size_t i = 0; i < STATIC_ARRAY_SIZE(bucket_cases); i++) {
-    size_t index = bucket_cases[i].index;
-    EXPECT_EQ_INT(bucket_cases[i].want, peek->histogram[index]);
-  }
-
   struct {
     cdtime_t lower_bound;
     cdtime_t upper_bound;
     double want;
   } cases[] = {
       {
-          // bucket 6 is zero
-          DOUBLE_TO_CDTIME_T_STATIC(0.750), DOUBLE_TO_CDTIME_T_STATIC(0.875),
+          // no events between 0.5 and 0.9
+          DOUBLE_TO_CDTIME_T_STATIC(0.500), DOUBLE_TO_CDTIME_T_STATIC(0.900),
           0.00,
       },
       {
-          // bucket 7 contains the t=1 update
+          // contains the t=1 update
           DOUBLE_TO_CDTIME_T_STATIC(0.875), DOUBLE_TO_CDTIME_T_STATIC(1.000),
           1.00,
       },
       {
-          // range: bucket 7 - bucket 15; contains the t=1 and t=2 updates
+          // contains the t=1 and t=2 updates
           DOUBLE_TO_CDTIME_T_STATIC(0.875), DOUBLE_TO_CDTIME_T_STATIC(2.000),
           2.00,
       },
       {
-          // lower bucket is only partially applied
-          DOUBLE_TO_CDTIME_T_STATIC(0.875 + (0.125 / 4)),
-          DOUBLE_TO_CDTIME_T_STATIC(2.000), 1.75,
-      },
-      {
-          // upper bucket is only partially applied
-          DOUBLE_TO_CDTIME_T_STATIC(0.875),
-          DOUBLE_TO_CDTIME_T_STATIC(2.000 - (0.125 / 4)), 1.75,
+          // the bucket (99-100] is only partially applied
+          DOUBLE_TO_CDTIME_T_STATIC(99.750), DOUBLE_TO_CDTIME_T_STATIC(125.000),
+          25.25,
       },
       {
-          // both buckets are only partially applied
-          DOUBLE_TO_CDTIME_T_STATIC(0.875 + (0.125 / 4)),
-          DOUBLE_TO_CDTIME_T_STATIC(2.000 - (0.125 / 4)), 1.50,
+          // the buckets (99-100] and (119-120] are only partially applied
+          DOUBLE_TO_CDTIME_T_STATIC(99.750), DOUBLE_TO_CDTIME_T_STATIC(119.500),
+          19.75,
       },
       {
           // lower bound is unspecified
@@ -193,7 +155,7 @@ DEF_TEST(get_rate) {
       },
       {
           // upper bound is unspecified
-          DOUBLE_TO_CDTIME_T_STATIC(125.000 - 0.125), 0, 1.00,
+          DOUBLE_TO_CDTIME_T_STATIC(124.000), 0, 1.00,
       },
       {
           // overflow test: upper >> longest latency
@@ -225,10 +187,75 @@ DEF_TEST(get_rate) {
   return 0;
 }
 
+DEF_TEST(relative_error) {
+  latency_counter_t *l;
+
+  CHECK_NOT_NULL(l = latency_counter_create());
+
+  /* Heavy tailed distribution: 1ms .. ~17min. */
+  for (size_t i = 0; i < 1000; i++) {
+    double v = 0.001 * pow(1.0 + (1.0 / 64.0), (double)i);
+    latency_counter_add(l, DOUBLE_TO_CDTIME_T(v));
+  }
+
+  double percents[] = {1.0, 10.0, 50.0, 90.0, 99.0, 99.9};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(percents); i++) {
+    double want = 0.001 * pow(1.0 + (1.0 / 64.0), percents[i] * 10.0 - 1.0);
+    double got =
+        CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(l, percents[i]));
+    printf("# percentile(%g): want %g, got %g\n", percents[i], want, got);
+    OK(fabs(got - want) <= want / 32.0);
+  }
+
+  latency_counter_destroy(l);
+  return 0;
+}
+
+DEF_TEST(merge) {
+  latency_counter_t *a;
+  latency_counter_t *b;
+  latency_counter_t *all;
+
+  CHECK_NOT_NULL(a = latency_counter_create());
+  CHECK_NOT_NULL(b = latency_counter_create());
+  CHECK_NOT_NULL(all = latency_counter_create());
+
+  for (time_t i = 1; i <= 100; i++) {
+    /* Counters cover disjoint ranges so that "a" needs to grow. */
+    latency_counter_add((i <= 50) ? a : b, TIME_T_TO_CDTIME_T(i));
+    latency_counter_add(all, TIME_T_TO_CDTIME_T(i));
+  }
+
+  CHECK_ZERO(latency_counter_merge(a, b));
+
+  EXPECT_EQ_UINT64(latency_counter_get_num(all), latency_counter_get_num(a));
+  EXPECT_EQ_UINT64(latency_counter_get_min(all), latency_counter_get_min(a));
+  EXPECT_EQ_UINT64(latency_counter_get_max(all), latency_counter_get_max(a));
+  EXPECT_EQ_UINT64(latency_counter_get_sum(all), latency_counter_get_sum(a));
+
+  double percents[] = {10.0, 50.0, 80.0, 95.0, 99.0};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(percents); i++) {
+    EXPECT_EQ_UINT64(latency_counter_get_percentile(all, percents[i]),
+                     latency_counter_get_percentile(a, percents[i]));
+  }
+
+  /* Merging an empty counter is a no-op. */
+  latency_counter_reset(b);
+  CHECK_ZERO(latency_counter_merge(a, b));
+  EXPECT_EQ_UINT64(100, latency_counter_get_num(a));
+
+  latency_counter_destroy(a);
+  latency_counter_destroy(b);
+  latency_counter_destroy(all);
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(simple);
   RUN_TEST(percentile);
   RUN_TEST(get_rate);
+  RUN_TEST(relative_error);
+  RUN_TEST(merge);
 
   END_TEST;
 }
@@ -38,6 +38,7 @@
 
 struct cu_match_s {
   regex_t regex;
+  char *regex_string;
   regex_t excluderegex;
   int flags;
 
@@ -50,28 +51,6 @@ struct cu_match_s {
 /*
  * Private functions
  */
-static char *match_substr(const char *str, int begin, int end) {
-  char *ret;
-  size_t ret_len;
-
-  if ((begin < 0) || (end < 0) || (begin >= end))
-    return NULL;
-  if ((size_t)end > (strlen(str) + 1)) {
-    ERROR("utils_match: match_substr: `end' points after end of string.");
-    return NULL;
-  }
-
-  ret_len = end - begin;
-  ret = malloc(ret_len + 1);
-  if (ret == NULL) {
-    ERROR("utils_match: match_substr: malloc failed.");
-    return NULL;
-  }
-
-  sstrncpy(ret, str + begin, ret_len + 1);
-  return ret;
-} /* char *match_substr */
-
 static int default_callback(const char __attribute__((unused)) * str,
                             char *const *matches, size_t matches_num,
                             void *user_data) {
@@ -237,11 +216,21 @@ match_create_callback(const char *regex, const char *excluderegex,
   }
   obj->flags |= UTILS_MATCH_FLAGS_REGEX;
 
+  obj->regex_string = strdup(regex);
+  if (obj->regex_string == NULL) {
+    ERROR("utils_match: match_create_callback: strdup failed.");
+    regfree(&obj->regex);
+    sfree(obj);
+    return NULL;
+  }
+
   if (excluderegex && strcmp(excluderegex, "") != 0) {
     status = regcomp(&obj->excluderegex, excluderegex, REG_EXTENDED);
     if (status != 0) {
       ERROR("Compiling the excluding regular expression \"%s\" failed.",
             excluderegex);
+      regfree(&obj->regex);
+      sfree(obj->regex_string);
       sfree(obj);
       return NULL;
     }
@@ -307,6 +296,7 @@ void match_destroy(cu_match_t *obj) {
     regfree(&obj->regex);
   if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX)
     regfree(&obj->excluderegex);
+  sfree(obj->regex_string);
   if ((obj->user_data != NULL) && (obj->free != NULL))
     (*obj->free)(obj->user_data);
 
@@ -318,14 +308,26 @@ int match_apply(cu_match_t *obj, const char *str) {
   regmatch_t re_match[32];
   char *matches[32] = {0};
   size_t matches_num;
+  size_t str_len;
+  size_t buffer_size = 0;
+  char *buffer;
+  char *ptr;
 
   if ((obj == NULL) || (str == NULL))
     return -1;
 
+  status = regexec(&obj->regex, str, STATIC_ARRAY_SIZE(re_match), re_match,
+                   /* eflags = */ 0);
+
+  /* Regex did not match */
+  if (status != 0)
+    return 0;
+
+  /* The exclude regex is only relevant for lines that would be counted, so it
+   * is checked after the (usually more selective) regex. */
   if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX) {
-    status =
-        regexec(&obj->excluderegex, str, STATIC_ARRAY_SIZE(re_match), re_match,
-                /* eflags = */ 0);
+    status = regexec(&obj->excluderegex, str, /* nmatch = */ 0,
+                     /* pmatch = */ NULL, /* eflags = */ 0);
     /* Regex did match, so exclude this line */
     if (status == 0) {
       DEBUG("ExludeRegex matched, don't count that line\n");
@@ -333,39 +335,45 @@ int match_apply(cu_match_t *obj, const char *str) {
     }
   }
 
-  status = regexec(&obj->regex, str, STATIC_ARRAY_SIZE(re_match), re_match,
-                   /* eflags = */ 0);
-
-  /* Regex did not match */
-  if (status != 0)
-    return 0;
-
+  str_len = strlen(str);
   for (matches_num = 0; matches_num < STATIC_ARRAY_SIZE(matches);
        matches_num++) {
-    if ((re_match[matches_num].rm_so < 0) || (re_match[matches_num].rm_eo < 0))
-      break;
+    regoff_t begin = re_match[matches_num].rm_so;
+    regoff_t end = re_match[matches_num].rm_eo;
 
-    matches[matches_num] = match_substr(str, re_match[matches_num].rm_so,
-                                        re_match[matches_num].rm_eo);
-    if (matches[matches_num] == NULL) {
-      status = -1;
+    if ((begin < 0) || (end < 0))
       break;
+    if ((begin >= end) || ((size_t)end > str_len)) {
+      ERROR("utils_match: match_apply: Invalid sub-match %zu.", matches_num);
+      return -1;
     }
+
+    buffer_size += (size_t)(end - begin) + 1;
   }
 
-  if (status != 0) {
-    ERROR("utils_match: match_apply: match_substr failed.");
-  } else {
-    status = obj->callback(str, matches, matches_num, obj->user_data);
-    if (status != 0) {
-      ERROR("utils_match: match_apply: callback failed.");
-    }
+  /* All sub-matches share a single allocation. */
+  buffer = malloc(buffer_size + 1);
+  if (buffer == NULL) {
+    ERROR("utils_match: match_apply: malloc failed.");
+    return -1;
   }
 
+  ptr = buffer;
   for (size_t i = 0; i < matches_num; i++) {
-    sfree(matches[i]);
+    size_t len = (size_t)(re_match[i].rm_eo - re_match[i].rm_so);
+
+    memcpy(ptr, str + re_match[i].rm_so, len);
+    ptr[len] = 0;
+    matches[i] = ptr;
+    ptr += len + 1;
+  }
+
+  status = obj->callback(str, matches, matches_num, obj->user_data);
+  if (status != 0) {
+    ERROR("utils_match: match_apply: callback failed.");
   }
 
+  sfree(buffer);
   return status;
 } /* int match_apply */
 
@@ -374,3 +382,9 @@ void *match_get_user_data(cu_match_t *obj) {
     return NULL;
   return obj->user_data;
 } /* void *match_get_user_data */
+
+const char *match_get_regex(cu_match_t *obj) {
+  if (obj == NULL)
+    return NULL;
+  return obj->regex_string;
+} /* const char *match_get_regex */
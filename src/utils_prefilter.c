@@ -0,0 +1,359 @@
+/**
+ * collectd - src/utils_prefilter.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+
+#include "utils_prefilter.h"
+
+#define PREFILTER_LITERAL_MAX 64
+
+typedef struct pf_node_s {
+  int child;   /* first child */
+  int sibling; /* next child of the same parent */
+  int fail;    /* longest proper suffix that is also in the trie */
+  int dict;    /* next node on the fail chain that ends a literal */
+  int out;     /* first expression ending here, or -1 */
+  unsigned char c;
+} pf_node_t;
+
+struct cu_prefilter_s {
+  _Bool *has_literal;
+  int *out_next; /* next expression with the same literal, or -1 */
+  size_t num;
+
+  pf_node_t *nodes;
+  size_t nodes_num;
+};
+
+/* Returns a pointer to the closing bracket of the bracket expression starting
+ * at "ptr", or to the terminating null byte. */
+static char const *pf_skip_bracket(char const *ptr) /* {{{ */
+{
+  ptr++;
+  if (*ptr == '^')
+    ptr++;
+  if (*ptr == ']')
+    ptr++;
+
+  while ((*ptr != 0) && (*ptr != ']')) {
+    if ((ptr[0] == '[') &&
+        ((ptr[1] == ':') || (ptr[1] == '.') || (ptr[1] == '='))) {
+      char delim = ptr[1];
+      ptr += 2;
+      while ((ptr[0] != 0) && !((ptr[0] == delim) && (ptr[1] == ']')))
+        ptr++;
+      if (ptr[0] != 0)
+        ptr += 2;
+      continue;
+    }
+    ptr++;
+  }
+
+  return ptr;
+} /* }}} char const *pf_skip_bracket */
+
+size_t prefilter_literal(char const *regex, char *buffer, /* {{{ */
+                         size_t buffer_size) {
+  char run[PREFILTER_LITERAL_MAX];
+  size_t run_len = 0;
+  size_t best_len = 0;
+  _Bool last_literal = 0;
+  int depth = 0;
+
+  if ((regex == NULL) || (buffer == NULL) || (buffer_size == 0))
+    return 0;
+  buffer[0] = 0;
+
+#define PF_LITERAL_FLUSH()                                                     \
+  do {                                                                         \
+    if ((run_len > best_len) && (run_len < buffer_size)) {                     \
+      memcpy(buffer, run, run_len);                                            \
+      buffer[run_len] = 0;                                                     \
+      best_len = run_len;                                                      \
+    }                                                                          \
+    run_len = 0;                                                               \
+    last_literal = 0;                                                          \
+  } while (0)
+
+  for (char const *ptr = regex; *ptr != 0; ptr++) {
+    if (depth > 0) {
+      if ((*ptr == '\\') && (ptr[1] != 0))
+        ptr++;
+      else if (*ptr == '[')
+        ptr = pf_skip_bracket(ptr);
+      else if (*ptr == '(')
+        depth++;
+      else if (*ptr == ')')
+        depth--;
+
+      if (*ptr == 0)
+        break;
+      continue;
+    }
+
+    switch (*ptr) {
+    case '|':
+      return 0;
+
+    case '\\':
+      if ((ptr[1] == 0) || isalnum((unsigned char)ptr[1])) {
+        PF_LITERAL_FLUSH();
+        if (ptr[1] != 0)
+          ptr++;
+        break;
+      }
+      ptr++;
+      if (run_len >= sizeof(run))
+        PF_LITERAL_FLUSH();
+      run[run_len++] = *ptr;
+      last_literal = 1;
+      break;
+
+    case '[':
+      PF_LITERAL_FLUSH();
+      ptr = pf_skip_bracket(ptr);
+      break;
+
+    case '(':
+      PF_LITERAL_FLUSH();
+      depth = 1;
+      break;
+
+    case '*':
+    case '?':
+    case '{':
+      /* The preceding character is optional. */
+      if (last_literal)
+        run_len--;
+      PF_LITERAL_FLUSH();
+      if (*ptr == '{') {
+        while ((*ptr != 0) && (*ptr != '}'))
+          ptr++;
+      }
+      break;
+
+    case '+':
+    case '.':
+    case '^':
+    case '$':
+    case ')':
+      PF_LITERAL_FLUSH();
+      break;
+
+    default:
+      if (run_len >= sizeof(run))
+        PF_LITERAL_FLUSH();
+      run[run_len++] = *ptr;
+      last_literal = 1;
+    }
+
+    if (*ptr == 0)
+      break;
+  }
+  PF_LITERAL_FLUSH();
+
+#undef PF_LITERAL_FLUSH
+
+  return best_len;
+} /* }}} size_t prefilter_literal */
+
+static int pf_child(pf_node_t const *nodes, int node, unsigned char c) {
+  for (int child = nodes[node].child; child > 0; child = nodes[child].sibling)
+    if (nodes[child].c == c)
+      return child;
+  return -1;
+} /* int pf_child */
+
+static int pf_add_node(cu_prefilter_t *pf) /* {{{ */
+{
+  pf_node_t *tmp;
+
+  tmp = realloc(pf->nodes, (pf->nodes_num + 1) * sizeof(*pf->nodes));
+  if (tmp == NULL)
+    return -1;
+  pf->nodes = tmp;
+  pf->nodes[pf->nodes_num] = (pf_node_t){.out = -1};
+
+  return (int)pf->nodes_num++;
+} /* }}} int pf_add_node */
+
+static int pf_insert(cu_prefilter_t *pf, char const *literal, /* {{{ */
+                     int id) {
+  int node = 0;
+
+  for (unsigned char const *ptr = (unsigned char const *)literal; *ptr != 0;
+       ptr++) {
+    int child = pf_child(pf->nodes, node, *ptr);
+    if (child < 0) {
+      child = pf_add_node(pf);
+      if (child < 0)
+        return -1;
+      pf->nodes[child].c = *ptr;
+      pf->nodes[child].sibling = pf->nodes[node].child;
+      pf->nodes[node].child = child;
+    }
+    node = child;
+  }
+
+  pf->out_next[id] = pf->nodes[node].out;
+  pf->nodes[node].out = id;
+  return 0;
+} /* }}} int pf_insert */
+
+cu_prefilter_t *prefilter_create(void) /* {{{ */
+{
+  cu_prefilter_t *pf = calloc(1, sizeof(*pf));
+  if (pf == NULL)
+    return NULL;
+
+  if (pf_add_node(pf) != 0) {
+    sfree(pf);
+    return NULL;
+  }
+
+  return pf;
+} /* }}} cu_prefilter_t *prefilter_create */
+
+void prefilter_destroy(cu_prefilter_t *pf) /* {{{ */
+{
+  if (pf == NULL)
+    return;
+
+  sfree(pf->has_literal);
+  sfree(pf->out_next);
+  sfree(pf->nodes);
+  sfree(pf);
+} /* }}} void prefilter_destroy */
+
+int prefilter_add(cu_prefilter_t *pf, char const *regex) /* {{{ */
+{
+  char literal[PREFILTER_LITERAL_MAX];
+  _Bool *has_literal;
+  int *out_next;
+  int id;
+
+  if ((pf == NULL) || (regex == NULL) || (pf->num >= INT_MAX))
+    return -1;
+
+  has_literal = realloc(pf->has_literal, (pf->num + 1) * sizeof(*has_literal));
+  if (has_literal == NULL)
+    return -1;
+  pf->has_literal = has_literal;
+
+  out_next = realloc(pf->out_next, (pf->num + 1) * sizeof(*out_next));
+  if (out_next == NULL)
+    return -1;
+  pf->out_next = out_next;
+
+  id = (int)pf->num;
+  pf->has_literal[id] = 0;
+  pf->out_next[id] = -1;
+
+  if (prefilter_literal(regex, literal, sizeof(literal)) > 0) {
+    if (pf_insert(pf, literal, id) != 0)
+      return -1;
+    pf->has_literal[id] = 1;
+  }
+
+  pf->num++;
+  return id;
+} /* }}} int prefilter_add */
+
+/* Computes the fail and dictionary links in breadth first order. */
+int prefilter_compile(cu_prefilter_t *pf) /* {{{ */
+{
+  pf_node_t *nodes;
+  int *queue;
+  size_t head = 0;
+  size_t tail = 0;
+
+  if (pf == NULL)
+    return EINVAL;
+  nodes = pf->nodes;
+
+  queue = calloc(pf->nodes_num, sizeof(*queue));
+  if (queue == NULL)
+    return ENOMEM;
+
+  for (int child = nodes[0].child; child > 0; child = nodes[child].sibling)
+    queue[tail++] = child;
+
+  while (head < tail) {
+    int node = queue[head++];
+
+    for (int child = nodes[node].child; child > 0;
+         child = nodes[child].sibling) {
+      int fail = nodes[node].fail;
+      int next;
+
+      while (((next = pf_child(nodes, fail, nodes[child].c)) < 0) &&
+             (fail != 0))
+        fail = nodes[fail].fail;
+
+      nodes[child].fail = (next < 0) ? 0 : next;
+      nodes[child].dict = (nodes[nodes[child].fail].out >= 0)
+                              ? nodes[child].fail
+                              : nodes[nodes[child].fail].dict;
+      queue[tail++] = child;
+    }
+  }
+
+  sfree(queue);
+  return 0;
+} /* }}} int prefilter_compile */
+
+size_t prefilter_size(cu_prefilter_t const *pf) /* {{{ */
+{
+  return (pf == NULL) ? 0 : pf->num;
+} /* }}} size_t prefilter_size */
+
+void prefilter_candidates(cu_prefilter_t const *pf, /* {{{ */
+                          char const *str, _Bool *candidates) {
+  pf_node_t const *nodes;
+  int node = 0;
+
+  if (pf == NULL)
+    return;
+  nodes = pf->nodes;
+
+  for (size_t i = 0; i < pf->num; i++)
+    candidates[i] = !pf->has_literal[i];
+
+  if (str == NULL)
+    return;
+
+  for (unsigned char const *ptr = (unsigned char const *)str; *ptr != 0;
+       ptr++) {
+    int next;
+
+    while (((next = pf_child(nodes, node, *ptr)) < 0) && (node != 0))
+      node = nodes[node].fail;
+    node = (next < 0) ? 0 : next;
+
+    for (int n = (nodes[node].out >= 0) ? node : nodes[node].dict; n > 0;
+         n = nodes[n].dict)
+      for (int id = nodes[n].out; id >= 0; id = pf->out_next[id])
+        candidates[id] = 1;
+  }
+} /* }}} void prefilter_candidates */
@@ -0,0 +1,119 @@
+/**
+ * collectd - src/utils_prefilter.h
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *   Speeds up matching a string against many extended regular expressions.
+ *   For each expression a literal string that every match has to contain is
+ *   extracted. All of these strings are searched for in a single pass using
+ *   an Aho-Corasick automaton, so that only the expressions whose string was
+ *   found (or which have none) need to be executed.
+ **/
+
+#ifndef UTILS_PREFILTER_H
+#define UTILS_PREFILTER_H 1
+
+#include "collectd.h"
+
+struct cu_prefilter_s;
+typedef struct cu_prefilter_s cu_prefilter_t;
+
+/*
+ * NAME
+ *   prefilter_create
+ *
+ * DESCRIPTION
+ *   Allocates a new, empty prefilter.
+ */
+cu_prefilter_t *prefilter_create(void);
+
+/*
+ * NAME
+ *   prefilter_destroy
+ *
+ * DESCRIPTION
+ *   Frees all memory used by the prefilter.
+ */
+void prefilter_destroy(cu_prefilter_t *pf);
+
+/*
+ * NAME
+ *   prefilter_add
+ *
+ * DESCRIPTION
+ *   Adds the extended regular expression `regex'. Expressions are numbered in
+ *   the order they are added, starting at zero. Must not be called after
+ *   `prefilter_compile'.
+ *
+ * RETURN VALUE
+ *   The number of the expression on success, a negative value on failure.
+ */
+int prefilter_add(cu_prefilter_t *pf, char const *regex);
+
+/*
+ * NAME
+ *   prefilter_compile
+ *
+ * DESCRIPTION
+ *   Finishes the prefilter after all expressions have been added.
+ *
+ * RETURN VALUE
+ *   Zero on success, non-zero otherwise.
+ */
+int prefilter_compile(cu_prefilter_t *pf);
+
+/*
+ * NAME
+ *   prefilter_size
+ *
+ * DESCRIPTION
+ *   Returns the number of expressions added to the prefilter.
+ */
+size_t prefilter_size(cu_prefilter_t const *pf);
+
+/*
+ * NAME
+ *   prefilter_candidates
+ *
+ * DESCRIPTION
+ *   Scans `str' once and sets `candidates[i]' to true for every expression
+ *   `i' that may match it, and to false for every expression that can't.
+ *   `candidates' must have room for `prefilter_size' elements. May be called
+ *   from multiple threads concurrently.
+ */
+void prefilter_candidates(cu_prefilter_t const *pf, char const *str,
+                          _Bool *candidates);
+
+/*
+ * NAME
+ *   prefilter_literal
+ *
+ * DESCRIPTION
+ *   Stores the longest string that every match of the extended regular
+ *   expression `regex' contains in `buffer'. Errs on the side of returning
+ *   shorter strings: groups, bracket expressions and escapes such as "\w" end
+ *   a string, and alternations outside of groups disable the search.
+ *
+ * RETURN VALUE
+ *   The length of the string, or zero if no such string could be determined.
+ */
+size_t prefilter_literal(char const *regex, char *buffer, size_t buffer_size);
+
+#endif /* UTILS_PREFILTER_H */
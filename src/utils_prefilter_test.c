@@ -0,0 +1,160 @@
+/**
+ * collectd - src/utils_prefilter_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils_prefilter.h"
+
+#include <regex.h>
+
+DEF_TEST(literal) {
+  struct {
+    char const *regex;
+    char const *want;
+  } cases[] = {
+      {"foo", "foo"},
+      {"^/usr/sbin/sshd", "/usr/sbin/sshd"},
+      {"GET (/[a-z]+) HTTP", " HTTP"},
+      {"status=([0-9]+) bytes", "status="},
+      {"colou?r", "colo"},
+      {"ab*cdef", "cdef"},
+      {"a{2}bcd", "bcd"},
+      {"\\[error\\] client", "[error] client"},
+      {"\\wfoo\\s+barbaz", "barbaz"},
+      {"[fo]oo|bar", ""},
+      {"(foo|bar)", ""},
+      {"(foo|bar)baz", "baz"},
+      {"[]ab]xyz", "xyz"},
+      {"[[:digit:]]+ms", "ms"},
+      {".*", ""},
+      {"", ""},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    char buffer[64];
+
+    printf("# case %zu: regex = \"%s\"\n", i, cases[i].regex);
+    EXPECT_EQ_INT((int)strlen(cases[i].want),
+                  (int)prefilter_literal(cases[i].regex, buffer,
+                                         sizeof(buffer)));
+    EXPECT_EQ_STR(cases[i].want, buffer);
+  }
+
+  return 0;
+}
+
+DEF_TEST(candidates) {
+  char const *regexes[] = {
+      "GET (/[a-z]+) HTTP", "POST", "error: (.*)", "[0-9]+", "rror: dis",
+  };
+  struct {
+    char const *str;
+    _Bool want[STATIC_ARRAY_SIZE(regexes)];
+  } cases[] = {
+      {"GET /index HTTP/1.1", {1, 0, 0, 1, 0}},
+      {"POST /form HTTP/1.1", {1, 1, 0, 1, 0}},
+      {"error: disk full", {0, 0, 1, 1, 1}},
+      {"nothing to see", {0, 0, 0, 1, 0}},
+      {"", {0, 0, 0, 1, 0}},
+  };
+  cu_prefilter_t *pf;
+
+  CHECK_NOT_NULL(pf = prefilter_create());
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(regexes); i++)
+    EXPECT_EQ_INT((int)i, prefilter_add(pf, regexes[i]));
+  CHECK_ZERO(prefilter_compile(pf));
+  EXPECT_EQ_INT((int)STATIC_ARRAY_SIZE(regexes), (int)prefilter_size(pf));
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    _Bool got[STATIC_ARRAY_SIZE(regexes)];
+
+    prefilter_candidates(pf, cases[i].str, got);
+    for (size_t j = 0; j < STATIC_ARRAY_SIZE(regexes); j++) {
+      printf("# case %zu: str = \"%s\", regex = \"%s\"\n", i, cases[i].str,
+             regexes[j]);
+      EXPECT_EQ_INT(cases[i].want[j], got[j]);
+    }
+  }
+
+  prefilter_destroy(pf);
+  return 0;
+}
+
+/* Every string a regular expression matches has to be a candidate. */
+DEF_TEST(no_false_negatives) {
+  char const *regexes[] = {
+      "abc",   "b+c",       "^a.c$", "x(ab|cd)y", "ab?c",
+      "a\\.b", "[ab]c{1,}", "ca",    "aab",       "bca|x",
+  };
+  char const alphabet[] = "abcxy.";
+  cu_prefilter_t *pf;
+  regex_t re[STATIC_ARRAY_SIZE(regexes)];
+
+  CHECK_NOT_NULL(pf = prefilter_create());
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(regexes); i++) {
+    CHECK_ZERO(regcomp(&re[i], regexes[i], REG_EXTENDED | REG_NOSUB));
+    EXPECT_EQ_INT((int)i, prefilter_add(pf, regexes[i]));
+  }
+  CHECK_ZERO(prefilter_compile(pf));
+
+  /* All strings of up to five characters over the alphabet. */
+  for (size_t len = 0; len <= 5; len++) {
+    size_t total = 1;
+    for (size_t i = 0; i < len; i++)
+      total *= sizeof(alphabet) - 1;
+
+    for (size_t n = 0; n < total; n++) {
+      char str[6] = {0};
+      _Bool got[STATIC_ARRAY_SIZE(regexes)];
+      size_t tmp = n;
+
+      for (size_t i = 0; i < len; i++) {
+        str[i] = alphabet[tmp % (sizeof(alphabet) - 1)];
+        tmp /= sizeof(alphabet) - 1;
+      }
+
+      prefilter_candidates(pf, str, got);
+      for (size_t i = 0; i < STATIC_ARRAY_SIZE(regexes); i++) {
+        if (got[i] || (regexec(&re[i], str, 0, NULL, 0) != 0))
+          continue;
+        printf("# \"%s\" matches \"%s\" but is no candidate\n", str,
+               regexes[i]);
+        OK(0);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(regexes); i++)
+    regfree(&re[i]);
+  prefilter_destroy(pf);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(literal);
+  RUN_TEST(candidates);
+  RUN_TEST(no_false_negatives);
+
+  END_TEST;
+}
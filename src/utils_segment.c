@@ -0,0 +1,870 @@
+/**
+ * collectd - src/utils_segment.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "utils_segment.h"
+
+#include <sys/mman.h>
+
+/* File header: magic, version, header size, start time and the offset of the
+ * first unused byte. The latter is updated after each record, so a reader
+ * never sees a partially written record. */
+#define SEGMENT_MAGIC "CDSEGMNT"
+#define SEGMENT_VERSION 1
+#define SEGMENT_HEADER_SIZE 32
+#define SEGMENT_HEADER_DATA_END 24
+
+/* Every record starts with its type, three reserved bytes and its size. */
+#define SEGMENT_RECORD_HEADER_SIZE 8
+#define SEGMENT_SERIES_HEADER_SIZE (SEGMENT_RECORD_HEADER_SIZE + 8)
+#define SEGMENT_BLOCK_HEADER_SIZE (SEGMENT_RECORD_HEADER_SIZE + 28)
+
+#define SEGMENT_GROW_MIN (1024 * 1024)
+#define SEGMENT_GROW_MAX (64 * 1024 * 1024)
+
+struct segment_file_s {
+  int fd;
+  uint8_t *map;
+  size_t map_size;
+  size_t used;
+  uint32_t next_id;
+};
+
+struct segment_reader_s {
+  uint8_t *map;
+  size_t map_size;
+  size_t end;
+  size_t offset;
+  uint64_t start;
+};
+
+/*
+ * Byte order
+ */
+static void seg_put_u16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void seg_put_u32(uint8_t *p, uint32_t v) {
+  for (size_t i = 0; i < 4; i++)
+    p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void seg_put_u64(uint8_t *p, uint64_t v) {
+  for (size_t i = 0; i < 8; i++)
+    p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint16_t seg_get_u16(uint8_t const *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t seg_get_u32(uint8_t const *p) {
+  uint32_t v = 0;
+  for (size_t i = 0; i < 4; i++)
+    v |= ((uint32_t)p[i]) << (8 * i);
+  return v;
+}
+
+static uint64_t seg_get_u64(uint8_t const *p) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < 8; i++)
+    v |= ((uint64_t)p[i]) << (8 * i);
+  return v;
+}
+
+/*
+ * Bit streams
+ */
+static int seg_leading_zeros(uint64_t x) /* {{{ */
+{
+#if defined(__GNUC__)
+  return __builtin_clzll((unsigned long long)x);
+#else
+  int n = 0;
+  while (!(x & (UINT64_C(1) << 63))) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+#endif
+} /* }}} int seg_leading_zeros */
+
+static int seg_trailing_zeros(uint64_t x) /* {{{ */
+{
+#if defined(__GNUC__)
+  return __builtin_ctzll((unsigned long long)x);
+#else
+  int n = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+#endif
+} /* }}} int seg_trailing_zeros */
+
+/* Appends the `n' least significant bits of `v', most significant first. */
+static int seg_put_bits(segment_column_t *c, uint64_t v, int n) /* {{{ */
+{
+  if (c->bits + (size_t)n > 8 * c->size) {
+    size_t size = (c->size == 0) ? 64 : 2 * c->size;
+    uint8_t *tmp = realloc(c->data, size);
+    if (tmp == NULL)
+      return ENOMEM;
+    memset(tmp + c->size, 0, size - c->size);
+    c->data = tmp;
+    c->size = size;
+  }
+
+  while (n > 0) {
+    int avail = 8 - (int)(c->bits % 8);
+    int take = (n < avail) ? n : avail;
+    uint8_t chunk = (uint8_t)((v >> (n - take)) & ((1u << take) - 1));
+
+    c->data[c->bits / 8] |= (uint8_t)(chunk << (avail - take));
+    c->bits += (size_t)take;
+    n -= take;
+  }
+
+  return 0;
+} /* }}} int seg_put_bits */
+
+static int seg_get_bits(segment_decoder_t *d, int n, /* {{{ */
+                        uint64_t *ret) {
+  uint64_t v = 0;
+
+  if (d->pos + (size_t)n > d->bits)
+    return -1;
+
+  while (n > 0) {
+    int avail = 8 - (int)(d->pos % 8);
+    int take = (n < avail) ? n : avail;
+
+    v = (v << take) |
+        ((d->data[d->pos / 8] >> (avail - take)) & ((1u << take) - 1));
+    d->pos += (size_t)take;
+    n -= take;
+  }
+
+  *ret = v;
+  return 0;
+} /* }}} int seg_get_bits */
+
+/*
+ * Column encoding
+ */
+void segment_column_init(segment_column_t *c, int encoding) /* {{{ */
+{
+  memset(c, 0, sizeof(*c));
+  c->encoding = encoding;
+  c->prev_leading = -1;
+} /* }}} void segment_column_init */
+
+void segment_column_reset(segment_column_t *c) /* {{{ */
+{
+  if (c->data != NULL)
+    memset(c->data, 0, (c->bits + 7) / 8);
+  c->bits = 0;
+  c->count = 0;
+  c->prev = 0;
+  c->prev_delta = 0;
+  c->prev_leading = -1;
+  c->prev_trailing = 0;
+} /* }}} void segment_column_reset */
+
+void segment_column_destroy(segment_column_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return;
+  free(c->data);
+  segment_column_init(c, c->encoding);
+} /* }}} void segment_column_destroy */
+
+size_t segment_column_size(segment_column_t const *c) /* {{{ */
+{
+  return (c->bits + 7) / 8;
+} /* }}} size_t segment_column_size */
+
+/* Delta-of-delta encoding. The zig-zag encoded difference between two
+ * consecutive deltas is stored with a prefix selecting its width:
+ *   0    -> unchanged delta
+ *   10   -> 7 bits
+ *   110  -> 12 bits
+ *   1110 -> 20 bits
+ *   1111 -> 64 bits */
+int segment_column_add_int64(segment_column_t *c, int64_t value) /* {{{ */
+{
+  uint64_t v = (uint64_t)value;
+  int64_t delta;
+  uint64_t dod;
+  uint64_t zz;
+  int status;
+
+  if (c->count == 0) {
+    status = seg_put_bits(c, v, 64);
+    if (status != 0)
+      return status;
+    c->prev = v;
+    c->prev_delta = 0;
+    c->count++;
+    return 0;
+  }
+
+  delta = (int64_t)(v - c->prev);
+  dod = (uint64_t)delta - (uint64_t)c->prev_delta;
+  zz = (dod << 1) ^ (uint64_t)((int64_t)dod >> 63);
+
+  if (zz == 0)
+    status = seg_put_bits(c, 0, 1);
+  else if (zz < (UINT64_C(1) << 7))
+    status = seg_put_bits(c, (UINT64_C(0x2) << 7) | zz, 2 + 7);
+  else if (zz < (UINT64_C(1) << 12))
+    status = seg_put_bits(c, (UINT64_C(0x6) << 12) | zz, 3 + 12);
+  else if (zz < (UINT64_C(1) << 20))
+    status = seg_put_bits(c, (UINT64_C(0xe) << 20) | zz, 4 + 20);
+  else if ((status = seg_put_bits(c, 0xf, 4)) == 0)
+    status = seg_put_bits(c, zz, 64);
+  if (status != 0)
+    return status;
+
+  c->prev = v;
+  c->prev_delta = delta;
+  c->count++;
+  return 0;
+} /* }}} int segment_column_add_int64 */
+
+/* XOR encoding. Each value is XORed with its predecessor:
+ *   0  -> identical value
+ *   10 -> the meaningful bits fit into the previous window
+ *   11 -> 5 bits of leading zeros, 6 bits of meaningful bits, the bits */
+int segment_column_add_double(segment_column_t *c, double value) /* {{{ */
+{
+  uint64_t v;
+  uint64_t x;
+  int leading;
+  int trailing;
+  int status;
+
+  memcpy(&v, &value, sizeof(v));
+
+  if (c->count == 0) {
+    status = seg_put_bits(c, v, 64);
+    if (status != 0)
+      return status;
+    c->prev = v;
+    c->count++;
+    return 0;
+  }
+
+  x = v ^ c->prev;
+  if (x == 0) {
+    status = seg_put_bits(c, 0, 1);
+    if (status != 0)
+      return status;
+    c->count++;
+    return 0;
+  }
+
+  leading = seg_leading_zeros(x);
+  if (leading > 31)
+    leading = 31;
+  trailing = seg_trailing_zeros(x);
+
+  if ((c->prev_leading >= 0) && (leading >= c->prev_leading) &&
+      (trailing >= c->prev_trailing)) {
+    int width = 64 - c->prev_leading - c->prev_trailing;
+
+    status = seg_put_bits(c, 0x2, 2);
+    if (status == 0)
+      status = seg_put_bits(c, x >> c->prev_trailing, width);
+  } else {
+    int width = 64 - leading - trailing;
+
+    status = seg_put_bits(
+        c, (UINT64_C(0x3) << 11) | ((uint64_t)leading << 6) | (width & 0x3f),
+        2 + 5 + 6);
+    if (status == 0)
+      status = seg_put_bits(c, x >> trailing, width);
+    c->prev_leading = leading;
+    c->prev_trailing = trailing;
+  }
+  if (status != 0)
+    return status;
+
+  c->prev = v;
+  c->count++;
+  return 0;
+} /* }}} int segment_column_add_double */
+
+/*
+ * Column decoding
+ */
+void segment_decoder_init(segment_decoder_t *d, int encoding, /* {{{ */
+                          void const *data, size_t size) {
+  memset(d, 0, sizeof(*d));
+  d->encoding = encoding;
+  d->data = data;
+  d->bits = 8 * size;
+  d->prev_leading = -1;
+} /* }}} void segment_decoder_init */
+
+int segment_decoder_next_int64(segment_decoder_t *d, /* {{{ */
+                               int64_t *ret_value) {
+  uint64_t bit = 0;
+  uint64_t zz = 0;
+  int64_t dod;
+  int width = 0;
+
+  if (d->count == 0) {
+    if (seg_get_bits(d, 64, &d->prev) != 0)
+      return -1;
+    d->prev_delta = 0;
+    d->count++;
+    *ret_value = (int64_t)d->prev;
+    return 0;
+  }
+
+  /* Count the leading ones of the prefix, up to four. */
+  for (int ones = 0; ones < 4; ones++) {
+    if (seg_get_bits(d, 1, &bit) != 0)
+      return -1;
+    if (bit == 0) {
+      static int const widths[] = {0, 7, 12, 20};
+      width = widths[ones];
+      break;
+    }
+    width = 64;
+  }
+  if ((width > 0) && (seg_get_bits(d, width, &zz) != 0))
+    return -1;
+
+  dod = (int64_t)((zz >> 1) ^ (~(zz & 1) + 1));
+  d->prev_delta = (int64_t)((uint64_t)d->prev_delta + (uint64_t)dod);
+  d->prev += (uint64_t)d->prev_delta;
+  d->count++;
+
+  *ret_value = (int64_t)d->prev;
+  return 0;
+} /* }}} int segment_decoder_next_int64 */
+
+int segment_decoder_next_double(segment_decoder_t *d, /* {{{ */
+                                double *ret_value) {
+  uint64_t bit;
+  uint64_t x;
+
+  if (d->count == 0) {
+    if (seg_get_bits(d, 64, &d->prev) != 0)
+      return -1;
+  } else {
+    if (seg_get_bits(d, 1, &bit) != 0)
+      return -1;
+
+    if (bit != 0) {
+      if (seg_get_bits(d, 1, &bit) != 0)
+        return -1;
+
+      if (bit != 0) {
+        uint64_t tmp;
+        int width;
+
+        if (seg_get_bits(d, 5 + 6, &tmp) != 0)
+          return -1;
+        d->prev_leading = (int)(tmp >> 6);
+        width = (int)(tmp & 0x3f);
+        if (width == 0)
+          width = 64;
+        d->prev_trailing = 64 - d->prev_leading - width;
+        if (d->prev_trailing < 0)
+          return -1;
+      } else if (d->prev_leading < 0) {
+        return -1;
+      }
+
+      if (seg_get_bits(d, 64 - d->prev_leading - d->prev_trailing, &x) != 0)
+        return -1;
+      d->prev ^= x << d->prev_trailing;
+    }
+  }
+
+  d->count++;
+  memcpy(ret_value, &d->prev, sizeof(*ret_value));
+  return 0;
+} /* }}} int segment_decoder_next_double */
+
+/*
+ * Record parsing
+ */
+static int seg_parse_series(uint8_t const *p, size_t size, /* {{{ */
+                            segment_record_t *rec) {
+  size_t identifier_size;
+  size_t offset;
+
+  if (size < SEGMENT_SERIES_HEADER_SIZE)
+    return -1;
+
+  rec->id = seg_get_u32(p + 8);
+  rec->ds_num = seg_get_u16(p + 12);
+  identifier_size = seg_get_u16(p + 14);
+  if ((rec->ds_num > SEGMENT_DS_MAX) || (identifier_size == 0))
+    return -1;
+
+  offset = SEGMENT_SERIES_HEADER_SIZE;
+  if ((size - offset < identifier_size) ||
+      (p[offset + identifier_size - 1] != 0))
+    return -1;
+  rec->identifier = (char const *)(p + offset);
+  offset += identifier_size;
+
+  for (size_t i = 0; i < rec->ds_num; i++) {
+    size_t name_size;
+
+    if (size - offset < 2)
+      return -1;
+    rec->ds_types[i] = p[offset];
+    name_size = p[offset + 1];
+    offset += 2;
+
+    if ((name_size == 0) || (size - offset < name_size) ||
+        (p[offset + name_size - 1] != 0))
+      return -1;
+    rec->ds_names[i] = (char const *)(p + offset);
+    offset += name_size;
+  }
+
+  return 0;
+} /* }}} int seg_parse_series */
+
+static int seg_parse_block(uint8_t const *p, size_t size, /* {{{ */
+                           segment_record_t *rec) {
+  size_t offset;
+
+  if (size < SEGMENT_BLOCK_HEADER_SIZE)
+    return -1;
+
+  rec->id = seg_get_u32(p + 8);
+  rec->count = seg_get_u32(p + 12);
+  rec->t_first = seg_get_u64(p + 16);
+  rec->t_last = seg_get_u64(p + 24);
+  rec->columns_num = seg_get_u16(p + 32);
+  if ((rec->columns_num == 0) || (rec->columns_num > SEGMENT_DS_MAX + 1))
+    return -1;
+
+  offset = SEGMENT_BLOCK_HEADER_SIZE;
+  if (size - offset < 4 * rec->columns_num)
+    return -1;
+  for (size_t i = 0; i < rec->columns_num; i++)
+    rec->columns_size[i] = seg_get_u32(p + offset + 4 * i);
+  offset += 4 * rec->columns_num;
+
+  for (size_t i = 0; i < rec->columns_num; i++) {
+    if (size - offset < rec->columns_size[i])
+      return -1;
+    rec->columns[i] = p + offset;
+    offset += rec->columns_size[i];
+  }
+
+  return 0;
+} /* }}} int seg_parse_block */
+
+/* Parses the record at `*offset' and advances `*offset' past it. Returns 1
+ * if there are no more records. */
+static int seg_parse(uint8_t const *map, size_t end, /* {{{ */
+                     size_t *offset, segment_record_t *rec) {
+  uint8_t const *p;
+  size_t size;
+  int status;
+
+  if (*offset >= end)
+    return 1;
+  if (end - *offset < SEGMENT_RECORD_HEADER_SIZE)
+    return -1;
+
+  p = map + *offset;
+  size = seg_get_u32(p + 4);
+  if ((size < SEGMENT_RECORD_HEADER_SIZE) || (size > end - *offset))
+    return -1;
+
+  rec->type = p[0];
+  if (rec->type == SEGMENT_RECORD_SERIES)
+    status = seg_parse_series(p, size, rec);
+  else if (rec->type == SEGMENT_RECORD_BLOCK)
+    status = seg_parse_block(p, size, rec);
+  else
+    status = -1;
+  if (status != 0)
+    return -1;
+
+  *offset += size;
+  return 0;
+} /* }}} int seg_parse */
+
+/* Checks the header and returns the offset of the first unused byte. */
+static int seg_check_header(uint8_t const *map, size_t size, /* {{{ */
+                            size_t *ret_end) {
+  uint64_t end;
+
+  if ((size < SEGMENT_HEADER_SIZE) ||
+      (memcmp(map, SEGMENT_MAGIC, strlen(SEGMENT_MAGIC)) != 0) ||
+      (seg_get_u32(map + 8) != SEGMENT_VERSION) ||
+      (seg_get_u32(map + 12) != SEGMENT_HEADER_SIZE))
+    return EINVAL;
+
+  end = seg_get_u64(map + SEGMENT_HEADER_DATA_END);
+  if (end < SEGMENT_HEADER_SIZE)
+    return EINVAL;
+  *ret_end = (end > size) ? size : (size_t)end;
+  return 0;
+} /* }}} int seg_check_header */
+
+/*
+ * Writing segment files
+ */
+
+/* Grows the file to `new_size' bytes. The blocks are allocated rather than
+ * left sparse, so that a full file system is reported here instead of by a
+ * SIGBUS when the mapping is written to. Returns zero or an error number. */
+static int seg_allocate(int fd, size_t old_size, size_t new_size) /* {{{ */
+{
+#if HAVE_POSIX_FALLOCATE
+  return posix_fallocate(fd, (off_t)old_size, (off_t)(new_size - old_size));
+#else
+  if (ftruncate(fd, (off_t)new_size) != 0)
+    return errno;
+  return 0;
+#endif
+} /* }}} int seg_allocate */
+segment_file_t *segment_file_open(char const *path, /* {{{ */
+                                  uint64_t start) {
+  segment_file_t *f;
+  struct stat statbuf;
+  int status;
+
+  f = calloc(1, sizeof(*f));
+  if (f == NULL)
+    return NULL;
+
+  f->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (f->fd < 0) {
+    free(f);
+    return NULL;
+  }
+
+  if (fstat(f->fd, &statbuf) != 0) {
+    status = errno;
+    goto fail;
+  }
+
+  f->map_size = (size_t)statbuf.st_size;
+  if (f->map_size == 0) {
+    f->map_size = SEGMENT_GROW_MIN;
+    status = seg_allocate(f->fd, 0, f->map_size);
+    if (status != 0)
+      goto fail;
+  }
+
+  f->map = mmap(NULL, f->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd,
+                0);
+  if (f->map == MAP_FAILED) {
+    status = errno;
+    f->map = NULL;
+    goto fail;
+  }
+
+  if (statbuf.st_size == 0) {
+    memcpy(f->map, SEGMENT_MAGIC, strlen(SEGMENT_MAGIC));
+    seg_put_u32(f->map + 8, SEGMENT_VERSION);
+    seg_put_u32(f->map + 12, SEGMENT_HEADER_SIZE);
+    seg_put_u64(f->map + 16, start);
+    seg_put_u64(f->map + SEGMENT_HEADER_DATA_END, SEGMENT_HEADER_SIZE);
+    f->used = SEGMENT_HEADER_SIZE;
+  } else {
+    segment_record_t rec;
+    size_t offset = SEGMENT_HEADER_SIZE;
+
+    status = seg_check_header(f->map, f->map_size, &f->used);
+    if (status != 0)
+      goto fail;
+
+    /* Continue numbering series after the existing ones. A corrupt record
+     * and everything after it is overwritten. */
+    while ((status = seg_parse(f->map, f->used, &offset, &rec)) == 0) {
+      if ((rec.type == SEGMENT_RECORD_SERIES) && (rec.id >= f->next_id))
+        f->next_id = rec.id + 1;
+    }
+    if (status < 0) {
+      f->used = offset;
+      seg_put_u64(f->map + SEGMENT_HEADER_DATA_END, f->used);
+    }
+  }
+
+  return f;
+
+fail:
+  if (f->map != NULL)
+    munmap(f->map, f->map_size);
+  close(f->fd);
+  free(f);
+  errno = status;
+  return NULL;
+} /* }}} segment_file_t *segment_file_open */
+
+int segment_file_close(segment_file_t *f) /* {{{ */
+{
+  int status = 0;
+
+  if (f == NULL)
+    return EINVAL;
+
+  munmap(f->map, f->map_size);
+  if (ftruncate(f->fd, (off_t)f->used) != 0)
+    status = errno;
+  if (close(f->fd) != 0)
+    status = errno;
+  free(f);
+
+  return status;
+} /* }}} int segment_file_close */
+
+uint32_t segment_file_next_id(segment_file_t *f) /* {{{ */
+{
+  return f->next_id++;
+} /* }}} uint32_t segment_file_next_id */
+
+/* Makes sure `size' bytes can be appended and returns where to put them. On
+ * failure, returns NULL and sets errno. */
+static uint8_t *seg_reserve(segment_file_t *f, size_t size) /* {{{ */
+{
+  size_t grow;
+  size_t new_size;
+  uint8_t *new_map;
+  int status;
+
+  if (f->map_size - f->used >= size)
+    return f->map + f->used;
+
+  grow = f->map_size;
+  if (grow < SEGMENT_GROW_MIN)
+    grow = SEGMENT_GROW_MIN;
+  else if (grow > SEGMENT_GROW_MAX)
+    grow = SEGMENT_GROW_MAX;
+  if (grow < size)
+    grow = size;
+
+  new_size = f->used + grow;
+  new_size = SEGMENT_GROW_MIN * ((new_size + SEGMENT_GROW_MIN - 1) /
+                                 SEGMENT_GROW_MIN);
+
+  status = seg_allocate(f->fd, f->map_size, new_size);
+  if (status != 0) {
+    /* Blocks that were allocated before the failure are released by
+     * segment_file_close(). */
+    errno = status;
+    return NULL;
+  }
+
+  new_map =
+      mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+  if (new_map == MAP_FAILED)
+    return NULL;
+
+  munmap(f->map, f->map_size);
+  f->map = new_map;
+  f->map_size = new_size;
+
+  return f->map + f->used;
+} /* }}} uint8_t *seg_reserve */
+
+static void seg_commit(segment_file_t *f, uint8_t *p, int type, /* {{{ */
+                       size_t size) {
+  p[0] = (uint8_t)type;
+  p[1] = p[2] = p[3] = 0;
+  seg_put_u32(p + 4, (uint32_t)size);
+
+  f->used += size;
+  seg_put_u64(f->map + SEGMENT_HEADER_DATA_END, f->used);
+} /* }}} void seg_commit */
+
+int segment_file_add_series(segment_file_t *f, uint32_t id, /* {{{ */
+                            char const *identifier, size_t ds_num,
+                            uint8_t const *ds_types,
+                            char const *const *ds_names) {
+  size_t identifier_size = strlen(identifier) + 1;
+  size_t size;
+  size_t offset;
+  uint8_t *p;
+
+  if ((ds_num > SEGMENT_DS_MAX) || (identifier_size > UINT16_MAX))
+    return EINVAL;
+
+  size = SEGMENT_SERIES_HEADER_SIZE + identifier_size;
+  for (size_t i = 0; i < ds_num; i++) {
+    size_t name_size = strlen(ds_names[i]) + 1;
+    if (name_size > UINT8_MAX)
+      return EINVAL;
+    size += 2 + name_size;
+  }
+
+  p = seg_reserve(f, size);
+  if (p == NULL)
+    return errno;
+
+  seg_put_u32(p + 8, id);
+  seg_put_u16(p + 12, (uint16_t)ds_num);
+  seg_put_u16(p + 14, (uint16_t)identifier_size);
+  offset = SEGMENT_SERIES_HEADER_SIZE;
+  memcpy(p + offset, identifier, identifier_size);
+  offset += identifier_size;
+
+  for (size_t i = 0; i < ds_num; i++) {
+    size_t name_size = strlen(ds_names[i]) + 1;
+
+    p[offset] = ds_types[i];
+    p[offset + 1] = (uint8_t)name_size;
+    memcpy(p + offset + 2, ds_names[i], name_size);
+    offset += 2 + name_size;
+  }
+
+  seg_commit(f, p, SEGMENT_RECORD_SERIES, size);
+  return 0;
+} /* }}} int segment_file_add_series */
+
+int segment_file_add_block(segment_file_t *f, uint32_t id, /* {{{ */
+                           size_t count, uint64_t t_first, uint64_t t_last,
+                           segment_column_t const *columns,
+                           size_t columns_num) {
+  size_t size;
+  size_t offset;
+  uint8_t *p;
+
+  if ((columns_num == 0) || (columns_num > SEGMENT_DS_MAX + 1) ||
+      (count > UINT32_MAX))
+    return EINVAL;
+
+  size = SEGMENT_BLOCK_HEADER_SIZE + 4 * columns_num;
+  for (size_t i = 0; i < columns_num; i++)
+    size += segment_column_size(columns + i);
+  if (size > UINT32_MAX)
+    return EINVAL;
+
+  p = seg_reserve(f, size);
+  if (p == NULL)
+    return errno;
+
+  seg_put_u32(p + 8, id);
+  seg_put_u32(p + 12, (uint32_t)count);
+  seg_put_u64(p + 16, t_first);
+  seg_put_u64(p + 24, t_last);
+  seg_put_u16(p + 32, (uint16_t)columns_num);
+  seg_put_u16(p + 34, 0);
+
+  offset = SEGMENT_BLOCK_HEADER_SIZE;
+  for (size_t i = 0; i < columns_num; i++)
+    seg_put_u32(p + offset + 4 * i, (uint32_t)segment_column_size(columns + i));
+  offset += 4 * columns_num;
+
+  for (size_t i = 0; i < columns_num; i++) {
+    size_t column_size = segment_column_size(columns + i);
+    if (column_size > 0)
+      memcpy(p + offset, columns[i].data, column_size);
+    offset += column_size;
+  }
+
+  seg_commit(f, p, SEGMENT_RECORD_BLOCK, size);
+  return 0;
+} /* }}} int segment_file_add_block */
+
+/*
+ * Reading segment files
+ */
+segment_reader_t *segment_reader_open(char const *path) /* {{{ */
+{
+  segment_reader_t *r;
+  struct stat statbuf;
+  int fd;
+  int status;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &statbuf) != 0) {
+    status = errno;
+    close(fd);
+    errno = status;
+    return NULL;
+  }
+  if (statbuf.st_size < SEGMENT_HEADER_SIZE) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  r = calloc(1, sizeof(*r));
+  if (r == NULL) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  r->map_size = (size_t)statbuf.st_size;
+  r->map = mmap(NULL, r->map_size, PROT_READ, MAP_SHARED, fd, 0);
+  status = errno;
+  close(fd);
+  if (r->map == MAP_FAILED) {
+    free(r);
+    errno = status;
+    return NULL;
+  }
+
+  status = seg_check_header(r->map, r->map_size, &r->end);
+  if (status != 0) {
+    segment_reader_close(r);
+    errno = status;
+    return NULL;
+  }
+  r->start = seg_get_u64(r->map + 16);
+  r->offset = SEGMENT_HEADER_SIZE;
+
+  return r;
+} /* }}} segment_reader_t *segment_reader_open */
+
+void segment_reader_close(segment_reader_t *r) /* {{{ */
+{
+  if (r == NULL)
+    return;
+
+  munmap(r->map, r->map_size);
+  free(r);
+} /* }}} void segment_reader_close */
+
+uint64_t segment_reader_start(segment_reader_t const *r) /* {{{ */
+{
+  return r->start;
+} /* }}} uint64_t segment_reader_start */
+
+int segment_reader_next(segment_reader_t *r, segment_record_t *rec) /* {{{ */
+{
+  return seg_parse(r->map, r->end, &r->offset, rec);
+} /* }}} int segment_reader_next */
@@ -0,0 +1,299 @@
+/**
+ * collectd - src/utils_segment.h
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *   Compressed, column oriented time series segments, as described in
+ *   Pelkonen et al., "Gorilla: A Fast, Scalable, In-Memory Time Series
+ *   Database" (VLDB 2015).
+ *
+ *   A segment file starts with a header, followed by records that are only
+ *   ever appended. A "series" record assigns a number to an identifier and
+ *   lists its data sources. A "block" record holds a number of points of one
+ *   series as separate columns: one for the times and one per data source.
+ *   Times and integers are stored as delta-of-delta, doubles are XORed with
+ *   their predecessor. All integers in headers are little endian.
+ **/
+
+#ifndef UTILS_SEGMENT_H
+#define UTILS_SEGMENT_H 1
+
+#include "collectd.h"
+
+/* Maximum number of data sources per series. */
+#define SEGMENT_DS_MAX 64
+
+#define SEGMENT_ENCODING_DOUBLE 0
+#define SEGMENT_ENCODING_INT64 1
+
+#define SEGMENT_RECORD_SERIES 'S'
+#define SEGMENT_RECORD_BLOCK 'B'
+
+/*
+ * Column encoder
+ */
+typedef struct segment_column_s {
+  int encoding;
+  uint8_t *data;
+  size_t size; /* allocated bytes */
+  size_t bits; /* used bits */
+  size_t count;
+
+  uint64_t prev;
+  int64_t prev_delta;
+  int prev_leading;
+  int prev_trailing;
+} segment_column_t;
+
+/*
+ * NAME
+ *   segment_column_init
+ *
+ * DESCRIPTION
+ *   Initializes an empty column using the encoding `encoding', either
+ *   SEGMENT_ENCODING_DOUBLE or SEGMENT_ENCODING_INT64.
+ */
+void segment_column_init(segment_column_t *c, int encoding);
+
+/*
+ * NAME
+ *   segment_column_reset
+ *
+ * DESCRIPTION
+ *   Removes all values from the column, keeping the allocated memory.
+ */
+void segment_column_reset(segment_column_t *c);
+
+/*
+ * NAME
+ *   segment_column_destroy
+ *
+ * DESCRIPTION
+ *   Frees the memory used by the column.
+ */
+void segment_column_destroy(segment_column_t *c);
+
+/*
+ * NAME
+ *   segment_column_add_int64, segment_column_add_double
+ *
+ * DESCRIPTION
+ *   Appends a value to the column. Which function to use depends on the
+ *   encoding of the column. Unsigned integers may be passed to
+ *   segment_column_add_int64 by casting them; the deltas wrap around.
+ *
+ * RETURN VALUE
+ *   Zero on success, ENOMEM if the column could not be enlarged.
+ */
+int segment_column_add_int64(segment_column_t *c, int64_t value);
+int segment_column_add_double(segment_column_t *c, double value);
+
+/*
+ * NAME
+ *   segment_column_size
+ *
+ * DESCRIPTION
+ *   Returns the number of bytes the encoded column takes up.
+ */
+size_t segment_column_size(segment_column_t const *c);
+
+/*
+ * Column decoder
+ */
+typedef struct segment_decoder_s {
+  int encoding;
+  uint8_t const *data;
+  size_t bits;
+  size_t pos;
+  size_t count;
+
+  uint64_t prev;
+  int64_t prev_delta;
+  int prev_leading;
+  int prev_trailing;
+} segment_decoder_t;
+
+/*
+ * NAME
+ *   segment_decoder_init
+ *
+ * DESCRIPTION
+ *   Prepares decoding the `size' bytes of encoded column at `data'.
+ */
+void segment_decoder_init(segment_decoder_t *d, int encoding, void const *data,
+                          size_t size);
+
+/*
+ * NAME
+ *   segment_decoder_next_int64, segment_decoder_next_double
+ *
+ * DESCRIPTION
+ *   Decodes the next value of the column. The end of the column can't be
+ *   detected reliably, so callers must stop after the number of values
+ *   stored in the block.
+ *
+ * RETURN VALUE
+ *   Zero on success, non-zero if the column is truncated or corrupt.
+ */
+int segment_decoder_next_int64(segment_decoder_t *d, int64_t *ret_value);
+int segment_decoder_next_double(segment_decoder_t *d, double *ret_value);
+
+/*
+ * Segment files
+ */
+struct segment_file_s;
+typedef struct segment_file_s segment_file_t;
+
+/*
+ * NAME
+ *   segment_file_open
+ *
+ * DESCRIPTION
+ *   Opens the segment file `path' for appending, creating it if it doesn't
+ *   exist. `start' is stored in the header of new files. The file is memory
+ *   mapped and grows in steps of at least one megabyte.
+ *
+ * RETURN VALUE
+ *   The segment file on success, NULL on failure with errno set.
+ */
+segment_file_t *segment_file_open(char const *path, uint64_t start);
+
+/*
+ * NAME
+ *   segment_file_close
+ *
+ * DESCRIPTION
+ *   Unmaps the file, truncates it to the used size and closes it.
+ */
+int segment_file_close(segment_file_t *f);
+
+/*
+ * NAME
+ *   segment_file_next_id
+ *
+ * DESCRIPTION
+ *   Returns the lowest series number not yet used in the file and reserves
+ *   it.
+ */
+uint32_t segment_file_next_id(segment_file_t *f);
+
+/*
+ * NAME
+ *   segment_file_add_series
+ *
+ * DESCRIPTION
+ *   Appends a series record, assigning `id' to `identifier'. `ds_types' and
+ *   `ds_names' describe the data sources; the types are stored verbatim.
+ *
+ * RETURN VALUE
+ *   Zero on success, an errno value otherwise.
+ */
+int segment_file_add_series(segment_file_t *f, uint32_t id,
+                            char const *identifier, size_t ds_num,
+                            uint8_t const *ds_types,
+                            char const *const *ds_names);
+
+/*
+ * NAME
+ *   segment_file_add_block
+ *
+ * DESCRIPTION
+ *   Appends a block record holding `count' points of series `id', with times
+ *   ranging from `t_first' to `t_last'. The first column holds the times.
+ *
+ * RETURN VALUE
+ *   Zero on success, an errno value otherwise.
+ */
+int segment_file_add_block(segment_file_t *f, uint32_t id, size_t count,
+                           uint64_t t_first, uint64_t t_last,
+                           segment_column_t const *columns,
+                           size_t columns_num);
+
+/*
+ * Reading segment files
+ */
+typedef struct segment_record_s {
+  int type; /* SEGMENT_RECORD_SERIES or SEGMENT_RECORD_BLOCK */
+  uint32_t id;
+
+  /* SEGMENT_RECORD_SERIES */
+  char const *identifier;
+  size_t ds_num;
+  uint8_t ds_types[SEGMENT_DS_MAX];
+  char const *ds_names[SEGMENT_DS_MAX];
+
+  /* SEGMENT_RECORD_BLOCK */
+  size_t count;
+  uint64_t t_first;
+  uint64_t t_last;
+  size_t columns_num;
+  void const *columns[SEGMENT_DS_MAX + 1];
+  size_t columns_size[SEGMENT_DS_MAX + 1];
+} segment_record_t;
+
+struct segment_reader_s;
+typedef struct segment_reader_s segment_reader_t;
+
+/*
+ * NAME
+ *   segment_reader_open
+ *
+ * DESCRIPTION
+ *   Maps the segment file `path' read-only. Records appended after this call
+ *   are not seen.
+ *
+ * RETURN VALUE
+ *   The reader on success, NULL on failure with errno set.
+ */
+segment_reader_t *segment_reader_open(char const *path);
+
+/*
+ * NAME
+ *   segment_reader_close
+ *
+ * DESCRIPTION
+ *   Unmaps the file. Pointers into records become invalid.
+ */
+void segment_reader_close(segment_reader_t *r);
+
+/*
+ * NAME
+ *   segment_reader_start
+ *
+ * DESCRIPTION
+ *   Returns the start time stored in the header of the file.
+ */
+uint64_t segment_reader_start(segment_reader_t const *r);
+
+/*
+ * NAME
+ *   segment_reader_next
+ *
+ * DESCRIPTION
+ *   Parses the next record into `rec'. Strings and columns point into the
+ *   mapped file.
+ *
+ * RETURN VALUE
+ *   Zero on success, a positive value after the last record and a negative
+ *   value if the file is corrupt.
+ */
+int segment_reader_next(segment_reader_t *r, segment_record_t *rec);
+
+#endif /* UTILS_SEGMENT_H */
@@ -0,0 +1,260 @@
+/**
+ * collectd - src/utils_segment_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "testing.h"
+#include "utils_segment.h"
+
+#include <sys/resource.h>
+
+DEF_TEST(int64) {
+  int64_t values[] = {
+      /* times in milliseconds with some jitter */
+      1500000000000, 1500000010000, 1500000020001, 1500000029998,
+      1500000040000, 1500000050000, 1500000050000, 1500000060500,
+      /* large jumps and extremes */
+      0, -1, INT64_MAX, INT64_MIN, 42, 4200000, -4200000, 1,
+  };
+  segment_column_t c;
+  segment_decoder_t d;
+  int64_t got;
+
+  segment_column_init(&c, SEGMENT_ENCODING_INT64);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(values); i++)
+    CHECK_ZERO(segment_column_add_int64(&c, values[i]));
+  EXPECT_EQ_INT(STATIC_ARRAY_SIZE(values), c.count);
+
+  segment_decoder_init(&d, SEGMENT_ENCODING_INT64, c.data,
+                       segment_column_size(&c));
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(values); i++) {
+    CHECK_ZERO(segment_decoder_next_int64(&d, &got));
+    printf("# value %zu: want %" PRIi64 ", got %" PRIi64 "\n", i, values[i],
+           got);
+    OK(values[i] == got);
+  }
+
+  /* Regular intervals take one bit per value. */
+  segment_column_reset(&c);
+  for (int64_t i = 0; i < 100; i++)
+    CHECK_ZERO(segment_column_add_int64(&c, 1500000000000 + 10000 * i));
+  printf("# 100 regular times in %zu bytes\n", segment_column_size(&c));
+  OK(segment_column_size(&c) <= 24);
+
+  /* A counter wrapping around. */
+  segment_column_reset(&c);
+  CHECK_ZERO(segment_column_add_int64(&c, (int64_t)(UINT64_MAX - 5)));
+  CHECK_ZERO(segment_column_add_int64(&c, (int64_t)(UINT64_C(3))));
+  segment_decoder_init(&d, SEGMENT_ENCODING_INT64, c.data,
+                       segment_column_size(&c));
+  CHECK_ZERO(segment_decoder_next_int64(&d, &got));
+  OK((uint64_t)got == UINT64_MAX - 5);
+  CHECK_ZERO(segment_decoder_next_int64(&d, &got));
+  OK((uint64_t)got == 3);
+
+  segment_column_destroy(&c);
+  return 0;
+}
+
+DEF_TEST(double) {
+  double values[] = {
+      12.0, 12.0, 24.0, 15.5, 14.0625, 0.1, -0.1,      0.0, -0.0,
+      1e300, 1e-300, NAN, INFINITY, -INFINITY, 42.0, 42.0, 3.14159,
+  };
+  segment_column_t c;
+  segment_decoder_t d;
+  double got;
+
+  segment_column_init(&c, SEGMENT_ENCODING_DOUBLE);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(values); i++)
+    CHECK_ZERO(segment_column_add_double(&c, values[i]));
+
+  segment_decoder_init(&d, SEGMENT_ENCODING_DOUBLE, c.data,
+                       segment_column_size(&c));
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(values); i++) {
+    CHECK_ZERO(segment_decoder_next_double(&d, &got));
+    printf("# value %zu: want %g, got %g\n", i, values[i], got);
+    OK(memcmp(&values[i], &got, sizeof(got)) == 0);
+  }
+
+  /* Pseudo-random values, including many sharing the XOR window. */
+  segment_column_reset(&c);
+  uint64_t state = 88172645463325252ULL;
+  double random_values[1000];
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(random_values); i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    random_values[i] = (i % 3) ? (double)(state % 1000) / 8.0
+                               : (double)state / (double)UINT64_MAX;
+    CHECK_ZERO(segment_column_add_double(&c, random_values[i]));
+  }
+  segment_decoder_init(&d, SEGMENT_ENCODING_DOUBLE, c.data,
+                       segment_column_size(&c));
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(random_values); i++) {
+    CHECK_ZERO(segment_decoder_next_double(&d, &got));
+    if (memcmp(&random_values[i], &got, sizeof(got)) != 0) {
+      printf("# random value %zu: want %.17g, got %.17g\n", i,
+             random_values[i], got);
+      OK(0);
+    }
+  }
+
+  segment_column_destroy(&c);
+  return 0;
+}
+
+DEF_TEST(file) {
+  char path[] = "/tmp/collectd-segment-test.XXXXXX";
+  char const *ds_names[] = {"rx", "tx"};
+  uint8_t ds_types[] = {2, 2};
+  segment_column_t columns[3];
+  segment_file_t *f;
+  segment_reader_t *r;
+  segment_record_t rec;
+  int fd;
+
+  fd = mkstemp(path);
+  OK(fd >= 0);
+  close(fd);
+
+  segment_column_init(&columns[0], SEGMENT_ENCODING_INT64);
+  segment_column_init(&columns[1], SEGMENT_ENCODING_INT64);
+  segment_column_init(&columns[2], SEGMENT_ENCODING_DOUBLE);
+  for (int64_t i = 0; i < 10; i++) {
+    CHECK_ZERO(segment_column_add_int64(&columns[0], 1000 * i));
+    CHECK_ZERO(segment_column_add_int64(&columns[1], 100 * i));
+    CHECK_ZERO(segment_column_add_double(&columns[2], 0.5 * (double)i));
+  }
+
+  CHECK_NOT_NULL(f = segment_file_open(path, 1234));
+  EXPECT_EQ_INT(0, segment_file_next_id(f));
+  CHECK_ZERO(segment_file_add_series(f, 0, "host/interface-eth0/if_octets",
+                                     2, ds_types, ds_names));
+  CHECK_ZERO(segment_file_add_block(f, 0, 10, 0, 9000, columns, 3));
+  CHECK_ZERO(segment_file_close(f));
+
+  /* Reopening continues numbering after the existing series. */
+  CHECK_NOT_NULL(f = segment_file_open(path, 5678));
+  EXPECT_EQ_INT(1, segment_file_next_id(f));
+  CHECK_ZERO(segment_file_add_series(f, 1, "host/load/load", 0, NULL, NULL));
+  CHECK_ZERO(segment_file_close(f));
+
+  CHECK_NOT_NULL(r = segment_reader_open(path));
+  OK(segment_reader_start(r) == 1234);
+
+  CHECK_ZERO(segment_reader_next(r, &rec));
+  EXPECT_EQ_INT(SEGMENT_RECORD_SERIES, rec.type);
+  EXPECT_EQ_INT(0, rec.id);
+  EXPECT_EQ_STR("host/interface-eth0/if_octets", rec.identifier);
+  EXPECT_EQ_INT(2, rec.ds_num);
+  EXPECT_EQ_INT(2, rec.ds_types[1]);
+  EXPECT_EQ_STR("tx", rec.ds_names[1]);
+
+  CHECK_ZERO(segment_reader_next(r, &rec));
+  EXPECT_EQ_INT(SEGMENT_RECORD_BLOCK, rec.type);
+  EXPECT_EQ_INT(0, rec.id);
+  EXPECT_EQ_INT(10, rec.count);
+  OK(rec.t_last == 9000);
+  EXPECT_EQ_INT(3, rec.columns_num);
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ_INT(segment_column_size(&columns[i]), rec.columns_size[i]);
+    OK(memcmp(columns[i].data, rec.columns[i], rec.columns_size[i]) == 0);
+  }
+
+  CHECK_ZERO(segment_reader_next(r, &rec));
+  EXPECT_EQ_INT(SEGMENT_RECORD_SERIES, rec.type);
+  EXPECT_EQ_INT(1, rec.id);
+  EXPECT_EQ_INT(0, rec.ds_num);
+
+  EXPECT_EQ_INT(1, segment_reader_next(r, &rec));
+  segment_reader_close(r);
+
+  for (size_t i = 0; i < 3; i++)
+    segment_column_destroy(&columns[i]);
+  unlink(path);
+  return 0;
+}
+
+/* A file that can't grow reports an error instead of crashing with SIGBUS
+ * when the new space is written to, and stays usable. */
+DEF_TEST(file_full) {
+  char path[] = "/tmp/collectd-segment-test.XXXXXX";
+  struct rlimit old_limit;
+  segment_column_t column;
+  segment_file_t *f;
+  segment_reader_t *r;
+  segment_record_t rec;
+  int fd;
+
+  fd = mkstemp(path);
+  OK(fd >= 0);
+  close(fd);
+
+  /* Bigger than the file may grow. */
+  segment_column_init(&column, SEGMENT_ENCODING_INT64);
+  for (int64_t i = 0; segment_column_size(&column) < 2 * 1024 * 1024; i++) {
+    if (segment_column_add_int64(&column, i * i * i) != 0)
+      break;
+  }
+  OK(segment_column_size(&column) >= 2 * 1024 * 1024);
+
+  CHECK_NOT_NULL(f = segment_file_open(path, 1234));
+  CHECK_ZERO(segment_file_add_series(f, 0, "host/load/load", 0, NULL, NULL));
+
+  /* Writing beyond the limit fails with EFBIG rather than SIGXFSZ. */
+  CHECK_ZERO(getrlimit(RLIMIT_FSIZE, &old_limit));
+  signal(SIGXFSZ, SIG_IGN);
+  CHECK_ZERO(setrlimit(RLIMIT_FSIZE, &(struct rlimit){
+                                         .rlim_cur = 1024 * 1024,
+                                         .rlim_max = old_limit.rlim_max,
+                                     }));
+  EXPECT_EQ_INT(EFBIG, segment_file_add_block(f, 0, 1, 0, 0, &column, 1));
+  CHECK_ZERO(setrlimit(RLIMIT_FSIZE, &old_limit));
+  signal(SIGXFSZ, SIG_DFL);
+
+  CHECK_ZERO(segment_file_add_series(f, 1, "host/cpu/cpu", 0, NULL, NULL));
+  CHECK_ZERO(segment_file_close(f));
+
+  CHECK_NOT_NULL(r = segment_reader_open(path));
+  CHECK_ZERO(segment_reader_next(r, &rec));
+  EXPECT_EQ_INT(0, rec.id);
+  CHECK_ZERO(segment_reader_next(r, &rec));
+  EXPECT_EQ_INT(SEGMENT_RECORD_SERIES, rec.type);
+  EXPECT_EQ_INT(1, rec.id);
+  EXPECT_EQ_INT(1, segment_reader_next(r, &rec));
+  segment_reader_close(r);
+
+  segment_column_destroy(&column);
+  unlink(path);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(int64);
+  RUN_TEST(double);
+  RUN_TEST(file);
+  RUN_TEST(file_full);
+
+  END_TEST;
+}
@@ -35,15 +35,153 @@
 #include "common.h"
 #include "utils_tail.h"
 
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+/* Lines longer than this are split. */
+#define CU_TAIL_BUFFER_SIZE 65536
+
 struct cu_tail_s {
   char *file;
-  FILE *fh;
+  int fd;
   struct stat stat;
+  off_t offset;
+
+  /* Data read from "fd"; [pos, fill) has not been handed out yet. One extra
+   * byte is allocated for terminating a line that fills the whole buffer. */
+  char *buffer;
+  size_t pos;
+  size_t fill;
+
+  uint64_t bytes;
+  uint64_t lines;
+  uint64_t lag;
+
+#if HAVE_SYS_INOTIFY_H
+  int watch;
+  _Bool changed;
+#endif
 };
 
+#if HAVE_SYS_INOTIFY_H
+/* All tail objects share one inotify descriptor and are told apart by their
+ * watch descriptors. Events read while checking one object are recorded in
+ * the "changed" flag of the object they belong to. Watching the same file
+ * twice yields the same watch descriptor, so it is only removed once no other
+ * object uses it. */
+static pthread_mutex_t cu_tail_inotify_lock = PTHREAD_MUTEX_INITIALIZER;
+static int cu_tail_inotify_fd = -1;
+static cu_tail_t **cu_tail_objects = NULL;
+static size_t cu_tail_objects_num = 0;
+
+/* Must be called with "cu_tail_inotify_lock" held. */
+static void cu_tail_unwatch(cu_tail_t *obj) {
+  if (obj->watch < 0)
+    return;
+
+  _Bool shared = 0;
+  for (size_t i = 0; i < cu_tail_objects_num; i++) {
+    if ((cu_tail_objects[i] != obj) && (cu_tail_objects[i]->watch == obj->watch))
+      shared = 1;
+  }
+  if (!shared)
+    inotify_rm_watch(cu_tail_inotify_fd, obj->watch);
+  obj->watch = -1;
+} /* void cu_tail_unwatch */
+
+/* Watches the currently opened file, so that stat(2) is only called when
+ * the file was modified, moved or deleted. Falls back to calling stat(2) on
+ * every read if inotify is unavailable. */
+static void cu_tail_watch(cu_tail_t *obj) {
+  pthread_mutex_lock(&cu_tail_inotify_lock);
+  if (cu_tail_inotify_fd < 0)
+    cu_tail_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (cu_tail_inotify_fd >= 0) {
+    cu_tail_unwatch(obj);
+    obj->watch = inotify_add_watch(cu_tail_inotify_fd, obj->file,
+                                   IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                                       IN_DELETE_SELF);
+    obj->changed = 0;
+  }
+  pthread_mutex_unlock(&cu_tail_inotify_lock);
+} /* void cu_tail_watch */
+
+/* Reads all pending events and flags the objects they belong to. Must be
+ * called with "cu_tail_inotify_lock" held. Returns non-zero if events may
+ * have been lost, in which case all objects are flagged. */
+static int cu_tail_inotify_drain(void) {
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (42) {
+    ssize_t status = read(cu_tail_inotify_fd, buffer, sizeof(buffer));
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    if ((status < 0) && (errno == EAGAIN))
+      return 0;
+    if (status <= 0)
+      break;
+
+    for (char *ptr = buffer; ptr < buffer + status;) {
+      struct inotify_event *ev = (struct inotify_event *)ptr;
+      ptr += sizeof(*ev) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW)
+        goto lost;
+
+      for (size_t i = 0; i < cu_tail_objects_num; i++) {
+        if (cu_tail_objects[i]->watch != ev->wd)
+          continue;
+        cu_tail_objects[i]->changed = 1;
+        /* The watch is gone if the file was deleted. */
+        if (ev->mask & IN_IGNORED)
+          cu_tail_objects[i]->watch = -1;
+      }
+    }
+  }
+
+lost:
+  for (size_t i = 0; i < cu_tail_objects_num; i++)
+    cu_tail_objects[i]->changed = 1;
+  return -1;
+} /* int cu_tail_inotify_drain */
+#endif
+
+/* Returns true if the file may have been rotated or truncated since the file
+ * was last checked successfully, see cu_tail_checked(). */
+static _Bool cu_tail_changed(cu_tail_t *obj) {
+#if HAVE_SYS_INOTIFY_H
+  _Bool changed = 1;
+
+  pthread_mutex_lock(&cu_tail_inotify_lock);
+  if ((cu_tail_inotify_fd >= 0) && (obj->watch >= 0)) {
+    cu_tail_inotify_drain();
+    changed = obj->changed;
+  }
+  pthread_mutex_unlock(&cu_tail_inotify_lock);
+
+  return changed;
+#else
+  return 1;
+#endif
+} /* _Bool cu_tail_changed */
+
+/* Clears the "changed" flag once cu_tail_reopen() succeeded. Until then, e.g.
+ * while a rotated file has not been re-created yet, every read checks the
+ * file again. Events read after cu_tail_changed() are still pending and are
+ * not lost. */
+static void cu_tail_checked(cu_tail_t *obj) {
+#if HAVE_SYS_INOTIFY_H
+  pthread_mutex_lock(&cu_tail_inotify_lock);
+  obj->changed = 0;
+  pthread_mutex_unlock(&cu_tail_inotify_lock);
+#endif
+} /* void cu_tail_checked */
+
 static int cu_tail_reopen(cu_tail_t *obj) {
   int seek_end = 0;
-  FILE *fh;
+  int fd;
   struct stat stat_buf = {0};
   int status;
 
@@ -56,22 +194,28 @@ static int cu_tail_reopen(cu_tail_t *obj) {
   }
 
   /* The file is already open.. */
-  if ((obj->fh != NULL) && (stat_buf.st_ino == obj->stat.st_ino)) {
+  if ((obj->fd >= 0) && (stat_buf.st_ino == obj->stat.st_ino)) {
+    _Bool truncated = 0;
+
     /* Seek to the beginning if file was truncated */
-    if (stat_buf.st_size < obj->stat.st_size) {
+    if (stat_buf.st_size < obj->offset) {
       INFO("utils_tail: File `%s' was truncated.", obj->file);
-      status = fseek(obj->fh, 0, SEEK_SET);
-      if (status != 0) {
+      if (lseek(obj->fd, 0, SEEK_SET) == (off_t)-1) {
         char errbuf[1024];
-        ERROR("utils_tail: fseek (%s) failed: %s", obj->file,
+        ERROR("utils_tail: lseek (%s) failed: %s", obj->file,
               sstrerror(errno, errbuf, sizeof(errbuf)));
-        fclose(obj->fh);
-        obj->fh = NULL;
+        close(obj->fd);
+        obj->fd = -1;
         return -1;
       }
+      obj->offset = 0;
+      obj->pos = obj->fill = 0;
+      truncated = 1;
     }
     memcpy(&obj->stat, &stat_buf, sizeof(struct stat));
-    return 1;
+    obj->lag = (uint64_t)(stat_buf.st_size - obj->offset);
+    /* Nothing changed, unless the file has to be read again from the start. */
+    return truncated ? 0 : 1;
   }
 
   /* Seek to the end if we re-open the same file again or the file opened
@@ -79,150 +223,216 @@ static int cu_tail_reopen(cu_tail_t *obj) {
   if ((obj->stat.st_ino == 0) || (obj->stat.st_ino == stat_buf.st_ino))
     seek_end = 1;
 
-  fh = fopen(obj->file, "r");
-  if (fh == NULL) {
+  fd = open(obj->file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
     char errbuf[1024];
-    ERROR("utils_tail: fopen (%s) failed: %s", obj->file,
+    ERROR("utils_tail: open (%s) failed: %s", obj->file,
           sstrerror(errno, errbuf, sizeof(errbuf)));
     return -1;
   }
 
+  obj->offset = 0;
   if (seek_end != 0) {
-    status = fseek(fh, 0, SEEK_END);
-    if (status != 0) {
+    obj->offset = lseek(fd, 0, SEEK_END);
+    if (obj->offset == (off_t)-1) {
       char errbuf[1024];
-      ERROR("utils_tail: fseek (%s) failed: %s", obj->file,
+      ERROR("utils_tail: lseek (%s) failed: %s", obj->file,
             sstrerror(errno, errbuf, sizeof(errbuf)));
-      fclose(fh);
+      close(fd);
+      obj->offset = 0;
       return -1;
     }
   }
 
-  if (obj->fh != NULL)
-    fclose(obj->fh);
-  obj->fh = fh;
+  if (obj->fd >= 0)
+    close(obj->fd);
+  obj->fd = fd;
   memcpy(&obj->stat, &stat_buf, sizeof(struct stat));
+#if HAVE_SYS_INOTIFY_H
+  cu_tail_watch(obj);
+#endif
 
   return 0;
 } /* int cu_tail_reopen */
 
-cu_tail_t *cu_tail_create(const char *file) {
-  cu_tail_t *obj;
-
-  obj = calloc(1, sizeof(*obj));
-  if (obj == NULL)
-    return NULL;
+/* Returns the next line, without the trailing newline and null-terminated, in
+ * "ret". The line is stored in the object's buffer and valid until the next
+ * call. Returns 0 on success, 1 if no complete line is available, and a
+ * negative value on error. */
+static int cu_tail_next(cu_tail_t *obj, char **ret, size_t *ret_len) {
+  int status;
 
-  obj->file = strdup(file);
-  if (obj->file == NULL) {
-    free(obj);
-    return NULL;
+  if (obj->fd < 0) {
+    status = cu_tail_reopen(obj);
+    if (status < 0)
+      return status;
   }
+  assert(obj->fd >= 0);
 
-  obj->fh = NULL;
+  while (42) {
+    char *line = obj->buffer + obj->pos;
+    char *newline = memchr(line, '\n', obj->fill - obj->pos);
+    ssize_t len;
+
+    if (newline != NULL) {
+      *newline = 0;
+      *ret = line;
+      *ret_len = (size_t)(newline - line);
+      obj->pos += *ret_len + 1;
+      obj->lines++;
+      return 0;
+    }
 
-  return obj;
-} /* cu_tail_t *cu_tail_create */
+    /* Move the partial line to the front of the buffer. */
+    if (obj->pos > 0) {
+      memmove(obj->buffer, line, obj->fill - obj->pos);
+      obj->fill -= obj->pos;
+      obj->pos = 0;
+    }
 
-int cu_tail_destroy(cu_tail_t *obj) {
-  if (obj->fh != NULL)
-    fclose(obj->fh);
-  free(obj->file);
-  free(obj);
+    /* The line doesn't fit into the buffer: return what we've got. */
+    if (obj->fill == CU_TAIL_BUFFER_SIZE) {
+      obj->buffer[obj->fill] = 0;
+      *ret = obj->buffer;
+      *ret_len = obj->fill;
+      obj->pos = obj->fill;
+      obj->lines++;
+      return 0;
+    }
 
-  return 0;
-} /* int cu_tail_destroy */
+    len = read(obj->fd, obj->buffer + obj->fill,
+               CU_TAIL_BUFFER_SIZE - obj->fill);
+    if (len > 0) {
+      obj->fill += (size_t)len;
+      obj->offset += (off_t)len;
+      obj->bytes += (uint64_t)len;
+      continue;
+    } else if (len < 0) {
+      char errbuf[1024];
 
-int cu_tail_readline(cu_tail_t *obj, char *buf, int buflen) {
-  int status;
+      if (errno == EINTR)
+        continue;
 
-  if (buflen < 1) {
-    ERROR("utils_tail: cu_tail_readline: buflen too small: %i bytes.", buflen);
-    return -1;
-  }
+      WARNING("utils_tail: read (%s) returned an error: %s", obj->file,
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+      /* Force `cu_tail_reopen' to reopen the file.. */
+      close(obj->fd);
+      obj->fd = -1;
+      return -1;
+    }
+
+    /* EOF -> check if the file was moved away and reopen the new file if
+     * so.. */
+    obj->lag = 0;
+    if (!cu_tail_changed(obj))
+      return 1;
 
-  if (obj->fh == NULL) {
     status = cu_tail_reopen(obj);
     if (status < 0)
       return status;
-  }
-  assert(obj->fh != NULL);
+    cu_tail_checked(obj);
+    if (status > 0)
+      return status;
 
-  /* Try to read from the filehandle. If that succeeds, everything appears to
-   * be fine and we can return. */
-  clearerr(obj->fh);
-  if (fgets(buf, buflen, obj->fh) != NULL) {
-    buf[buflen - 1] = 0;
-    return 0;
+    /* The file was re-opened: return the rest of the old file, which lacks a
+     * trailing newline, and start over with the new one. */
+    if (obj->fill > 0) {
+      obj->buffer[obj->fill] = 0;
+      *ret = obj->buffer;
+      *ret_len = obj->fill;
+      obj->pos = obj->fill;
+      obj->lines++;
+      return 0;
+    }
   }
+} /* int cu_tail_next */
 
-  /* Check if we encountered an error */
-  if (ferror(obj->fh) != 0) {
-    /* Jupp, error. Force `cu_tail_reopen' to reopen the file.. */
-    fclose(obj->fh);
-    obj->fh = NULL;
-  }
-  /* else: eof -> check if the file was moved away and reopen the new file if
-   * so.. */
+cu_tail_t *cu_tail_create(const char *file) {
+  cu_tail_t *obj;
+
+  obj = calloc(1, sizeof(*obj));
+  if (obj == NULL)
+    return NULL;
 
-  status = cu_tail_reopen(obj);
-  /* error -> return with error */
-  if (status < 0)
-    return status;
-  /* file end reached and file not reopened -> nothing more to read */
-  else if (status > 0) {
-    buf[0] = 0;
-    return 0;
+  obj->file = strdup(file);
+  obj->buffer = malloc(CU_TAIL_BUFFER_SIZE + 1);
+  if ((obj->file == NULL) || (obj->buffer == NULL)) {
+    free(obj->file);
+    free(obj->buffer);
+    free(obj);
+    return NULL;
   }
 
-  /* If we get here: file was re-opened and there may be more to read.. Let's
-   * try again. */
-  if (fgets(buf, buflen, obj->fh) != NULL) {
-    buf[buflen - 1] = 0;
-    return 0;
+  obj->fd = -1;
+#if HAVE_SYS_INOTIFY_H
+  obj->watch = -1;
+
+  pthread_mutex_lock(&cu_tail_inotify_lock);
+  cu_tail_t **tmp = realloc(cu_tail_objects, (cu_tail_objects_num + 1) *
+                                                 sizeof(*cu_tail_objects));
+  if (tmp != NULL) {
+    cu_tail_objects = tmp;
+    cu_tail_objects[cu_tail_objects_num] = obj;
+    cu_tail_objects_num++;
   }
+  pthread_mutex_unlock(&cu_tail_inotify_lock);
+  if (tmp == NULL) {
+    free(obj->file);
+    free(obj->buffer);
+    free(obj);
+    return NULL;
+  }
+#endif
 
-  if (ferror(obj->fh) != 0) {
-    char errbuf[1024];
-    WARNING("utils_tail: fgets (%s) returned an error: %s", obj->file,
-            sstrerror(errno, errbuf, sizeof(errbuf)));
-    fclose(obj->fh);
-    obj->fh = NULL;
-    return -1;
+  return obj;
+} /* cu_tail_t *cu_tail_create */
+
+int cu_tail_destroy(cu_tail_t *obj) {
+  if (obj->fd >= 0)
+    close(obj->fd);
+#if HAVE_SYS_INOTIFY_H
+  pthread_mutex_lock(&cu_tail_inotify_lock);
+  cu_tail_unwatch(obj);
+  for (size_t i = 0; i < cu_tail_objects_num; i++) {
+    if (cu_tail_objects[i] != obj)
+      continue;
+    cu_tail_objects[i] = cu_tail_objects[cu_tail_objects_num - 1];
+    cu_tail_objects_num--;
+    break;
+  }
+  if (cu_tail_objects_num == 0) {
+    sfree(cu_tail_objects);
+    if (cu_tail_inotify_fd >= 0)
+      close(cu_tail_inotify_fd);
+    cu_tail_inotify_fd = -1;
   }
+  pthread_mutex_unlock(&cu_tail_inotify_lock);
+#endif
+  free(obj->buffer);
+  free(obj->file);
+  free(obj);
 
-  /* EOf, well, apparently the new file is empty.. */
-  buf[0] = 0;
   return 0;
-} /* int cu_tail_readline */
+} /* int cu_tail_destroy */
 
-int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
-                 void *data) {
+int cu_tail_read(cu_tail_t *obj, tailfunc_t *callback, void *data) {
   int status;
 
   while (42) {
-    size_t len;
+    char *line;
+    size_t line_len;
 
-    status = cu_tail_readline(obj, buf, buflen);
-    if (status != 0) {
-      ERROR("utils_tail: cu_tail_read: cu_tail_readline "
-            "failed.");
+    status = cu_tail_next(obj, &line, &line_len);
+    if (status < 0) {
+      ERROR("utils_tail: cu_tail_read: reading from `%s' failed.", obj->file);
       break;
-    }
-
-    /* check for EOF */
-    if (buf[0] == 0)
+    } else if (status > 0) {
+      /* EOF */
+      status = 0;
       break;
-
-    len = strlen(buf);
-    while (len > 0) {
-      if (buf[len - 1] != '\n')
-        break;
-      buf[len - 1] = '\0';
-      len--;
     }
 
-    status = callback(data, buf, buflen);
+    status = callback(data, line, (int)line_len);
     if (status != 0) {
       ERROR("utils_tail: cu_tail_read: callback returned "
             "status %i.",
@@ -233,3 +443,13 @@ int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
 
   return status;
 } /* int cu_tail_read */
+
+void cu_tail_stats(cu_tail_t const *obj, uint64_t *bytes, uint64_t *lines,
+                   uint64_t *lag) {
+  if (bytes != NULL)
+    *bytes = obj->bytes;
+  if (lines != NULL)
+    *lines = obj->lines;
+  if (lag != NULL)
+    *lag = obj->lag;
+} /* void cu_tail_stats */
@@ -35,6 +35,7 @@
 struct cu_tail_s;
 typedef struct cu_tail_s cu_tail_t;
 
+/* `buf' is the line without its trailing newline and `buflen' its length. */
 typedef int tailfunc_t(void *data, char *buf, int buflen);
 
 /*
@@ -60,29 +61,25 @@ cu_tail_t *cu_tail_create(const char *file);
 int cu_tail_destroy(cu_tail_t *obj);
 
 /*
- * cu_tail_readline
+ * cu_tail_read
  *
- * Reads from the file until `buflen' characters are read, a newline
- * character is read, or an eof condition is encountered. `buf' is
- * always null-terminated on successful return and isn't touched when non-zero
- * is returned.
- *
- * You can check if the EOF condition is reached by looking at the buffer: If
- * the length of the string stored in the buffer is zero, EOF occurred.
- * Otherwise at least the newline character will be in the buffer.
+ * Reads from the file until eof condition or an error is encountered and
+ * calls `callback' for each line. Lines are passed in the object's internal
+ * buffer without copying them; they are only valid during the callback, which
+ * may modify them.
  *
  * Returns 0 when successful and non-zero otherwise.
  */
-int cu_tail_readline(cu_tail_t *obj, char *buf, int buflen);
+int cu_tail_read(cu_tail_t *obj, tailfunc_t *callback, void *data);
 
 /*
- * cu_tail_readline
- *
- * Reads from the file until eof condition or an error is encountered.
+ * cu_tail_stats
  *
- * Returns 0 when successful and non-zero otherwise.
+ * Returns the number of bytes and lines read so far, and the number of bytes
+ * that were appended to the file after the last read reached its end. Any of
+ * the pointers may be NULL.
  */
-int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
-                 void *data);
+void cu_tail_stats(cu_tail_t const *obj, uint64_t *bytes, uint64_t *lines,
+                   uint64_t *lag);
 
 #endif /* UTILS_TAIL_H */
@@ -35,6 +35,7 @@
 #include "plugin.h"
 #include "utils_latency_config.h"
 #include "utils_match.h"
+#include "utils_prefilter.h"
 #include "utils_tail.h"
 #include "utils_tail_match.h"
 
@@ -63,6 +64,15 @@ struct cu_tail_match_s {
   cdtime_t interval;
   cu_tail_match_match_t *matches;
   size_t matches_num;
+
+  /* Narrows the matches down to those that may match a line, so that only
+   * their regular expressions need to be executed. Built on the first read
+   * after matches have been added. */
+  cu_prefilter_t *prefilter;
+  _Bool *candidates;
+
+  /* Where to dispatch statistics about the file, if enabled. */
+  cu_tail_match_simple_t *stats;
 };
 
 /*
@@ -170,16 +180,95 @@ static int latency_submit_match(cu_match_t *match, void *user_data) {
   return 0;
 } /* int latency_submit_match */
 
+static void tail_match_submit_stats(cu_tail_match_t *obj) {
+  cu_tail_match_simple_t *data = obj->stats;
+  uint64_t bytes = 0;
+  uint64_t lines = 0;
+  uint64_t lag = 0;
+  struct {
+    char const *type;
+    char const *type_instance;
+    value_t value;
+  } stats[3];
+
+  cu_tail_stats(obj->tail, &bytes, &lines, &lag);
+  stats[0].type = "total_bytes";
+  stats[0].type_instance = "read";
+  stats[0].value.derive = (derive_t)bytes;
+  stats[1].type = "total_operations";
+  stats[1].type_instance = "lines";
+  stats[1].value.derive = (derive_t)lines;
+  stats[2].type = "bytes";
+  stats[2].type_instance = "lag";
+  stats[2].value.gauge = (gauge_t)lag;
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(stats); i++) {
+    value_list_t vl = VALUE_LIST_INIT;
+
+    vl.values = &stats[i].value;
+    vl.values_len = 1;
+    sstrncpy(vl.plugin, data->plugin, sizeof(vl.plugin));
+    sstrncpy(vl.plugin_instance, data->plugin_instance,
+             sizeof(vl.plugin_instance));
+    sstrncpy(vl.type, stats[i].type, sizeof(vl.type));
+    sstrncpy(vl.type_instance, stats[i].type_instance,
+             sizeof(vl.type_instance));
+    vl.interval = data->interval;
+
+    plugin_dispatch_values(&vl);
+  }
+} /* void tail_match_submit_stats */
+
 static int tail_callback(void *data, char *buf,
                          int __attribute__((unused)) buflen) {
   cu_tail_match_t *obj = (cu_tail_match_t *)data;
 
+  if (obj->prefilter == NULL) {
+    for (size_t i = 0; i < obj->matches_num; i++)
+      match_apply(obj->matches[i].match, buf);
+    return 0;
+  }
+
+  prefilter_candidates(obj->prefilter, buf, obj->candidates);
   for (size_t i = 0; i < obj->matches_num; i++)
-    match_apply(obj->matches[i].match, buf);
+    if (obj->candidates[i])
+      match_apply(obj->matches[i].match, buf);
 
   return 0;
 } /* int tail_callback */
 
+static void tail_match_prefilter_free(cu_tail_match_t *obj) {
+  prefilter_destroy(obj->prefilter);
+  obj->prefilter = NULL;
+  sfree(obj->candidates);
+} /* void tail_match_prefilter_free */
+
+/* Builds the prefilter over all matches. On failure, every match is applied
+ * to every line. */
+static void tail_match_prefilter_create(cu_tail_match_t *obj) {
+  /* A single match gains nothing from prefiltering. */
+  if (obj->matches_num < 2)
+    return;
+
+  obj->prefilter = prefilter_create();
+  obj->candidates = calloc(obj->matches_num, sizeof(*obj->candidates));
+  if ((obj->prefilter == NULL) || (obj->candidates == NULL)) {
+    tail_match_prefilter_free(obj);
+    return;
+  }
+
+  for (size_t i = 0; i < obj->matches_num; i++) {
+    if (prefilter_add(obj->prefilter, match_get_regex(obj->matches[i].match)) <
+        0) {
+      tail_match_prefilter_free(obj);
+      return;
+    }
+  }
+
+  if (prefilter_compile(obj->prefilter) != 0)
+    tail_match_prefilter_free(obj);
+} /* void tail_match_prefilter_create */
+
 static void tail_match_simple_free(void *data) {
   cu_tail_match_simple_t *user_data = (cu_tail_match_simple_t *)data;
   latency_config_free(user_data->latency_config);
@@ -226,7 +315,9 @@ void tail_match_destroy(cu_tail_match_t *obj) {
     match->user_data = NULL;
   }
 
+  tail_match_prefilter_free(obj);
   sfree(obj->matches);
+  sfree(obj->stats);
   sfree(obj);
 } /* void tail_match_destroy */
 
@@ -245,6 +336,9 @@ int tail_match_add_match(cu_tail_match_t *obj, cu_match_t *match,
   obj->matches = temp;
   obj->matches_num++;
 
+  /* Rebuilt by tail_match_read(). */
+  tail_match_prefilter_free(obj);
+
   DEBUG("tail_match_add_match interval %lf",
         CDTIME_T_TO_DOUBLE(((cu_tail_match_simple_t *)user_data)->interval));
   temp = obj->matches + (obj->matches_num - 1);
@@ -314,12 +408,31 @@ out:
   return status;
 } /* int tail_match_add_match_simple */
 
+int tail_match_report_stats(cu_tail_match_t *obj, const char *plugin,
+                            const char *plugin_instance,
+                            const cdtime_t interval) {
+  if (obj->stats == NULL) {
+    obj->stats = calloc(1, sizeof(*obj->stats));
+    if (obj->stats == NULL)
+      return -1;
+  }
+
+  sstrncpy(obj->stats->plugin, plugin, sizeof(obj->stats->plugin));
+  if (plugin_instance != NULL)
+    sstrncpy(obj->stats->plugin_instance, plugin_instance,
+             sizeof(obj->stats->plugin_instance));
+  obj->stats->interval = interval;
+
+  return 0;
+} /* int tail_match_report_stats */
+
 int tail_match_read(cu_tail_match_t *obj) {
-  char buffer[4096];
   int status;
 
-  status = cu_tail_read(obj->tail, buffer, sizeof(buffer), tail_callback,
-                        (void *)obj);
+  if (obj->prefilter == NULL)
+    tail_match_prefilter_create(obj);
+
+  status = cu_tail_read(obj->tail, tail_callback, (void *)obj);
   if (status != 0) {
     ERROR("tail_match: cu_tail_read failed.");
     return status;
@@ -334,5 +447,8 @@ int tail_match_read(cu_tail_match_t *obj) {
     (*lt_match->submit)(lt_match->match, lt_match->user_data);
   }
 
+  if (obj->stats != NULL)
+    tail_match_submit_stats(obj);
+
   return 0;
 } /* int tail_match_read */
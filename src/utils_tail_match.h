@@ -120,6 +120,21 @@ int tail_match_add_match_simple(cu_tail_match_t *obj, const char *regex,
                                 const latency_config_t latency_cfg,
                                 const cdtime_t interval);
 
+/*
+ * NAME
+ *   tail_match_report_stats
+ * DESCRIPTION
+ *   Enables dispatching the number of bytes and lines read from the file, and
+ *   the number of bytes which were appended while reading, after each call to
+ *   `tail_match_read'. The values are dispatched using the passed `plugin' and
+ *   `plugin_instance'.
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise.
+ */
+int tail_match_report_stats(cu_tail_match_t *obj, const char *plugin,
+                            const char *plugin_instance,
+                            const cdtime_t interval);
+
 /*
  * NAME
  *   tail_match_read
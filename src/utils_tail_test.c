@@ -0,0 +1,218 @@
+/**
+ * collectd - src/utils_tail_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "common.h"
+#include "testing.h"
+#include "utils_tail.h"
+
+typedef struct {
+  char lines[8][64];
+  size_t lines_num;
+} received_t;
+
+static int append_line(void *data, char *buf, int buflen) {
+  received_t *r = data;
+
+  if (r->lines_num >= STATIC_ARRAY_SIZE(r->lines))
+    return -1;
+  if ((size_t)buflen != strlen(buf))
+    return -1;
+
+  sstrncpy(r->lines[r->lines_num], buf, sizeof(r->lines[r->lines_num]));
+  r->lines_num++;
+  return 0;
+}
+
+static int write_file(char const *file, char const *mode, char const *data) {
+  FILE *fh = fopen(file, mode);
+  if (fh == NULL)
+    return -1;
+  fputs(data, fh);
+  return fclose(fh);
+}
+
+/* Reads everything available and returns the number of lines received. */
+static size_t tail_read(cu_tail_t *tail, received_t *r) {
+  memset(r, 0, sizeof(*r));
+  if (cu_tail_read(tail, append_line, r) != 0)
+    return (size_t)-1;
+  return r->lines_num;
+}
+
+static char *temp_file(char *buffer, size_t buffer_size, char const *name) {
+  char const *tmpdir = getenv("TMPDIR");
+  snprintf(buffer, buffer_size, "%s/utils_tail_test.%d.%s",
+           (tmpdir != NULL) ? tmpdir : "/tmp", (int)getpid(), name);
+  return buffer;
+}
+
+DEF_TEST(partial_lines) {
+  char file[PATH_MAX];
+  received_t r;
+  cu_tail_t *tail;
+
+  temp_file(file, sizeof(file), "partial");
+  EXPECT_EQ_INT(0, write_file(file, "w", "existing line\n"));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+
+  /* The file is opened at its end. */
+  EXPECT_EQ_INT(0, tail_read(tail, &r));
+
+  EXPECT_EQ_INT(0, write_file(file, "a", "first\nsec"));
+  EXPECT_EQ_INT(1, tail_read(tail, &r));
+  EXPECT_EQ_STR("first", r.lines[0]);
+
+  /* The rest of a line is only returned with its newline. */
+  EXPECT_EQ_INT(0, write_file(file, "a", "ond"));
+  EXPECT_EQ_INT(0, tail_read(tail, &r));
+  EXPECT_EQ_INT(0, write_file(file, "a", "\n\nthird\n"));
+  EXPECT_EQ_INT(3, tail_read(tail, &r));
+  EXPECT_EQ_STR("second", r.lines[0]);
+  EXPECT_EQ_STR("", r.lines[1]);
+  EXPECT_EQ_STR("third", r.lines[2]);
+
+  uint64_t bytes = 0, lines = 0, lag = 0;
+  cu_tail_stats(tail, &bytes, &lines, &lag);
+  EXPECT_EQ_UINT64(strlen("first\nsecond\n\nthird\n"), bytes);
+  EXPECT_EQ_UINT64(4, lines);
+  EXPECT_EQ_UINT64(0, lag);
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  return 0;
+}
+
+DEF_TEST(truncation) {
+  char file[PATH_MAX];
+  received_t r;
+  cu_tail_t *tail;
+
+  temp_file(file, sizeof(file), "truncate");
+  EXPECT_EQ_INT(0, write_file(file, "w", ""));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+  EXPECT_EQ_INT(0, tail_read(tail, &r));
+
+  EXPECT_EQ_INT(0, write_file(file, "a", "a rather long line\n"));
+  EXPECT_EQ_INT(1, tail_read(tail, &r));
+
+  /* Truncated in place: reading starts over at the beginning. */
+  EXPECT_EQ_INT(0, write_file(file, "w", "new\n"));
+  EXPECT_EQ_INT(1, tail_read(tail, &r));
+  EXPECT_EQ_STR("new", r.lines[0]);
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  return 0;
+}
+
+DEF_TEST(rotation) {
+  char file[PATH_MAX];
+  char rotated[PATH_MAX];
+  char other[PATH_MAX];
+  received_t r;
+  cu_tail_t *tail;
+  cu_tail_t *other_tail;
+
+  temp_file(file, sizeof(file), "rotate");
+  temp_file(rotated, sizeof(rotated), "rotate.1");
+  temp_file(other, sizeof(other), "other");
+  EXPECT_EQ_INT(0, write_file(file, "w", ""));
+  EXPECT_EQ_INT(0, write_file(other, "w", ""));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+  CHECK_NOT_NULL(other_tail = cu_tail_create(other));
+  EXPECT_EQ_INT(0, tail_read(tail, &r));
+  EXPECT_EQ_INT(0, tail_read(other_tail, &r));
+
+  /* The old file is read to its end, including a last line without newline,
+   * before switching to the new file, which is read from the beginning. */
+  EXPECT_EQ_INT(0, write_file(file, "a", "old 1\nold 2"));
+  EXPECT_EQ_INT(0, rename(file, rotated));
+  EXPECT_EQ_INT(0, write_file(file, "w", "new 1\n"));
+
+  /* Events of one file must not get lost when another file is read. */
+  EXPECT_EQ_INT(0, write_file(other, "a", "other\n"));
+  EXPECT_EQ_INT(1, tail_read(other_tail, &r));
+  EXPECT_EQ_STR("other", r.lines[0]);
+
+  EXPECT_EQ_INT(3, tail_read(tail, &r));
+  EXPECT_EQ_STR("old 1", r.lines[0]);
+  EXPECT_EQ_STR("old 2", r.lines[1]);
+  EXPECT_EQ_STR("new 1", r.lines[2]);
+
+  EXPECT_EQ_INT(0, write_file(file, "a", "new 2\n"));
+  EXPECT_EQ_INT(1, tail_read(tail, &r));
+  EXPECT_EQ_STR("new 2", r.lines[0]);
+
+  cu_tail_destroy(other_tail);
+  cu_tail_destroy(tail);
+  unlink(file);
+  unlink(rotated);
+  unlink(other);
+  return 0;
+}
+
+DEF_TEST(rotation_delayed) {
+  char file[PATH_MAX];
+  char rotated[PATH_MAX];
+  received_t r;
+  cu_tail_t *tail;
+
+  temp_file(file, sizeof(file), "delayed");
+  temp_file(rotated, sizeof(rotated), "delayed.1");
+  EXPECT_EQ_INT(0, write_file(file, "w", ""));
+  CHECK_NOT_NULL(tail = cu_tail_create(file));
+  EXPECT_EQ_INT(0, tail_read(tail, &r));
+
+  /* The file is read while the new file doesn't exist yet, which fails. */
+  EXPECT_EQ_INT(0, write_file(file, "a", "old 1\n"));
+  EXPECT_EQ_INT(0, rename(file, rotated));
+  EXPECT_EQ_INT(-1, tail_read(tail, &r));
+  EXPECT_EQ_STR("old 1", r.lines[0]);
+  EXPECT_EQ_INT(-1, tail_read(tail, &r));
+
+  /* Creating the new file causes no event on the old one; the new file must
+   * be picked up regardless. */
+  EXPECT_EQ_INT(0, write_file(file, "w", "new 1\n"));
+  EXPECT_EQ_INT(1, tail_read(tail, &r));
+  EXPECT_EQ_STR("new 1", r.lines[0]);
+
+  EXPECT_EQ_INT(0, write_file(file, "a", "new 2\n"));
+  EXPECT_EQ_INT(1, tail_read(tail, &r));
+  EXPECT_EQ_STR("new 2", r.lines[0]);
+  EXPECT_EQ_INT(0, tail_read(tail, &r));
+
+  cu_tail_destroy(tail);
+  unlink(file);
+  unlink(rotated);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(partial_lines);
+  RUN_TEST(truncation);
+  RUN_TEST(rotation);
+  RUN_TEST(rotation_delayed);
+
+  END_TEST;
+}
@@ -51,6 +51,8 @@
 #include "utils_format_graphite.h"
 
 #include <netdb.h>
+#include <poll.h>
+#include <sys/uio.h>
 
 #ifndef WG_DEFAULT_NODE
 #define WG_DEFAULT_NODE "localhost"
@@ -72,6 +74,10 @@
 #define WG_DEFAULT_ESCAPE '_'
 #endif
 
+#ifndef WG_DEFAULT_ASYNC_QUEUE_SIZE
+#define WG_DEFAULT_ASYNC_QUEUE_SIZE 1024
+#endif
+
 /* Ethernet - (IPv6 + TCP) = 1500 - (40 + 32) = 1428 */
 #ifndef WG_SEND_BUF_SIZE
 #define WG_SEND_BUF_SIZE 1428
@@ -81,12 +87,62 @@
 #define WG_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T(1)
 #endif
 
+/* Maximum number of queued buffers passed to a single writev(2) call. */
+#ifndef WG_IOV_MAX
+#define WG_IOV_MAX 64
+#endif
+
+/* How long the sender thread keeps trying to send queued data on shutdown. */
+#ifndef WG_SHUTDOWN_TIMEOUT
+#define WG_SHUTDOWN_TIMEOUT TIME_T_TO_CDTIME_T(2)
+#endif
+
 /*
  * Private variables
  */
-struct wg_callback {
+typedef struct wg_buffer_s {
+  struct wg_buffer_s *next;
+  size_t fill;
+  char data[WG_SEND_BUF_SIZE];
+} wg_buffer_t;
+
+struct wg_callback;
+
+/* A connection to the Graphite backend. Value lists are assigned to a
+ * connection by hashing their identifier, so all lines of a metric are sent
+ * in order over the same connection. */
+struct wg_connection {
+  struct wg_callback *cb;
   int sock_fd;
 
+  /* The buffer wg_send_message() appends to. */
+  wg_buffer_t *buffer;
+  cdtime_t buffer_init_time;
+
+  /* Asynchronous mode only: filled buffers waiting for the sender thread.
+   * `queue_offset' bytes of `queue_head' have been sent already. Sent
+   * buffers are kept on the idle list for reuse. */
+  wg_buffer_t *queue_head;
+  wg_buffer_t *queue_tail;
+  size_t queue_len;
+  size_t queue_offset;
+  wg_buffer_t *idle;
+  uint64_t dropped_buffers;
+  uint64_t dropped_bytes;
+  c_complain_t drop_complaint;
+
+  /* Protects the buffers and the queue. In synchronous mode it also protects
+   * the socket, which is only used by the sender thread otherwise. */
+  pthread_mutex_t send_lock;
+  c_complain_t init_complaint;
+  cdtime_t last_connect_time;
+
+  /* Force reconnect useful for load balanced environments */
+  cdtime_t last_reconnect_time;
+  _Bool reconnect_interval_reached;
+};
+
+struct wg_callback {
   char *name;
 
   char *node;
@@ -99,61 +155,67 @@ struct wg_callback {
 
   unsigned int format_flags;
 
-  char send_buf[WG_SEND_BUF_SIZE];
-  size_t send_buf_free;
-  size_t send_buf_fill;
-  cdtime_t send_buf_init_time;
-
-  pthread_mutex_t send_lock;
-  c_complain_t init_complaint;
-  cdtime_t last_connect_time;
-
-  /* Force reconnect useful for load balanced environments */
-  cdtime_t last_reconnect_time;
   cdtime_t reconnect_interval;
-  _Bool reconnect_interval_reached;
+
+  struct wg_connection *connections;
+  size_t connections_num;
+
+  /* In asynchronous mode, writers only fill buffers and queue them. A sender
+   * thread writes the queued buffers to non-blocking sockets, so a slow or
+   * unreachable backend never blocks the write callback. The thread is
+   * started when the first buffer is queued and woken up through a pipe. */
+  _Bool async;
+  size_t async_queue_size;
+  pthread_mutex_t sender_lock;
+  pthread_t sender_thread;
+  _Bool sender_running;
+  _Bool sender_shutdown;
+  _Bool sender_wakeup;
+  int wakeup_fd[2];
+  c_complain_t sender_complaint;
 };
 
-/* wg_force_reconnect_check closes cb->sock_fd when it was open for longer
- * than cb->reconnect_interval. Must hold cb->send_lock when calling. */
-static void wg_force_reconnect_check(struct wg_callback *cb) {
+/* wg_force_reconnect_check closes conn->sock_fd when it was open for longer
+ * than the reconnect interval. Must hold conn->send_lock when calling in
+ * synchronous mode. */
+static void wg_force_reconnect_check(struct wg_connection *conn) {
   cdtime_t now;
 
-  if (cb->reconnect_interval == 0)
+  if (conn->cb->reconnect_interval == 0)
     return;
 
   /* check if address changes if addr_timeout */
   now = cdtime();
-  if ((now - cb->last_reconnect_time) < cb->reconnect_interval)
+  if ((now - conn->last_reconnect_time) < conn->cb->reconnect_interval)
     return;
 
-  /* here we should close connection on next */
-  close(cb->sock_fd);
-  cb->sock_fd = -1;
-  cb->last_reconnect_time = now;
-  cb->reconnect_interval_reached = 1;
+  if (conn->sock_fd >= 0)
+    INFO("write_graphite plugin: Connection closed after %.3f seconds.",
+         CDTIME_T_TO_DOUBLE(now - conn->last_reconnect_time));
 
-  INFO("write_graphite plugin: Connection closed after %.3f seconds.",
-       CDTIME_T_TO_DOUBLE(now - cb->last_reconnect_time));
+  /* here we should close connection on next */
+  close(conn->sock_fd);
+  conn->sock_fd = -1;
+  conn->last_reconnect_time = now;
+  conn->reconnect_interval_reached = 1;
 }
 
 /*
  * Functions
  */
-static void wg_reset_buffer(struct wg_callback *cb) {
-  memset(cb->send_buf, 0, sizeof(cb->send_buf));
-  cb->send_buf_free = sizeof(cb->send_buf);
-  cb->send_buf_fill = 0;
-  cb->send_buf_init_time = cdtime();
+static void wg_reset_buffer(struct wg_connection *conn) {
+  conn->buffer->fill = 0;
+  conn->buffer_init_time = cdtime();
 }
 
-static int wg_send_buffer(struct wg_callback *cb) {
+static int wg_send_buffer(struct wg_connection *conn) {
+  struct wg_callback *cb = conn->cb;
   ssize_t status;
 
-  if (cb->sock_fd < 0)
+  if (conn->sock_fd < 0)
     return -1;
 
-  status = swrite(cb->sock_fd, cb->send_buf, strlen(cb->send_buf));
+  status = swrite(conn->sock_fd, conn->buffer->data, conn->buffer->fill);
   if (status != 0) {
     if (cb->log_send_errors) {
       char errbuf[1024];
@@ -163,8 +225,8 @@ static int wg_send_buffer(struct wg_callback *cb) {
             sstrerror(errno, errbuf, sizeof(errbuf)));
     }
 
-    close(cb->sock_fd);
-    cb->sock_fd = -1;
+    close(conn->sock_fd);
+    conn->sock_fd = -1;
 
     return -1;
   }
@@ -172,50 +234,51 @@ static int wg_send_buffer(struct wg_callback *cb) {
   return 0;
 }
 
-/* NOTE: You must hold cb->send_lock when calling this function! */
-static int wg_flush_nolock(cdtime_t timeout, struct wg_callback *cb) {
+/* NOTE: You must hold conn->send_lock when calling this function! */
+static int wg_flush_nolock(cdtime_t timeout, struct wg_connection *conn) {
   int status;
 
   DEBUG("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
         "send_buf_fill = %zu;",
-        (double)timeout, cb->send_buf_fill);
+        (double)timeout, conn->buffer->fill);
 
   /* timeout == 0  => flush unconditionally */
   if (timeout > 0) {
     cdtime_t now;
 
     now = cdtime();
-    if ((cb->send_buf_init_time + timeout) > now)
+    if ((conn->buffer_init_time + timeout) > now)
       return 0;
   }
 
-  if (cb->send_buf_fill == 0) {
-    cb->send_buf_init_time = cdtime();
+  if (conn->buffer->fill == 0) {
+    conn->buffer_init_time = cdtime();
     return 0;
   }
 
-  status = wg_send_buffer(cb);
-  wg_reset_buffer(cb);
+  status = wg_send_buffer(conn);
+  wg_reset_buffer(conn);
 
   return status;
 }
 
-static int wg_callback_init(struct wg_callback *cb) {
+static int wg_connection_init(struct wg_connection *conn) {
+  struct wg_callback *cb = conn->cb;
   struct addrinfo *ai_list;
   cdtime_t now;
   int status;
 
   char connerr[1024] = "";
 
-  if (cb->sock_fd > 0)
+  if (conn->sock_fd > 0)
     return 0;
 
   /* Don't try to reconnect too often. By default, one reconnection attempt
    * is made per second. */
   now = cdtime();
-  if ((now - cb->last_connect_time) < WG_MIN_RECONNECT_INTERVAL)
+  if ((now - conn->last_connect_time) < WG_MIN_RECONNECT_INTERVAL)
     return EAGAIN;
-  cb->last_connect_time = now;
+  conn->last_connect_time = now;
 
   struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
                               .ai_flags = AI_ADDRCONFIG};
@@ -235,25 +298,25 @@ static int wg_callback_init(struct wg_callback *cb) {
   assert(ai_list != NULL);
   for (struct addrinfo *ai_ptr = ai_list; ai_ptr != NULL;
        ai_ptr = ai_ptr->ai_next) {
-    cb->sock_fd =
+    conn->sock_fd =
         socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
-    if (cb->sock_fd < 0) {
+    if (conn->sock_fd < 0) {
       char errbuf[1024];
       snprintf(connerr, sizeof(connerr), "failed to open socket: %s",
                sstrerror(errno, errbuf, sizeof(errbuf)));
       continue;
     }
 
-    set_sock_opts(cb->sock_fd);
+    set_sock_opts(conn->sock_fd);
 
-    status = connect(cb->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+    status = connect(conn->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
     if (status != 0) {
       char errbuf[1024];
       snprintf(connerr, sizeof(connerr), "failed to connect to remote "
                                          "host: %s",
                sstrerror(errno, errbuf, sizeof(errbuf)));
-      close(cb->sock_fd);
-      cb->sock_fd = -1;
+      close(conn->sock_fd);
+      conn->sock_fd = -1;
       continue;
     }
 
@@ -262,32 +325,369 @@ static int wg_callback_init(struct wg_callback *cb) {
 
   freeaddrinfo(ai_list);
 
-  if (cb->sock_fd < 0) {
+  if (conn->sock_fd < 0) {
     if (connerr[0] == '\0')
       /* this should not happen but try to get a message anyway */
       sstrerror(errno, connerr, sizeof(connerr));
-    c_complain(LOG_ERR, &cb->init_complaint,
+    c_complain(LOG_ERR, &conn->init_complaint,
                "write_graphite plugin: Connecting to %s:%s via %s failed. "
                "The last error was: %s",
                cb->node, cb->service, cb->protocol, connerr);
     return -1;
   } else {
-    c_release(LOG_INFO, &cb->init_complaint,
+    c_release(LOG_INFO, &conn->init_complaint,
               "write_graphite plugin: Successfully connected to %s:%s via %s.",
               cb->node, cb->service, cb->protocol);
   }
 
+  /* The sender thread must never block in write(2). */
+  if (cb->async) {
+    int flags = fcntl(conn->sock_fd, F_GETFL);
+    if ((flags < 0) ||
+        (fcntl(conn->sock_fd, F_SETFL, flags | O_NONBLOCK) != 0)) {
+      char errbuf[1024];
+      ERROR("write_graphite plugin: Setting O_NONBLOCK failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      close(conn->sock_fd);
+      conn->sock_fd = -1;
+      return -1;
+    }
+    return 0;
+  }
+
   /* wg_force_reconnect_check does not flush the buffer before closing a
    * sending socket, so only call wg_reset_buffer() if the socket was closed
-   * for a different reason (tracked in cb->reconnect_interval_reached). */
-  if (!cb->reconnect_interval_reached || (cb->send_buf_free == 0))
-    wg_reset_buffer(cb);
+   * for a different reason (tracked in conn->reconnect_interval_reached). */
+  if (!conn->reconnect_interval_reached ||
+      (conn->buffer->fill == sizeof(conn->buffer->data)))
+    wg_reset_buffer(conn);
   else
-    cb->reconnect_interval_reached = 0;
+    conn->reconnect_interval_reached = 0;
 
   return 0;
 }
 
+static void *wg_sender_thread(void *arg);
+
+static void wg_sender_notify(struct wg_callback *cb) {
+  /* If the pipe is full, the sender thread is going to wake up anyway. */
+  ssize_t status = write(cb->wakeup_fd[1], "", 1);
+  (void)status;
+}
+
+/* Wakes up the sender thread, starting it if necessary. Called after a buffer
+ * has been queued, so the locking overhead is paid at most once per
+ * WG_SEND_BUF_SIZE bytes. */
+static void wg_sender_wakeup(struct wg_callback *cb) /* {{{ */
+{
+  pthread_mutex_lock(&cb->sender_lock);
+
+  if (!cb->sender_running && !cb->sender_shutdown) {
+    int status = plugin_thread_create(&cb->sender_thread, /* attr = */ NULL,
+                                      wg_sender_thread, cb, "write_graphite");
+    if (status != 0) {
+      char errbuf[1024];
+      c_complain(LOG_ERR, &cb->sender_complaint,
+                 "write_graphite plugin: Starting the sender thread failed: "
+                 "%s",
+                 sstrerror(status, errbuf, sizeof(errbuf)));
+      pthread_mutex_unlock(&cb->sender_lock);
+      return;
+    }
+    cb->sender_running = 1;
+  }
+
+  if (!cb->sender_wakeup) {
+    cb->sender_wakeup = 1;
+    wg_sender_notify(cb);
+  }
+
+  pthread_mutex_unlock(&cb->sender_lock);
+} /* }}} void wg_sender_wakeup */
+
+/* Moves the current buffer to the send queue and replaces it with an idle or
+ * newly allocated one. If the queue is full, the buffer's content is dropped
+ * instead. Returns non-zero if the sender thread needs to be woken up. Must
+ * hold conn->send_lock. */
+static _Bool wg_enqueue_nolock(struct wg_connection *conn) /* {{{ */
+{
+  struct wg_callback *cb = conn->cb;
+  wg_buffer_t *next;
+
+  if (conn->buffer->fill == 0) {
+    conn->buffer_init_time = cdtime();
+    return 0;
+  }
+
+  next = NULL;
+  if (conn->queue_len < cb->async_queue_size) {
+    next = conn->idle;
+    if (next != NULL)
+      conn->idle = next->next;
+    else
+      next = malloc(sizeof(*next));
+  }
+
+  if (next == NULL) {
+    conn->dropped_buffers++;
+    conn->dropped_bytes += conn->buffer->fill;
+    c_complain(LOG_WARNING, &conn->drop_complaint,
+               "write_graphite plugin: [%s]:%s (%s) The send queue is full. "
+               "%" PRIu64 " buffers (%" PRIu64 " bytes) have been dropped so "
+               "far.",
+               cb->node, cb->service, cb->protocol, conn->dropped_buffers,
+               conn->dropped_bytes);
+    wg_reset_buffer(conn);
+    return 1;
+  }
+
+  conn->buffer->next = NULL;
+  if (conn->queue_tail == NULL)
+    conn->queue_head = conn->buffer;
+  else
+    conn->queue_tail->next = conn->buffer;
+  conn->queue_tail = conn->buffer;
+  conn->queue_len++;
+
+  conn->buffer = next;
+  wg_reset_buffer(conn);
+
+  c_release(LOG_INFO, &conn->drop_complaint,
+            "write_graphite plugin: [%s]:%s (%s) The send queue accepts data "
+            "again.",
+            cb->node, cb->service, cb->protocol);
+  return 1;
+} /* }}} _Bool wg_enqueue_nolock */
+
+/* Removes the first buffer from the send queue. Must hold conn->send_lock. */
+static void wg_dequeue_nolock(struct wg_connection *conn) /* {{{ */
+{
+  wg_buffer_t *buf = conn->queue_head;
+
+  conn->queue_head = buf->next;
+  if (conn->queue_head == NULL)
+    conn->queue_tail = NULL;
+  conn->queue_len--;
+  conn->queue_offset = 0;
+
+  buf->next = conn->idle;
+  conn->idle = buf;
+} /* }}} void wg_dequeue_nolock */
+
+/* Writes as much of the send queue as possible without blocking. Only the
+ * sender thread uses the socket in asynchronous mode, so conn->send_lock is
+ * only held while looking at the queue. Returns zero if the queue is empty,
+ * EAGAIN if the socket is not writable and -1 if no connection could be
+ * established. */
+static int wg_send_queue(struct wg_connection *conn) /* {{{ */
+{
+  struct wg_callback *cb = conn->cb;
+  struct iovec iov[WG_IOV_MAX];
+  /* Every buffer is sent as a datagram of its own. */
+  int iov_max = (strcasecmp("udp", cb->protocol) == 0) ? 1 : WG_IOV_MAX;
+
+  while (42) {
+    int iov_num = 0;
+    ssize_t status;
+
+    pthread_mutex_lock(&conn->send_lock);
+    for (wg_buffer_t *buf = conn->queue_head;
+         (buf != NULL) && (iov_num < iov_max); buf = buf->next) {
+      size_t offset = (iov_num == 0) ? conn->queue_offset : 0;
+      iov[iov_num].iov_base = buf->data + offset;
+      iov[iov_num].iov_len = buf->fill - offset;
+      iov_num++;
+    }
+    /* Don't cut a line in half when reconnecting. */
+    if ((iov_num > 0) && (conn->queue_offset == 0))
+      wg_force_reconnect_check(conn);
+    pthread_mutex_unlock(&conn->send_lock);
+
+    if (iov_num == 0)
+      return 0;
+
+    if (conn->sock_fd < 0) {
+      if (wg_connection_init(conn) != 0)
+        return -1;
+      continue;
+    }
+
+    status = writev(conn->sock_fd, iov, iov_num);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return EAGAIN;
+
+      if (cb->log_send_errors) {
+        char errbuf[1024];
+        ERROR("write_graphite plugin: send to %s:%s (%s) failed: %s",
+              cb->node, cb->service, cb->protocol,
+              sstrerror(errno, errbuf, sizeof(errbuf)));
+      }
+      close(conn->sock_fd);
+      conn->sock_fd = -1;
+
+      /* Like in synchronous mode, the buffer that failed is lost. This also
+       * avoids sending the rest of a partially sent line. */
+      pthread_mutex_lock(&conn->send_lock);
+      wg_dequeue_nolock(conn);
+      pthread_mutex_unlock(&conn->send_lock);
+      return -1;
+    }
+
+    pthread_mutex_lock(&conn->send_lock);
+    for (size_t sent = (size_t)status; sent > 0;) {
+      size_t left = conn->queue_head->fill - conn->queue_offset;
+
+      if (sent < left) {
+        conn->queue_offset += sent;
+        break;
+      }
+      sent -= left;
+      wg_dequeue_nolock(conn);
+    }
+    pthread_mutex_unlock(&conn->send_lock);
+  }
+} /* }}} int wg_send_queue */
+
+static void *wg_sender_thread(void *arg) /* {{{ */
+{
+  struct wg_callback *cb = arg;
+  struct pollfd *fds;
+  cdtime_t deadline = 0;
+
+  fds = calloc(cb->connections_num + 1, sizeof(*fds));
+  if (fds == NULL) {
+    ERROR("write_graphite plugin: wg_sender_thread: calloc failed.");
+    return NULL;
+  }
+
+  while (42) {
+    nfds_t fds_num = 1;
+    _Bool pending = 0;
+    _Bool shutdown;
+    int timeout = -1;
+    char tmp[64];
+
+    pthread_mutex_lock(&cb->sender_lock);
+    shutdown = cb->sender_shutdown;
+    cb->sender_wakeup = 0;
+    pthread_mutex_unlock(&cb->sender_lock);
+    while (read(cb->wakeup_fd[0], tmp, sizeof(tmp)) > 0)
+      /* drain the pipe */;
+
+    if (shutdown && (deadline == 0)) {
+      deadline = cdtime() + WG_SHUTDOWN_TIMEOUT;
+      for (size_t i = 0; i < cb->connections_num; i++) {
+        struct wg_connection *conn = cb->connections + i;
+        pthread_mutex_lock(&conn->send_lock);
+        wg_enqueue_nolock(conn);
+        pthread_mutex_unlock(&conn->send_lock);
+      }
+    }
+
+    for (size_t i = 0; i < cb->connections_num; i++) {
+      struct wg_connection *conn = cb->connections + i;
+      int status = wg_send_queue(conn);
+
+      if (status == 0)
+        continue;
+      pending = 1;
+      if (status == EAGAIN)
+        fds[fds_num++] =
+            (struct pollfd){.fd = conn->sock_fd, .events = POLLOUT};
+    }
+
+    /* Retry unconnected sockets after WG_MIN_RECONNECT_INTERVAL. */
+    if (pending)
+      timeout = (int)CDTIME_T_TO_MS(WG_MIN_RECONNECT_INTERVAL);
+
+    if (shutdown) {
+      cdtime_t now = cdtime();
+      if (!pending || (now >= deadline))
+        break;
+      if ((deadline - now) < WG_MIN_RECONNECT_INTERVAL)
+        timeout = (int)CDTIME_T_TO_MS(deadline - now);
+    }
+
+    fds[0] = (struct pollfd){.fd = cb->wakeup_fd[0], .events = POLLIN};
+    if ((poll(fds, fds_num, timeout) < 0) && (errno != EINTR)) {
+      char errbuf[1024];
+      ERROR("write_graphite plugin: poll failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      break;
+    }
+  }
+
+  sfree(fds);
+  return NULL;
+} /* }}} void *wg_sender_thread */
+
+/* Sends the remaining data, for at most WG_SHUTDOWN_TIMEOUT, and stops the
+ * sender thread. */
+static void wg_sender_stop(struct wg_callback *cb) /* {{{ */
+{
+  _Bool running;
+
+  /* Start the thread if necessary, so that partially filled buffers are sent,
+   * too. */
+  wg_sender_wakeup(cb);
+
+  pthread_mutex_lock(&cb->sender_lock);
+  running = cb->sender_running;
+  cb->sender_shutdown = 1;
+  if (running)
+    wg_sender_notify(cb);
+  pthread_mutex_unlock(&cb->sender_lock);
+
+  if (running) {
+    pthread_join(cb->sender_thread, /* retval = */ NULL);
+    cb->sender_running = 0;
+  }
+} /* }}} void wg_sender_stop */
+
+static void wg_connection_free(struct wg_connection *conn) /* {{{ */
+{
+  struct wg_callback *cb = conn->cb;
+
+  pthread_mutex_lock(&conn->send_lock);
+
+  if (cb->async) {
+    if (conn->buffer != NULL) {
+      conn->dropped_bytes += conn->buffer->fill;
+      conn->dropped_buffers += (conn->buffer->fill > 0) ? 1 : 0;
+    }
+    while (conn->queue_head != NULL) {
+      conn->dropped_bytes += conn->queue_head->fill - conn->queue_offset;
+      conn->dropped_buffers++;
+      wg_dequeue_nolock(conn);
+    }
+    if (conn->dropped_buffers > 0)
+      INFO("write_graphite plugin: [%s]:%s (%s) %" PRIu64 " buffers (%" PRIu64
+           " bytes) have been dropped.",
+           cb->node, cb->service, cb->protocol, conn->dropped_buffers,
+           conn->dropped_bytes);
+  } else if (conn->buffer != NULL) {
+    wg_flush_nolock(/* timeout = */ 0, conn);
+  }
+
+  if (conn->sock_fd >= 0) {
+    close(conn->sock_fd);
+    conn->sock_fd = -1;
+  }
+
+  while (conn->idle != NULL) {
+    wg_buffer_t *buf = conn->idle;
+    conn->idle = buf->next;
+    sfree(buf);
+  }
+  sfree(conn->buffer);
+
+  pthread_mutex_unlock(&conn->send_lock);
+  pthread_mutex_destroy(&conn->send_lock);
+} /* }}} void wg_connection_free */
+
 static void wg_callback_free(void *data) {
   struct wg_callback *cb;
 
@@ -296,15 +696,19 @@ static void wg_callback_free(void *data) {
 
   cb = data;
 
-  pthread_mutex_lock(&cb->send_lock);
-
-  wg_flush_nolock(/* timeout = */ 0, cb);
+  if (cb->connections != NULL) {
+    if (cb->async)
+      wg_sender_stop(cb);
 
-  if (cb->sock_fd >= 0) {
-    close(cb->sock_fd);
-    cb->sock_fd = -1;
+    for (size_t i = 0; i < cb->connections_num; i++)
+      wg_connection_free(cb->connections + i);
+    sfree(cb->connections);
   }
 
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cb->wakeup_fd); i++)
+    if (cb->wakeup_fd[i] >= 0)
+      close(cb->wakeup_fd[i]);
+
   sfree(cb->name);
   sfree(cb->node);
   sfree(cb->protocol);
@@ -312,7 +716,7 @@ static void wg_callback_free(void *data) {
   sfree(cb->prefix);
   sfree(cb->postfix);
 
-  pthread_mutex_destroy(&cb->send_lock);
+  pthread_mutex_destroy(&cb->sender_lock);
 
   sfree(cb);
 }
@@ -321,77 +725,124 @@ static int wg_flush(cdtime_t timeout,
                     const char *identifier __attribute__((unused)),
                     user_data_t *user_data) {
   struct wg_callback *cb;
-  int status;
+  _Bool wakeup = 0;
+  int status = 0;
 
   if (user_data == NULL)
     return -EINVAL;
 
   cb = user_data->data;
 
-  pthread_mutex_lock(&cb->send_lock);
+  for (size_t i = 0; i < cb->connections_num; i++) {
+    struct wg_connection *conn = cb->connections + i;
 
-  if (cb->sock_fd < 0) {
-    status = wg_callback_init(cb);
-    if (status != 0) {
-      /* An error message has already been printed. */
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
+    pthread_mutex_lock(&conn->send_lock);
+
+    if (cb->async) {
+      if ((timeout == 0) || ((conn->buffer_init_time + timeout) <= cdtime()))
+        wakeup |= wg_enqueue_nolock(conn);
+      pthread_mutex_unlock(&conn->send_lock);
+      continue;
+    }
+
+    if (conn->sock_fd < 0) {
+      if (wg_connection_init(conn) != 0) {
+        /* An error message has already been printed. */
+        pthread_mutex_unlock(&conn->send_lock);
+        status = -1;
+        continue;
+      }
     }
+
+    if (wg_flush_nolock(timeout, conn) != 0)
+      status = -1;
+    pthread_mutex_unlock(&conn->send_lock);
   }
 
-  status = wg_flush_nolock(timeout, cb);
-  pthread_mutex_unlock(&cb->send_lock);
+  if (wakeup)
+    wg_sender_wakeup(cb);
 
   return status;
 }
 
-static int wg_send_message(char const *message, struct wg_callback *cb) {
+static int wg_send_message(char const *message, struct wg_connection *conn) {
+  struct wg_callback *cb = conn->cb;
+  _Bool wakeup = 0;
   int status;
   size_t message_len;
 
   message_len = strlen(message);
 
-  pthread_mutex_lock(&cb->send_lock);
+  pthread_mutex_lock(&conn->send_lock);
 
-  wg_force_reconnect_check(cb);
-
-  if (cb->sock_fd < 0) {
-    status = wg_callback_init(cb);
-    if (status != 0) {
-      /* An error message has already been printed. */
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
+  if (cb->async) {
+    if (message_len > sizeof(conn->buffer->data) - conn->buffer->fill)
+      wakeup = wg_enqueue_nolock(conn);
+  } else {
+    wg_force_reconnect_check(conn);
+
+    if (conn->sock_fd < 0) {
+      status = wg_connection_init(conn);
+      if (status != 0) {
+        /* An error message has already been printed. */
+        pthread_mutex_unlock(&conn->send_lock);
+        return -1;
+      }
     }
-  }
 
-  if (message_len >= cb->send_buf_free) {
-    status = wg_flush_nolock(/* timeout = */ 0, cb);
-    if (status != 0) {
-      pthread_mutex_unlock(&cb->send_lock);
-      return status;
+    if (message_len > sizeof(conn->buffer->data) - conn->buffer->fill) {
+      status = wg_flush_nolock(/* timeout = */ 0, conn);
+      if (status != 0) {
+        pthread_mutex_unlock(&conn->send_lock);
+        return status;
+      }
     }
   }
 
   /* Assert that we have enough space for this message. */
-  assert(message_len < cb->send_buf_free);
+  assert(message_len <= sizeof(conn->buffer->data) - conn->buffer->fill);
 
-  /* `message_len + 1' because `message_len' does not include the
-   * trailing null byte. Neither does `send_buffer_fill'. */
-  memcpy(cb->send_buf + cb->send_buf_fill, message, message_len + 1);
-  cb->send_buf_fill += message_len;
-  cb->send_buf_free -= message_len;
+  memcpy(conn->buffer->data + conn->buffer->fill, message, message_len);
+  conn->buffer->fill += message_len;
 
   DEBUG("write_graphite plugin: [%s]:%s (%s) buf %zu/%zu (%.1f %%) \"%s\"",
-        cb->node, cb->service, cb->protocol, cb->send_buf_fill,
-        sizeof(cb->send_buf),
-        100.0 * ((double)cb->send_buf_fill) / ((double)sizeof(cb->send_buf)),
+        cb->node, cb->service, cb->protocol, conn->buffer->fill,
+        sizeof(conn->buffer->data),
+        100.0 * ((double)conn->buffer->fill) /
+            ((double)sizeof(conn->buffer->data)),
         message);
 
-  pthread_mutex_unlock(&cb->send_lock);
+  pthread_mutex_unlock(&conn->send_lock);
+
+  if (wakeup)
+    wg_sender_wakeup(cb);
 
   return 0;
 }
 
+/* Chooses the connection for a value list using the FNV-1a hash of its
+ * identifier. */
+static struct wg_connection *wg_connection_get(struct wg_callback *cb,
+                                               value_list_t const *vl) {
+  char const *fields[] = {vl->host, vl->plugin, vl->plugin_instance, vl->type,
+                          vl->type_instance};
+  uint32_t hash = 2166136261u;
+
+  if (cb->connections_num == 1)
+    return cb->connections;
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fields); i++) {
+    for (char const *ptr = fields[i]; *ptr != 0; ptr++) {
+      hash ^= (uint32_t)(unsigned char)*ptr;
+      hash *= 16777619u;
+    }
+    hash ^= (uint32_t)'/';
+    hash *= 16777619u;
+  }
+
+  return cb->connections + (hash % cb->connections_num);
+}
+
 static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
                              struct wg_callback *cb) {
   char buffer[WG_SEND_BUF_SIZE] = {0};
@@ -409,7 +860,7 @@ static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
     return status;
 
   /* Send the message to graphite */
-  status = wg_send_message(buffer, cb);
+  status = wg_send_message(buffer, wg_connection_get(cb, vl));
   if (status != 0) /* error message has been printed already. */
     return status;
 
@@ -456,42 +907,44 @@ static int config_set_char(char *dest, oconfig_item_t *ci) {
   return 0;
 }
 
-static int wg_config_node(oconfig_item_t *ci) {
+/* Creates a callback and its connections from a "Node" block. Returns NULL
+ * on error. */
+static struct wg_callback *wg_callback_create(oconfig_item_t *ci) {
   struct wg_callback *cb;
-  char callback_name[DATA_MAX_NAME_LEN];
   int status = 0;
 
   cb = calloc(1, sizeof(*cb));
   if (cb == NULL) {
     ERROR("write_graphite plugin: calloc failed.");
-    return -1;
+    return NULL;
   }
-  cb->sock_fd = -1;
   cb->name = NULL;
   cb->node = strdup(WG_DEFAULT_NODE);
   cb->service = strdup(WG_DEFAULT_SERVICE);
   cb->protocol = strdup(WG_DEFAULT_PROTOCOL);
-  cb->last_reconnect_time = cdtime();
   cb->reconnect_interval = 0;
-  cb->reconnect_interval_reached = 0;
   cb->log_send_errors = WG_DEFAULT_LOG_SEND_ERRORS;
   cb->prefix = NULL;
   cb->postfix = NULL;
   cb->escape_char = WG_DEFAULT_ESCAPE;
   cb->format_flags = GRAPHITE_STORE_RATES;
+  cb->connections_num = 1;
+  cb->async = 0;
+  cb->async_queue_size = WG_DEFAULT_ASYNC_QUEUE_SIZE;
+  cb->wakeup_fd[0] = -1;
+  cb->wakeup_fd[1] = -1;
+  pthread_mutex_init(&cb->sender_lock, /* attr = */ NULL);
+  C_COMPLAIN_INIT(&cb->sender_complaint);
 
   /* FIXME: Legacy configuration syntax. */
   if (strcasecmp("Carbon", ci->key) != 0) {
     status = cf_util_get_string(ci, &cb->name);
     if (status != 0) {
       wg_callback_free(cb);
-      return status;
+      return NULL;
     }
   }
 
-  pthread_mutex_init(&cb->send_lock, /* attr = */ NULL);
-  C_COMPLAIN_INIT(&cb->init_complaint);
-
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
 
@@ -527,7 +980,26 @@ static int wg_config_node(oconfig_item_t *ci) {
       cf_util_get_flag(child, &cb->format_flags, GRAPHITE_DROP_DUPE_FIELDS);
     else if (strcasecmp("EscapeCharacter", child->key) == 0)
       config_set_char(&cb->escape_char, child);
-    else {
+    else if (strcasecmp("Connections", child->key) == 0) {
+      int tmp = (int)cb->connections_num;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 1)) {
+        ERROR("write_graphite plugin: \"Connections\" must be at least 1.");
+        status = -1;
+      }
+      cb->connections_num = (size_t)tmp;
+    } else if (strcasecmp("Asynchronous", child->key) == 0)
+      status = cf_util_get_boolean(child, &cb->async);
+    else if (strcasecmp("AsyncQueueSize", child->key) == 0) {
+      int tmp = (int)cb->async_queue_size;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 1)) {
+        ERROR("write_graphite plugin: \"AsyncQueueSize\" must be at least "
+              "1.");
+        status = -1;
+      }
+      cb->async_queue_size = (size_t)tmp;
+    } else {
       ERROR("write_graphite plugin: Invalid configuration "
             "option: %s.",
             child->key);
@@ -540,9 +1012,60 @@ static int wg_config_node(oconfig_item_t *ci) {
 
   if (status != 0) {
     wg_callback_free(cb);
-    return status;
+    return NULL;
+  }
+
+  if (cb->async) {
+    if (pipe(cb->wakeup_fd) != 0) {
+      char errbuf[1024];
+      ERROR("write_graphite plugin: pipe failed: %s",
+            sstrerror(errno, errbuf, sizeof(errbuf)));
+      cb->wakeup_fd[0] = cb->wakeup_fd[1] = -1;
+      wg_callback_free(cb);
+      return NULL;
+    }
+    for (size_t i = 0; i < STATIC_ARRAY_SIZE(cb->wakeup_fd); i++)
+      fcntl(cb->wakeup_fd[i], F_SETFL,
+            fcntl(cb->wakeup_fd[i], F_GETFL) | O_NONBLOCK);
+  }
+
+  cb->connections = calloc(cb->connections_num, sizeof(*cb->connections));
+  if (cb->connections == NULL) {
+    ERROR("write_graphite plugin: calloc failed.");
+    wg_callback_free(cb);
+    return NULL;
+  }
+  for (size_t i = 0; i < cb->connections_num; i++) {
+    struct wg_connection *conn = cb->connections + i;
+
+    conn->cb = cb;
+    conn->sock_fd = -1;
+    conn->last_reconnect_time = cdtime();
+    conn->buffer = calloc(1, sizeof(*conn->buffer));
+    conn->buffer_init_time = cdtime();
+    pthread_mutex_init(&conn->send_lock, /* attr = */ NULL);
+    C_COMPLAIN_INIT(&conn->init_complaint);
+    C_COMPLAIN_INIT(&conn->drop_complaint);
+
+    if (conn->buffer == NULL) {
+      ERROR("write_graphite plugin: calloc failed.");
+      cb->connections_num = i + 1;
+      wg_callback_free(cb);
+      return NULL;
+    }
   }
 
+  return cb;
+}
+
+static int wg_config_node(oconfig_item_t *ci) {
+  struct wg_callback *cb;
+  char callback_name[DATA_MAX_NAME_LEN];
+
+  cb = wg_callback_create(ci);
+  if (cb == NULL)
+    return -1;
+
   /* FIXME: Legacy configuration syntax. */
   if (cb->name == NULL)
     snprintf(callback_name, sizeof(callback_name), "write_graphite/%s/%s/%s",
@@ -570,7 +1093,16 @@ static int wg_config(oconfig_item_t *ci) {
     /* FIXME: Remove this legacy mode in version 6. */
     else if (strcasecmp("Carbon", child->key) == 0)
       wg_config_node(child);
-    else {
+    else if (strcasecmp("NameCacheSize", child->key) == 0) {
+      int size = 0;
+      if (cf_util_get_int(child, &size) != 0)
+        continue;
+      if (size < 0) {
+        ERROR("write_graphite plugin: NameCacheSize must not be negative.");
+        continue;
+      }
+      format_graphite_set_cache_size((size_t)size);
+    } else {
       ERROR("write_graphite plugin: Invalid configuration "
             "option: %s.",
             child->key);
@@ -0,0 +1,301 @@
+/**
+ * collectd - src/write_graphite_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/* Don't wait for unreachable servers on shutdown. */
+#define WG_SHUTDOWN_TIMEOUT 0
+
+#include "testing.h"
+#include "write_graphite.c" /* sic */
+
+#include <netinet/in.h>
+
+#define TEST_STREAMS_MAX 8
+
+static struct wg_callback *test_callback_create(int port, int connections,
+                                                _Bool async, int queue_size) {
+  oconfig_item_t children[] = {
+      {.key = "Host",
+       .values = &(oconfig_value_t){.value.string = "127.0.0.1",
+                                    .type = OCONFIG_TYPE_STRING},
+       .values_num = 1},
+      {.key = "Port",
+       .values = &(oconfig_value_t){.value.number = port,
+                                    .type = OCONFIG_TYPE_NUMBER},
+       .values_num = 1},
+      {.key = "StoreRates",
+       .values = &(oconfig_value_t){.value.boolean = 0,
+                                    .type = OCONFIG_TYPE_BOOLEAN},
+       .values_num = 1},
+      {.key = "LogSendErrors",
+       .values = &(oconfig_value_t){.value.boolean = 0,
+                                    .type = OCONFIG_TYPE_BOOLEAN},
+       .values_num = 1},
+      {.key = "Connections",
+       .values = &(oconfig_value_t){.value.number = connections,
+                                    .type = OCONFIG_TYPE_NUMBER},
+       .values_num = 1},
+      {.key = "Asynchronous",
+       .values = &(oconfig_value_t){.value.boolean = async,
+                                    .type = OCONFIG_TYPE_BOOLEAN},
+       .values_num = 1},
+      {.key = "AsyncQueueSize",
+       .values = &(oconfig_value_t){.value.number = queue_size,
+                                    .type = OCONFIG_TYPE_NUMBER},
+       .values_num = 1},
+  };
+  oconfig_item_t ci = {
+      .key = "Node",
+      .values = &(oconfig_value_t){.value.string = "test",
+                                   .type = OCONFIG_TYPE_STRING},
+      .values_num = 1,
+      .children = children,
+      .children_num = STATIC_ARRAY_SIZE(children),
+  };
+
+  return wg_callback_create(&ci);
+}
+
+static int test_write(struct wg_callback *cb, int n) {
+  value_list_t vl = {
+      .values = &(value_t){.derive = n},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T(1480063672),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "MAGIC",
+  };
+  snprintf(vl.type_instance, sizeof(vl.type_instance), "%d", n);
+
+  return wg_write(plugin_get_ds("MAGIC"), &vl, &(user_data_t){.data = cb});
+}
+
+/* Opens a listening TCP socket on an unused port of the loopback interface. */
+static int test_listen(int *port) {
+  struct sockaddr_in sa = {
+      .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  socklen_t sa_len = sizeof(sa);
+  int fd;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+      (listen(fd, TEST_STREAMS_MAX) != 0) ||
+      (getsockname(fd, (struct sockaddr *)&sa, &sa_len) != 0)) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  *port = ntohs(sa.sin_port);
+  return fd;
+}
+
+/* Accepts all pending connections and reads each of them until the client
+ * has closed it. Returns the number of connections. */
+static size_t test_read_streams(int listen_fd, char **streams) {
+  size_t streams_num = 0;
+
+  while (streams_num < TEST_STREAMS_MAX) {
+    size_t size = 0;
+    size_t fill = 0;
+    char *buf = NULL;
+    int fd;
+
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+      break;
+
+    while (42) {
+      ssize_t status;
+
+      if ((size - fill) < 4096) {
+        size = (size == 0) ? 65536 : 2 * size;
+        buf = realloc(buf, size);
+        assert(buf != NULL);
+      }
+
+      status = read(fd, buf + fill, size - fill - 1);
+      if (status <= 0)
+        break;
+      fill += (size_t)status;
+    }
+    close(fd);
+
+    buf[fill] = 0;
+    streams[streams_num++] = buf;
+  }
+
+  return streams_num;
+}
+
+DEF_TEST(connection_get) {
+  struct wg_callback *cb;
+  size_t used[4] = {0};
+
+  CHECK_NOT_NULL(cb = test_callback_create(2003, STATIC_ARRAY_SIZE(used),
+                                           /* async = */ 0, 1));
+  EXPECT_EQ_INT(STATIC_ARRAY_SIZE(used), cb->connections_num);
+
+  for (int i = 0; i < 100; i++) {
+    value_list_t vl = {
+        .host = "example.com", .plugin = "test", .type = "MAGIC",
+    };
+    struct wg_connection *conn;
+
+    snprintf(vl.type_instance, sizeof(vl.type_instance), "%d", i);
+    conn = wg_connection_get(cb, &vl);
+    OK(conn == wg_connection_get(cb, &vl));
+    used[conn - cb->connections]++;
+  }
+
+  /* Every connection gets a share of the identifiers. */
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(used); i++)
+    OK(used[i] > 0);
+
+  wg_callback_free(cb);
+  return 0;
+}
+
+DEF_TEST(sync) {
+  struct wg_callback *cb;
+  char *streams[TEST_STREAMS_MAX];
+  int listen_fd;
+  int port;
+
+  listen_fd = test_listen(&port);
+  OK(listen_fd >= 0);
+  CHECK_NOT_NULL(cb = test_callback_create(port, 1, /* async = */ 0, 1));
+
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ_INT(0, test_write(cb, i));
+  /* Values are buffered until the buffer is full or flushed. */
+  EXPECT_EQ_INT(0, wg_flush(0, NULL, &(user_data_t){.data = cb}));
+  wg_callback_free(cb);
+
+  EXPECT_EQ_INT(1, test_read_streams(listen_fd, streams));
+  EXPECT_EQ_STR("example_com.test.MAGIC-0 0 1480063672\r\n"
+                "example_com.test.MAGIC-1 1 1480063672\r\n"
+                "example_com.test.MAGIC-2 2 1480063672\r\n",
+                streams[0]);
+
+  sfree(streams[0]);
+  close(listen_fd);
+  return 0;
+}
+
+DEF_TEST(async) {
+  struct wg_callback *cb;
+  char *streams[TEST_STREAMS_MAX];
+  size_t streams_num;
+  int stream_of[500];
+  int listen_fd;
+  int port;
+  int count = 0;
+
+  listen_fd = test_listen(&port);
+  OK(listen_fd >= 0);
+  CHECK_NOT_NULL(cb = test_callback_create(port, 3, /* async = */ 1, 64));
+
+  /* Many times the size of a send buffer, so that the sender thread is
+   * started while values are still being written. */
+  for (int i = 0; i < (int)STATIC_ARRAY_SIZE(stream_of); i++)
+    EXPECT_EQ_INT(0, test_write(cb, i));
+
+  /* Sends whatever is left in the buffers. */
+  wg_callback_free(cb);
+
+  streams_num = test_read_streams(listen_fd, streams);
+  EXPECT_EQ_INT(3, streams_num);
+
+  /* All values arrive, every identifier on exactly one connection, and in the
+   * order they were written. */
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(stream_of); i++)
+    stream_of[i] = -1;
+  for (size_t i = 0; i < streams_num; i++) {
+    int prev = -1;
+    char *line = streams[i];
+
+    while (*line != 0) {
+      int n;
+
+      OK(1 == sscanf(line, "example_com.test.MAGIC-%d ", &n));
+      OK((n > prev) && (n < (int)STATIC_ARRAY_SIZE(stream_of)));
+      OK(stream_of[n] == -1);
+      stream_of[n] = (int)i;
+      prev = n;
+      count++;
+
+      line = strchr(line, '\n');
+      CHECK_NOT_NULL(line);
+      line++;
+    }
+    sfree(streams[i]);
+  }
+  EXPECT_EQ_INT(STATIC_ARRAY_SIZE(stream_of), count);
+
+  close(listen_fd);
+  return 0;
+}
+
+DEF_TEST(async_queue_full) {
+  struct wg_callback *cb;
+  struct wg_connection *conn;
+  uint64_t dropped;
+  int listen_fd;
+  int port;
+
+  /* Nothing listens on the port after it has been closed. */
+  listen_fd = test_listen(&port);
+  OK(listen_fd >= 0);
+  close(listen_fd);
+
+  CHECK_NOT_NULL(cb = test_callback_create(port, 1, /* async = */ 1, 2));
+  conn = cb->connections;
+
+  /* Writers must neither block nor fail when the server is unreachable. */
+  for (int i = 0; i < 500; i++)
+    EXPECT_EQ_INT(0, test_write(cb, i));
+
+  pthread_mutex_lock(&conn->send_lock);
+  OK(conn->queue_len <= 2);
+  dropped = conn->dropped_buffers;
+  pthread_mutex_unlock(&conn->send_lock);
+  OK(dropped > 0);
+
+  wg_callback_free(cb);
+  return 0;
+}
+
+int main(void) {
+  /* wg_connection_init() doesn't reconnect within a second of time zero. */
+  cdtime_mock = TIME_T_TO_CDTIME_T(1480063672);
+
+  RUN_TEST(connection_get);
+  RUN_TEST(sync);
+  RUN_TEST(async);
+  RUN_TEST(async_queue_full);
+
+  END_TEST;
+}
@@ -27,11 +27,16 @@
 
 #include "common.h"
 #include "plugin.h"
+#include "utils_complain.h"
 #include "utils_format_json.h"
 #include "utils_format_kairosdb.h"
 
 #include <curl/curl.h>
 
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 #ifndef WRITE_HTTP_DEFAULT_BUFFER_SIZE
 #define WRITE_HTTP_DEFAULT_BUFFER_SIZE 4096
 #endif
@@ -39,6 +44,23 @@
 /*
  * Private variables
  */
+/* A filled send buffer, queued for or being sent by the sender thread. Once
+ * sent, requests are kept for reuse of their buffer and curl handle. */
+struct wh_request_s {
+  char *data;
+  size_t data_len;
+
+  /* gzip compressed copy of `data', if enabled. */
+  char *body;
+  size_t body_size;
+
+  CURL *curl;
+  char curl_errbuf[CURL_ERROR_SIZE];
+
+  struct wh_request_s *next;
+};
+typedef struct wh_request_s wh_request_t;
+
 struct wh_callback_s {
   char *name;
 
@@ -59,6 +81,7 @@ struct wh_callback_s {
   int low_speed_limit;
   time_t low_speed_time;
   int timeout;
+  _Bool compress;
 
 #define WH_FORMAT_COMMAND 0
 #define WH_FORMAT_JSON 1
@@ -77,8 +100,38 @@ struct wh_callback_s {
   size_t send_buffer_fill;
   cdtime_t send_buffer_init_time;
 
+  char *gzip_buffer;
+  size_t gzip_buffer_size;
+
   pthread_mutex_t send_lock;
 
+  /* Asynchronous mode: full send buffers are swapped for unused ones and
+   * posted by a sender thread, using the curl multi interface. `queue_lock'
+   * protects the queue, the idle list and the counters. At most
+   * `async_queue_size' requests are queued or in flight; further buffers are
+   * dropped. */
+  _Bool async;
+  int async_concurrency;
+  int async_queue_size;
+
+  CURLM *multi;
+  pthread_t sender_thread;
+  _Bool sender_running;
+  _Bool sender_shutdown;
+
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+  wh_request_t *queue_head;
+  wh_request_t *queue_tail;
+  wh_request_t *idle;
+  int queue_len;
+  int in_flight;
+
+  uint64_t dropped_requests;
+  uint64_t dropped_bytes;
+  uint64_t failed_requests;
+  c_complain_t drop_complaint;
+
   int data_ttl;
 };
 typedef struct wh_callback_s wh_callback_t;
@@ -86,13 +139,13 @@ typedef struct wh_callback_s wh_callback_t;
 static char **http_attrs;
 static size_t http_attrs_num;
 
-static void wh_log_http_error(wh_callback_t *cb) {
+static void wh_log_http_error(wh_callback_t *cb, CURL *curl) {
   if (!cb->log_http_error)
     return;
 
   long http_code = 0;
 
-  curl_easy_getinfo(cb->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
 
   if (http_code != 200)
     INFO("write_http plugin: HTTP Error code: %lu", http_code);
@@ -114,16 +167,80 @@ static void wh_reset_buffer(wh_callback_t *cb) /* {{{ */
   }
 } /* }}} wh_reset_buffer */
 
+#if HAVE_LIBZ
+/* Compresses `data' using the gzip format. `*buffer' is grown as needed. */
+static int wh_gzip(char const *data, size_t data_len, /* {{{ */
+                   char **buffer, size_t *buffer_size, size_t *ret_len) {
+  z_stream zs = {0};
+  uLong bound;
+  int status;
+
+  status = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                        /* windowBits = */ 15 + 16, /* memLevel = */ 8,
+                        Z_DEFAULT_STRATEGY);
+  if (status != Z_OK)
+    return -1;
+
+  bound = deflateBound(&zs, (uLong)data_len);
+  if (*buffer_size < bound) {
+    char *tmp = realloc(*buffer, bound);
+    if (tmp == NULL) {
+      deflateEnd(&zs);
+      return ENOMEM;
+    }
+    *buffer = tmp;
+    *buffer_size = bound;
+  }
+
+  zs.next_in = (Bytef *)data;
+  zs.avail_in = (uInt)data_len;
+  zs.next_out = (Bytef *)*buffer;
+  zs.avail_out = (uInt)*buffer_size;
+
+  status = deflate(&zs, Z_FINISH);
+  *ret_len = (size_t)zs.total_out;
+  deflateEnd(&zs);
+
+  return (status == Z_STREAM_END) ? 0 : -1;
+} /* }}} int wh_gzip */
+#endif
+
+/* Sets the body to post, compressing it if enabled. */
+static int wh_set_body(wh_callback_t *cb, CURL *curl, /* {{{ */
+                       char const *data, size_t data_len, char **buffer,
+                       size_t *buffer_size) {
+#if HAVE_LIBZ
+  if (cb->compress) {
+    size_t len = 0;
+    int status = wh_gzip(data, data_len, buffer, buffer_size, &len);
+    if (status != 0) {
+      ERROR("write_http plugin: Compressing %zu bytes failed.", data_len);
+      return status;
+    }
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, *buffer);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)len);
+    return 0;
+  }
+#endif
+
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)data_len);
+  return 0;
+} /* }}} int wh_set_body */
+
 /* must hold cb->send_lock when calling */
 static int wh_post_nolock(wh_callback_t *cb, char const *data) /* {{{ */
 {
   int status = 0;
 
-  curl_easy_setopt(cb->curl, CURLOPT_URL, cb->location);
-  curl_easy_setopt(cb->curl, CURLOPT_POSTFIELDS, data);
+  status = wh_set_body(cb, cb->curl, data, strlen(data), &cb->gzip_buffer,
+                       &cb->gzip_buffer_size);
+  if (status != 0)
+    return status;
+
   status = curl_easy_perform(cb->curl);
 
-  wh_log_http_error(cb);
+  wh_log_http_error(cb, cb->curl);
 
   if (status != CURLE_OK) {
     ERROR("write_http plugin: curl_easy_perform failed with "
@@ -133,51 +250,104 @@ static int wh_post_nolock(wh_callback_t *cb, char const *data) /* {{{ */
   return status;
 } /* }}} wh_post_nolock */
 
+/* Applies the node's options to a curl handle. */
+static void wh_curl_setup(wh_callback_t *cb, CURL *curl, /* {{{ */
+                          char *errbuf) {
+  if (cb->low_speed_limit > 0 && cb->low_speed_time > 0) {
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT,
+                     (long)(cb->low_speed_limit * cb->low_speed_time));
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)cb->low_speed_time);
+  }
+
+#ifdef HAVE_CURLOPT_TIMEOUT_MS
+  if (cb->timeout > 0)
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
+#endif
+
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(curl, CURLOPT_URL, cb->location);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, cb->headers);
+
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 50L);
+
+  if (cb->user != NULL) {
+#ifdef HAVE_CURLOPT_USERNAME
+    curl_easy_setopt(curl, CURLOPT_USERNAME, cb->user);
+    curl_easy_setopt(curl, CURLOPT_PASSWORD,
+                     (cb->pass == NULL) ? "" : cb->pass);
+#else
+    curl_easy_setopt(curl, CURLOPT_USERPWD, cb->credentials);
+#endif
+    curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+  }
+
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
+  curl_easy_setopt(curl, CURLOPT_SSLVERSION, cb->sslversion);
+  if (cb->cacert != NULL)
+    curl_easy_setopt(curl, CURLOPT_CAINFO, cb->cacert);
+  if (cb->capath != NULL)
+    curl_easy_setopt(curl, CURLOPT_CAPATH, cb->capath);
+
+  if (cb->clientkey != NULL && cb->clientcert != NULL) {
+    curl_easy_setopt(curl, CURLOPT_SSLKEY, cb->clientkey);
+    curl_easy_setopt(curl, CURLOPT_SSLCERT, cb->clientcert);
+
+    if (cb->clientkeypass != NULL)
+      curl_easy_setopt(curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+  }
+} /* }}} void wh_curl_setup */
+
+static void *wh_sender_thread(void *arg);
+
 static int wh_callback_init(wh_callback_t *cb) /* {{{ */
 {
   if (cb->curl != NULL)
     return 0;
 
+  if (cb->async && (cb->multi == NULL)) {
+    int status;
+
+    cb->multi = curl_multi_init();
+    if (cb->multi == NULL) {
+      ERROR("write_http plugin: curl_multi_init failed.");
+      return -1;
+    }
+
+    status = plugin_thread_create(&cb->sender_thread, /* attr = */ NULL,
+                                  wh_sender_thread, cb, "write_http send");
+    if (status != 0) {
+      char errbuf[1024];
+      ERROR("write_http plugin: Starting the sender thread failed: %s",
+            sstrerror(status, errbuf, sizeof(errbuf)));
+      curl_multi_cleanup(cb->multi);
+      cb->multi = NULL;
+      return -1;
+    }
+    cb->sender_running = 1;
+  }
+
   cb->curl = curl_easy_init();
   if (cb->curl == NULL) {
     ERROR("curl plugin: curl_easy_init failed.");
     return -1;
   }
 
-  if (cb->low_speed_limit > 0 && cb->low_speed_time > 0) {
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_LIMIT,
-                     (long)(cb->low_speed_limit * cb->low_speed_time));
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_TIME,
-                     (long)cb->low_speed_time);
-  }
-
-#ifdef HAVE_CURLOPT_TIMEOUT_MS
-  if (cb->timeout > 0)
-    curl_easy_setopt(cb->curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
-#endif
-
-  curl_easy_setopt(cb->curl, CURLOPT_NOSIGNAL, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
-
   cb->headers = curl_slist_append(cb->headers, "Accept:  */*");
   if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB)
     cb->headers =
         curl_slist_append(cb->headers, "Content-Type: application/json");
   else
     cb->headers = curl_slist_append(cb->headers, "Content-Type: text/plain");
+  if (cb->compress)
+    cb->headers = curl_slist_append(cb->headers, "Content-Encoding: gzip");
   cb->headers = curl_slist_append(cb->headers, "Expect:");
-  curl_easy_setopt(cb->curl, CURLOPT_HTTPHEADER, cb->headers);
-
-  curl_easy_setopt(cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
-  curl_easy_setopt(cb->curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_MAXREDIRS, 50L);
 
+#ifndef HAVE_CURLOPT_USERNAME
   if (cb->user != NULL) {
-#ifdef HAVE_CURLOPT_USERNAME
-    curl_easy_setopt(cb->curl, CURLOPT_USERNAME, cb->user);
-    curl_easy_setopt(cb->curl, CURLOPT_PASSWORD,
-                     (cb->pass == NULL) ? "" : cb->pass);
-#else
     size_t credentials_size;
 
     credentials_size = strlen(cb->user) + 2;
@@ -192,31 +362,245 @@ static int wh_callback_init(wh_callback_t *cb) /* {{{ */
 
     snprintf(cb->credentials, credentials_size, "%s:%s", cb->user,
              (cb->pass == NULL) ? "" : cb->pass);
-    curl_easy_setopt(cb->curl, CURLOPT_USERPWD, cb->credentials);
+  }
 #endif
-    curl_easy_setopt(cb->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+
+  wh_curl_setup(cb, cb->curl, cb->curl_errbuf);
+
+  wh_reset_buffer(cb);
+
+  return 0;
+} /* }}} int wh_callback_init */
+
+/* Wakes up the sender thread, which is either waiting for requests or for
+ * network activity. Must hold cb->queue_lock. */
+static void wh_sender_wakeup(wh_callback_t *cb) /* {{{ */
+{
+  pthread_cond_signal(&cb->queue_cond);
+#if LIBCURL_VERSION_NUM >= 0x074400
+  curl_multi_wakeup(cb->multi);
+#endif
+} /* }}} void wh_sender_wakeup */
+
+/* Hands the send buffer to the sender thread and replaces it with an unused
+ * one. If too many requests are pending, the buffer's content is dropped
+ * instead. Must hold cb->send_lock. */
+static int wh_enqueue_nolock(wh_callback_t *cb) /* {{{ */
+{
+  wh_request_t *req;
+  char *tmp;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  if (cb->queue_len >= cb->async_queue_size) {
+    uint64_t dropped_requests = ++cb->dropped_requests;
+    uint64_t dropped_bytes = cb->dropped_bytes += cb->send_buffer_fill;
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    c_complain(LOG_WARNING, &cb->drop_complaint,
+               "write_http plugin: <%s> The send queue is full. %" PRIu64
+               " requests (%" PRIu64 " bytes) have been dropped so far.",
+               cb->location, dropped_requests, dropped_bytes);
+    return 0;
   }
 
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
-  curl_easy_setopt(cb->curl, CURLOPT_SSLVERSION, cb->sslversion);
-  if (cb->cacert != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAINFO, cb->cacert);
-  if (cb->capath != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAPATH, cb->capath);
+  req = cb->idle;
+  if (req != NULL)
+    cb->idle = req->next;
+  cb->queue_len++;
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  if (req == NULL) {
+    req = calloc(1, sizeof(*req));
+    if (req != NULL)
+      req->data = malloc(cb->send_buffer_size);
+    if ((req == NULL) || (req->data == NULL)) {
+      ERROR("write_http plugin: wh_enqueue_nolock: malloc failed.");
+      if (req != NULL)
+        sfree(req);
+      pthread_mutex_lock(&cb->queue_lock);
+      cb->queue_len--;
+      pthread_mutex_unlock(&cb->queue_lock);
+      return ENOMEM;
+    }
+  }
 
-  if (cb->clientkey != NULL && cb->clientcert != NULL) {
-    curl_easy_setopt(cb->curl, CURLOPT_SSLKEY, cb->clientkey);
-    curl_easy_setopt(cb->curl, CURLOPT_SSLCERT, cb->clientcert);
+  tmp = req->data;
+  req->data = cb->send_buffer;
+  req->data_len = cb->send_buffer_fill;
+  req->next = NULL;
+  cb->send_buffer = tmp;
 
-    if (cb->clientkeypass != NULL)
-      curl_easy_setopt(cb->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+  pthread_mutex_lock(&cb->queue_lock);
+  if (cb->queue_tail == NULL)
+    cb->queue_head = req;
+  else
+    cb->queue_tail->next = req;
+  cb->queue_tail = req;
+  wh_sender_wakeup(cb);
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  c_release(LOG_INFO, &cb->drop_complaint,
+            "write_http plugin: <%s> The send queue accepts requests again.",
+            cb->location);
+  return 0;
+} /* }}} int wh_enqueue_nolock */
+
+/* Starts posting a request. Called by the sender thread. */
+static int wh_request_start(wh_callback_t *cb, wh_request_t *req) /* {{{ */
+{
+  int status;
+
+  if (req->curl == NULL) {
+    req->curl = curl_easy_init();
+    if (req->curl == NULL) {
+      ERROR("write_http plugin: curl_easy_init failed.");
+      return -1;
+    }
+    wh_curl_setup(cb, req->curl, req->curl_errbuf);
+    curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
   }
 
-  wh_reset_buffer(cb);
+  status = wh_set_body(cb, req->curl, req->data, req->data_len, &req->body,
+                       &req->body_size);
+  if (status != 0)
+    return status;
+
+  status = curl_multi_add_handle(cb->multi, req->curl);
+  if (status != CURLM_OK) {
+    ERROR("write_http plugin: curl_multi_add_handle failed: %s",
+          curl_multi_strerror(status));
+    return -1;
+  }
 
   return 0;
-} /* }}} int wh_callback_init */
+} /* }}} int wh_request_start */
+
+/* Puts a finished request on the idle list. Must hold cb->queue_lock. */
+static void wh_request_done(wh_callback_t *cb, wh_request_t *req, /* {{{ */
+                            _Bool success) {
+  if (!success)
+    cb->failed_requests++;
+
+  req->next = cb->idle;
+  cb->idle = req;
+  cb->queue_len--;
+} /* }}} void wh_request_done */
+
+/* Takes requests off the queue and posts up to `async_concurrency' of them in
+ * parallel, until wh_callback_free() asks it to stop. Remaining requests are
+ * sent before the thread exits. */
+static void *wh_sender_thread(void *arg) /* {{{ */
+{
+  wh_callback_t *cb = arg;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  while (42) {
+    CURLMsg *msg;
+    int running = 0;
+    int msgs_left = 0;
+
+    while ((cb->queue_head != NULL) &&
+           (cb->in_flight < cb->async_concurrency)) {
+      wh_request_t *req = cb->queue_head;
+      int status;
+
+      cb->queue_head = req->next;
+      if (cb->queue_head == NULL)
+        cb->queue_tail = NULL;
+      cb->in_flight++;
+      pthread_mutex_unlock(&cb->queue_lock);
+
+      status = wh_request_start(cb, req);
+
+      pthread_mutex_lock(&cb->queue_lock);
+      if (status != 0) {
+        cb->in_flight--;
+        wh_request_done(cb, req, /* success = */ 0);
+      }
+    }
+
+    if (cb->in_flight == 0) {
+      if (cb->sender_shutdown)
+        break;
+      pthread_cond_wait(&cb->queue_cond, &cb->queue_lock);
+      continue;
+    }
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    curl_multi_perform(cb->multi, &running);
+
+    while ((msg = curl_multi_info_read(cb->multi, &msgs_left)) != NULL) {
+      wh_request_t *req = NULL;
+
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req);
+      wh_log_http_error(cb, req->curl);
+      if (msg->data.result != CURLE_OK)
+        ERROR("write_http plugin: <%s> Posting %zu bytes failed with "
+              "status %i: %s",
+              cb->location, req->data_len, msg->data.result,
+              req->curl_errbuf);
+      curl_multi_remove_handle(cb->multi, req->curl);
+
+      pthread_mutex_lock(&cb->queue_lock);
+      cb->in_flight--;
+      wh_request_done(cb, req, msg->data.result == CURLE_OK);
+      pthread_mutex_unlock(&cb->queue_lock);
+    }
+
+    if (running > 0) {
+#if LIBCURL_VERSION_NUM >= 0x074400
+      curl_multi_poll(cb->multi, NULL, 0, /* timeout_ms = */ 1000, NULL);
+#else
+      curl_multi_wait(cb->multi, NULL, 0, /* timeout_ms = */ 100, NULL);
+#endif
+    }
+
+    pthread_mutex_lock(&cb->queue_lock);
+  }
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  return NULL;
+} /* }}} void *wh_sender_thread */
+
+/* Sends the remaining requests, stops the sender thread and frees all
+ * requests. */
+static void wh_sender_stop(wh_callback_t *cb) /* {{{ */
+{
+  if (cb->sender_running) {
+    pthread_mutex_lock(&cb->queue_lock);
+    cb->sender_shutdown = 1;
+    wh_sender_wakeup(cb);
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    pthread_join(cb->sender_thread, /* retval = */ NULL);
+    cb->sender_running = 0;
+  }
+
+  while (cb->idle != NULL) {
+    wh_request_t *req = cb->idle;
+    cb->idle = req->next;
+
+    if (req->curl != NULL)
+      curl_easy_cleanup(req->curl);
+    sfree(req->data);
+    sfree(req->body);
+    sfree(req);
+  }
+
+  if (cb->multi != NULL) {
+    curl_multi_cleanup(cb->multi);
+    cb->multi = NULL;
+  }
+
+  if ((cb->dropped_requests > 0) || (cb->failed_requests > 0))
+    INFO("write_http plugin: <%s> %" PRIu64 " requests (%" PRIu64
+         " bytes) have been dropped and %" PRIu64 " requests failed.",
+         cb->location, cb->dropped_requests, cb->dropped_bytes,
+         cb->failed_requests);
+} /* }}} void wh_sender_stop */
 
 static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
 {
@@ -241,7 +625,10 @@ static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
       return 0;
     }
 
-    status = wh_post_nolock(cb, cb->send_buffer);
+    if (cb->async)
+      status = wh_enqueue_nolock(cb);
+    else
+      status = wh_post_nolock(cb, cb->send_buffer);
     wh_reset_buffer(cb);
   } else if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB) {
     if (cb->send_buffer_fill <= 2) {
@@ -258,7 +645,10 @@ static int wh_flush_nolock(cdtime_t timeout, wh_callback_t *cb) /* {{{ */
       return status;
     }
 
-    status = wh_post_nolock(cb, cb->send_buffer);
+    if (cb->async)
+      status = wh_enqueue_nolock(cb);
+    else
+      status = wh_post_nolock(cb, cb->send_buffer);
     wh_reset_buffer(cb);
   } else {
     ERROR("write_http: wh_flush_nolock: "
@@ -307,6 +697,9 @@ static void wh_callback_free(void *data) /* {{{ */
   if (cb->send_buffer != NULL)
     wh_flush_nolock(/* timeout = */ 0, cb);
 
+  if (cb->async)
+    wh_sender_stop(cb);
+
   if (cb->curl != NULL) {
     curl_easy_cleanup(cb->curl);
     cb->curl = NULL;
@@ -328,6 +721,11 @@ static void wh_callback_free(void *data) /* {{{ */
   sfree(cb->clientcert);
   sfree(cb->clientkeypass);
   sfree(cb->send_buffer);
+  sfree(cb->gzip_buffer);
+
+  pthread_mutex_destroy(&cb->send_lock);
+  pthread_mutex_destroy(&cb->queue_lock);
+  pthread_cond_destroy(&cb->queue_cond);
 
   sfree(cb);
 } /* }}} void wh_callback_free */
@@ -342,8 +740,9 @@ static int wh_write_command(const data_set_t *ds,
 
   int status;
 
-  /* sanity checks, primarily to make static analyzers happy. */
-  if ((cb == NULL) || (cb->send_buffer == NULL))
+  /* sanity checks, primarily to make static analyzers happy. The send buffer
+   * is swapped in asynchronous mode, so it is checked under the lock below. */
+  if (cb == NULL)
     return -1;
 
   if (strcmp(ds->type, vl->type) != 0) {
@@ -606,17 +1005,17 @@ static int wh_config_append_string(const char *name,
   return 0;
 } /* }}} int wh_config_append_string */
 
-static int wh_config_node(oconfig_item_t *ci) /* {{{ */
+/* Creates a node from its configuration block. Returns NULL on error. */
+static wh_callback_t *wh_callback_create(oconfig_item_t *ci) /* {{{ */
 {
   wh_callback_t *cb;
   int buffer_size = 0;
-  char callback_name[DATA_MAX_NAME_LEN];
   int status = 0;
 
   cb = calloc(1, sizeof(*cb));
   if (cb == NULL) {
     ERROR("write_http plugin: calloc failed.");
-    return -1;
+    return NULL;
   }
   cb->verify_peer = 1;
   cb->verify_host = 1;
@@ -629,8 +1028,13 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   cb->send_metrics = 1;
   cb->send_notifications = 0;
   cb->data_ttl = 0;
+  cb->async_concurrency = 4;
+  cb->async_queue_size = 8;
+  C_COMPLAIN_INIT(&cb->drop_complaint);
 
   pthread_mutex_init(&cb->send_lock, /* attr = */ NULL);
+  pthread_mutex_init(&cb->queue_lock, /* attr = */ NULL);
+  pthread_cond_init(&cb->queue_cond, /* attr = */ NULL);
 
   cf_util_get_string(ci, &cb->name);
 
@@ -740,6 +1144,14 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
       sfree(val);
     } else if (strcasecmp("TTL", child->key) == 0) {
       status = cf_util_get_int(child, &cb->data_ttl);
+    } else if (strcasecmp("Compress", child->key) == 0) {
+      status = cf_util_get_boolean(child, &cb->compress);
+    } else if (strcasecmp("Asynchronous", child->key) == 0) {
+      status = cf_util_get_boolean(child, &cb->async);
+    } else if (strcasecmp("AsyncConcurrency", child->key) == 0) {
+      status = cf_util_get_int(child, &cb->async_concurrency);
+    } else if (strcasecmp("AsyncQueueSize", child->key) == 0) {
+      status = cf_util_get_int(child, &cb->async_queue_size);
     } else {
       ERROR("write_http plugin: Invalid configuration "
             "option: %s.",
@@ -753,13 +1165,13 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
 
   if (status != 0) {
     wh_callback_free(cb);
-    return status;
+    return NULL;
   }
 
   if (cb->location == NULL) {
     ERROR("write_http plugin: no URL defined for instance '%s'", cb->name);
     wh_callback_free(cb);
-    return -1;
+    return NULL;
   }
 
   if (!cb->send_metrics && !cb->send_notifications) {
@@ -767,7 +1179,24 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
           "are enabled for \"%s\".",
           cb->name);
     wh_callback_free(cb);
-    return -1;
+    return NULL;
+  }
+
+#if !HAVE_LIBZ
+  if (cb->compress) {
+    WARNING("write_http plugin: Compression is not supported by this build "
+            "and has been disabled for \"%s\".",
+            cb->name);
+    cb->compress = 0;
+  }
+#endif
+
+  if ((cb->async_concurrency < 1) || (cb->async_queue_size < 1)) {
+    ERROR("write_http plugin: AsyncConcurrency and AsyncQueueSize must be "
+          "positive for \"%s\".",
+          cb->name);
+    wh_callback_free(cb);
+    return NULL;
   }
 
   if (cb->low_speed_limit > 0)
@@ -786,11 +1215,23 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   if (cb->send_buffer == NULL) {
     ERROR("write_http plugin: malloc(%zu) failed.", cb->send_buffer_size);
     wh_callback_free(cb);
-    return -1;
+    return NULL;
   }
   /* Nulls the buffer and sets ..._free and ..._fill. */
   wh_reset_buffer(cb);
 
+  return cb;
+} /* }}} wh_callback_t *wh_callback_create */
+
+static int wh_config_node(oconfig_item_t *ci) /* {{{ */
+{
+  wh_callback_t *cb;
+  char callback_name[DATA_MAX_NAME_LEN];
+
+  cb = wh_callback_create(ci);
+  if (cb == NULL)
+    return -1;
+
   snprintf(callback_name, sizeof(callback_name), "write_http/%s", cb->name);
   DEBUG("write_http: Registering write callback '%s' with URL '%s'",
         callback_name, cb->location);
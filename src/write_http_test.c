@@ -0,0 +1,393 @@
+/**
+ * collectd - src/write_http_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "testing.h"
+#include "write_http.c" /* sic */
+
+#include <netinet/in.h>
+#include <poll.h>
+
+#define TEST_CONNECTIONS_MAX 8
+#define TEST_REQUESTS_MAX 256
+
+/* A minimal HTTP server, which records the requests it receives and answers
+ * each of them with "200 OK". Connections are kept open, like curl expects. */
+typedef struct {
+  char *headers;
+  char *body;
+  size_t body_len;
+} test_request_t;
+
+typedef struct {
+  int fd;
+  /* Null-terminated, so that the headers can be searched with strstr(). */
+  char *buf;
+  size_t fill;
+} test_connection_t;
+
+static int server_fd = -1;
+static int server_port;
+static pthread_t server_thread;
+static _Bool server_shutdown;
+
+static pthread_mutex_t requests_lock = PTHREAD_MUTEX_INITIALIZER;
+static test_request_t requests[TEST_REQUESTS_MAX];
+static size_t requests_num;
+
+static void test_requests_free(void) {
+  pthread_mutex_lock(&requests_lock);
+  for (size_t i = 0; i < requests_num; i++) {
+    sfree(requests[i].headers);
+    sfree(requests[i].body);
+  }
+  requests_num = 0;
+  pthread_mutex_unlock(&requests_lock);
+}
+
+/* Handles all complete requests in the connection's buffer. Returns non-zero
+ * if the connection has to be closed. */
+static int test_connection_handle(test_connection_t *conn) {
+  static char const response[] = "HTTP/1.1 200 OK\r\n"
+                                 "Content-Length: 0\r\n"
+                                 "\r\n";
+
+  while (42) {
+    char *end = strstr(conn->buf, "\r\n\r\n");
+    char *length;
+    size_t headers_len;
+    size_t body_len = 0;
+
+    if (end == NULL)
+      return 0;
+    headers_len = (size_t)(end - conn->buf) + 4;
+
+    *end = 0;
+    length = strstr(conn->buf, "\r\nContent-Length:");
+    if (length != NULL)
+      body_len = (size_t)strtoul(length + strlen("\r\nContent-Length:"),
+                                 NULL, 10);
+    *end = '\r';
+    if (conn->fill < headers_len + body_len)
+      return 0;
+
+    pthread_mutex_lock(&requests_lock);
+    if (requests_num >= TEST_REQUESTS_MAX) {
+      pthread_mutex_unlock(&requests_lock);
+      return -1;
+    }
+    requests[requests_num].headers = strndup(conn->buf, headers_len);
+    requests[requests_num].body = malloc(body_len + 1);
+    memcpy(requests[requests_num].body, conn->buf + headers_len, body_len);
+    requests[requests_num].body[body_len] = 0;
+    requests[requests_num].body_len = body_len;
+    requests_num++;
+    pthread_mutex_unlock(&requests_lock);
+
+    if (swrite(conn->fd, response, strlen(response)) != 0)
+      return -1;
+
+    conn->fill -= headers_len + body_len;
+    memmove(conn->buf, conn->buf + headers_len + body_len, conn->fill + 1);
+  }
+}
+
+static void *test_server(void __attribute__((unused)) * arg) {
+  test_connection_t conns[TEST_CONNECTIONS_MAX] = {{0}};
+  size_t conns_num = 0;
+  size_t buf_size = 2 * 65536;
+
+  while (!server_shutdown) {
+    struct pollfd fds[TEST_CONNECTIONS_MAX + 1];
+
+    fds[0] = (struct pollfd){.fd = server_fd, .events = POLLIN};
+    for (size_t i = 0; i < conns_num; i++)
+      fds[i + 1] = (struct pollfd){.fd = conns[i].fd, .events = POLLIN};
+
+    if (poll(fds, conns_num + 1, /* timeout = */ 100) <= 0)
+      continue;
+
+    for (size_t i = conns_num; i > 0; i--) {
+      test_connection_t *conn = conns + (i - 1);
+      ssize_t status;
+
+      if (fds[i].revents == 0)
+        continue;
+
+      status =
+          read(conn->fd, conn->buf + conn->fill, buf_size - conn->fill - 1);
+      if (status > 0) {
+        conn->fill += (size_t)status;
+        conn->buf[conn->fill] = 0;
+        if (test_connection_handle(conn) == 0)
+          continue;
+      }
+
+      close(conn->fd);
+      sfree(conn->buf);
+      *conn = conns[--conns_num];
+    }
+
+    if ((fds[0].revents & POLLIN) && (conns_num < TEST_CONNECTIONS_MAX)) {
+      int fd = accept(server_fd, NULL, NULL);
+      if (fd >= 0) {
+        conns[conns_num] = (test_connection_t){.fd = fd,
+                                               .buf = calloc(1, buf_size)};
+        conns_num++;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < conns_num; i++) {
+    close(conns[i].fd);
+    sfree(conns[i].buf);
+  }
+  return NULL;
+}
+
+/* Starts the server on an unused port of the loopback interface. */
+static int test_server_start(void) {
+  struct sockaddr_in sa = {
+      .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  socklen_t sa_len = sizeof(sa);
+
+  server_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (server_fd < 0)
+    return -1;
+  if ((bind(server_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+      (listen(server_fd, TEST_CONNECTIONS_MAX) != 0) ||
+      (getsockname(server_fd, (struct sockaddr *)&sa, &sa_len) != 0)) {
+    close(server_fd);
+    return -1;
+  }
+  server_port = ntohs(sa.sin_port);
+
+  server_shutdown = 0;
+  return pthread_create(&server_thread, NULL, test_server, NULL);
+}
+
+static void test_server_stop(void) {
+  server_shutdown = 1;
+  pthread_join(server_thread, NULL);
+  close(server_fd);
+  server_fd = -1;
+}
+
+static wh_callback_t *test_callback_create(int port, _Bool compress,
+                                           _Bool async) {
+  char url[64];
+
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/collectd", port);
+
+  oconfig_item_t children[] = {
+      {.key = "URL",
+       .values = &(oconfig_value_t){.value.string = url,
+                                    .type = OCONFIG_TYPE_STRING},
+       .values_num = 1},
+      {.key = "BufferSize",
+       .values = &(oconfig_value_t){.value.number = 1024,
+                                    .type = OCONFIG_TYPE_NUMBER},
+       .values_num = 1},
+      {.key = "Compress",
+       .values = &(oconfig_value_t){.value.boolean = compress,
+                                    .type = OCONFIG_TYPE_BOOLEAN},
+       .values_num = 1},
+      {.key = "Asynchronous",
+       .values = &(oconfig_value_t){.value.boolean = async,
+                                    .type = OCONFIG_TYPE_BOOLEAN},
+       .values_num = 1},
+      {.key = "AsyncConcurrency",
+       .values = &(oconfig_value_t){.value.number = 3,
+                                    .type = OCONFIG_TYPE_NUMBER},
+       .values_num = 1},
+      {.key = "AsyncQueueSize",
+       .values = &(oconfig_value_t){.value.number = 4,
+                                    .type = OCONFIG_TYPE_NUMBER},
+       .values_num = 1},
+  };
+  oconfig_item_t ci = {
+      .key = "Node",
+      .values = &(oconfig_value_t){.value.string = "test",
+                                   .type = OCONFIG_TYPE_STRING},
+      .values_num = 1,
+      .children = children,
+      .children_num = STATIC_ARRAY_SIZE(children),
+  };
+
+  return wh_callback_create(&ci);
+}
+
+static int test_write(wh_callback_t *cb, int n) {
+  value_list_t vl = {
+      .values = &(value_t){.derive = n},
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T(1480063672),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "MAGIC",
+  };
+  snprintf(vl.type_instance, sizeof(vl.type_instance), "%d", n);
+
+  return wh_write(plugin_get_ds("MAGIC"), &vl, &(user_data_t){.data = cb});
+}
+
+/* Returns the body of a request, decompressed if necessary. */
+static char *test_request_body(test_request_t const *req) {
+  z_stream zs = {0};
+  size_t size = 65536;
+  char *body;
+
+  if (strstr(req->headers, "\r\nContent-Encoding: gzip") == NULL)
+    return strdup(req->body);
+
+  body = calloc(1, size);
+  if ((body == NULL) || (inflateInit2(&zs, 15 + 16) != Z_OK)) {
+    sfree(body);
+    return NULL;
+  }
+  zs.next_in = (Bytef *)req->body;
+  zs.avail_in = (uInt)req->body_len;
+  zs.next_out = (Bytef *)body;
+  zs.avail_out = (uInt)(size - 1);
+
+  if (inflate(&zs, Z_FINISH) != Z_STREAM_END)
+    sfree(body);
+  inflateEnd(&zs);
+  return body;
+}
+
+/* Writes "num" values and checks that every value was posted exactly once,
+ * and that all requests have the expected encoding. */
+static int test_post(_Bool compress, _Bool async, int num) {
+  wh_callback_t *cb;
+  int seen[1000] = {0};
+  int count = 0;
+
+  assert(num <= (int)STATIC_ARRAY_SIZE(seen));
+
+  CHECK_ZERO(test_server_start());
+  CHECK_NOT_NULL(cb = test_callback_create(server_port, compress, async));
+
+  for (int i = 0; i < num; i++)
+    EXPECT_EQ_INT(0, test_write(cb, i));
+  /* Posts whatever is left in the buffer and, in asynchronous mode, waits
+   * for the sender thread to finish. */
+  EXPECT_EQ_INT(0, wh_flush(0, NULL, &(user_data_t){.data = cb}));
+  wh_callback_free(cb);
+
+  test_server_stop();
+
+  /* The send buffer holds about 1 KiB, so several requests are needed. */
+  printf("%zu requests\n", requests_num);
+  OK(requests_num > 1);
+
+  for (size_t i = 0; i < requests_num; i++) {
+    char *body;
+    char *line;
+
+    OK(strncmp("POST /collectd HTTP/1.1\r\n", requests[i].headers,
+               strlen("POST /collectd HTTP/1.1\r\n")) == 0);
+    OK(strstr(requests[i].headers, "\r\nContent-Type: text/plain") !=
+       NULL);
+    OK(compress == (strstr(requests[i].headers,
+                               "\r\nContent-Encoding: gzip") != NULL));
+    if (compress)
+      OK(memcmp(requests[i].body, "\x1f\x8b", 2) == 0);
+
+    CHECK_NOT_NULL(body = test_request_body(&requests[i]));
+    for (line = body; *line != 0;) {
+      int n = -1;
+
+      OK(1 == sscanf(line,
+                     "PUTVAL example.com/test/MAGIC-%d interval=10.000 "
+                     "1480063672.000:",
+                     &n));
+      OK((n >= 0) && (n < num));
+      EXPECT_EQ_INT(0, seen[n]);
+      seen[n]++;
+      count++;
+
+      line = strstr(line, "\r\n");
+      CHECK_NOT_NULL(line);
+      line += 2;
+    }
+    sfree(body);
+  }
+  EXPECT_EQ_INT(num, count);
+
+  test_requests_free();
+  return 0;
+}
+
+DEF_TEST(sync) { return test_post(/* compress = */ 0, /* async = */ 0, 200); }
+
+DEF_TEST(sync_gzip) {
+  return test_post(/* compress = */ 1, /* async = */ 0, 200);
+}
+
+/* 40 values fill about three buffers of 1 KiB, which fit into the queue of
+ * four requests, so nothing is dropped. */
+DEF_TEST(async) { return test_post(/* compress = */ 0, /* async = */ 1, 40); }
+
+DEF_TEST(async_gzip) {
+  return test_post(/* compress = */ 1, /* async = */ 1, 40);
+}
+
+DEF_TEST(async_unreachable) {
+  wh_callback_t *cb;
+  int port;
+
+  /* Nothing listens on the port after the server has been stopped. */
+  CHECK_ZERO(test_server_start());
+  port = server_port;
+  test_server_stop();
+
+  CHECK_NOT_NULL(cb = test_callback_create(port, /* compress = */ 0,
+                                           /* async = */ 1));
+
+  /* Writers must neither block nor fail when the server is unreachable. */
+  for (int i = 0; i < 500; i++)
+    EXPECT_EQ_INT(0, test_write(cb, i));
+
+  pthread_mutex_lock(&cb->queue_lock);
+  OK(cb->queue_len <= cb->async_queue_size);
+  OK((cb->dropped_requests + cb->failed_requests) > 0);
+  pthread_mutex_unlock(&cb->queue_lock);
+
+  wh_callback_free(cb);
+  EXPECT_EQ_INT(0, requests_num);
+  return 0;
+}
+
+int main(void) {
+  cdtime_mock = TIME_T_TO_CDTIME_T(1480063672);
+  wh_init();
+
+  RUN_TEST(sync);
+  RUN_TEST(sync_gzip);
+  RUN_TEST(async);
+  RUN_TEST(async_gzip);
+  RUN_TEST(async_unreachable);
+
+  END_TEST;
+}
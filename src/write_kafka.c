@@ -168,8 +168,8 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
   void *key;
   size_t keylen = 0;
   char buffer[8192];
-  size_t bfree = sizeof(buffer);
-  size_t bfill = 0;
+  format_json_buffer_t json = FORMAT_JSON_BUFFER_INIT;
+  char const *msg = buffer;
   size_t blen = 0;
   struct kafka_topic_context *ctx = ud->data;
 
@@ -195,10 +195,18 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
     blen = strlen(buffer);
     break;
   case KAFKA_FORMAT_JSON:
-    format_json_initialize(buffer, &bfill, &bfree);
-    format_json_value_list(buffer, &bfill, &bfree, ds, vl, ctx->store_rates);
-    format_json_finalize(buffer, &bfill, &bfree);
-    blen = strlen(buffer);
+    status = format_json_buffer_value_list(&json, ds, vl, ctx->store_rates);
+    if (status == 0)
+      status = format_json_buffer_finalize(&json);
+    if (status != 0) {
+      ERROR("write_kafka plugin: format_json_buffer_value_list failed with "
+            "status %i.",
+            status);
+      format_json_buffer_free(&json);
+      return status;
+    }
+    msg = json.data;
+    blen = json.len;
     break;
   case KAFKA_FORMAT_GRAPHITE:
     status =
@@ -221,7 +229,9 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
   keylen = strlen(key);
 
   rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
-                   buffer, blen, key, keylen, NULL);
+                   (void *)msg, blen, key, keylen, NULL);
+
+  format_json_buffer_free(&json);
 
   return status;
 } /* }}} int kafka_write */
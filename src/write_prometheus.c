@@ -30,12 +30,17 @@
 #include "plugin.h"
 #include "utils_avltree.h"
 #include "utils_complain.h"
+#include "utils_format_number.h"
 #include "utils_time.h"
 
 #include "prometheus.pb-c.h"
 
 #include <microhttpd.h>
 
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 #ifndef PROMETHEUS_DEFAULT_STALENESS_DELTA
 #define PROMETHEUS_DEFAULT_STALENESS_DELTA TIME_T_TO_CDTIME_T_STATIC(300)
 #endif
@@ -47,8 +52,55 @@
   "encoding=delimited"
 #define CONTENT_TYPE_TEXT "text/plain; version=0.0.4"
 
+/* metric_t extends a metric with its serialization in both exposition
+ * formats. The text line starts with the constant "name{labels} " prefix,
+ * which is formatted once when the metric is created. When the metric is
+ * updated, only its own serializations are invalidated; a scrape rewrites the
+ * value and timestamp after the prefix in place and re-packs the protobuf of
+ * changed metrics only. Since "pb" is the first member, pointers to it can be
+ * cast to metric_t. */
+typedef struct {
+  Io__Prometheus__Client__Metric pb;
+
+  char *text;
+  size_t text_len;
+  size_t text_size;
+  size_t text_prefix_len;
+  _Bool text_valid;
+
+  uint8_t *proto;
+  size_t proto_len;
+  size_t proto_size;
+  _Bool proto_valid;
+} metric_t;
+
+#define METRIC(m) ((metric_t *)(m))
+
+/* Room for the value and the timestamp after the prefix of a text line. */
+#define METRIC_TEXT_VALUE_SIZE (FORMAT_NUMBER_BUFSIZE + 32)
+
+/* metric_family_t extends a metric family with a lock and the constant parts
+ * of its serialization: the HELP and TYPE lines and the protobuf fields other
+ * than the metrics. Writers only lock the family they update. Since "pb" is
+ * the first member, pointers to it can be cast to metric_family_t. */
+typedef struct {
+  Io__Prometheus__Client__MetricFamily pb;
+  pthread_mutex_t lock;
+
+  char *text_header;
+  size_t text_header_len;
+
+  uint8_t *proto_header;
+  size_t proto_header_len;
+} metric_family_t;
+
+#define METRIC_FAMILY(fam) ((metric_family_t *)(fam))
+
+/* "metrics_lock" protects the structure of the "metrics" tree. It is held for
+ * reading while families are updated or formatted and only held for writing
+ * when families are added or removed. */
 static c_avl_tree_t *metrics;
-static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t metrics_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 static unsigned short httpd_port = 9103;
 static struct MHD_Daemon *httpd;
@@ -72,30 +124,60 @@ static size_t varint(uint8_t buffer[static VARINT_UINT32_BYTES],
   return 0;
 }
 
-/* format_protobuf iterates over all metric families in "metrics" and adds them
- * to a buffer in ProtoBuf format. It prefixes each protobuf with its encoded
- * size, the so called "delimited" format. */
-static void format_protobuf(ProtobufCBuffer *buffer) {
-  pthread_mutex_lock(&metrics_lock);
+/* metric_proto_update packs a metric into its protobuf cache. */
+static int metric_proto_update(metric_t *m) {
+  size_t len = io__prometheus__client__metric__get_packed_size(&m->pb);
 
-  char *unused_name;
-  Io__Prometheus__Client__MetricFamily *fam;
-  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
-  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    /* Prometheus uses a message length prefix to determine where one
-     * MetricFamily ends and the next begins. This delimiter is encoded as a
-     * "varint", which is common in Protobufs. */
-    uint8_t delim[VARINT_UINT32_BYTES] = {0};
-    size_t delim_len = varint(
-        delim,
-        (uint32_t)io__prometheus__client__metric_family__get_packed_size(fam));
-    buffer->append(buffer, delim_len, delim);
+  if (len > m->proto_size) {
+    uint8_t *tmp = realloc(m->proto, len);
+    if (tmp == NULL)
+      return ENOMEM;
+    m->proto = tmp;
+    m->proto_size = len;
+  }
 
-    io__prometheus__client__metric_family__pack_to_buffer(fam, buffer);
+  m->proto_len = io__prometheus__client__metric__pack(&m->pb, m->proto);
+  m->proto_valid = 1;
+  return 0;
+}
+
+/* format_family_protobuf adds a metric family to a buffer in ProtoBuf format.
+ * It prefixes the protobuf with its encoded size, the so called "delimited"
+ * format. The message is assembled from the family's constant fields and the
+ * packed metrics, which are only re-packed if they changed. */
+static void format_family_protobuf(ProtobufCBuffer *buffer,
+                                   metric_family_t *fam) {
+  /* Tag of the "metric" field: field number 4, length-delimited. */
+  uint8_t const metric_tag = (4 << 3) | 2;
+  uint8_t len_buffer[VARINT_UINT32_BYTES];
+  size_t size = fam->proto_header_len;
+
+  for (size_t i = 0; i < fam->pb.n_metric; i++) {
+    metric_t *m = METRIC(fam->pb.metric[i]);
+
+    if (!m->proto_valid && (metric_proto_update(m) != 0))
+      continue;
+    size += 1 + varint(len_buffer, (uint32_t)m->proto_len) + m->proto_len;
   }
-  c_avl_iterator_destroy(iter);
 
-  pthread_mutex_unlock(&metrics_lock);
+  /* Prometheus uses a message length prefix to determine where one
+   * MetricFamily ends and the next begins. This delimiter is encoded as a
+   * "varint", which is common in Protobufs. */
+  uint8_t delim[VARINT_UINT32_BYTES] = {0};
+  size_t delim_len = varint(delim, (uint32_t)size);
+  buffer->append(buffer, delim_len, delim);
+  buffer->append(buffer, fam->proto_header_len, fam->proto_header);
+
+  for (size_t i = 0; i < fam->pb.n_metric; i++) {
+    metric_t *m = METRIC(fam->pb.metric[i]);
+
+    if (!m->proto_valid)
+      continue;
+    buffer->append(buffer, 1, &metric_tag);
+    buffer->append(buffer, varint(len_buffer, (uint32_t)m->proto_len),
+                   len_buffer);
+    buffer->append(buffer, m->proto_len, m->proto);
+  }
 }
 
 static char const *escape_label_value(char *buffer, size_t buffer_size,
@@ -167,57 +249,188 @@ static char *format_labels(char *buffer, size_t buffer_size,
   return buffer;
 }
 
-/* format_protobuf iterates over all metric families in "metrics" and adds them
- * to a buffer in plain text format. */
-static void format_text(ProtobufCBuffer *buffer) {
-  pthread_mutex_lock(&metrics_lock);
+/* metric_text_init formats the constant prefix of a metric's text line and
+ * allocates room for its value and timestamp. */
+static int metric_text_init(metric_t *m, char const *family_name) {
+  char labels[1024];
+  char prefix[2048];
+
+  int len = snprintf(prefix, sizeof(prefix), "%s{%s} ", family_name,
+                     format_labels(labels, sizeof(labels), &m->pb));
+  if (len < 0)
+    return -1;
+  if ((size_t)len >= sizeof(prefix))
+    len = sizeof(prefix) - 1;
+
+  m->text_size = (size_t)len + METRIC_TEXT_VALUE_SIZE;
+  m->text = malloc(m->text_size);
+  if (m->text == NULL)
+    return ENOMEM;
+
+  memcpy(m->text, prefix, (size_t)len);
+  m->text_prefix_len = (size_t)len;
+  m->text_len = 0;
+  m->text_valid = 0;
+  return 0;
+}
+
+/* metric_text_update writes the value and timestamp after the prefix of a
+ * metric's text line. */
+static void metric_text_update(metric_t *m) {
+  char value[FORMAT_NUMBER_BUFSIZE];
+  char *tail = m->text + m->text_prefix_len;
+  size_t tail_size = m->text_size - m->text_prefix_len;
+  int len;
+
+  if (m->pb.gauge != NULL)
+    format_double(value, m->pb.gauge->value);
+  else
+    snprintf(value, sizeof(value), "%.0f", m->pb.counter->value);
+
+  if (m->pb.has_timestamp_ms)
+    len = snprintf(tail, tail_size, "%s %" PRIi64 "\n", value,
+                   m->pb.timestamp_ms);
+  else
+    len = snprintf(tail, tail_size, "%s\n", value);
+  if ((len < 0) || ((size_t)len >= tail_size))
+    len = (int)strlen(tail);
+
+  m->text_len = m->text_prefix_len + (size_t)len;
+  m->text_valid = 1;
+}
+
+/* format_family_text adds a metric family to a buffer in plain text format. */
+static void format_family_text(ProtobufCBuffer *buffer, metric_family_t *fam) {
+  buffer->append(buffer, fam->text_header_len, (uint8_t *)fam->text_header);
+
+  for (size_t i = 0; i < fam->pb.n_metric; i++) {
+    metric_t *m = METRIC(fam->pb.metric[i]);
+
+    /* The metric has never been updated successfully. */
+    if ((m->pb.gauge == NULL) && (m->pb.counter == NULL))
+      continue;
+
+    if (!m->text_valid)
+      metric_text_update(m);
+    buffer->append(buffer, m->text_len, (uint8_t *)m->text);
+  }
+}
+
+/* format_metrics iterates over all metric families in "metrics" and adds them
+ * to a buffer in the requested format. Only metrics that changed since the
+ * last scrape are serialized again. Only one family is locked at a time, so
+ * writers are not blocked for the duration of the scrape. */
+static void format_metrics(ProtobufCBuffer *buffer, _Bool want_proto) {
+  pthread_rwlock_rdlock(&metrics_lock);
 
   char *unused_name;
-  Io__Prometheus__Client__MetricFamily *fam;
+  metric_family_t *fam;
   c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
   while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    char line[1024]; /* 4x DATA_MAX_NAME_LEN? */
+    pthread_mutex_lock(&fam->lock);
+
+    if (want_proto)
+      format_family_protobuf(buffer, fam);
+    else
+      format_family_text(buffer, fam);
+
+    pthread_mutex_unlock(&fam->lock);
+  }
+  c_avl_iterator_destroy(iter);
 
-    snprintf(line, sizeof(line), "# HELP %s %s\n", fam->name, fam->help);
-    buffer->append(buffer, strlen(line), (uint8_t *)line);
+  pthread_rwlock_unlock(&metrics_lock);
 
-    snprintf(line, sizeof(line), "# TYPE %s %s\n", fam->name,
-             (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-                 ? "gauge"
-                 : "counter");
-    buffer->append(buffer, strlen(line), (uint8_t *)line);
+  if (!want_proto) {
+    char server[1024];
+    snprintf(server, sizeof(server), "\n# collectd/write_prometheus %s at %s\n",
+             PACKAGE_VERSION, hostname_g);
+    buffer->append(buffer, strlen(server), (uint8_t *)server);
+  }
+}
 
-    for (size_t i = 0; i < fam->n_metric; i++) {
-      Io__Prometheus__Client__Metric *m = fam->metric[i];
+#if HAVE_LIBZ
+/* gzip_buffer compresses "in" in gzip format. The returned buffer must be
+ * freed by the caller. Returns NULL on failure. */
+static uint8_t *gzip_buffer(uint8_t const *in, size_t in_len,
+                            size_t *ret_out_len) {
+  z_stream stream = {.zalloc = Z_NULL, .zfree = Z_NULL, .opaque = Z_NULL};
 
-      char labels[1024];
+  /* windowBits 15 + 16 selects the gzip header. */
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+                   /* memLevel = */ 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
 
-      char timestamp_ms[24] = "";
-      if (m->has_timestamp_ms)
-        snprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64,
-                 m->timestamp_ms);
+  size_t out_size = deflateBound(&stream, (uLong)in_len);
+  uint8_t *out = malloc(out_size);
+  if (out == NULL) {
+    deflateEnd(&stream);
+    return NULL;
+  }
 
-      if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-        snprintf(line, sizeof(line), "%s{%s} " GAUGE_FORMAT "%s\n", fam->name,
-                 format_labels(labels, sizeof(labels), m), m->gauge->value,
-                 timestamp_ms);
-      else /* if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER) */
-        snprintf(line, sizeof(line), "%s{%s} %.0f%s\n", fam->name,
-                 format_labels(labels, sizeof(labels), m), m->counter->value,
-                 timestamp_ms);
+  stream.next_in = (Bytef *)in;
+  stream.avail_in = (uInt)in_len;
+  stream.next_out = out;
+  stream.avail_out = (uInt)out_size;
 
-      buffer->append(buffer, strlen(line), (uint8_t *)line);
-    }
+  if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&stream);
+    sfree(out);
+    return NULL;
   }
-  c_avl_iterator_destroy(iter);
 
-  char server[1024];
-  snprintf(server, sizeof(server), "\n# collectd/write_prometheus %s at %s\n",
-           PACKAGE_VERSION, hostname_g);
-  buffer->append(buffer, strlen(server), (uint8_t *)server);
+  *ret_out_len = (size_t)stream.total_out;
+  deflateEnd(&stream);
+  return out;
+}
+
+/* accepts_gzip parses the value of an Accept-Encoding header and returns true
+ * if the client accepts gzip, i.e. if "gzip" or "*" is listed with a non-zero
+ * quality value. An explicit "gzip" entry takes precedence over "*", so
+ * "*, gzip;q=0" refuses gzip. */
+static _Bool accepts_gzip(char const *encoding) {
+  int gzip = -1; /* -1: not listed, 0: refused, 1: accepted */
+  int any = -1;
+
+  char const *ptr = encoding;
+  while (*ptr != 0) {
+    char const *end = ptr + strcspn(ptr, ",");
+
+    while ((ptr < end) && isspace((unsigned char)*ptr))
+      ptr++;
+    char const *name = ptr;
+    while ((ptr < end) && (*ptr != ';') && !isspace((unsigned char)*ptr))
+      ptr++;
+    size_t name_len = (size_t)(ptr - name);
+
+    /* The only parameter defined for content codings is "q". */
+    int accepted = 1;
+    while ((ptr = memchr(ptr, ';', (size_t)(end - ptr))) != NULL) {
+      ptr++;
+      while ((ptr < end) && isspace((unsigned char)*ptr))
+        ptr++;
+      if ((ptr == end) || ((*ptr != 'q') && (*ptr != 'Q')))
+        continue;
+      ptr++;
+      while ((ptr < end) && isspace((unsigned char)*ptr))
+        ptr++;
+      if ((ptr < end) && (*ptr == '='))
+        accepted = (strtod(ptr + 1, NULL) > 0.0);
+    }
+
+    if (((name_len == 4) && (strncasecmp(name, "gzip", 4) == 0)) ||
+        ((name_len == 6) && (strncasecmp(name, "x-gzip", 6) == 0)))
+      gzip = accepted;
+    else if ((name_len == 1) && (name[0] == '*'))
+      any = accepted;
+
+    ptr = (*end == ',') ? end + 1 : end;
+  }
 
-  pthread_mutex_unlock(&metrics_lock);
+  if (gzip != -1)
+    return gzip == 1;
+  return any == 1;
 }
+#endif
 
 /* http_handler is the callback called by the microhttpd library. It essentially
  * handles all HTTP request aspects and creates an HTTP response. */
@@ -248,24 +461,48 @@ static int http_handler(void *cls, struct MHD_Connection *connection,
   ProtobufCBufferSimple simple = PROTOBUF_C_BUFFER_SIMPLE_INIT(scratch);
   ProtobufCBuffer *buffer = (ProtobufCBuffer *)&simple;
 
-  if (want_proto)
-    format_protobuf(buffer);
-  else
-    format_text(buffer);
+  format_metrics(buffer, want_proto);
+
+  uint8_t *body = simple.data;
+  size_t body_len = simple.len;
+  _Bool gzipped = 0;
+
+#if HAVE_LIBZ
+  char const *encoding = MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  uint8_t *compressed = NULL;
+  if ((encoding != NULL) && accepts_gzip(encoding)) {
+    compressed = gzip_buffer(simple.data, simple.len, &body_len);
+    if (compressed != NULL) {
+      body = compressed;
+      gzipped = 1;
+    }
+  }
+#endif
 
 #if defined(MHD_VERSION) && MHD_VERSION >= 0x00090500
-  struct MHD_Response *res = MHD_create_response_from_buffer(
-      simple.len, simple.data, MHD_RESPMEM_MUST_COPY);
+  struct MHD_Response *res =
+      MHD_create_response_from_buffer(body_len, body, MHD_RESPMEM_MUST_COPY);
 #else
   struct MHD_Response *res = MHD_create_response_from_data(
-      simple.len, simple.data, /* must_free = */ 0, /* must_copy = */ 1);
+      body_len, body, /* must_free = */ 0, /* must_copy = */ 1);
 #endif
   MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_TYPE,
                           want_proto ? CONTENT_TYPE_PROTO : CONTENT_TYPE_TEXT);
+#if HAVE_LIBZ
+  /* The body depends on Accept-Encoding, so caches must not mix them up. */
+  MHD_add_response_header(res, MHD_HTTP_HEADER_VARY,
+                          MHD_HTTP_HEADER_ACCEPT_ENCODING);
+#endif
+  if (gzipped)
+    MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_ENCODING, "gzip");
 
   int status = MHD_queue_response(connection, MHD_HTTP_OK, res);
 
   MHD_destroy_response(res);
+#if HAVE_LIBZ
+  sfree(compressed);
+#endif
   PROTOBUF_C_BUFFER_SIMPLE_CLEAR(&simple);
   return status;
 }
@@ -328,6 +565,9 @@ static void metric_destroy(Io__Prometheus__Client__Metric *msg) {
   sfree(msg->gauge);
   sfree(msg->counter);
 
+  sfree(METRIC(msg)->text);
+  sfree(METRIC(msg)->proto);
+
   sfree(msg);
 }
 
@@ -422,9 +662,11 @@ static int metric_cmp(void const *a, void const *b) {
 /* metric_clone allocates and initializes a new metric based on orig. */
 static Io__Prometheus__Client__Metric *
 metric_clone(Io__Prometheus__Client__Metric const *orig) {
-  Io__Prometheus__Client__Metric *copy = calloc(1, sizeof(*copy));
-  if (copy == NULL)
+  metric_t *m = calloc(1, sizeof(*m));
+  if (m == NULL)
     return NULL;
+
+  Io__Prometheus__Client__Metric *copy = &m->pb;
   io__prometheus__client__metric__init(copy);
 
   copy->n_label = orig->n_label;
@@ -502,6 +744,8 @@ static int metric_update(Io__Prometheus__Client__Metric *m, value_t value,
     m->has_timestamp_ms = 0;
   }
 
+  METRIC(m)->text_valid = 0;
+  METRIC(m)->proto_valid = 0;
   return 0;
 }
 
@@ -580,6 +824,11 @@ metric_family_get_metric(Io__Prometheus__Client__MetricFamily *fam,
   if (new_metric == NULL)
     return NULL;
 
+  if (metric_text_init(METRIC(new_metric), fam->name) != 0) {
+    metric_destroy(new_metric);
+    return NULL;
+  }
+
   DEBUG("write_prometheus plugin: created new metric in family");
   int status = metric_family_add_metric(fam, new_metric);
   if (status != 0) {
@@ -595,12 +844,21 @@ metric_family_get_metric(Io__Prometheus__Client__MetricFamily *fam,
 static int metric_family_update(Io__Prometheus__Client__MetricFamily *fam,
                                 data_set_t const *ds, value_list_t const *vl,
                                 size_t ds_index) {
+  metric_family_t *mf = METRIC_FAMILY(fam);
+
+  pthread_mutex_lock(&mf->lock);
+
   Io__Prometheus__Client__Metric *m = metric_family_get_metric(fam, vl);
-  if (m == NULL)
+  if (m == NULL) {
+    pthread_mutex_unlock(&mf->lock);
     return -1;
+  }
 
-  return metric_update(m, vl->values[ds_index], ds->ds[ds_index].type, vl->time,
-                       vl->interval);
+  int status = metric_update(m, vl->values[ds_index], ds->ds[ds_index].type,
+                             vl->time, vl->interval);
+
+  pthread_mutex_unlock(&mf->lock);
+  return status;
 }
 
 /* metric_family_destroy frees the memory used by a metric family. */
@@ -608,6 +866,11 @@ static void metric_family_destroy(Io__Prometheus__Client__MetricFamily *msg) {
   if (msg == NULL)
     return;
 
+  metric_family_t *mf = METRIC_FAMILY(msg);
+  sfree(mf->text_header);
+  sfree(mf->proto_header);
+  pthread_mutex_destroy(&mf->lock);
+
   sfree(msg->name);
   sfree(msg->help);
 
@@ -623,9 +886,12 @@ static void metric_family_destroy(Io__Prometheus__Client__MetricFamily *msg) {
 static Io__Prometheus__Client__MetricFamily *
 metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
                      size_t ds_index) {
-  Io__Prometheus__Client__MetricFamily *msg = calloc(1, sizeof(*msg));
-  if (msg == NULL)
+  metric_family_t *mf = calloc(1, sizeof(*mf));
+  if (mf == NULL)
     return NULL;
+  pthread_mutex_init(&mf->lock, /* attr = */ NULL);
+
+  Io__Prometheus__Client__MetricFamily *msg = &mf->pb;
   io__prometheus__client__metric_family__init(msg);
 
   msg->name = name;
@@ -643,6 +909,36 @@ metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
                   : IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER;
   msg->has_type = 1;
 
+  if (msg->help == NULL) {
+    msg->name = NULL; /* owned by the caller on failure */
+    metric_family_destroy(msg);
+    return NULL;
+  }
+
+  /* The family has no metrics yet, so this packs the constant fields only. */
+  mf->proto_header_len =
+      io__prometheus__client__metric_family__get_packed_size(msg);
+  mf->proto_header = malloc(mf->proto_header_len);
+
+  char text_header[3072];
+  int len = snprintf(text_header, sizeof(text_header),
+                     "# HELP %s %s\n"
+                     "# TYPE %s %s\n",
+                     msg->name, msg->help, msg->name,
+                     (msg->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
+                         ? "gauge"
+                         : "counter");
+  if ((len > 0) && ((size_t)len < sizeof(text_header)))
+    mf->text_header = strdup(text_header);
+
+  if ((mf->proto_header == NULL) || (mf->text_header == NULL)) {
+    msg->name = NULL; /* owned by the caller on failure */
+    metric_family_destroy(msg);
+    return NULL;
+  }
+  io__prometheus__client__metric_family__pack(msg, mf->proto_header);
+  mf->text_header_len = (size_t)len;
+
   return msg;
 }
 
@@ -651,8 +947,9 @@ metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
  * compatibility. In essence, the plugin, type and data source name go in the
  * metric family name, while hostname, plugin instance and type instance go into
  * the labels of a metric. */
-static char *metric_family_name(data_set_t const *ds, value_list_t const *vl,
-                                size_t ds_index) {
+static void metric_family_name(char *buffer, size_t buffer_size,
+                               data_set_t const *ds, value_list_t const *vl,
+                               size_t ds_index) {
   char const *fields[5] = {"collectd"};
   size_t fields_num = 1;
 
@@ -676,31 +973,30 @@ static char *metric_family_name(data_set_t const *ds, value_list_t const *vl,
     fields_num++;
   }
 
-  char name[5 * DATA_MAX_NAME_LEN];
-  strjoin(name, sizeof(name), (char **)fields, fields_num, "_");
-  return strdup(name);
+  strjoin(buffer, buffer_size, (char **)fields, fields_num, "_");
 }
 
 /* metric_family_get looks up the matching metric family, allocating it if
- * necessary. */
+ * necessary. The caller must hold "metrics_lock" for writing if "allocate" is
+ * true and for reading otherwise. */
 static Io__Prometheus__Client__MetricFamily *
 metric_family_get(data_set_t const *ds, value_list_t const *vl, size_t ds_index,
                   _Bool allocate) {
-  char *name = metric_family_name(ds, vl, ds_index);
-  if (name == NULL) {
-    ERROR("write_prometheus plugin: Allocating metric family name failed.");
-    return NULL;
-  }
+  char buffer[5 * DATA_MAX_NAME_LEN];
+  metric_family_name(buffer, sizeof(buffer), ds, vl, ds_index);
 
   Io__Prometheus__Client__MetricFamily *fam = NULL;
-  if (c_avl_get(metrics, name, (void *)&fam) == 0) {
-    sfree(name);
+  if (c_avl_get(metrics, buffer, (void *)&fam) == 0) {
     assert(fam != NULL);
     return fam;
   }
 
-  if (!allocate) {
-    sfree(name);
+  if (!allocate)
+    return NULL;
+
+  char *name = strdup(buffer);
+  if (name == NULL) {
+    ERROR("write_prometheus plugin: Allocating metric family name failed.");
     return NULL;
   }
 
@@ -782,11 +1078,26 @@ static int prom_init() {
 
 static int prom_write(data_set_t const *ds, value_list_t const *vl,
                       __attribute__((unused)) user_data_t *ud) {
-  pthread_mutex_lock(&metrics_lock);
+  /* In the common case all metric families already exist and the tree only
+   * needs to be locked for reading. If a family is missing, take the write
+   * lock and allocate it. */
+  _Bool allocate = 0;
+
+  pthread_rwlock_rdlock(&metrics_lock);
+  for (size_t i = 0; i < ds->ds_num; i++) {
+    if (metric_family_get(ds, vl, i, /* allocate = */ 0) == NULL) {
+      allocate = 1;
+      break;
+    }
+  }
+  if (allocate) {
+    pthread_rwlock_unlock(&metrics_lock);
+    pthread_rwlock_wrlock(&metrics_lock);
+  }
 
   for (size_t i = 0; i < ds->ds_num; i++) {
     Io__Prometheus__Client__MetricFamily *fam =
-        metric_family_get(ds, vl, i, /* allocate = */ 1);
+        metric_family_get(ds, vl, i, allocate);
     if (fam == NULL)
       continue;
 
@@ -799,7 +1110,7 @@ static int prom_write(data_set_t const *ds, value_list_t const *vl,
     }
   }
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_rwlock_unlock(&metrics_lock);
   return 0;
 }
 
@@ -809,7 +1120,7 @@ static int prom_missing(value_list_t const *vl,
   if (ds == NULL)
     return ENOENT;
 
-  pthread_mutex_lock(&metrics_lock);
+  pthread_rwlock_wrlock(&metrics_lock);
 
   for (size_t i = 0; i < ds->ds_num; i++) {
     Io__Prometheus__Client__MetricFamily *fam =
@@ -835,10 +1146,11 @@ static int prom_missing(value_list_t const *vl,
         continue;
       }
       metric_family_destroy(fam);
+      continue;
     }
   }
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_rwlock_unlock(&metrics_lock);
   return 0;
 }
 
@@ -848,7 +1160,7 @@ static int prom_shutdown() {
     httpd = NULL;
   }
 
-  pthread_mutex_lock(&metrics_lock);
+  pthread_rwlock_wrlock(&metrics_lock);
   if (metrics != NULL) {
     char *name;
     Io__Prometheus__Client__MetricFamily *fam;
@@ -861,7 +1173,7 @@ static int prom_shutdown() {
     c_avl_destroy(metrics);
     metrics = NULL;
   }
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_rwlock_unlock(&metrics_lock);
 
   return 0;
 }
@@ -36,6 +36,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_cache.h"
+#include "utils_format_number.h"
 
 #include <stdlib.h>
 #define SENSU_HOST "localhost"
@@ -343,7 +344,7 @@ static char *sensu_value_to_json(struct sensu_host const *host, /* {{{ */
   char service_buffer[6 * DATA_MAX_NAME_LEN];
   char *ret_str;
   char *temp_str;
-  char *value_str;
+  char value_str[FORMAT_NUMBER_BUFSIZE];
   int res;
   // First part of the JSON string
   const char *part1 = "{\"name\": \"collectd\", \"type\": \"metric\"";
@@ -489,44 +490,16 @@ static char *sensu_value_to_json(struct sensu_host const *host, /* {{{ */
   }
 
   // calculate the value and set to a string
-  if (ds->ds[index].type == DS_TYPE_GAUGE) {
-    res = my_asprintf(&value_str, GAUGE_FORMAT, vl->values[index].gauge);
-    if (res == -1) {
-      free(ret_str);
-      ERROR("write_sensu plugin: Unable to alloc memory");
-      return NULL;
-    }
-  } else if (rates != NULL) {
-    res = my_asprintf(&value_str, GAUGE_FORMAT, rates[index]);
-    if (res == -1) {
-      free(ret_str);
-      ERROR("write_sensu plugin: Unable to alloc memory");
-      return NULL;
-    }
-  } else {
-    if (ds->ds[index].type == DS_TYPE_DERIVE) {
-      res = my_asprintf(&value_str, "%" PRIi64, vl->values[index].derive);
-      if (res == -1) {
-        free(ret_str);
-        ERROR("write_sensu plugin: Unable to alloc memory");
-        return NULL;
-      }
-    } else if (ds->ds[index].type == DS_TYPE_ABSOLUTE) {
-      res = my_asprintf(&value_str, "%" PRIu64, vl->values[index].absolute);
-      if (res == -1) {
-        free(ret_str);
-        ERROR("write_sensu plugin: Unable to alloc memory");
-        return NULL;
-      }
-    } else {
-      res = my_asprintf(&value_str, "%llu", vl->values[index].counter);
-      if (res == -1) {
-        free(ret_str);
-        ERROR("write_sensu plugin: Unable to alloc memory");
-        return NULL;
-      }
-    }
-  }
+  if (ds->ds[index].type == DS_TYPE_GAUGE)
+    format_double(value_str, vl->values[index].gauge);
+  else if (rates != NULL)
+    format_double(value_str, rates[index]);
+  else if (ds->ds[index].type == DS_TYPE_DERIVE)
+    format_int64(value_str, vl->values[index].derive);
+  else if (ds->ds[index].type == DS_TYPE_ABSOLUTE)
+    format_uint64(value_str, vl->values[index].absolute);
+  else
+    format_uint64(value_str, (uint64_t)vl->values[index].counter);
 
   // Generate the full service name
   sensu_format_name2(name_buffer, sizeof(name_buffer), vl->host, vl->plugin,
@@ -556,7 +529,6 @@ static char *sensu_value_to_json(struct sensu_host const *host, /* {{{ */
                     service_buffer, value_str,
                     (long long)CDTIME_T_TO_TIME_T(vl->time));
   free(ret_str);
-  free(value_str);
   if (res == -1) {
     ERROR("write_sensu plugin: Unable to alloc memory");
     return NULL;
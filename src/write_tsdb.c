@@ -46,6 +46,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_cache.h"
+#include "utils_format_number.h"
 #include "utils_random.h"
 
 #include <netdb.h>
@@ -315,54 +316,39 @@ static int wt_flush(cdtime_t timeout,
 static int wt_format_values(char *ret, size_t ret_len, int ds_num,
                             const data_set_t *ds, const value_list_t *vl,
                             _Bool store_rates) {
-  size_t offset = 0;
-  int status;
+  char tmp[FORMAT_NUMBER_BUFSIZE];
+  size_t len;
   gauge_t *rates = NULL;
 
   assert(0 == strcmp(ds->type, vl->type));
 
-  memset(ret, 0, ret_len);
-
-#define BUFFER_ADD(...)                                                        \
-  do {                                                                         \
-    status = snprintf(ret + offset, ret_len - offset, __VA_ARGS__);            \
-    if (status < 1) {                                                          \
-      sfree(rates);                                                            \
-      return -1;                                                               \
-    } else if (((size_t)status) >= (ret_len - offset)) {                       \
-      sfree(rates);                                                            \
-      return -1;                                                               \
-    } else                                                                     \
-      offset += ((size_t)status);                                              \
-  } while (0)
-
   if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-    BUFFER_ADD(GAUGE_FORMAT, vl->values[ds_num].gauge);
+    len = format_double(tmp, vl->values[ds_num].gauge);
   else if (store_rates) {
-    if (rates == NULL)
-      rates = uc_get_rate(ds, vl);
+    rates = uc_get_rate(ds, vl);
     if (rates == NULL) {
       WARNING("format_values: "
               "uc_get_rate failed.");
       return -1;
     }
-    BUFFER_ADD(GAUGE_FORMAT, rates[ds_num]);
+    len = format_double(tmp, rates[ds_num]);
+    sfree(rates);
   } else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-    BUFFER_ADD("%llu", vl->values[ds_num].counter);
+    len = format_uint64(tmp, (uint64_t)vl->values[ds_num].counter);
   else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-    BUFFER_ADD("%" PRIi64, vl->values[ds_num].derive);
+    len = format_int64(tmp, vl->values[ds_num].derive);
   else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-    BUFFER_ADD("%" PRIu64, vl->values[ds_num].absolute);
+    len = format_uint64(tmp, vl->values[ds_num].absolute);
   else {
     ERROR("format_values plugin: Unknown data source type: %i",
           ds->ds[ds_num].type);
-    sfree(rates);
     return -1;
   }
 
-#undef BUFFER_ADD
+  if (len >= ret_len)
+    return -1;
+  memcpy(ret, tmp, len + 1);
 
-  sfree(rates);
   return 0;
 }
 